@@ -0,0 +1,126 @@
+#include "arena.h"
+
+#include <cstdlib> // malloc, free
+#include <new>     // bad_alloc
+
+#include "vk_utils.h"
+
+namespace {
+
+thread_local uint64_t threadHeapAllocationCount = 0;
+
+size_t
+AlignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+#ifdef _DEBUG
+// Counts every allocation of the program, the array and nothrow variants
+// forward to these by default.
+void*
+operator new(size_t size)
+{
+  ++threadHeapAllocationCount;
+
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+  free(p);
+}
+#endif
+
+void
+FrameArena::Create(size_t blockSize)
+{
+  blocks.push_back({ new char[blockSize], blockSize });
+  offset = 0;
+}
+
+void
+FrameArena::Destroy()
+{
+  for (auto& block : blocks) {
+    delete[] block.data;
+  }
+  blocks.clear();
+  offset = 0;
+  usedSize = 0;
+}
+
+void*
+FrameArena::Allocate(size_t size, size_t alignment)
+{
+  ASSERT_TRUE(blocks.size() > 0);
+
+  Block* block = &blocks.back();
+  size_t start = AlignUp(offset, alignment);
+
+  if (start + size > block->size) {
+    // the block is only reached through the arena, the old blocks stay valid
+    // until Reset
+    size_t blockSize = block->size;
+    while (blockSize < size + alignment) {
+      blockSize *= 2;
+    }
+    blocks.push_back({ new char[blockSize], blockSize });
+
+    block = &blocks.back();
+    start = AlignUp(reinterpret_cast<uintptr_t>(block->data), alignment) -
+            reinterpret_cast<uintptr_t>(block->data);
+  }
+
+  offset = start + size;
+  usedSize += size;
+
+  return block->data + start;
+}
+
+void
+FrameArena::Reset()
+{
+  if (usedSize > peakSize) {
+    peakSize = usedSize;
+  }
+
+  // merge into one block that holds the whole frame
+  if (blocks.size() > 1) {
+    size_t blockSize = 0;
+    for (auto& block : blocks) {
+      blockSize += block.size;
+      delete[] block.data;
+    }
+    blocks.clear();
+    blocks.push_back({ new char[blockSize], blockSize });
+  }
+
+  offset = 0;
+  usedSize = 0;
+}
+
+uint64_t
+GetThreadHeapAllocationCount()
+{
+  return threadHeapAllocationCount;
+}
+
+NoHeapAllocationScope::NoHeapAllocationScope(bool enabled)
+  : enabled(enabled)
+  , count(GetThreadHeapAllocationCount())
+{}
+
+NoHeapAllocationScope::~NoHeapAllocationScope()
+{
+  if (enabled) {
+    ASSERT_TRUE((GetThreadHeapAllocationCount() == count));
+  }
+}
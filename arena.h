@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Linear allocator for memory that lives until the end of a frame. Allocate
+// bumps a pointer, individual deallocations are ignored and Reset releases
+// everything at once, i.e. it must only be called after the frame retired.
+//
+// An arena is used by a single thread, every recording thread has its own
+// arena per frame in flight (see VulkanBase::GetArena). If a frame needs more
+// than the current block, further blocks are allocated from the heap and
+// merged into one block on the next Reset, so the arena stops allocating
+// once it has seen the largest frame.
+struct FrameArena
+{
+  struct Block
+  {
+    char* data = nullptr;
+    size_t size = 0;
+  };
+
+  static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+  void Create(size_t blockSize = DEFAULT_BLOCK_SIZE);
+  void Destroy();
+
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+  void Reset();
+
+  // bytes allocated since the last Reset
+  size_t GetUsedSize() const { return usedSize; }
+  // bytes allocated in the largest frame so far
+  size_t GetPeakSize() const { return peakSize; }
+
+  std::vector<Block> blocks = {};
+  size_t offset = 0; // into blocks.back()
+  size_t usedSize = 0;
+  size_t peakSize = 0;
+};
+
+// STL allocator that takes its memory from a FrameArena, the arena has to
+// outlive the container.
+template<typename T>
+struct ArenaAllocator
+{
+  typedef T value_type;
+
+  ArenaAllocator(FrameArena* arena)
+    : arena(arena)
+  {}
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)
+    : arena(other.arena)
+  {}
+
+  T* allocate(size_t n)
+  {
+    return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  template<typename U>
+  bool operator==(const ArenaAllocator<U>& other) const
+  {
+    return arena == other.arena;
+  }
+
+  template<typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const
+  {
+    return arena != other.arena;
+  }
+
+  FrameArena* arena = nullptr;
+};
+
+// vector for temporary data during recording, e.g.
+//   ScratchVector<VkImageMemoryBarrier> barriers(arena);
+template<typename T>
+struct ScratchVector : std::vector<T, ArenaAllocator<T>>
+{
+  ScratchVector(FrameArena* arena)
+    : std::vector<T, ArenaAllocator<T>>(ArenaAllocator<T>(arena))
+  {}
+};
+
+// Number of global operator new calls made by the calling thread so far.
+// Only counted in debug builds (_DEBUG), always 0 otherwise.
+uint64_t
+GetThreadHeapAllocationCount();
+
+// Asserts that the calling thread does not allocate from the global heap
+// between construction and destruction, e.g. while recording a frame in the
+// steady state. Does nothing if enabled is false.
+struct NoHeapAllocationScope
+{
+  NoHeapAllocationScope(bool enabled = true);
+  ~NoHeapAllocationScope();
+
+  bool enabled = false;
+  uint64_t count = 0;
+};
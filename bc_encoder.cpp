@@ -0,0 +1,908 @@
+#include "bc_encoder.h"
+
+#include <algorithm> // min, max, swap
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// texels of a block as floats, channels of them are used
+struct BlockTexels
+{
+  float values[16][4];
+  uint32_t channels;
+};
+
+// Quantizes the endpoints to a block encoding, picks the indices and returns
+// the squared error. weights receives the interpolation weight of each
+// texel's index between e0 and e1, or a negative value for texels that do
+// not depend on the endpoints.
+typedef float (*EvaluateFunc)(const BlockTexels& texels,
+                              const float* e0,
+                              const float* e1,
+                              float* weights,
+                              void* encoding);
+
+float
+Clamp255(float value)
+{
+  return std::min(std::max(value, 0.0f), 255.0f);
+}
+
+uint32_t
+Round255(float value)
+{
+  return static_cast<uint32_t>(Clamp255(value) + 0.5f);
+}
+
+void
+GetBoundingBox(const BlockTexels& texels, float* e0, float* e1)
+{
+  for (uint32_t c = 0; c < texels.channels; ++c) {
+    float low = 255.0f;
+    float high = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i) {
+      low = std::min(low, texels.values[i][c]);
+      high = std::max(high, texels.values[i][c]);
+    }
+    // the extremes are rarely hit exactly by the interpolated values
+    float inset = (high - low) / 16.0f;
+    e0[c] = low + inset;
+    e1[c] = high - inset;
+  }
+}
+
+// extremes of the texels projected on their principal axis
+void
+GetPrincipalAxis(const BlockTexels& texels, float* e0, float* e1)
+{
+  uint32_t channels = texels.channels;
+
+  float mean[4] = {};
+  for (uint32_t i = 0; i < 16; ++i) {
+    for (uint32_t c = 0; c < channels; ++c) {
+      mean[c] += texels.values[i][c] / 16.0f;
+    }
+  }
+
+  float covariance[4][4] = {};
+  for (uint32_t i = 0; i < 16; ++i) {
+    for (uint32_t a = 0; a < channels; ++a) {
+      for (uint32_t b = 0; b < channels; ++b) {
+        covariance[a][b] += (texels.values[i][a] - mean[a]) *
+                            (texels.values[i][b] - mean[b]);
+      }
+    }
+  }
+
+  // power iteration
+  float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  for (uint32_t iteration = 0; iteration < 8; ++iteration) {
+    float next[4] = {};
+    float length = 0.0f;
+    for (uint32_t a = 0; a < channels; ++a) {
+      for (uint32_t b = 0; b < channels; ++b) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      length = std::max(length, std::fabs(next[a]));
+    }
+    if (length < 1e-6f) {
+      // a single colour
+      for (uint32_t c = 0; c < channels; ++c) {
+        e0[c] = e1[c] = mean[c];
+      }
+      return;
+    }
+    for (uint32_t c = 0; c < channels; ++c) {
+      axis[c] = next[c] / length;
+    }
+  }
+
+  float axisLength = 0.0f;
+  for (uint32_t c = 0; c < channels; ++c) {
+    axisLength += axis[c] * axis[c];
+  }
+
+  float low = FLT_MAX;
+  float high = -FLT_MAX;
+  for (uint32_t i = 0; i < 16; ++i) {
+    float t = 0.0f;
+    for (uint32_t c = 0; c < channels; ++c) {
+      t += (texels.values[i][c] - mean[c]) * axis[c];
+    }
+    low = std::min(low, t / axisLength);
+    high = std::max(high, t / axisLength);
+  }
+  for (uint32_t c = 0; c < channels; ++c) {
+    e0[c] = Clamp255(mean[c] + low * axis[c]);
+    e1[c] = Clamp255(mean[c] + high * axis[c]);
+  }
+}
+
+// Endpoints with the least squared error for fixed weights, false if the
+// weights do not tell the endpoints apart.
+bool
+SolveEndpoints(const BlockTexels& texels,
+               const float* weights,
+               float* e0,
+               float* e1)
+{
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  float xa[4] = {};
+  float xb[4] = {};
+  for (uint32_t i = 0; i < 16; ++i) {
+    float w = weights[i];
+    if (w < 0.0f) {
+      continue;
+    }
+    aa += (1.0f - w) * (1.0f - w);
+    ab += (1.0f - w) * w;
+    bb += w * w;
+    for (uint32_t c = 0; c < texels.channels; ++c) {
+      xa[c] += (1.0f - w) * texels.values[i][c];
+      xb[c] += w * texels.values[i][c];
+    }
+  }
+
+  float determinant = aa * bb - ab * ab;
+  if (std::fabs(determinant) < 1e-6f) {
+    return false;
+  }
+  for (uint32_t c = 0; c < texels.channels; ++c) {
+    e0[c] = Clamp255((bb * xa[c] - ab * xb[c]) / determinant);
+    e1[c] = Clamp255((aa * xb[c] - ab * xa[c]) / determinant);
+  }
+  return true;
+}
+
+// Finds the endpoints for evaluate, which keeps the encoding of the best
+// ones. step is the distance between quantized endpoint values per channel.
+void
+OptimizeEndpoints(const BlockTexels& texels,
+                  BcQuality quality,
+                  const float* step,
+                  EvaluateFunc evaluate,
+                  void* encoding,
+                  size_t encodingSize)
+{
+  float e0[4] = {};
+  float e1[4] = {};
+  if (quality == BC_QUALITY_FAST) {
+    GetBoundingBox(texels, e0, e1);
+  } else {
+    GetPrincipalAxis(texels, e0, e1);
+  }
+
+  float weights[16];
+  float error = evaluate(texels, e0, e1, weights, encoding);
+  if (quality == BC_QUALITY_FAST || error == 0.0f) {
+    return;
+  }
+
+  // candidates are evaluated into scratch, which is kept when it is better;
+  // it starts as a copy for the settings the encodings carry
+  uint8_t scratch[64];
+  memcpy(scratch, encoding, encodingSize);
+  float candidateWeights[16];
+
+  uint32_t refinements = quality == BC_QUALITY_HIGH ? 4 : 1;
+  for (uint32_t i = 0; i < refinements; ++i) {
+    float c0[4] = {};
+    float c1[4] = {};
+    if (!SolveEndpoints(texels, weights, c0, c1)) {
+      break;
+    }
+    float candidate = evaluate(texels, c0, c1, candidateWeights, scratch);
+    if (candidate >= error) {
+      break;
+    }
+    error = candidate;
+    memcpy(e0, c0, sizeof(e0));
+    memcpy(e1, c1, sizeof(e1));
+    memcpy(weights, candidateWeights, sizeof(weights));
+    memcpy(encoding, scratch, encodingSize);
+  }
+
+  if (quality != BC_QUALITY_HIGH) {
+    return;
+  }
+
+  for (uint32_t pass = 0; pass < 8 && error > 0.0f; ++pass) {
+    bool improved = false;
+    for (uint32_t endpoint = 0; endpoint < 2; ++endpoint) {
+      for (uint32_t c = 0; c < texels.channels; ++c) {
+        for (float direction = -1.0f; direction <= 1.0f; direction += 2.0f) {
+          float c0[4];
+          float c1[4];
+          memcpy(c0, e0, sizeof(c0));
+          memcpy(c1, e1, sizeof(c1));
+          float* e = endpoint == 0 ? c0 : c1;
+          e[c] = Clamp255(e[c] + direction * step[c]);
+
+          float candidate =
+            evaluate(texels, c0, c1, candidateWeights, scratch);
+          if (candidate < error) {
+            error = candidate;
+            memcpy(e0, c0, sizeof(e0));
+            memcpy(e1, c1, sizeof(e1));
+            memcpy(encoding, scratch, encodingSize);
+            improved = true;
+          }
+        }
+      }
+    }
+    if (!improved) {
+      break;
+    }
+  }
+}
+
+void
+GetTexels(const uint8_t* values,
+          uint32_t stride,
+          uint32_t channels,
+          BlockTexels& texels)
+{
+  texels.channels = channels;
+  for (uint32_t i = 0; i < 16; ++i) {
+    for (uint32_t c = 0; c < 4; ++c) {
+      texels.values[i][c] = c < channels ? values[i * stride + c] : 0.0f;
+    }
+  }
+}
+
+// BC1
+
+struct Bc1Encoding
+{
+  uint16_t color0;
+  uint16_t color1;
+  uint32_t indices;
+  // 3 colour mode, index 3 for texels with alpha below 128
+  bool alpha;
+  uint8_t transparent[16];
+};
+
+uint16_t
+To565(const float* color)
+{
+  return static_cast<uint16_t>(((Round255(color[0]) * 31 + 127) / 255) << 11 |
+                               ((Round255(color[1]) * 63 + 127) / 255) << 5 |
+                               ((Round255(color[2]) * 31 + 127) / 255));
+}
+
+void
+From565(uint16_t color, int32_t* rgb)
+{
+  int32_t r = (color >> 11) & 31;
+  int32_t g = (color >> 5) & 63;
+  int32_t b = color & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+float
+EvaluateBc1(const BlockTexels& texels,
+            const float* e0,
+            const float* e1,
+            float* weights,
+            void* encoding)
+{
+  Bc1Encoding& bc1 = *static_cast<Bc1Encoding*>(encoding);
+
+  uint16_t color0 = To565(e0);
+  uint16_t color1 = To565(e1);
+  // the order of the colours selects the mode
+  bool swapped = bc1.alpha ? color0 > color1 : color0 < color1;
+  if (swapped) {
+    std::swap(color0, color1);
+  }
+  bc1.color0 = color0;
+  bc1.color1 = color1;
+
+  int32_t palette[4][3];
+  From565(color0, palette[0]);
+  From565(color1, palette[1]);
+  // equal colours are the 3 colour mode as well
+  bool fourColors = color0 > color1;
+  float paletteWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+  for (uint32_t c = 0; c < 3; ++c) {
+    if (fourColors) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!fourColors) {
+    paletteWeights[2] = 0.5f;
+  }
+  uint32_t paletteSize = fourColors ? 4 : 3;
+
+  float error = 0.0f;
+  bc1.indices = 0;
+  for (uint32_t i = 0; i < 16; ++i) {
+    if (bc1.alpha && bc1.transparent[i]) {
+      bc1.indices |= 3u << (2 * i);
+      weights[i] = -1.0f;
+      continue;
+    }
+
+    uint32_t best = 0;
+    float bestError = FLT_MAX;
+    for (uint32_t p = 0; p < paletteSize; ++p) {
+      float texelError = 0.0f;
+      for (uint32_t c = 0; c < 3; ++c) {
+        float d = texels.values[i][c] - palette[p][c];
+        texelError += d * d;
+      }
+      if (texelError < bestError) {
+        best = p;
+        bestError = texelError;
+      }
+    }
+    bc1.indices |= best << (2 * i);
+    weights[i] = swapped ? 1.0f - paletteWeights[best] : paletteWeights[best];
+    error += bestError;
+  }
+  return error;
+}
+
+void
+WriteBc1Block(const Bc1Encoding& bc1, uint8_t* block)
+{
+  block[0] = static_cast<uint8_t>(bc1.color0);
+  block[1] = static_cast<uint8_t>(bc1.color0 >> 8);
+  block[2] = static_cast<uint8_t>(bc1.color1);
+  block[3] = static_cast<uint8_t>(bc1.color1 >> 8);
+  memcpy(block + 4, &bc1.indices, sizeof(bc1.indices));
+}
+
+// BC4
+
+struct Bc4Encoding
+{
+  uint8_t value0;
+  uint8_t value1;
+  uint8_t indices[16];
+  // 6 values and 0 and 255
+  bool sixValues;
+};
+
+float
+EvaluateBc4(const BlockTexels& texels,
+            const float* e0,
+            const float* e1,
+            float* weights,
+            void* encoding)
+{
+  Bc4Encoding& bc4 = *static_cast<Bc4Encoding*>(encoding);
+
+  uint32_t value0 = Round255(e0[0]);
+  uint32_t value1 = Round255(e1[0]);
+  // the order of the values selects the mode
+  bool swapped = bc4.sixValues ? value0 > value1 : value0 < value1;
+  if (swapped) {
+    std::swap(value0, value1);
+  }
+  bc4.value0 = static_cast<uint8_t>(value0);
+  bc4.value1 = static_cast<uint8_t>(value1);
+
+  int32_t palette[8];
+  float paletteWeights[8];
+  palette[0] = value0;
+  palette[1] = value1;
+  paletteWeights[0] = 0.0f;
+  paletteWeights[1] = 1.0f;
+  if (value0 > value1) {
+    for (int32_t i = 2; i < 8; ++i) {
+      palette[i] = ((8 - i) * value0 + (i - 1) * value1) / 7;
+      paletteWeights[i] = (i - 1) / 7.0f;
+    }
+  } else {
+    for (int32_t i = 2; i < 6; ++i) {
+      palette[i] = ((6 - i) * value0 + (i - 1) * value1) / 5;
+      paletteWeights[i] = (i - 1) / 5.0f;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+    paletteWeights[6] = -1.0f;
+    paletteWeights[7] = -1.0f;
+  }
+
+  float error = 0.0f;
+  for (uint32_t i = 0; i < 16; ++i) {
+    uint32_t best = 0;
+    float bestError = FLT_MAX;
+    for (uint32_t p = 0; p < 8; ++p) {
+      float d = texels.values[i][0] - palette[p];
+      if (d * d < bestError) {
+        best = p;
+        bestError = d * d;
+      }
+    }
+    bc4.indices[i] = static_cast<uint8_t>(best);
+    float w = paletteWeights[best];
+    weights[i] = swapped && w >= 0.0f ? 1.0f - w : w;
+    error += bestError;
+  }
+  return error;
+}
+
+void
+WriteBc4Block(const Bc4Encoding& bc4, uint8_t* block)
+{
+  block[0] = bc4.value0;
+  block[1] = bc4.value1;
+  uint64_t indices = 0;
+  for (uint32_t i = 0; i < 16; ++i) {
+    indices |= uint64_t(bc4.indices[i]) << (3 * i);
+  }
+  for (uint32_t i = 0; i < 6; ++i) {
+    block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+  }
+}
+
+// BC7 mode 6
+
+const uint32_t BC7_WEIGHTS[16] = { 0,  4,  9,  13, 17, 21, 26, 30,
+                                   34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Encoding
+{
+  uint8_t endpoints[2][4]; // 7 bits
+  uint8_t pBits[2];
+  uint8_t indices[16];
+};
+
+// the 7 bit endpoint and p-bit closest to endpoint, returns the expanded
+// 8 bit values
+void
+QuantizeBc7Endpoint(const float* endpoint,
+                    uint8_t* quantized,
+                    uint8_t& pBit,
+                    int32_t* expanded)
+{
+  float bestError = FLT_MAX;
+  for (uint32_t p = 0; p < 2; ++p) {
+    uint8_t candidate[4];
+    float error = 0.0f;
+    for (uint32_t c = 0; c < 4; ++c) {
+      float value = (Clamp255(endpoint[c]) - p) / 2.0f;
+      candidate[c] =
+        static_cast<uint8_t>(std::min(std::max(value + 0.5f, 0.0f), 127.0f));
+      float d = endpoint[c] - (candidate[c] * 2 + p);
+      error += d * d;
+    }
+    if (error < bestError) {
+      bestError = error;
+      memcpy(quantized, candidate, sizeof(candidate));
+      pBit = static_cast<uint8_t>(p);
+    }
+  }
+  for (uint32_t c = 0; c < 4; ++c) {
+    expanded[c] = quantized[c] * 2 + pBit;
+  }
+}
+
+float
+EvaluateBc7(const BlockTexels& texels,
+            const float* e0,
+            const float* e1,
+            float* weights,
+            void* encoding)
+{
+  Bc7Encoding& bc7 = *static_cast<Bc7Encoding*>(encoding);
+
+  int32_t a[4];
+  int32_t b[4];
+  QuantizeBc7Endpoint(e0, bc7.endpoints[0], bc7.pBits[0], a);
+  QuantizeBc7Endpoint(e1, bc7.endpoints[1], bc7.pBits[1], b);
+
+  int32_t palette[16][4];
+  float axis[4];
+  float axisLength = 0.0f;
+  for (uint32_t c = 0; c < 4; ++c) {
+    for (uint32_t i = 0; i < 16; ++i) {
+      palette[i][c] =
+        ((64 - BC7_WEIGHTS[i]) * a[c] + BC7_WEIGHTS[i] * b[c] + 32) >> 6;
+    }
+    axis[c] = static_cast<float>(b[c] - a[c]);
+    axisLength += axis[c] * axis[c];
+  }
+
+  float error = 0.0f;
+  for (uint32_t i = 0; i < 16; ++i) {
+    // the projection on the endpoints is within one index of the best
+    float t = 0.0f;
+    for (uint32_t c = 0; c < 4; ++c) {
+      t += (texels.values[i][c] - a[c]) * axis[c];
+    }
+    int32_t guess =
+      axisLength > 0.0f ? static_cast<int32_t>(t / axisLength * 15.0f + 0.5f)
+                        : 0;
+    guess = std::min(std::max(guess, 0), 15);
+
+    uint32_t best = 0;
+    float bestError = FLT_MAX;
+    for (int32_t p = std::max(guess - 1, 0); p <= std::min(guess + 1, 15);
+         ++p) {
+      float texelError = 0.0f;
+      for (uint32_t c = 0; c < 4; ++c) {
+        float d = texels.values[i][c] - palette[p][c];
+        texelError += d * d;
+      }
+      if (texelError < bestError) {
+        best = p;
+        bestError = texelError;
+      }
+    }
+    bc7.indices[i] = static_cast<uint8_t>(best);
+    weights[i] = BC7_WEIGHTS[best] / 64.0f;
+    error += bestError;
+  }
+  return error;
+}
+
+void
+WriteBits(uint8_t* block, uint32_t& bit, uint32_t value, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; ++i, ++bit) {
+    if ((value >> i) & 1) {
+      block[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+    }
+  }
+}
+
+void
+WriteBc7Block(Bc7Encoding bc7, uint8_t* block)
+{
+  // the most significant index bit of texel 0 is implicitly 0
+  if (bc7.indices[0] >= 8) {
+    std::swap(bc7.endpoints[0], bc7.endpoints[1]);
+    std::swap(bc7.pBits[0], bc7.pBits[1]);
+    for (uint32_t i = 0; i < 16; ++i) {
+      bc7.indices[i] = static_cast<uint8_t>(15 - bc7.indices[i]);
+    }
+  }
+
+  memset(block, 0, 16);
+  uint32_t bit = 0;
+  WriteBits(block, bit, 1 << 6, 7); // mode 6
+  for (uint32_t c = 0; c < 4; ++c) {
+    WriteBits(block, bit, bc7.endpoints[0][c], 7);
+    WriteBits(block, bit, bc7.endpoints[1][c], 7);
+  }
+  WriteBits(block, bit, bc7.pBits[0], 1);
+  WriteBits(block, bit, bc7.pBits[1], 1);
+  WriteBits(block, bit, bc7.indices[0], 3);
+  for (uint32_t i = 1; i < 16; ++i) {
+    WriteBits(block, bit, bc7.indices[i], 4);
+  }
+}
+
+// image
+
+float
+SrgbToLinear(float value)
+{
+  return value <= 0.04045f ? value / 12.92f
+                           : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float
+LinearToSrgb(float value)
+{
+  return value <= 0.0031308f ? value * 12.92f
+                             : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+bool
+IsEncodable(VkFormat format)
+{
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:  // fallthrough
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:   // fallthrough
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: // fallthrough
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:  // fallthrough
+    case VK_FORMAT_BC3_UNORM_BLOCK:      // fallthrough
+    case VK_FORMAT_BC3_SRGB_BLOCK:       // fallthrough
+    case VK_FORMAT_BC4_UNORM_BLOCK:      // fallthrough
+    case VK_FORMAT_BC5_UNORM_BLOCK:      // fallthrough
+    case VK_FORMAT_BC7_UNORM_BLOCK:      // fallthrough
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool
+IsSrgb(VkFormat format)
+{
+  return format == VK_FORMAT_R8G8B8A8_SRGB ||
+         format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ||
+         format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK ||
+         format == VK_FORMAT_BC3_SRGB_BLOCK ||
+         format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+} // namespace
+
+void
+EncodeBc1Block(const uint8_t* rgba,
+               bool alpha,
+               BcQuality quality,
+               uint8_t* block)
+{
+  BlockTexels texels;
+  GetTexels(rgba, 4, 3, texels);
+
+  Bc1Encoding bc1 = {};
+  float opaque[3] = {};
+  uint32_t opaqueCount = 0;
+  for (uint32_t i = 0; i < 16; ++i) {
+    bc1.transparent[i] = alpha && rgba[i * 4 + 3] < 128;
+    bc1.alpha |= bc1.transparent[i] != 0;
+    if (!bc1.transparent[i]) {
+      for (uint32_t c = 0; c < 3; ++c) {
+        opaque[c] += texels.values[i][c];
+      }
+      ++opaqueCount;
+    }
+  }
+
+  // the colour of transparent texels must not pull the endpoints
+  for (uint32_t i = 0; i < 16 && opaqueCount > 0; ++i) {
+    if (bc1.transparent[i]) {
+      for (uint32_t c = 0; c < 3; ++c) {
+        texels.values[i][c] = opaque[c] / opaqueCount;
+      }
+    }
+  }
+
+  const float step[4] = { 255.0f / 31.0f, 255.0f / 63.0f, 255.0f / 31.0f };
+  OptimizeEndpoints(texels, quality, step, EvaluateBc1, &bc1, sizeof(bc1));
+  WriteBc1Block(bc1, block);
+}
+
+void
+EncodeBc4Block(const uint8_t* values,
+               uint32_t stride,
+               BcQuality quality,
+               uint8_t* block)
+{
+  BlockTexels texels;
+  GetTexels(values, stride, 1, texels);
+
+  const float step[4] = { 1.0f };
+  Bc4Encoding bc4 = {};
+  OptimizeEndpoints(texels, quality, step, EvaluateBc4, &bc4, sizeof(bc4));
+
+  // blocks with 0 or 255 next to other values may do better with 6 values
+  if (quality == BC_QUALITY_HIGH) {
+    BlockTexels inner = texels;
+    float low = 255.0f;
+    float high = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i) {
+      if (texels.values[i][0] > 0.0f && texels.values[i][0] < 255.0f) {
+        low = std::min(low, texels.values[i][0]);
+        high = std::max(high, texels.values[i][0]);
+      }
+    }
+    // the optimizer starts from the extremes of the values in between
+    for (uint32_t i = 0; i < 16 && low <= high; ++i) {
+      inner.values[i][0] = std::min(std::max(texels.values[i][0], low), high);
+    }
+
+    Bc4Encoding sixValues = {};
+    sixValues.sixValues = true;
+    OptimizeEndpoints(
+      inner, quality, step, EvaluateBc4, &sixValues, sizeof(sixValues));
+
+    // both compared against the real values
+    float weights[16];
+    float e0[4] = { float(bc4.value0) };
+    float e1[4] = { float(bc4.value1) };
+    float error = EvaluateBc4(texels, e0, e1, weights, &bc4);
+    e0[0] = sixValues.value0;
+    e1[0] = sixValues.value1;
+    float sixError = EvaluateBc4(texels, e0, e1, weights, &sixValues);
+    if (sixError < error) {
+      bc4 = sixValues;
+    }
+  }
+  WriteBc4Block(bc4, block);
+}
+
+void
+EncodeBc3Block(const uint8_t* rgba, BcQuality quality, uint8_t* block)
+{
+  EncodeBc4Block(rgba + 3, 4, quality, block);
+  // the colour block of BC3 always has 4 colours
+  EncodeBc1Block(rgba, false, quality, block + 8);
+}
+
+void
+EncodeBc5Block(const uint8_t* rgba, BcQuality quality, uint8_t* block)
+{
+  EncodeBc4Block(rgba, 4, quality, block);
+  EncodeBc4Block(rgba + 1, 4, quality, block + 8);
+}
+
+void
+EncodeBc7Block(const uint8_t* rgba, BcQuality quality, uint8_t* block)
+{
+  BlockTexels texels;
+  GetTexels(rgba, 4, 4, texels);
+
+  const float step[4] = { 2.0f, 2.0f, 2.0f, 2.0f };
+  Bc7Encoding bc7 = {};
+  OptimizeEndpoints(texels, quality, step, EvaluateBc7, &bc7, sizeof(bc7));
+  WriteBc7Block(bc7, block);
+}
+
+bool
+EncodeBcImage(const uint8_t* rgba,
+              uint32_t width,
+              uint32_t height,
+              VkFormat format,
+              BcQuality quality,
+              uint8_t* blocks)
+{
+  if (!IsEncodable(format)) {
+    return false;
+  }
+
+  uint32_t blockSize = GetFormatBlockInfo(format).blockSize;
+  uint32_t blocksX = (width + 3) / 4;
+  uint32_t blocksY = (height + 3) / 4;
+
+  std::atomic<uint32_t> nextRow(0);
+  auto encodeRows = [&]() {
+    uint8_t texels[16 * 4];
+    for (uint32_t by = nextRow++; by < blocksY; by = nextRow++) {
+      uint8_t* block = blocks + size_t(by) * blocksX * blockSize;
+      for (uint32_t bx = 0; bx < blocksX; ++bx, block += blockSize) {
+        for (uint32_t i = 0; i < 16; ++i) {
+          uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+          uint32_t y = std::min(by * 4 + i / 4, height - 1);
+          memcpy(&texels[i * 4], &rgba[(size_t(y) * width + x) * 4], 4);
+        }
+
+        switch (format) {
+          case VK_FORMAT_BC1_RGB_UNORM_BLOCK: // fallthrough
+          case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            EncodeBc1Block(texels, false, quality, block);
+            break;
+          case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: // fallthrough
+          case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            EncodeBc1Block(texels, true, quality, block);
+            break;
+          case VK_FORMAT_BC3_UNORM_BLOCK: // fallthrough
+          case VK_FORMAT_BC3_SRGB_BLOCK:
+            EncodeBc3Block(texels, quality, block);
+            break;
+          case VK_FORMAT_BC4_UNORM_BLOCK:
+            EncodeBc4Block(texels, 4, quality, block);
+            break;
+          case VK_FORMAT_BC5_UNORM_BLOCK:
+            EncodeBc5Block(texels, quality, block);
+            break;
+          default:
+            EncodeBc7Block(texels, quality, block);
+            break;
+        }
+      }
+    }
+  };
+
+  uint32_t threadCount =
+    std::min(std::max(std::thread::hardware_concurrency(), 1u), blocksY);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < threadCount; ++i) {
+    threads.emplace_back(encodeRows);
+  }
+  encodeRows();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return true;
+}
+
+void
+DownsampleRgba8(const uint8_t* rgba,
+                uint32_t width,
+                uint32_t height,
+                bool srgb,
+                std::vector<uint8_t>& mip)
+{
+  float toLinear[256];
+  for (uint32_t i = 0; i < 256; ++i) {
+    toLinear[i] = srgb ? SrgbToLinear(i / 255.0f) : i / 255.0f;
+  }
+
+  uint32_t mipWidth = std::max(width / 2, 1u);
+  uint32_t mipHeight = std::max(height / 2, 1u);
+  mip.resize(size_t(mipWidth) * mipHeight * 4);
+
+  for (uint32_t y = 0; y < mipHeight; ++y) {
+    uint32_t y0 = std::min(y * 2, height - 1);
+    uint32_t y1 = std::min(y * 2 + 1, height - 1);
+    for (uint32_t x = 0; x < mipWidth; ++x) {
+      uint32_t x0 = std::min(x * 2, width - 1);
+      uint32_t x1 = std::min(x * 2 + 1, width - 1);
+      const uint8_t* texels[4] = { &rgba[(size_t(y0) * width + x0) * 4],
+                                   &rgba[(size_t(y0) * width + x1) * 4],
+                                   &rgba[(size_t(y1) * width + x0) * 4],
+                                   &rgba[(size_t(y1) * width + x1) * 4] };
+
+      uint8_t* texel = &mip[(size_t(y) * mipWidth + x) * 4];
+      for (uint32_t c = 0; c < 3; ++c) {
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < 4; ++i) {
+          sum += toLinear[texels[i][c]];
+        }
+        float value = srgb ? LinearToSrgb(sum / 4.0f) : sum / 4.0f;
+        texel[c] = static_cast<uint8_t>(Round255(value * 255.0f));
+      }
+      // alpha is always linear
+      uint32_t alpha =
+        texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3];
+      texel[3] = static_cast<uint8_t>((alpha + 2) / 4);
+    }
+  }
+}
+
+bool
+EncodeTexture(const uint8_t* rgba,
+              uint32_t width,
+              uint32_t height,
+              VkFormat format,
+              BcQuality quality,
+              bool mips,
+              TextureData& texture)
+{
+  bool uncompressed =
+    format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+  if (!uncompressed && !IsEncodable(format)) {
+    return false;
+  }
+
+  texture = {};
+  texture.desc.format = format;
+  texture.desc.width = width;
+  texture.desc.height = height;
+  texture.desc.mipCount = mips ? GetMipCount(width, height) : 1;
+  texture.Allocate();
+
+  std::vector<uint8_t> level(rgba, rgba + size_t(width) * height * 4);
+  std::vector<uint8_t> next;
+  for (uint32_t mip = 0; mip < texture.desc.mipCount; ++mip) {
+    const PackTextureLevel& info = texture.GetLevel(mip);
+    if (uncompressed) {
+      memcpy(texture.GetLevelData(mip), level.data(), level.size());
+    } else {
+      EncodeBcImage(level.data(),
+                    info.width,
+                    info.height,
+                    format,
+                    quality,
+                    texture.GetLevelData(mip));
+    }
+
+    if (mip + 1 < texture.desc.mipCount) {
+      DownsampleRgba8(
+        level.data(), info.width, info.height, IsSrgb(format), next);
+      level.swap(next);
+    }
+  }
+  return true;
+}
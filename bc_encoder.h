@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "texture.h"
+
+// How hard the encoder searches for block endpoints.
+enum BcQuality
+{
+  // bounding box of the block
+  BC_QUALITY_FAST = 0,
+  // principal axis of the block and one least squares refinement
+  BC_QUALITY_NORMAL,
+  // more refinements, then a greedy search of the neighbouring endpoints
+  BC_QUALITY_HIGH,
+};
+
+// Block encoders, rgba holds the 16 texels of a 4x4 block row by row.
+//
+// BC1 uses the 3 colour mode with transparent texels if alpha is set and a
+// texel has alpha below 128, the 4 colour mode otherwise.
+void
+EncodeBc1Block(const uint8_t* rgba,
+               bool alpha,
+               BcQuality quality,
+               uint8_t* block);
+// values are stride bytes apart, e.g. rgba + 3 and 4 for alpha
+void
+EncodeBc4Block(const uint8_t* values,
+               uint32_t stride,
+               BcQuality quality,
+               uint8_t* block);
+void
+EncodeBc3Block(const uint8_t* rgba, BcQuality quality, uint8_t* block);
+// red and green
+void
+EncodeBc5Block(const uint8_t* rgba, BcQuality quality, uint8_t* block);
+// mode 6 only, i.e. one subset with RGBA endpoints and 4 bit indices
+void
+EncodeBc7Block(const uint8_t* rgba, BcQuality quality, uint8_t* block);
+
+// Encodes an RGBA8 image into the blocks of format, row by row; edge blocks
+// repeat the last row and column. Rows of blocks are spread over all cores.
+// Returns false unless format is BC1, BC3, BC4, BC5 or BC7 (UNORM or SRGB).
+// sRGB formats encode the sRGB values as they are.
+bool
+EncodeBcImage(const uint8_t* rgba,
+              uint32_t width,
+              uint32_t height,
+              VkFormat format,
+              BcQuality quality,
+              uint8_t* blocks);
+
+// Next mip of an RGBA8 image with a 2x2 box filter, in linear space if srgb.
+// Odd sizes repeat the last row or column.
+void
+DownsampleRgba8(const uint8_t* rgba,
+                uint32_t width,
+                uint32_t height,
+                bool srgb,
+                std::vector<uint8_t>& mip);
+
+// A 2D texture of format, either R8G8B8A8 or one EncodeBcImage supports,
+// from an RGBA8 image with a full mip chain if mips is set.
+bool
+EncodeTexture(const uint8_t* rgba,
+              uint32_t width,
+              uint32_t height,
+              VkFormat format,
+              BcQuality quality,
+              bool mips,
+              TextureData& texture);
@@ -1,4 +1,6 @@
 echo off
 mkdir build
-for %%x in (main.vert main.frag compose.vert compose.frag) do tools\glslangValidator.exe -V res\shaders\%%x -o build\%%x.spv"
+for %%x in (main.vert main.frag compose.vert compose.frag cull.comp hiz.comp scene.vert scene.frag virtual_texture.frag) do tools\glslangValidator.exe -V res\shaders\%%x -o build\%%x.spv"
+tools\glslangValidator.exe -V -DOCCLUSION res\shaders\cull.comp -o build\cull_occlusion.comp.spv
+tools\glslangValidator.exe -V -DVIRTUAL_TEXTURE_SPARSE res\shaders\virtual_texture.frag -o build\virtual_texture_sparse.frag.spv
 pause
\ No newline at end of file
@@ -0,0 +1,465 @@
+#include "culling.h"
+
+#include "lod.h"
+#include "vk_init.h"
+#include "vk_utils.h"
+
+CullingPass::CullingPass(VkDevice device,
+                         DeviceProps deviceProps,
+                         uint32_t maxInstanceCount,
+                         const char* hiZName,
+                         uint32_t maxLodCount)
+  : device(device)
+  , deviceProps(deviceProps)
+  , maxInstanceCount(maxInstanceCount)
+  , maxLodCount(maxLodCount)
+  , hiZName(hiZName)
+{
+  // the draws pass the instance index as firstInstance
+  ASSERT_TRUE(deviceProps.features.drawIndirectFirstInstance == VK_TRUE);
+
+  if (hiZName != nullptr) {
+    SetOperation(hiZName,
+                 Operation::Sampled(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT));
+  }
+}
+
+void
+CullingPass::SetInstances(const Instance* instances, uint32_t count)
+{
+  ASSERT_TRUE(count <= maxInstanceCount);
+  memcpy(instanceHostMemory, instances, sizeof(Instance) * count);
+  frame.instanceCount = count;
+}
+
+void
+CullingPass::SetLods(const Lod* lods, uint32_t count)
+{
+  ASSERT_TRUE(count <= maxLodCount);
+  memcpy(lodHostMemory, lods, sizeof(Lod) * count);
+}
+
+void
+CullingPass::SetViewProj(const glm::mat4& viewProj)
+{
+  frame.viewProj = viewProj;
+
+  // rows of the (column major) view projection matrix
+  glm::mat4 rows = glm::transpose(viewProj);
+  glm::vec4 r0 = rows[0];
+  glm::vec4 r1 = rows[1];
+  glm::vec4 r2 = rows[2];
+  glm::vec4 r3 = rows[3];
+
+  // clip volume: -w <= x <= w, -w <= y <= w, 0 <= z <= w
+  frame.frustumPlanes[0] = r3 + r0;
+  frame.frustumPlanes[1] = r3 - r0;
+  frame.frustumPlanes[2] = r3 + r1;
+  frame.frustumPlanes[3] = r3 - r1;
+  frame.frustumPlanes[4] = r2;
+  frame.frustumPlanes[5] = r3 - r2;
+
+  for (auto& plane : frame.frustumPlanes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+}
+
+void
+CullingPass::SetCameraPosition(const glm::vec3& position)
+{
+  frame.cameraPosition = glm::vec4(position, 1.0f);
+}
+
+void
+CullingPass::SetLodSelection(float viewportHeight,
+                             float fovY,
+                             float pixelThreshold)
+{
+  frame.lodScale = GetLodScale(viewportHeight, fovY, pixelThreshold);
+}
+
+void
+CullingPass::OnBakeDone()
+{
+  drawIndirectCount =
+    deviceProps.HasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+  if (drawIndirectCount) {
+    vkCmdDrawIndexedIndirectCountKHR =
+      (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(
+        device, "vkCmdDrawIndexedIndirectCountKHR");
+    ASSERT_TRUE(vkCmdDrawIndexedIndirectCountKHR != nullptr);
+  }
+
+  // the occlusion variant is compiled from the same source with OCCLUSION
+  // defined, see compile_shaders.bat
+  PipelineState::ShaderState::ShaderStage stage = {};
+  stage.shaderName =
+    hiZName != nullptr ? "cull_occlusion.comp.spv" : "cull.comp.spv";
+  stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkBool32 compact = drawIndirectCount;
+  memcpy(stage.specialization.data, &compact, sizeof(compact));
+  stage.specialization.dataSize = sizeof(VkBool32);
+  stage.specialization.mapEntries[0].constantID = 0;
+  stage.specialization.mapEntries[0].offset = 0;
+  stage.specialization.mapEntries[0].size = sizeof(VkBool32);
+  stage.specialization.mapEntryCount += 1;
+
+  pipeline = graph->resources->computePipelines.Add(
+    ComputePipeline(device, stage, graph->pipelineCache));
+  graph->GetComputePipeline(pipeline)->Compile();
+
+  // buffers
+  frameBuffer.buf = vkuCreateBuffer(device,
+                                    sizeof(Frame),
+                                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  frameBuffer.mem = vkuAllocateBufferMemory(device,
+                                            deviceProps.memProps,
+                                            frameBuffer.buf,
+                                            VKU_MEMORY_USAGE_GPU_ONLY,
+                                            true);
+
+  instanceBuffer.buf =
+    vkuCreateBuffer(device,
+                    sizeof(Instance) * maxInstanceCount,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  instanceBuffer.mem = vkuAllocateBufferMemory(device,
+                                               deviceProps.memProps,
+                                               instanceBuffer.buf,
+                                               VKU_MEMORY_USAGE_UPLOAD,
+                                               true);
+
+  vkMapMemory(device,
+              instanceBuffer.mem,
+              0,
+              sizeof(Instance) * maxInstanceCount,
+              0,
+              (void**)&instanceHostMemory);
+
+  // the shader always binds the buffer, even without levels of detail
+  VkDeviceSize lodBufferSize = sizeof(Lod) * std::max(maxLodCount, 1u);
+  lodBuffer.buf = vkuCreateBuffer(
+    device, lodBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  lodBuffer.mem = vkuAllocateBufferMemory(device,
+                                          deviceProps.memProps,
+                                          lodBuffer.buf,
+                                          VKU_MEMORY_USAGE_UPLOAD,
+                                          true);
+
+  vkMapMemory(device,
+              lodBuffer.mem,
+              0,
+              lodBufferSize,
+              0,
+              (void**)&lodHostMemory);
+
+  drawBuffer.buf =
+    vkuCreateBuffer(device,
+                    sizeof(VkDrawIndexedIndirectCommand) * maxInstanceCount,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  drawBuffer.mem = vkuAllocateBufferMemory(device,
+                                           deviceProps.memProps,
+                                           drawBuffer.buf,
+                                           VKU_MEMORY_USAGE_GPU_ONLY,
+                                           true);
+
+  drawCountBuffer.buf = vkuCreateBuffer(device,
+                                        sizeof(uint32_t),
+                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  drawCountBuffer.mem = vkuAllocateBufferMemory(device,
+                                                deviceProps.memProps,
+                                                drawCountBuffer.buf,
+                                                VKU_MEMORY_USAGE_GPU_ONLY,
+                                                true);
+
+  // descriptors
+  VkDescriptorPoolSize poolSizes[] = {
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4),
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1),
+  };
+  auto poolCreateInfo = vkiDescriptorPoolCreateInfo(1, 3, poolSizes);
+  ASSERT_VK_SUCCESS(
+    vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool));
+
+  auto layout = graph->GetComputePipeline(pipeline)->GetDescriptorSetLayout(0);
+  auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
+  ASSERT_VK_SUCCESS(
+    vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet));
+
+  VkDescriptorBufferInfo bufferInfos[] = {
+    vkiDescriptorBufferInfo(frameBuffer.buf, 0, VK_WHOLE_SIZE),
+    vkiDescriptorBufferInfo(instanceBuffer.buf, 0, VK_WHOLE_SIZE),
+    vkiDescriptorBufferInfo(drawBuffer.buf, 0, VK_WHOLE_SIZE),
+    vkiDescriptorBufferInfo(drawCountBuffer.buf, 0, VK_WHOLE_SIZE),
+    vkiDescriptorBufferInfo(lodBuffer.buf, 0, VK_WHOLE_SIZE),
+  };
+
+  VkWriteDescriptorSet descriptorWrites[] = {
+    vkiWriteDescriptorSet(descriptorSet,
+                          0,
+                          0,
+                          1,
+                          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                          nullptr,
+                          &bufferInfos[0],
+                          nullptr),
+    vkiWriteDescriptorSet(descriptorSet,
+                          1,
+                          0,
+                          3,
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          nullptr,
+                          &bufferInfos[1],
+                          nullptr),
+    vkiWriteDescriptorSet(descriptorSet,
+                          5,
+                          0,
+                          1,
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          nullptr,
+                          &bufferInfos[4],
+                          nullptr),
+  };
+  vkUpdateDescriptorSets(device, 3, descriptorWrites, 0, nullptr);
+
+  if (hiZName != nullptr) {
+    auto samplerInfo =
+      vkiSamplerCreateInfo(VK_FILTER_NEAREST,
+                           VK_FILTER_NEAREST,
+                           VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                           VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                           VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                           VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                           0.f,
+                           VK_FALSE,
+                           0.f,
+                           VK_FALSE,
+                           VK_COMPARE_OP_NEVER,
+                           0.f,
+                           VK_LOD_CLAMP_NONE,
+                           VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+                           VK_FALSE);
+    ASSERT_VK_SUCCESS(
+      vkCreateSampler(device, &samplerInfo, nullptr, &hiZSampler));
+  }
+}
+
+void
+CullingPass::UpdateHiZDescriptor()
+{
+  if (graph->pis[hiZName] == boundHiZ) {
+    return;
+  }
+
+  if (!boundHiZ.IsNull()) {
+    graph->WaitForFramesInFlight();
+  }
+
+  PhysicalImage* pi = graph->GetPhysicalImage(hiZName);
+
+  auto imageInfo = vkiDescriptorImageInfo(
+    hiZSampler, pi->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  auto descriptorWrite =
+    vkiWriteDescriptorSet(descriptorSet,
+                          4,
+                          0,
+                          1,
+                          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                          &imageInfo,
+                          nullptr,
+                          nullptr);
+
+  vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+  boundHiZ = graph->pis[hiZName];
+  hiZFrameCount = 0;
+}
+
+void
+CullingPass::RecordCmds(VkCommandBuffer cmdBuffer)
+{
+  if (hiZName != nullptr) {
+    UpdateHiZDescriptor();
+
+    // the pyramid is only valid once a previous frame has written it
+    auto vi = graph->vis[hiZName];
+    frame.hiZExtent = { (float)vi->extent.width, (float)vi->extent.height };
+    frame.hiZValid = hiZFrameCount > 0 ? 1 : 0;
+    hiZFrameCount += 1;
+  }
+
+  // the draws of the previous frame have to be consumed before the buffers
+  // are overwritten
+  vkCmdPipelineBarrier(cmdBuffer,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr);
+
+  vkCmdUpdateBuffer(cmdBuffer, frameBuffer.buf, 0, sizeof(Frame), &frame);
+  vkCmdFillBuffer(cmdBuffer, drawCountBuffer.buf, 0, sizeof(uint32_t), 0);
+
+  {
+    VkBufferMemoryBarrier bufferMemoryBarriers[] = {
+      vkiBufferMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_UNIFORM_READ_BIT,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             frameBuffer.buf,
+                             0,
+                             VK_WHOLE_SIZE),
+      vkiBufferMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_SHADER_READ_BIT |
+                               VK_ACCESS_SHADER_WRITE_BIT,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             drawCountBuffer.buf,
+                             0,
+                             VK_WHOLE_SIZE),
+    };
+
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         2,
+                         bufferMemoryBarriers,
+                         0,
+                         nullptr);
+  }
+
+  if (frame.instanceCount > 0) {
+    ComputePipeline* cull = graph->GetComputePipeline(pipeline);
+    cull->Bind(cmdBuffer);
+    cull->BindDescriptorSets(cmdBuffer, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdDispatch(cmdBuffer,
+                  (frame.instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                  1,
+                  1);
+  }
+
+  {
+    VkBufferMemoryBarrier bufferMemoryBarriers[] = {
+      vkiBufferMemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT,
+                             VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             drawBuffer.buf,
+                             0,
+                             VK_WHOLE_SIZE),
+      vkiBufferMemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT,
+                             VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             VK_QUEUE_FAMILY_IGNORED,
+                             drawCountBuffer.buf,
+                             0,
+                             VK_WHOLE_SIZE),
+    };
+
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         2,
+                         bufferMemoryBarriers,
+                         0,
+                         nullptr);
+  }
+}
+
+void
+CullingPass::RecordIndirectDraws(VkCommandBuffer cmdBuffer)
+{
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+  if (drawIndirectCount) {
+    vkCmdDrawIndexedIndirectCountKHR(cmdBuffer,
+                                     drawBuffer.buf,
+                                     0,
+                                     drawCountBuffer.buf,
+                                     0,
+                                     frame.instanceCount,
+                                     stride);
+    return;
+  }
+
+  // culled instances have an instanceCount of 0
+  const uint32_t maxDrawCount =
+    deviceProps.features.multiDrawIndirect
+      ? deviceProps.props.limits.maxDrawIndirectCount
+      : 1;
+
+  for (uint32_t first = 0; first < frame.instanceCount; first += maxDrawCount) {
+    uint32_t count = std::min(maxDrawCount, frame.instanceCount - first);
+    vkCmdDrawIndexedIndirect(
+      cmdBuffer, drawBuffer.buf, first * stride, count, stride);
+  }
+}
+
+void
+AppendClusterInstances(const MeshletMesh& meshletMesh,
+                       const glm::mat4& model,
+                       uint32_t firstIndex,
+                       int32_t vertexOffset,
+                       std::vector<CullingPass::Instance>& instances)
+{
+  glm::mat3 linear(model);
+  glm::vec3 scales(glm::length(linear[0]),
+                   glm::length(linear[1]),
+                   glm::length(linear[2]));
+  float maxScale = glm::max(scales.x, glm::max(scales.y, scales.z));
+  float minScale = glm::min(scales.x, glm::min(scales.y, scales.z));
+  bool uniformScale = maxScale - minScale <= maxScale * 1e-3f;
+
+  for (auto const& meshlet : meshletMesh.meshlets) {
+    CullingPass::Instance instance = {};
+    instance.sphere =
+      glm::vec4(glm::vec3(model * glm::vec4(glm::vec3(meshlet.sphere), 1.0f)),
+                meshlet.sphere.w * maxScale);
+    instance.indexCount = meshlet.triangleCount * 3;
+    instance.firstIndex = firstIndex + meshlet.triangleOffset * 3;
+    instance.vertexOffset = vertexOffset;
+
+    if (uniformScale && meshlet.cone.w < 1.0f) {
+      glm::vec3 axis = glm::normalize(linear * glm::vec3(meshlet.cone));
+      instance.cone = glm::vec4(axis, meshlet.cone.w);
+    }
+
+    instances.push_back(instance);
+  }
+}
+
+uint32_t
+AppendMeshLods(const Mesh& mesh,
+               uint32_t firstIndex,
+               std::vector<CullingPass::Lod>& lods)
+{
+  uint32_t firstLod = static_cast<uint32_t>(lods.size());
+
+  for (auto const& meshLod : mesh.lods) {
+    CullingPass::Lod lod = {};
+    lod.indexCount = meshLod.indexCount;
+    lod.firstIndex = firstIndex + meshLod.firstIndex;
+    lod.error = meshLod.error;
+    lods.push_back(lod);
+  }
+
+  return firstLod;
+}
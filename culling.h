@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glm\glm.hpp>
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+#include "meshlet.h"
+#include "pipeline.h"
+#include "rendergraph.h"
+
+// Tests instance bounding spheres against the view frustum and, optionally,
+// against a hierarchical depth (Hi-Z) image of the previous frame and writes
+// the indirect draw commands of the visible instances.
+//
+// Add it as the only subpass of a ComputePass that precedes the render pass
+// consuming the draws, and call RecordIndirectDraws in that render pass after
+// binding the pipeline, vertex and index buffers. Each draw uses the index of
+// its instance as firstInstance, which needs the drawIndirectFirstInstance
+// feature; vertex shaders find it in gl_InstanceIndex.
+//
+// An instance can also be a single cluster of a mesh (see
+// AppendClusterInstances), its normal cone then culls clusters that face
+// away from the camera.
+//
+// Instances with levels of detail (see AppendMeshLods) draw the coarsest
+// level whose error stays below the threshold set with SetLodSelection.
+struct CullingPass : Subpass
+{
+  // matches Instance in cull.comp (std430)
+  struct Instance
+  {
+    glm::vec4 sphere = {}; // xyz center, w radius (world space)
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    uint32_t pad = 0;
+    // xyz axis, w sine of the spread (world space), see Meshlet::cone
+    glm::vec4 cone = { 0.0f, 0.0f, 0.0f, 1.0f };
+    // levels in the LOD buffer, indexCount and firstIndex are used if 0
+    uint32_t firstLod = 0;
+    uint32_t lodCount = 0;
+    float lodErrorScale = 1.0f; // object to world scale
+    uint32_t pad2 = 0;
+  };
+
+  // matches Lod in cull.comp (std430)
+  struct Lod
+  {
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    float error = 0.0f; // object space, see MeshLod
+    uint32_t pad = 0;
+  };
+
+  // matches Frame in cull.comp (std140)
+  struct Frame
+  {
+    glm::mat4 viewProj = {};
+    glm::vec4 frustumPlanes[6] = {};
+    glm::vec4 cameraPosition = {};
+    glm::vec2 hiZExtent = {};
+    uint32_t instanceCount = 0;
+    uint32_t hiZValid = 0;
+    float lodScale = 0.0f; // see GetLodScale, 0 always draws the full mesh
+  };
+
+  static const uint32_t WORKGROUP_SIZE = 64;
+
+  // hiZName: name of a Hi-Z pyramid in the graph (see AddHiZPasses) that
+  // holds the farthest depth per texel in g, nullptr for frustum culling only
+  CullingPass(VkDevice device,
+              DeviceProps deviceProps,
+              uint32_t maxInstanceCount,
+              const char* hiZName = nullptr,
+              uint32_t maxLodCount = 0);
+
+  // The instance buffer is host visible and not multi-buffered, instances
+  // must not be changed while frames using them are in flight.
+  void SetInstances(const Instance* instances, uint32_t count);
+  void SetLods(const Lod* lods, uint32_t count);
+  void SetViewProj(const glm::mat4& viewProj);
+  void SetCameraPosition(const glm::vec3& position);
+  // tolerated error in pixels, fovY in radians
+  void SetLodSelection(float viewportHeight, float fovY, float pixelThreshold);
+
+  void OnBakeDone() override;
+  void RecordCmds(VkCommandBuffer cmdBuffer) override;
+
+  void RecordIndirectDraws(VkCommandBuffer cmdBuffer);
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceProps deviceProps = {};
+
+  uint32_t maxInstanceCount = 0;
+  uint32_t maxLodCount = 0;
+  const char* hiZName = nullptr;
+
+  // VK_KHR_draw_indirect_count: compacted draws plus a draw count;
+  // otherwise one draw per instance with instanceCount 0 for culled instances
+  bool drawIndirectCount = false;
+  PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCountKHR =
+    nullptr;
+
+  struct Buffer
+  {
+    VkBuffer buf = VK_NULL_HANDLE;
+    VkDeviceMemory mem = VK_NULL_HANDLE;
+  };
+
+  Buffer frameBuffer = {};
+  Buffer instanceBuffer = {};
+  Buffer lodBuffer = {};
+  Buffer drawBuffer = {};
+  Buffer drawCountBuffer = {};
+  Instance* instanceHostMemory = nullptr;
+  Lod* lodHostMemory = nullptr;
+
+  Frame frame = {};
+
+  ComputePipelineHandle pipeline = {};
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkSampler hiZSampler = VK_NULL_HANDLE;
+  ImageHandle boundHiZ = {};
+  uint32_t hiZFrameCount = 0;
+
+private:
+  void UpdateHiZDescriptor();
+};
+
+// Appends one instance per meshlet, transformed by model. The instances draw
+// from MeshletMesh::indices uploaded at firstIndex, with vertexOffset added to
+// every index. model may scale, but cones are only kept under uniform scale.
+void
+AppendClusterInstances(const MeshletMesh& meshletMesh,
+                       const glm::mat4& model,
+                       uint32_t firstIndex,
+                       int32_t vertexOffset,
+                       std::vector<CullingPass::Instance>& instances);
+
+// Appends the levels of mesh (see GenerateLods) for meshes whose indices are
+// uploaded at firstIndex and returns the index of the first one, i.e. the
+// Instance::firstLod of instances of the mesh.
+uint32_t
+AppendMeshLods(const Mesh& mesh,
+               uint32_t firstIndex,
+               std::vector<CullingPass::Lod>& lods);
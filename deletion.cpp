@@ -0,0 +1,186 @@
+#include "deletion.h"
+
+#include <algorithm> // remove_if
+
+#include "vk_base.h"
+#include "vk_utils.h"
+
+void
+DeletionQueue::Create(VkDevice device, Timeline* timeline)
+{
+  this->device = device;
+  this->timeline = timeline;
+}
+
+void
+DeletionQueue::Push(VkObjectType type, uint64_t handle, uint64_t value)
+{
+  if (handle == 0) {
+    return;
+  }
+
+  Entry entry = {};
+  entry.type = type;
+  entry.handle = handle;
+  entry.value = value == 0 ? timeline->GetNextValue() : value;
+  entries.push_back(entry);
+}
+
+void
+DeletionQueue::Push(std::function<void()> callback, uint64_t value)
+{
+  Entry entry = {};
+  entry.callback = callback;
+  entry.value = value == 0 ? timeline->GetNextValue() : value;
+  entries.push_back(entry);
+}
+
+void
+DeletionQueue::PushConcurrent(VkObjectType type,
+                              uint64_t handle,
+                              uint64_t value)
+{
+  if (handle == 0) {
+    return;
+  }
+
+  Node* node = new Node;
+  node->entry.type = type;
+  node->entry.handle = handle;
+  node->entry.value = value;
+
+  node->next = concurrentHead.load(std::memory_order_relaxed);
+  while (!concurrentHead.compare_exchange_weak(
+    node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+}
+
+void
+DeletionQueue::PushConcurrent(std::function<void()> callback, uint64_t value)
+{
+  Node* node = new Node;
+  node->entry.callback = callback;
+  node->entry.value = value;
+
+  node->next = concurrentHead.load(std::memory_order_relaxed);
+  while (!concurrentHead.compare_exchange_weak(
+    node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+}
+
+void
+DeletionQueue::Push(const PhysicalImage& image, uint64_t value)
+{
+  Push(VK_OBJECT_TYPE_IMAGE_VIEW, ToHandle64(image.view), value);
+  Push(VK_OBJECT_TYPE_IMAGE, ToHandle64(image.image), value);
+  Push(VK_OBJECT_TYPE_DEVICE_MEMORY, ToHandle64(image.memory), value);
+}
+
+void
+DeletionQueue::TakeConcurrent()
+{
+  // producers only ever prepend, so taking the whole list is safe
+  Node* node = concurrentHead.exchange(nullptr, std::memory_order_acquire);
+  while (node != nullptr) {
+    Node* next = node->next;
+    entries.push_back(node->entry);
+    delete node;
+    node = next;
+  }
+}
+
+void
+DeletionQueue::Collect()
+{
+  TakeConcurrent();
+
+  if (entries.size() == 0) {
+    return;
+  }
+
+  uint64_t completed = timeline->GetCompletedValue();
+
+  auto end = std::remove_if(
+    entries.begin(), entries.end(), [this, completed](const Entry& entry) {
+      if (entry.value > completed) {
+        return false;
+      }
+      Destroy(entry);
+      return true;
+    });
+  entries.erase(end, entries.end());
+}
+
+void
+DeletionQueue::Flush()
+{
+  TakeConcurrent();
+
+  for (auto const& entry : entries) {
+    timeline->Wait(std::min(entry.value, timeline->lastSubmitted));
+    Destroy(entry);
+  }
+  entries.clear();
+}
+
+void
+DeletionQueue::Destroy(const Entry& entry)
+{
+  switch (entry.type) {
+    case VK_OBJECT_TYPE_UNKNOWN:
+      entry.callback();
+      break;
+    case VK_OBJECT_TYPE_BUFFER:
+      vkDestroyBuffer(device, (VkBuffer)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_BUFFER_VIEW:
+      vkDestroyBufferView(device, (VkBufferView)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_IMAGE:
+      vkDestroyImage(device, (VkImage)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+      vkDestroyImageView(device, (VkImageView)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_DEVICE_MEMORY:
+      vkuFreeMemory(device, (VkDeviceMemory)entry.handle);
+      break;
+    case VK_OBJECT_TYPE_SAMPLER:
+      vkDestroySampler(device, (VkSampler)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+      vkDestroyFramebuffer(device, (VkFramebuffer)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_RENDER_PASS:
+      vkDestroyRenderPass(device, (VkRenderPass)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_PIPELINE:
+      vkDestroyPipeline(device, (VkPipeline)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+      vkDestroyPipelineLayout(device, (VkPipelineLayout)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+      vkDestroyDescriptorSetLayout(
+        device, (VkDescriptorSetLayout)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+      vkDestroyDescriptorPool(device, (VkDescriptorPool)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_EVENT:
+      vkDestroyEvent(device, (VkEvent)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_QUERY_POOL:
+      vkDestroyQueryPool(device, (VkQueryPool)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_SHADER_MODULE:
+      vkDestroyShaderModule(device, (VkShaderModule)entry.handle, nullptr);
+      break;
+    case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+      vkDestroySwapchainKHR(device, (VkSwapchainKHR)entry.handle, nullptr);
+      break;
+    default:
+      ASSERT_TRUE(false);
+      break;
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <vulkan\vulkan.h>
+
+struct PhysicalImage;
+struct Timeline;
+
+// Destroys Vulkan objects once the GPU no longer uses them. Every object is
+// queued with the timeline value of the last submission that may use it and
+// destroyed in bulk by Collect once that value completed.
+//
+// Push is meant for the thread that owns the queue (the one calling Collect).
+// PushConcurrent may be called from any thread, it prepends to a lock-free
+// list that Collect takes over as a whole.
+struct DeletionQueue
+{
+  struct Entry
+  {
+    VkObjectType type = VK_OBJECT_TYPE_UNKNOWN;
+    uint64_t handle = 0;
+    std::function<void()> callback = {}; // VK_OBJECT_TYPE_UNKNOWN only
+    uint64_t value = 0;
+  };
+
+  void Create(VkDevice device, Timeline* timeline);
+
+  // value 0 means the next submission of the timeline, i.e. the object might
+  // still be used by commands that are being recorded
+  void Push(VkObjectType type, uint64_t handle, uint64_t value = 0);
+  void Push(std::function<void()> callback, uint64_t value = 0);
+
+  // value has to be given explicitly, the timeline is not thread safe
+  void PushConcurrent(VkObjectType type, uint64_t handle, uint64_t value);
+  void PushConcurrent(std::function<void()> callback, uint64_t value);
+
+  // image view, image and memory
+  void Push(const PhysicalImage& image, uint64_t value = 0);
+
+  // destroys all entries whose value completed
+  void Collect();
+
+  // waits for all entries and destroys them
+  void Flush();
+
+  VkDevice device = VK_NULL_HANDLE;
+  Timeline* timeline = nullptr;
+
+private:
+  struct Node
+  {
+    Entry entry;
+    Node* next = nullptr;
+  };
+
+  void Destroy(const Entry& entry);
+  void TakeConcurrent();
+
+  std::vector<Entry> entries = {};
+  std::atomic<Node*> concurrentHead = { nullptr };
+};
+
+// converts any handle, dispatchable or not, for DeletionQueue::Push
+template<typename T>
+uint64_t
+ToHandle64(T handle)
+{
+  return (uint64_t)handle;
+}
@@ -1,9 +1,20 @@
 
+#include <cfloat>
+#include <glm\gtc\matrix_transform.hpp>
+
 #include "vk_base.h"
 #include "window.h"
 
+#include "culling.h"
+#include "hiz.h"
+#include "pack.h"
 #include "rendergraph.h"
+#include "permutations.h"
 #include "pipeline.h"
+#include "streaming.h"
+#include "teapot.h"
+#include "texture.h"
+#include "virtual_texture.h"
 
 uint32_t Operation::nextId = 0;
 
@@ -25,9 +36,10 @@ struct TextureSubpass : Subpass
   VkDevice device;
   DeviceProps deviceProps;
 
-  Pipeline* pipeline;
+  PipelinePermutations* permutations = nullptr;
   const char* imgName;
 
+  // value index of the color axis, can change between frames
   uint32_t specialization;
 
   struct Buffer
@@ -42,10 +54,6 @@ struct TextureSubpass : Subpass
 
   void OnBakeDone() override
   {
-    auto img = graph->vis[imgName];
-    auto w = img->extent.width;
-    auto h = img->extent.height;
-
     PipelineState pipelineState = {};
     pipelineState.shader.stages[0].shaderName = "main.vert.spv";
     pipelineState.shader.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
@@ -53,25 +61,13 @@ struct TextureSubpass : Subpass
 
     pipelineState.shader.stages[1].shaderName = "main.frag.spv";
     pipelineState.shader.stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    memcpy(pipelineState.shader.stages[1].specialization.data,
-           &specialization,
-           sizeof(specialization));
-    pipelineState.shader.stages[1].specialization.dataSize = sizeof(uint32_t);
-    pipelineState.shader.stages[1].specialization.mapEntries[0].constantID = 0;
-    pipelineState.shader.stages[1].specialization.mapEntries[0].offset = 0;
-    pipelineState.shader.stages[1].specialization.mapEntries[0].size =
-      sizeof(uint32_t);
-    pipelineState.shader.stages[1].specialization.mapEntryCount += 1;
     pipelineState.shader.stageCount += 1;
 
-    // viewports / scissors depend on render pass (at least if you want to use
-    // the whole attachment region)
+    // viewports / scissors cover the render area and are set by the graph,
+    // so the pipeline survives a resize
 
-    pipelineState.viewport.viewports[0] = { 0.0f,     0.0f, (float)w,
-                                            (float)h, 0.0f, 1.0f };
-    pipelineState.viewport.viewportCount += 1;
-    pipelineState.viewport.scissors[0] = { { 0, 0 }, { w, h } };
-    pipelineState.viewport.scissorCount += 1;
+    SimplifiedDynamicState dynamicState = {};
+    dynamicState.Apply(&pipelineState);
 
     // one color blend attachments for each color output attachment in the
     // renderpass
@@ -85,9 +81,17 @@ struct TextureSubpass : Subpass
     vertexInputState.attributeFlagsCount += 1;
     vertexInputState.Apply(&pipelineState);
 
-    pipeline =
-      new Pipeline(device, pipelineState, renderPass->renderPass, subpass);
-    pipeline->Compile();
+    // the color is a specialization constant, both variants are compiled in
+    // the background so switching does not stall
+    permutations = new PipelinePermutations(device,
+                                            pipelineState,
+                                            renderPass->renderPass,
+                                            subpass,
+                                            graph->pipelineCache,
+                                            graph->resources);
+    permutations->AddAxis(VK_SHADER_STAGE_FRAGMENT_BIT, 0, { 0, 1 });
+    permutations->Precompile({ permutations->GetVariant({ 0 }),
+                               permutations->GetVariant({ 1 }) });
 
     // vertex buffer
     vbuffer.buf = vkuCreateBuffer(
@@ -96,7 +100,7 @@ struct TextureSubpass : Subpass
     vbuffer.mem = vkuAllocateBufferMemory(device,
                                           deviceProps.memProps,
                                           vbuffer.buf,
-                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                          VKU_MEMORY_USAGE_UPLOAD,
                                           true);
 
     vkMapMemory(device,
@@ -114,8 +118,11 @@ struct TextureSubpass : Subpass
 
   void RecordCmds(VkCommandBuffer cmdBuffer) override
   {
+    Pipeline* pipeline = graph->GetPipeline(
+      permutations->GetPipeline(permutations->GetVariant({ specialization })));
+
     VkDeviceSize vbufferOffset = 0;
-    pipeline->Bind(cmdBuffer);
+    pipeline->Bind(cmdBuffer, &graph->dynamicState);
     vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vbuffer.buf, &vbufferOffset);
     for (uint32_t i = 0; i < 512; ++i) {
       vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
@@ -123,11 +130,309 @@ struct TextureSubpass : Subpass
   }
 };
 
+// A grid of teapots drawn with the indirect draws of a CullingPass, whose
+// compute pass has to be added to the graph before this render pass. The
+// teapot is generated until the one of the asset pack is streamed in.
+struct ScenePass : Subpass
+{
+  static const uint32_t GRID_SIZE = 16;
+  static const uint32_t INSTANCE_COUNT = GRID_SIZE * GRID_SIZE;
+  static const uint32_t MAX_LOD_COUNT = 8;
+
+  ScenePass(VkDevice device, DeviceProps deviceProps, CullingPass* culling)
+    : device(device)
+    , deviceProps(deviceProps)
+    , culling(culling)
+  {
+    SetOperation("img2", Operation::ColorOutputAttachment());
+    SetOperation("depth", Operation::DepthStencilAttachment());
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceProps deviceProps = {};
+  CullingPass* culling = nullptr;
+  PipelineHandle pipeline = {};
+  // QUANTIZED_POSITION | OCTAHEDRAL_NORMAL vertices of the pack
+  PipelineHandle packedPipeline = {};
+
+  struct Buffer
+  {
+    VkBuffer buf;
+    VkDeviceMemory mem;
+  };
+
+  Buffer vbuffer = {};
+  Buffer ibuffer = {};
+  Buffer modelBuffer = {}; // model matrix per instance
+
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  std::vector<CullingPass::Instance> instances = {};
+
+  // the mesh of the pack, drawn once streamed is set
+  bool streamed = false;
+  VkBuffer streamedBuffer = VK_NULL_HANDLE;
+  PackMesh streamedMesh = {};
+
+  // matches Push in scene.vert
+  struct Push
+  {
+    glm::mat4 viewProj = {};
+    glm::vec4 positionMin = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glm::vec4 positionExtent = { 1.0f, 1.0f, 1.0f, 1.0f };
+  } push = {};
+
+  float gridRadius = 0.0f;
+
+  // the buffers are written once, uploads go straight to host visible memory
+  Buffer CreateBuffer(const void* data,
+                      VkDeviceSize size,
+                      VkBufferUsageFlags usage)
+  {
+    Buffer buffer = {};
+    buffer.buf = vkuCreateBuffer(device, size, usage);
+    buffer.mem = vkuAllocateBufferMemory(
+      device, deviceProps.memProps, buffer.buf, VKU_MEMORY_USAGE_UPLOAD, true);
+
+    void* hostMemory = nullptr;
+    vkMapMemory(device, buffer.mem, 0, size, 0, &hostMemory);
+    memcpy(hostMemory, data, size);
+    vkUnmapMemory(device, buffer.mem);
+    return buffer;
+  }
+
+  PipelineHandle CreatePipeline(VertexEncodingFlags encodingFlags)
+  {
+    PipelineState pipelineState = {};
+    pipelineState.shader.stages[0].shaderName = "scene.vert.spv";
+    pipelineState.shader.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    pipelineState.shader.stageCount += 1;
+
+    auto& specialization = pipelineState.shader.stages[0].specialization;
+    VkBool32 packed = encodingFlags != 0;
+    memcpy(specialization.data, &packed, sizeof(packed));
+    specialization.dataSize = sizeof(VkBool32);
+    specialization.mapEntries[0].constantID = 0;
+    specialization.mapEntries[0].offset = 0;
+    specialization.mapEntries[0].size = sizeof(VkBool32);
+    specialization.mapEntryCount += 1;
+
+    pipelineState.shader.stages[1].shaderName = "scene.frag.spv";
+    pipelineState.shader.stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pipelineState.shader.stageCount += 1;
+
+    SimplifiedDynamicState dynamicState = {};
+    dynamicState.Apply(&pipelineState);
+
+    pipelineState.blend.colorBlendAttachmentCount = 1;
+
+    pipelineState.depthStencil.depthTestEnable = VK_TRUE;
+    pipelineState.depthStencil.depthWriteEnable = VK_TRUE;
+    pipelineState.depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    SimplifiedVertexInputState vertexInputState = {};
+    vertexInputState.attributeFlags[0] = POSITION | NORMAL;
+    vertexInputState.encodingFlags[0] = encodingFlags;
+    vertexInputState.attributeFlagsCount += 1;
+    vertexInputState.Apply(&pipelineState);
+
+    PipelineHandle handle =
+      graph->resources->pipelines.Add(Pipeline(device,
+                                               pipelineState,
+                                               renderPass->renderPass,
+                                               subpass,
+                                               graph->pipelineCache));
+    graph->GetPipeline(handle)->Compile();
+    return handle;
+  }
+
+  void OnBakeDone() override
+  {
+    pipeline = CreatePipeline(0);
+    packedPipeline = CreatePipeline(QUANTIZED_POSITION | OCTAHEDRAL_NORMAL);
+
+    Mesh mesh = GenerateTeapotMesh(true);
+    vbuffer = CreateBuffer(mesh.vertices.data(),
+                           sizeof(float) * mesh.vertices.size(),
+                           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    ibuffer = CreateBuffer(mesh.indices.data(),
+                           sizeof(uint32_t) * mesh.indices.size(),
+                           VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+    glm::vec3 lo(FLT_MAX);
+    glm::vec3 hi(-FLT_MAX);
+    for (uint32_t i = 0; i < mesh.GetVertexCount(); ++i) {
+      const float* position = &mesh.vertices[i * mesh.vertexStride];
+      lo = glm::min(lo, glm::vec3(position[0], position[1], position[2]));
+      hi = glm::max(hi, glm::vec3(position[0], position[1], position[2]));
+    }
+    glm::vec3 center = 0.5f * (lo + hi);
+    float radius = 0.5f * glm::length(hi - lo);
+
+    // the teapots are centered on the grid points
+    float spacing = 2.5f * radius;
+    gridRadius = 0.5f * spacing * GRID_SIZE;
+
+    std::vector<glm::mat4> models = {};
+    for (uint32_t z = 0; z < GRID_SIZE; ++z) {
+      for (uint32_t x = 0; x < GRID_SIZE; ++x) {
+        glm::vec3 position =
+          spacing * glm::vec3(x - 0.5f * (GRID_SIZE - 1),
+                              0.0f,
+                              z - 0.5f * (GRID_SIZE - 1));
+        models.push_back(glm::translate(glm::mat4(1.0f), position - center));
+
+        CullingPass::Instance instance = {};
+        instance.sphere = glm::vec4(position, radius);
+        instance.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        instances.push_back(instance);
+      }
+    }
+
+    // the culling pass was baked first and has mapped its instance buffer
+    culling->SetInstances(instances.data(), INSTANCE_COUNT);
+    modelBuffer = CreateBuffer(models.data(),
+                               sizeof(glm::mat4) * models.size(),
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    auto poolSize = vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1);
+    auto poolCreateInfo = vkiDescriptorPoolCreateInfo(1, 1, &poolSize);
+    ASSERT_VK_SUCCESS(
+      vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool));
+
+    auto layout = graph->GetPipeline(pipeline)->GetDescriptorSetLayout(0);
+    auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
+    ASSERT_VK_SUCCESS(
+      vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet));
+
+    auto bufferInfo =
+      vkiDescriptorBufferInfo(modelBuffer.buf, 0, VK_WHOLE_SIZE);
+    auto descriptorWrite =
+      vkiWriteDescriptorSet(descriptorSet,
+                            0,
+                            0,
+                            1,
+                            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                            nullptr,
+                            &bufferInfo,
+                            nullptr);
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+  }
+
+  // Switches to the teapot of the pack once asset is resident, with the
+  // levels of detail the packer generated. Their table is read from the pack.
+  void UseStreamedTeapot(const StreamedAsset* asset, const AssetPack& pack)
+  {
+    if (streamed || asset == nullptr) {
+      return;
+    }
+
+    // as written by tools/packer.cpp
+    const PackMesh& mesh = asset->mesh;
+    ASSERT_TRUE((mesh.attributeFlags == (POSITION | NORMAL) &&
+                 mesh.encodingFlags ==
+                   (QUANTIZED_POSITION | OCTAHEDRAL_NORMAL)));
+    ASSERT_TRUE(mesh.lodCount <= MAX_LOD_COUNT);
+
+    Mesh lodMesh = {};
+    lodMesh.lods.resize(mesh.lodCount);
+    ASSERT_TRUE(pack.ReadRange(*asset->entry,
+                               mesh.lodOffset,
+                               sizeof(MeshLod) * mesh.lodCount,
+                               lodMesh.lods.data()));
+    std::vector<CullingPass::Lod> lods = {};
+    AppendMeshLods(lodMesh, 0, lods);
+
+    for (auto& instance : instances) {
+      instance.indexCount = lods.size() > 0 ? lods[0].indexCount
+                                            : mesh.indexCount;
+      instance.firstIndex = 0;
+      instance.firstLod = 0;
+      instance.lodCount = static_cast<uint32_t>(lods.size());
+    }
+
+    // the instances and levels are not multi-buffered
+    graph->WaitForFramesInFlight();
+    culling->SetLods(lods.data(), static_cast<uint32_t>(lods.size()));
+    culling->SetInstances(instances.data(), INSTANCE_COUNT);
+
+    streamed = true;
+    streamedBuffer = asset->buffer;
+    streamedMesh = mesh;
+    push.positionMin = glm::vec4(mesh.positionMin[0],
+                                 mesh.positionMin[1],
+                                 mesh.positionMin[2],
+                                 0.0f);
+    push.positionExtent = glm::vec4(mesh.positionExtent[0],
+                                    mesh.positionExtent[1],
+                                    mesh.positionExtent[2],
+                                    0.0f);
+  }
+
+  // orbits the grid, the teapots next to the camera hide the ones behind them
+  void UpdateCamera(VkExtent2D extent, float angle)
+  {
+    const float fovY = glm::radians(60.0f);
+
+    glm::vec3 eye =
+      gridRadius *
+      glm::vec3(1.2f * std::cos(angle), 0.3f, 1.2f * std::sin(angle));
+    glm::mat4 view =
+      glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(fovY,
+                                      extent.width / (float)extent.height,
+                                      0.01f * gridRadius,
+                                      4.0f * gridRadius);
+
+    // OpenGL to Vulkan clip space, y points down and z goes from 0 to w
+    const glm::mat4 clip = { 1.0f, 0.0f,  0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f,
+                             0.0f, 0.0f,  0.5f, 0.0f, 0.0f, 0.0f,  0.5f, 1.0f };
+
+    push.viewProj = clip * proj * view;
+    culling->SetViewProj(push.viewProj);
+    culling->SetCameraPosition(eye);
+    culling->SetLodSelection((float)extent.height, fovY, 1.0f);
+  }
+
+  void RecordCmds(VkCommandBuffer cmdBuffer) override
+  {
+    Pipeline* current =
+      graph->GetPipeline(streamed ? packedPipeline : pipeline);
+    current->Bind(cmdBuffer, &graph->dynamicState);
+    current->BindDescriptorSets(cmdBuffer, 0, 1, &descriptorSet, 0, nullptr);
+    current->PushConstants(
+      cmdBuffer, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+
+    if (streamed) {
+      // one buffer holds the whole payload
+      vkCmdBindVertexBuffers(
+        cmdBuffer, 0, 1, &streamedBuffer, &streamedMesh.vertexOffset);
+      vkCmdBindIndexBuffer(cmdBuffer,
+                           streamedBuffer,
+                           streamedMesh.indexOffset,
+                           static_cast<VkIndexType>(streamedMesh.indexType));
+    } else {
+      VkDeviceSize vbufferOffset = 0;
+      vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vbuffer.buf, &vbufferOffset);
+      vkCmdBindIndexBuffer(cmdBuffer, ibuffer.buf, 0, VK_INDEX_TYPE_UINT32);
+    }
+    culling->RecordIndirectDraws(cmdBuffer);
+  }
+};
+
+// Puts img1 and img2 side by side, and texture, if any, minified in a corner
+// so that its mips show. virtualTexture, if any, goes into another corner
+// and has to be updated before the graph and get its feedback recorded
+// after it.
 struct ComposePass : Subpass
 {
   VkDevice device = VK_NULL_HANDLE;
   DeviceProps deviceProps = {};
-  Pipeline* pipeline = nullptr;
+  PipelineHandle pipeline = {};
+  const PhysicalImage* texture = nullptr;
+  VirtualTexture* virtualTexture = nullptr;
+  PipelineHandle virtualTexturePipeline = {};
 
   struct Buffer
   {
@@ -139,38 +444,36 @@ struct ComposePass : Subpass
   Buffer vbuffer = {};
   uint8_t* vbufferHostMemory = nullptr;
 
-  ComposePass(VkDevice device, DeviceProps deviceProps)
+  ComposePass(VkDevice device,
+              DeviceProps deviceProps,
+              const PhysicalImage* texture = nullptr,
+              VirtualTexture* virtualTexture = nullptr)
     : device(device)
     , deviceProps(deviceProps)
+    , texture(texture)
+    , virtualTexture(virtualTexture)
   {
     SetOperation("img1", Operation::Sampled());
     SetOperation("img2", Operation::Sampled());
     SetOperation("finalImg", Operation::ColorOutputAttachment());
   }
 
-  void OnBakeDone() override
+  PipelineHandle CreatePipeline(const char* fragmentShader)
   {
-    auto img = graph->vis["finalImg"];
-    auto w = img->extent.width;
-    auto h = img->extent.height;
-
     PipelineState pipelineState = {};
     pipelineState.shader.stages[0].shaderName = "compose.vert.spv";
     pipelineState.shader.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
     pipelineState.shader.stageCount += 1;
 
-    pipelineState.shader.stages[1].shaderName = "compose.frag.spv";
+    pipelineState.shader.stages[1].shaderName = fragmentShader;
     pipelineState.shader.stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     pipelineState.shader.stageCount += 1;
 
-    // viewports / scissors depend on render pass (at least if you want to use
-    // the whole attachment region)
+    // viewports / scissors cover the render area and are set by the graph,
+    // so the pipeline survives a resize
 
-    pipelineState.viewport.viewports[0] = { 0.0f,     0.0f, (float)w,
-                                            (float)h, 0.0f, 1.0f };
-    pipelineState.viewport.viewportCount += 1;
-    pipelineState.viewport.scissors[0] = { { 0, 0 }, { w, h } };
-    pipelineState.viewport.scissorCount += 1;
+    SimplifiedDynamicState dynamicState = {};
+    dynamicState.Apply(&pipelineState);
 
     // one color blend attachments for each color output attachment in the
     // renderpass
@@ -184,9 +487,19 @@ struct ComposePass : Subpass
     vertexInputState.attributeFlagsCount += 1;
     vertexInputState.Apply(&pipelineState);
 
-    pipeline =
-      new Pipeline(device, pipelineState, renderPass->renderPass, subpass);
-    pipeline->Compile();
+    PipelineHandle handle =
+      graph->resources->pipelines.Add(Pipeline(device,
+                                               pipelineState,
+                                               renderPass->renderPass,
+                                               subpass,
+                                               graph->pipelineCache));
+    graph->GetPipeline(handle)->Compile();
+    return handle;
+  }
+
+  void OnBakeDone() override
+  {
+    pipeline = CreatePipeline("compose.frag.spv");
 
     // vertex buffer
     vbuffer.buf = vkuCreateBuffer(
@@ -195,7 +508,7 @@ struct ComposePass : Subpass
     vbuffer.mem = vkuAllocateBufferMemory(device,
                                           deviceProps.memProps,
                                           vbuffer.buf,
-                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                          VKU_MEMORY_USAGE_UPLOAD,
                                           true);
 
     vkMapMemory(device,
@@ -213,13 +526,25 @@ struct ComposePass : Subpass
       0.0f,  -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
       0.0f,  1.0f,  0.0f, 0.0f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
       0.0f,  1.0f,  0.0f, 0.0f, 1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f,
+
+      // the texture repeated 8 times in the bottom right corner
+      0.5f,  0.5f,  0.0f, 0.0f, 0.0f, 1.0f, 0.5f,  0.0f, 8.0f, 0.0f,
+      0.5f,  1.0f,  0.0f, 0.0f, 8.0f, 1.0f, 0.5f,  0.0f, 8.0f, 0.0f,
+      0.5f,  1.0f,  0.0f, 0.0f, 8.0f, 1.0f, 1.0f,  0.0f, 8.0f, 8.0f,
+
+      // the virtual texture in the bottom left corner
+      -1.0f, 0.5f,  0.0f, 0.0f, 0.0f, -0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
+      -1.0f, 1.0f,  0.0f, 0.0f, 1.0f, -0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
+      -1.0f, 1.0f,  0.0f, 0.0f, 1.0f, -0.5f, 1.0f, 0.0f, 1.0f, 1.0f,
     };
 
     memcpy(vbufferHostMemory, verts.data(), verts.size() * sizeof(float));
 
-    auto poolSize =
-      vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2);
-    auto poolCreateInfo = vkiDescriptorPoolCreateInfo(2, 1, &poolSize);
+    VkDescriptorPoolSize poolSizes[2] = {
+      vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4),
+      vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2),
+    };
+    auto poolCreateInfo = vkiDescriptorPoolCreateInfo(4, 2, poolSizes);
     vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool);
 
     for (uint32_t set = 0; set < 2; ++set) {
@@ -241,26 +566,137 @@ struct ComposePass : Subpass
                              VK_FALSE);
 
       vkCreateSampler(device, &samplerInfo, nullptr, &samplers[set]);
-      auto layout = pipeline->GetDescriptorSetLayout(0);
+      auto layout = graph->GetPipeline(pipeline)->GetDescriptorSetLayout(0);
       auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
       vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSets[set]);
     }
+
+    if (texture != nullptr) {
+      // trilinear over the whole chain
+      auto samplerInfo =
+        vkiSamplerCreateInfo(VK_FILTER_LINEAR,
+                             VK_FILTER_LINEAR,
+                             VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                             VK_SAMPLER_ADDRESS_MODE_REPEAT,
+                             VK_SAMPLER_ADDRESS_MODE_REPEAT,
+                             VK_SAMPLER_ADDRESS_MODE_REPEAT,
+                             0.f,
+                             VK_FALSE,
+                             0.f,
+                             VK_FALSE,
+                             VK_COMPARE_OP_NEVER,
+                             0.f,
+                             VK_LOD_CLAMP_NONE,
+                             VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+                             VK_FALSE);
+
+      vkCreateSampler(device, &samplerInfo, nullptr, &samplers[2]);
+      auto layout = graph->GetPipeline(pipeline)->GetDescriptorSetLayout(0);
+      auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
+      vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSets[2]);
+
+      // the texture outlives the pass, written once
+      auto imageInfo =
+        vkiDescriptorImageInfo(samplers[2],
+                               texture->view,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      auto descriptorWrite =
+        vkiWriteDescriptorSet(descriptorSets[2],
+                              0,
+                              0,
+                              1,
+                              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                              &imageInfo,
+                              nullptr,
+                              nullptr);
+      vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    if (virtualTexture != nullptr) {
+      bool sparse = virtualTexture->mode == VIRTUAL_TEXTURE_MODE_SPARSE;
+      virtualTexturePipeline =
+        CreatePipeline(sparse ? "virtual_texture_sparse.frag.spv"
+                              : "virtual_texture.frag.spv");
+
+      // texture coordinates are clamped by the shaders, the atlas has no
+      // mips
+      auto samplerInfo =
+        vkiSamplerCreateInfo(VK_FILTER_LINEAR,
+                             VK_FILTER_LINEAR,
+                             VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                             VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                             VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                             VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                             0.f,
+                             VK_FALSE,
+                             0.f,
+                             VK_FALSE,
+                             VK_COMPARE_OP_NEVER,
+                             0.f,
+                             VK_LOD_CLAMP_NONE,
+                             VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+                             VK_FALSE);
+
+      vkCreateSampler(device, &samplerInfo, nullptr, &samplers[3]);
+      auto layout =
+        graph->GetPipeline(virtualTexturePipeline)->GetDescriptorSetLayout(0);
+      auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
+      vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSets[3]);
+
+      // see virtual_texture.frag
+      auto imageInfo = vkiDescriptorImageInfo(samplers[3],
+                                              virtualTexture->image.view,
+                                              VK_IMAGE_LAYOUT_GENERAL);
+      VkDescriptorBufferInfo bufferInfos[2] = {
+        vkiDescriptorBufferInfo(virtualTexture->pageTable.buffer,
+                                0,
+                                VK_WHOLE_SIZE),
+        vkiDescriptorBufferInfo(virtualTexture->feedback.buffer,
+                                0,
+                                VK_WHOLE_SIZE),
+      };
+      VkWriteDescriptorSet descriptorWrites[2] = {
+        vkiWriteDescriptorSet(descriptorSets[3],
+                              0,
+                              0,
+                              1,
+                              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                              &imageInfo,
+                              nullptr,
+                              nullptr),
+        vkiWriteDescriptorSet(descriptorSets[3],
+                              1,
+                              0,
+                              2,
+                              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                              nullptr,
+                              bufferInfos,
+                              nullptr),
+      };
+      vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+    }
   }
 
+  // rewrites the descriptors whenever the images were replaced, e.g. by a
+  // resize
   void UpdateDescriptorSets()
   {
-    static bool updated = false;
+    const char* names[2] = { "img1", "img2" };
 
-    if (updated) {
-      return;
-    }
+    for (uint32_t set = 0; set < 2; ++set) {
+      if (graph->pis[names[set]] == boundImages[set]) {
+        continue;
+      }
+      if (!boundImages[set].IsNull()) {
+        graph->WaitForFramesInFlight();
+      }
+      boundImages[set] = graph->pis[names[set]];
 
-    PhysicalImage* pImages[2] = { graph->pis["img1"], graph->pis["img2"] };
+      PhysicalImage* image = graph->GetPhysicalImage(names[set]);
 
-    for (uint32_t set = 0; set < 2; ++set) {
       auto imageInfo =
         vkiDescriptorImageInfo(samplers[set],
-                               pImages[set]->view,
+                               image->view,
                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
       auto descriptorWrite =
@@ -275,31 +711,49 @@ struct ComposePass : Subpass
 
       vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
     }
-
-    updated = true;
   }
 
   VkDescriptorPool pool = VK_NULL_HANDLE;
 
-  VkDescriptorSet descriptorSets[2] = {};
-  VkSampler samplers[2] = {};
+  // img1, img2, texture and virtualTexture
+  VkDescriptorSet descriptorSets[4] = {};
+  VkSampler samplers[4] = {};
+  ImageHandle boundImages[2] = {};
 
   void RecordCmds(VkCommandBuffer cmdBuffer) override
   {
     UpdateDescriptorSets();
 
     VkDeviceSize vbufferOffset = 0;
-    pipeline->Bind(cmdBuffer);
+    Pipeline* compose = graph->GetPipeline(pipeline);
+    compose->Bind(cmdBuffer, &graph->dynamicState);
 
     vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vbuffer.buf, &vbufferOffset);
     for (uint32_t i = 0; i < 2; ++i) {
-      pipeline->BindDescriptorSets(
+      compose->BindDescriptorSets(
         cmdBuffer, 0, 1, &descriptorSets[i], 0, nullptr);
 
       for (uint32_t j = 0; j < 512; ++j) {
         vkCmdDraw(cmdBuffer, 6, 1, i * 6, 0);
       }
     }
+
+    if (texture != nullptr) {
+      compose->BindDescriptorSets(
+        cmdBuffer, 0, 1, &descriptorSets[2], 0, nullptr);
+      vkCmdDraw(cmdBuffer, 6, 1, 12, 0);
+    }
+
+    if (virtualTexture != nullptr) {
+      VirtualTextureInfo info = virtualTexture->GetInfo();
+      Pipeline* sample = graph->GetPipeline(virtualTexturePipeline);
+      sample->Bind(cmdBuffer, &graph->dynamicState);
+      sample->BindDescriptorSets(
+        cmdBuffer, 0, 1, &descriptorSets[3], 0, nullptr);
+      sample->PushConstants(
+        cmdBuffer, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(info), &info);
+      vkCmdDraw(cmdBuffer, 6, 1, 18, 0);
+    }
   }
 };
 
@@ -310,7 +764,68 @@ main()
   VulkanBase base(&window);
   Swapchain swapchain(base.device, base.deviceProps, base.surface);
 
+  // written by tools/packer.cpp, e.g.
+  //   packer assets.pak --teapot --spirv scene.vert.spv ...
+  // shaders missing from the pack are read from their .spv files
+  AssetPack pack = {};
+  if (pack.Open("assets.pak")) {
+    SetShaderPack(&pack);
+  } else {
+    std::cout << "WARNING: no assets.pak, shaders are read from .spv files"
+              << std::endl;
+  }
+
+  // a checkerboard with only level 0 on the host, UploadTexture generates
+  // the other mips on the GPU (mipmaps.h)
+  TextureData checker = {};
+  checker.desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+  checker.desc.width = 256;
+  checker.desc.height = 256;
+  checker.desc.mipCount = GetMipCount(checker.desc.width, checker.desc.height);
+  checker.desc.flags = PACK_TEXTURE_GENERATE_MIPS;
+  checker.Allocate();
+  uint8_t* texels = checker.GetLevelData(0);
+  for (uint32_t y = 0; y < checker.desc.height; ++y) {
+    for (uint32_t x = 0; x < checker.desc.width; ++x) {
+      uint8_t value = ((x / 16 + y / 16) & 1) != 0 ? 255 : 0;
+      memset(&texels[(y * checker.desc.width + x) * 4], value, 4);
+    }
+  }
+
+  PhysicalImage checkerImage = {};
+  bool hasChecker = UploadTexture(base.device,
+                                  base.deviceProps.handle,
+                                  base.deviceProps.memProps,
+                                  base.cmdPool,
+                                  base.queue,
+                                  checker,
+                                  checkerImage);
+  if (!hasChecker) {
+    std::cout << "WARNING: cannot generate the mips of the checkerboard"
+              << std::endl;
+  }
+
+  // the first virtual texture of the pack, see packer --virtual
+  VirtualTexture virtualTexture = {};
+  bool hasVirtualTexture = false;
+  for (uint32_t i = 0; pack.IsOpen() && i < pack.GetEntryCount(); ++i) {
+    const PackEntry& entry = pack.GetEntry(i);
+    if (entry.type == PACK_ENTRY_VIRTUAL_TEXTURE) {
+      hasVirtualTexture = virtualTexture.Create(base.deviceProps,
+                                                base.device,
+                                                &base.timeline,
+                                                &base.deletionQueue,
+                                                &pack,
+                                                pack.GetName(entry));
+      break;
+    }
+  }
+
   RenderGraph* graph = new RenderGraph;
+  graph->deletionQueue = &base.deletionQueue;
+  graph->resources = &base.resources;
+  graph->pipelineCache = &base.pipelineCache;
+  graph->imagelessFramebuffers = base.imagelessFramebuffer;
 
   VirtualImage* img1 = new VirtualImage;
   img1->extent = { swapchain.extent.width, swapchain.extent.height, 1 };
@@ -318,6 +833,7 @@ main()
   img1->samples = VK_SAMPLE_COUNT_1_BIT;
   img1->layers = 1;
   img1->levels = 1;
+  img1->swapchainSized = true;
   img1->subresourceRange = {
     vkuGetImageAspectFlags(img1->format), 0, img1->levels, 0, img1->layers
   };
@@ -330,18 +846,34 @@ main()
   img2->samples = VK_SAMPLE_COUNT_1_BIT;
   img2->layers = 1;
   img2->levels = 1;
+  img2->swapchainSized = true;
   img2->subresourceRange = {
     vkuGetImageAspectFlags(img2->format), 0, img2->levels, 0, img2->layers
   };
 
   graph->AddVirtualImage("img2", img2);
 
+  VirtualImage* depth = new VirtualImage;
+  depth->extent = { swapchain.extent.width, swapchain.extent.height, 1 };
+  depth->format = VK_FORMAT_D32_SFLOAT;
+  depth->samples = VK_SAMPLE_COUNT_1_BIT;
+  depth->layers = 1;
+  depth->levels = 1;
+  depth->swapchainSized = true;
+  depth->subresourceRange = {
+    vkuGetImageAspectFlags(depth->format), 0, depth->levels, 0, depth->layers
+  };
+  depth->clearValue.depthStencil = { 1.0f, 0 };
+
+  graph->AddVirtualImage("depth", depth);
+
   VirtualImage* finalImg = new VirtualImage;
   finalImg->extent = { swapchain.extent.width, swapchain.extent.height, 1 };
   finalImg->format = swapchain.format.format;
   finalImg->samples = VK_SAMPLE_COUNT_1_BIT;
   finalImg->layers = 1;
   finalImg->levels = 1;
+  finalImg->swapchainSized = true;
   finalImg->subresourceRange = { vkuGetImageAspectFlags(img2->format),
                                  0,
                                  finalImg->levels,
@@ -354,47 +886,126 @@ main()
 
   renderPass0->AddSubpass(
     new TextureSubpass(base.device, base.deviceProps, "img1", 0));
-  renderPass0->AddSubpass(
-    new TextureSubpass(base.device, base.deviceProps, "img2", 1));
+
+  // the teapots are culled on the GPU and drawn into img2, occlusion is
+  // tested against the Hi-Z pyramid of the previous frame
+  CullingPass* culling = new CullingPass(base.device,
+                                         base.deviceProps,
+                                         ScenePass::INSTANCE_COUNT,
+                                         "hiz",
+                                         ScenePass::MAX_LOD_COUNT);
+  ComputePass* cullPass = new ComputePass;
+  cullPass->AddSubpass(culling);
+
+  ScenePass* scene = new ScenePass(base.device, base.deviceProps, culling);
+  RenderPass* scenePass = new RenderPass;
+  scenePass->AddSubpass(scene);
 
   RenderPass* renderPass1 = new RenderPass;
-  renderPass1->AddSubpass(new ComposePass(base.device, base.deviceProps));
+  renderPass1->AddSubpass(
+    new ComposePass(base.device,
+                    base.deviceProps,
+                    hasChecker ? &checkerImage : nullptr,
+                    hasVirtualTexture ? &virtualTexture : nullptr));
 
   graph->AddRenderPass(renderPass0);
+  graph->AddRenderPass(cullPass);
+  graph->AddRenderPass(scenePass);
+  AddHiZPasses(graph, base.device, base.deviceProps, "depth", "hiz");
   graph->AddRenderPass(renderPass1);
 
   graph->Bake(base.device);
 
-  graph->pis["img1"] = graph->vis["img1"]->CreatePhysicalImage(
-    base.device, base.deviceProps.memProps);
-  graph->pis["img2"] = graph->vis["img2"]->CreatePhysicalImage(
-    base.device, base.deviceProps.memProps);
-
-  swapchain.CreatePhysicalSwapchain(graph->vis["finalImg"]->usage);
+  graph->CreatePhysicalImage(base.device, base.deviceProps.memProps, "img1");
+  graph->CreatePhysicalImage(base.device, base.deviceProps.memProps, "img2");
+  graph->CreatePhysicalImage(base.device, base.deviceProps.memProps, "depth");
+  graph->CreatePhysicalImage(base.device, base.deviceProps.memProps, "hiz");
+
+  swapchain.CreatePhysicalSwapchain(graph->vis["finalImg"]->usage,
+                                    &base.resources);
+
+  // streams the teapot of the pack, the scene draws the generated one until
+  // it is resident
+  AssetStreamer streamer = {};
+  AssetHandle teapot = {};
+  if (pack.IsOpen()) {
+    streamer.Create(base.deviceProps.handle,
+                    base.device,
+                    base.deviceProps.memProps,
+                    &base.timeline,
+                    &base.deletionQueue,
+                    &pack);
+    teapot = streamer.Request("teapot");
+  }
 
+  uint32_t frameCount = 0;
+  float cameraAngle = 0.0f;
   while (true) {
+    window.Update();
+
+    if (window.windowSize.updated || swapchain.outOfDate) {
+      VkExtent2D extent = window.GetExtent();
+      if (extent.width == 0 || extent.height == 0) {
+        continue; // minimized
+      }
+
+      // only size dependent images and framebuffers are recreated
+      for (auto image : swapchain.images) {
+        graph->ReleaseViews(image);
+      }
+      swapchain.Resize(extent, base.deletionQueue);
+      graph->Resize(base.device, base.deviceProps.memProps, swapchain.extent);
+
+      // recording creates new framebuffers and views again
+      frameCount = 0;
+    }
+
     VkDevice device = base.device;
     auto cmdBuffer = base.NextCmdBuffer();
-    VkQueue queue = base.queue;
     VkSemaphore imageAvailableSemaphore = base.imageAvailableSemaphore;
     VkSemaphore renderFinishedSemaphore = base.renderFinishedSemaphore;
 
     graph->pis["finalImg"] =
       swapchain.AcquireImage(base.imageAvailableSemaphore);
+    if (graph->pis["finalImg"].IsNull()) {
+      continue; // out of date, resized in the next iteration
+    }
+
+    scene->UpdateCamera(swapchain.extent, cameraAngle);
+    cameraAngle += 0.002f;
 
     VkCommandBufferBeginInfo beginInfo = vkiCommandBufferBeginInfo(nullptr);
     ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmdBuffer.cmdBuffer, &beginInfo));
 
-    graph->RecordCmds(device, cmdBuffer.cmdBuffer);
+    if (pack.IsOpen()) {
+      streamer.Update(cmdBuffer.cmdBuffer);
+      scene->UseStreamedTeapot(streamer.GetResident(teapot), pack);
+    }
+    if (hasVirtualTexture) {
+      virtualTexture.Update(cmdBuffer.cmdBuffer);
+    }
+
+    {
+      // steady state once every frame in flight has been recorded once
+      NoHeapAllocationScope noHeapAllocations(frameCount >=
+                                              base.MAX_FRAMES_IN_FLIGHT);
+      graph->RecordCmds(device, cmdBuffer.cmdBuffer, base.GetArena());
+    }
+
+    if (hasVirtualTexture) {
+      virtualTexture.RecordFeedback(cmdBuffer.cmdBuffer);
+    }
+
+    PhysicalImage* finalImage = graph->GetPhysicalImage("finalImg");
 
     auto barrier =
       vkiImageMemoryBarrier(0,
                             0,
-                            graph->imageRanges["finalImg"].back().op.layout,
+                            finalImage->GetState(0).layout,
                             VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
                             VK_QUEUE_FAMILY_IGNORED,
                             -1,
-                            graph->pis["finalImg"]->image,
+                            finalImage->image,
                             graph->vis["finalImg"]->subresourceRange);
 
     vkCmdPipelineBarrier(cmdBuffer.cmdBuffer,
@@ -410,22 +1021,18 @@ main()
 
     ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmdBuffer.cmdBuffer));
 
-    VkPipelineStageFlags waitStage =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-    VkSubmitInfo submitInfo = vkiSubmitInfo(1,
-                                            &imageAvailableSemaphore,
-                                            &waitStage,
-                                            1,
-                                            &cmdBuffer.cmdBuffer,
-                                            1,
-                                            &renderFinishedSemaphore);
+    finalImage->SetState(graph->vis["finalImg"]->subresourceRange,
+                         { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                           0,
+                           VK_IMAGE_LAYOUT_PRESENT_SRC_KHR });
 
-    graph->pis["finalImg"]->layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    graph->pis["finalImg"]->stageFlags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    graph->pis["finalImg"]->accessFlags = 0;
-
-    ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, cmdBuffer.fence));
+    base.Submit(cmdBuffer,
+                imageAvailableSemaphore,
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                renderFinishedSemaphore);
     swapchain.Present(base.queue, base.renderFinishedSemaphore);
+
+    MemoryTelemetry::Get().EndFrame();
+    ++frameCount;
   }
 }
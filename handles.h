@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vk_utils.h"
+
+// Typed 32 bit handle: slot index in the low bits, generation of the slot in
+// the high bits. Releasing a slot bumps its generation, so stale handles are
+// detected in O(1) and never alias the resource that reuses the slot. Value 0
+// is never valid.
+template<typename Tag>
+struct Handle
+{
+  static const uint32_t INDEX_BITS = 20;
+  static const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+  static const uint32_t GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+
+  uint32_t value = 0;
+
+  uint32_t GetIndex() const { return value & INDEX_MASK; }
+  uint32_t GetGeneration() const { return value >> INDEX_BITS; }
+  bool IsNull() const { return value == 0; }
+
+  bool operator==(const Handle& other) const { return value == other.value; }
+  bool operator!=(const Handle& other) const { return value != other.value; }
+  bool operator<(const Handle& other) const { return value < other.value; }
+};
+
+// Resources stored by value in a contiguous slot array, addressed by
+// generational handles. Pointers returned by Get are valid until the next Add.
+template<typename T, typename Tag = T>
+struct HandlePool
+{
+  typedef Handle<Tag> HandleType;
+
+  HandleType Add(const T& item)
+  {
+    uint32_t index = 0;
+    if (freeSlots.size() > 0) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+      slots[index] = item;
+    } else {
+      index = static_cast<uint32_t>(slots.size());
+      ASSERT_TRUE(index <= HandleType::INDEX_MASK);
+      slots.push_back(item);
+      generations.push_back(1);
+    }
+
+    HandleType handle;
+    handle.value = (generations[index] << HandleType::INDEX_BITS) | index;
+    return handle;
+  }
+
+  bool IsValid(HandleType handle) const
+  {
+    return !handle.IsNull() && handle.GetIndex() < slots.size() &&
+           generations[handle.GetIndex()] == handle.GetGeneration();
+  }
+
+  // nullptr for stale handles
+  T* Get(HandleType handle)
+  {
+    return IsValid(handle) ? &slots[handle.GetIndex()] : nullptr;
+  }
+
+  void Remove(HandleType handle)
+  {
+    ASSERT_TRUE(IsValid(handle));
+
+    uint32_t index = handle.GetIndex();
+    slots[index] = T{};
+
+    // generation 0 is skipped, so a handle value is never 0
+    generations[index] = (generations[index] + 1) & HandleType::GENERATION_MASK;
+    if (generations[index] == 0) {
+      generations[index] = 1;
+    }
+
+    freeSlots.push_back(index);
+  }
+
+  uint32_t GetCount() const
+  {
+    return static_cast<uint32_t>(slots.size() - freeSlots.size());
+  }
+
+  std::vector<T> slots = {};
+  std::vector<uint32_t> generations = {};
+  std::vector<uint32_t> freeSlots = {};
+};
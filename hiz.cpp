@@ -0,0 +1,217 @@
+#include "hiz.h"
+
+#include <algorithm>
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+HiZPass::HiZPass(VkDevice device,
+                 DeviceProps deviceProps,
+                 const char* depthName,
+                 const char* pyramidName,
+                 uint32_t level)
+  : device(device)
+  , deviceProps(deviceProps)
+  , depthName(depthName)
+  , pyramidName(pyramidName)
+  , level(level)
+{
+  const VkPipelineStageFlags stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+  if (level == 0) {
+    SetOperation(depthName, Operation::Sampled(stage));
+  } else {
+    AddOperation(pyramidName,
+                 Operation::Sampled(stage).ForMipLevels(level - 1, 1));
+  }
+
+  AddOperation(pyramidName, Operation::Storage(stage).ForMipLevels(level, 1));
+}
+
+void
+HiZPass::OnBakeDone()
+{
+  PipelineState::ShaderState::ShaderStage stage = {};
+  stage.shaderName = "hiz.comp.spv";
+  stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkBool32 fromDepth = level == 0;
+  memcpy(stage.specialization.data, &fromDepth, sizeof(fromDepth));
+  stage.specialization.dataSize = sizeof(VkBool32);
+  stage.specialization.mapEntries[0].constantID = 0;
+  stage.specialization.mapEntries[0].offset = 0;
+  stage.specialization.mapEntries[0].size = sizeof(VkBool32);
+  stage.specialization.mapEntryCount += 1;
+
+  pipeline = graph->resources->computePipelines.Add(
+    ComputePipeline(device, stage, graph->pipelineCache));
+  graph->GetComputePipeline(pipeline)->Compile();
+
+  VkDescriptorPoolSize poolSizes[] = {
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1),
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),
+  };
+  auto poolCreateInfo = vkiDescriptorPoolCreateInfo(1, 2, poolSizes);
+  ASSERT_VK_SUCCESS(
+    vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool));
+
+  auto layout = graph->GetComputePipeline(pipeline)->GetDescriptorSetLayout(0);
+  auto allocateInfo = vkiDescriptorSetAllocateInfo(pool, 1, &layout);
+  ASSERT_VK_SUCCESS(
+    vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet));
+
+  auto samplerInfo =
+    vkiSamplerCreateInfo(VK_FILTER_NEAREST,
+                         VK_FILTER_NEAREST,
+                         VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                         0.f,
+                         VK_FALSE,
+                         0.f,
+                         VK_FALSE,
+                         VK_COMPARE_OP_NEVER,
+                         0.f,
+                         0.f,
+                         VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+                         VK_FALSE);
+  ASSERT_VK_SUCCESS(vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+}
+
+void
+HiZPass::UpdateDescriptorSet()
+{
+  const char* srcName = level == 0 ? depthName : pyramidName;
+
+  if (graph->pis[srcName] == boundSrc && graph->pis[pyramidName] == boundDst) {
+    return;
+  }
+
+  if (!boundDst.IsNull()) {
+    graph->WaitForFramesInFlight();
+  }
+
+  PhysicalImage* src = graph->GetPhysicalImage(srcName);
+  PhysicalImage* dst = graph->GetPhysicalImage(pyramidName);
+
+  const VkComponentMapping identity = { VK_COMPONENT_SWIZZLE_IDENTITY,
+                                        VK_COMPONENT_SWIZZLE_IDENTITY,
+                                        VK_COMPONENT_SWIZZLE_IDENTITY,
+                                        VK_COMPONENT_SWIZZLE_IDENTITY };
+
+  // frames in flight might still use the old views
+  graph->deletionQueue->Push(VK_OBJECT_TYPE_IMAGE_VIEW, ToHandle64(srcView));
+  graph->deletionQueue->Push(VK_OBJECT_TYPE_IMAGE_VIEW, ToHandle64(dstView));
+
+  if (level == 0) {
+    auto vi = graph->vis[depthName];
+    auto range = vi->subresourceRange;
+    range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    range.levelCount = 1;
+
+    auto createInfo = vkiImageViewCreateInfo(
+      src->image, VK_IMAGE_VIEW_TYPE_2D, vi->format, identity, range);
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &createInfo, nullptr, &srcView));
+  } else {
+    auto createInfo = vkiImageViewCreateInfo(
+      src->image,
+      VK_IMAGE_VIEW_TYPE_2D,
+      FORMAT,
+      identity,
+      { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 1, 0, 1 });
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &createInfo, nullptr, &srcView));
+  }
+
+  {
+    auto createInfo =
+      vkiImageViewCreateInfo(dst->image,
+                             VK_IMAGE_VIEW_TYPE_2D,
+                             FORMAT,
+                             identity,
+                             { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 });
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &createInfo, nullptr, &dstView));
+  }
+
+  auto srcInfo = vkiDescriptorImageInfo(
+    sampler, srcView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  auto dstInfo =
+    vkiDescriptorImageInfo(VK_NULL_HANDLE, dstView, VK_IMAGE_LAYOUT_GENERAL);
+
+  VkWriteDescriptorSet descriptorWrites[] = {
+    vkiWriteDescriptorSet(descriptorSet,
+                          0,
+                          0,
+                          1,
+                          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                          &srcInfo,
+                          nullptr,
+                          nullptr),
+    vkiWriteDescriptorSet(descriptorSet,
+                          1,
+                          0,
+                          1,
+                          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                          &dstInfo,
+                          nullptr,
+                          nullptr),
+  };
+  vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+
+  boundSrc = graph->pis[srcName];
+  boundDst = graph->pis[pyramidName];
+}
+
+void
+HiZPass::RecordCmds(VkCommandBuffer cmdBuffer)
+{
+  UpdateDescriptorSet();
+
+  auto vi = graph->vis[pyramidName];
+  uint32_t w = std::max(1u, vi->extent.width >> level);
+  uint32_t h = std::max(1u, vi->extent.height >> level);
+
+  ComputePipeline* reduce = graph->GetComputePipeline(pipeline);
+  reduce->Bind(cmdBuffer);
+  reduce->BindDescriptorSets(cmdBuffer, 0, 1, &descriptorSet, 0, nullptr);
+  vkCmdDispatch(cmdBuffer,
+                (w + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                (h + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                1);
+}
+
+void
+AddHiZPasses(RenderGraph* graph,
+             VkDevice device,
+             DeviceProps deviceProps,
+             const char* depthName,
+             const char* pyramidName)
+{
+  auto depth = graph->vis[depthName];
+
+  VirtualImage* pyramid = new VirtualImage;
+  pyramid->extent = { depth->extent.width, depth->extent.height, 1 };
+  pyramid->format = HiZPass::FORMAT;
+  pyramid->samples = VK_SAMPLE_COUNT_1_BIT;
+  pyramid->layers = 1;
+  pyramid->levels = 1;
+  while ((std::max(pyramid->extent.width, pyramid->extent.height) >>
+          pyramid->levels) > 0) {
+    pyramid->levels += 1;
+  }
+  pyramid->subresourceRange = {
+    VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramid->levels, 0, pyramid->layers
+  };
+
+  graph->AddVirtualImage(pyramidName, pyramid);
+
+  for (uint32_t level = 0; level < pyramid->levels; ++level) {
+    ComputePass* computePass = new ComputePass;
+    computePass->AddSubpass(
+      new HiZPass(device, deviceProps, depthName, pyramidName, level));
+    graph->AddRenderPass(computePass);
+  }
+}
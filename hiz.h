@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+#include "pipeline.h"
+#include "rendergraph.h"
+
+// Reduces one level of a hierarchical depth (Hi-Z) pyramid. Level 0 is a copy
+// of the depth image, every further level holds the minimum (r) and maximum
+// (g) depth of the 2x2 (3x3 at odd edges) texels of the level above.
+//
+// Each level is its own compute pass, so the graph synchronizes the pyramid
+// per mip level with events instead of full image barriers.
+struct HiZPass : Subpass
+{
+  static const VkFormat FORMAT = VK_FORMAT_R32G32_SFLOAT;
+  static const uint32_t WORKGROUP_SIZE = 8;
+
+  HiZPass(VkDevice device,
+          DeviceProps deviceProps,
+          const char* depthName,
+          const char* pyramidName,
+          uint32_t level);
+
+  void OnBakeDone() override;
+  void RecordCmds(VkCommandBuffer cmdBuffer) override;
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceProps deviceProps = {};
+
+  const char* depthName = nullptr;
+  const char* pyramidName = nullptr;
+  uint32_t level = 0;
+
+  ComputePipelineHandle pipeline = {};
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  // views of single mip levels, (re)created when the physical images change
+  ImageHandle boundSrc = {};
+  ImageHandle boundDst = {};
+  VkImageView srcView = VK_NULL_HANDLE;
+  VkImageView dstView = VK_NULL_HANDLE;
+
+private:
+  void UpdateDescriptorSet();
+};
+
+// Adds the pyramid image for the depth image depthName to the graph and one
+// compute pass per pyramid level. Call after the render passes writing the
+// depth image have been added and before baking. The pyramid keeps the
+// extent the depth image has now, also when that is resized.
+void
+AddHiZPasses(RenderGraph* graph,
+             VkDevice device,
+             DeviceProps deviceProps,
+             const char* depthName,
+             const char* pyramidName);
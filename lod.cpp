@@ -0,0 +1,351 @@
+#include "lod.h"
+
+#include <algorithm> // sort, max
+#include <cmath>     // sqrt, tan
+#include <unordered_map>
+
+#include <glm\glm.hpp>
+
+#include "vk_utils.h"
+
+namespace {
+
+// symmetric 4x4 matrix, the sum of squared distances to a set of planes;
+// weight counts the planes
+struct Quadric
+{
+  static Quadric FromPlane(const glm::dvec3& n, double d)
+  {
+    Quadric q = {};
+    q.a00 = n.x * n.x;
+    q.a01 = n.x * n.y;
+    q.a02 = n.x * n.z;
+    q.a03 = n.x * d;
+    q.a11 = n.y * n.y;
+    q.a12 = n.y * n.z;
+    q.a13 = n.y * d;
+    q.a22 = n.z * n.z;
+    q.a23 = n.z * d;
+    q.a33 = d * d;
+    q.weight = 1.0;
+    return q;
+  }
+
+  void operator+=(const Quadric& o)
+  {
+    a00 += o.a00;
+    a01 += o.a01;
+    a02 += o.a02;
+    a03 += o.a03;
+    a11 += o.a11;
+    a12 += o.a12;
+    a13 += o.a13;
+    a22 += o.a22;
+    a23 += o.a23;
+    a33 += o.a33;
+    weight += o.weight;
+  }
+
+  // mean squared distance of p to the planes
+  double Evaluate(const glm::dvec3& p) const
+  {
+    if (weight <= 0.0) {
+      return 0.0;
+    }
+
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z +
+               2.0 * a03 * x + a11 * y * y + 2.0 * a12 * y * z +
+               2.0 * a13 * y + a22 * z * z + 2.0 * a23 * z + a33;
+    // rounding can push it slightly below 0
+    return e > 0.0 ? e / weight : 0.0;
+  }
+
+  double a00 = 0.0, a01 = 0.0, a02 = 0.0, a03 = 0.0;
+  double a11 = 0.0, a12 = 0.0, a13 = 0.0;
+  double a22 = 0.0, a23 = 0.0;
+  double a33 = 0.0;
+  double weight = 0.0;
+};
+
+struct Collapse
+{
+  uint32_t from = 0;
+  uint32_t to = 0;
+  double cost = 0.0;
+};
+
+glm::dvec3
+GetPosition(const Mesh& mesh, uint32_t vertex)
+{
+  const float* p = &mesh.vertices[vertex * mesh.vertexStride];
+  return glm::dvec3(p[0], p[1], p[2]);
+}
+
+uint64_t
+GetEdgeKey(uint32_t a, uint32_t b)
+{
+  return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+} // namespace
+
+std::vector<uint32_t>
+SimplifyMesh(const Mesh& mesh,
+             const uint32_t* indices,
+             uint32_t indexCount,
+             uint32_t targetIndexCount,
+             float maxError,
+             float* error)
+{
+  uint32_t vertexCount = mesh.GetVertexCount();
+  std::vector<uint32_t> result(indices, indices + indexCount);
+
+  // plane quadrics of the triangles around each vertex, not area weighted so
+  // the cost stays a squared distance
+  std::vector<Quadric> quadrics(vertexCount);
+  std::unordered_map<uint64_t, uint32_t> edgeCounts;
+  edgeCounts.reserve(indexCount);
+
+  for (uint32_t i = 0; i < indexCount; i += 3) {
+    const uint32_t* corners = &indices[i];
+    glm::dvec3 a = GetPosition(mesh, corners[0]);
+    glm::dvec3 n = glm::cross(GetPosition(mesh, corners[1]) - a,
+                              GetPosition(mesh, corners[2]) - a);
+    double length = glm::length(n);
+    if (length > 0.0) {
+      n /= length;
+      Quadric q = Quadric::FromPlane(n, -glm::dot(n, a));
+      for (uint32_t k = 0; k < 3; ++k) {
+        quadrics[corners[k]] += q;
+      }
+    }
+
+    for (uint32_t k = 0; k < 3; ++k) {
+      edgeCounts[GetEdgeKey(corners[k], corners[(k + 1) % 3])] += 1;
+    }
+  }
+
+  // border and non-manifold edges pin their vertices
+  std::vector<bool> locked(vertexCount, false);
+  for (auto const& edge : edgeCounts) {
+    if (edge.second != 2) {
+      locked[static_cast<uint32_t>(edge.first >> 32)] = true;
+      locked[static_cast<uint32_t>(edge.first)] = true;
+    }
+  }
+
+  double maxCost = static_cast<double>(maxError) * maxError;
+  double resultCost = 0.0;
+
+  std::vector<Collapse> collapses;
+  std::vector<uint32_t> adjacencyOffsets;
+  std::vector<uint32_t> adjacency;
+  std::vector<bool> touched(vertexCount, false);
+  std::vector<uint32_t> remap(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    remap[v] = v;
+  }
+
+  // every pass collapses a set of independent edges, cheapest first
+  while (result.size() > targetIndexCount) {
+    uint32_t triangleCount = static_cast<uint32_t>(result.size() / 3);
+
+    collapses.clear();
+    for (uint32_t i = 0; i < result.size(); i += 3) {
+      for (uint32_t k = 0; k < 3; ++k) {
+        uint32_t a = result[i + k];
+        uint32_t b = result[i + (k + 1) % 3];
+        // interior edges show up once in each direction
+        if (a > b || (locked[a] && locked[b])) {
+          continue;
+        }
+
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+
+        Collapse collapse = {};
+        collapse.cost = DBL_MAX;
+        if (!locked[a]) {
+          collapse = { a, b, q.Evaluate(GetPosition(mesh, b)) };
+        }
+        if (!locked[b]) {
+          double cost = q.Evaluate(GetPosition(mesh, a));
+          if (cost < collapse.cost) {
+            collapse = { b, a, cost };
+          }
+        }
+        collapses.push_back(collapse);
+      }
+    }
+
+    std::sort(collapses.begin(),
+              collapses.end(),
+              [](const Collapse& a, const Collapse& b) {
+                return a.cost < b.cost;
+              });
+
+    // triangles around each vertex
+    adjacencyOffsets.assign(vertexCount + 1, 0);
+    for (auto index : result) {
+      adjacencyOffsets[index + 1] += 1;
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    adjacency.resize(result.size());
+    {
+      std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                                 adjacencyOffsets.end() - 1);
+      for (uint32_t t = 0; t < triangleCount; ++t) {
+        for (uint32_t k = 0; k < 3; ++k) {
+          adjacency[fill[result[t * 3 + k]]++] = t;
+        }
+      }
+    }
+
+    // a collapse usually removes two triangles
+    size_t collapseBudget = (result.size() - targetIndexCount) / 6 + 1;
+    size_t collapseCount = 0;
+    std::fill(touched.begin(), touched.end(), false);
+
+    for (auto const& collapse : collapses) {
+      if (collapseCount >= collapseBudget || collapse.cost > maxCost) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to]) {
+        continue;
+      }
+
+      // moving from onto to must not flip the remaining triangles
+      glm::dvec3 target = GetPosition(mesh, collapse.to);
+      bool flips = false;
+      for (uint32_t j = adjacencyOffsets[collapse.from];
+           j < adjacencyOffsets[collapse.from + 1] && !flips;
+           ++j) {
+        const uint32_t* corners = &result[adjacency[j] * 3];
+        if (corners[0] == collapse.to || corners[1] == collapse.to ||
+            corners[2] == collapse.to) {
+          continue;
+        }
+
+        glm::dvec3 p[3];
+        glm::dvec3 q[3];
+        for (uint32_t k = 0; k < 3; ++k) {
+          p[k] = GetPosition(mesh, corners[k]);
+          q[k] = corners[k] == collapse.from ? target : p[k];
+        }
+        glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        flips = glm::dot(before, after) <= 0.0;
+      }
+      if (flips) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      resultCost = std::max(resultCost, collapse.cost);
+      collapseCount += 1;
+
+      // the neighbourhood changed, leave it to the next pass
+      for (uint32_t v : { collapse.from, collapse.to }) {
+        for (uint32_t j = adjacencyOffsets[v]; j < adjacencyOffsets[v + 1];
+             ++j) {
+          const uint32_t* corners = &result[adjacency[j] * 3];
+          touched[corners[0]] = true;
+          touched[corners[1]] = true;
+          touched[corners[2]] = true;
+        }
+      }
+    }
+
+    if (collapseCount == 0) {
+      break;
+    }
+
+    // drop the triangles that became degenerate
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = remap[result[i + 0]];
+      uint32_t b = remap[result[i + 1]];
+      uint32_t c = remap[result[i + 2]];
+      if (a != b && b != c && a != c) {
+        result[write++] = a;
+        result[write++] = b;
+        result[write++] = c;
+      }
+    }
+    result.resize(write);
+
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      remap[v] = v;
+    }
+  }
+
+  if (error != nullptr) {
+    *error = static_cast<float>(sqrt(resultCost));
+  }
+  return result;
+}
+
+void
+GenerateLods(Mesh& mesh, uint32_t maxLodCount, float reduction, float maxError)
+{
+  ASSERT_TRUE(mesh.lods.size() == 0);
+
+  uint32_t baseIndexCount = static_cast<uint32_t>(mesh.indices.size());
+  mesh.lods.push_back({ 0, baseIndexCount, 0.0f });
+
+  for (uint32_t lod = 1; lod < maxLodCount; ++lod) {
+    uint32_t previousIndexCount = mesh.lods.back().indexCount;
+    uint32_t targetIndexCount =
+      static_cast<uint32_t>(previousIndexCount / 3 * reduction) * 3;
+
+    // always from the full mesh, so the errors do not accumulate
+    float error = 0.0f;
+    std::vector<uint32_t> indices = SimplifyMesh(mesh,
+                                                 mesh.indices.data(),
+                                                 baseIndexCount,
+                                                 targetIndexCount,
+                                                 maxError,
+                                                 &error);
+    if (indices.size() > previousIndexCount * 0.9f) {
+      break;
+    }
+    OptimizeVertexCache(indices, mesh.GetVertexCount());
+
+    MeshLod meshLod = {};
+    meshLod.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+    meshLod.indexCount = static_cast<uint32_t>(indices.size());
+    // the selection needs the errors to grow with the level
+    meshLod.error = std::max(error, mesh.lods.back().error);
+
+    mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+    mesh.lods.push_back(meshLod);
+  }
+}
+
+float
+GetLodScale(float viewportHeight, float fovY, float pixelThreshold)
+{
+  // pixels per unit at distance 1
+  float projectionScale = viewportHeight / (2.0f * tanf(fovY * 0.5f));
+  return projectionScale / pixelThreshold;
+}
+
+uint32_t
+SelectLod(const std::vector<MeshLod>& lods,
+          float distance,
+          float errorScale,
+          float lodScale)
+{
+  uint32_t selected = 0;
+  for (uint32_t i = 1; i < lods.size(); ++i) {
+    if (lods[i].error * errorScale * lodScale > distance) {
+      break;
+    }
+    selected = i;
+  }
+  return selected;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cfloat> // FLT_MAX
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+// Quadric error metric simplification (Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics"), restricted to collapsing
+// vertices onto their neighbours so every level keeps using the vertex
+// buffer of the full mesh. Vertices on borders stay in place, this includes
+// the seams where the mesh has split vertices for differing attributes.
+//
+// Returns at most targetIndexCount indices unless the next collapse would
+// exceed maxError or none is left. error receives the deviation of the
+// worst collapse in object space units, the root mean square distance to
+// the planes of the original triangles that merged into its vertex.
+std::vector<uint32_t>
+SimplifyMesh(const Mesh& mesh,
+             const uint32_t* indices,
+             uint32_t indexCount,
+             uint32_t targetIndexCount,
+             float maxError = FLT_MAX,
+             float* error = nullptr);
+
+// Fills mesh.lods with the full mesh and up to maxLodCount - 1 coarser
+// levels, each with reduction times the triangles of the previous one, and
+// appends their indices to mesh.indices. Stops early once a level saves less
+// than a tenth of the triangles.
+void
+GenerateLods(Mesh& mesh,
+             uint32_t maxLodCount = 4,
+             float reduction = 0.5f,
+             float maxError = FLT_MAX);
+
+// Converts an error tolerance in pixels into the scale SelectLod expects,
+// fovY is the vertical field of view in radians.
+float
+GetLodScale(float viewportHeight, float fovY, float pixelThreshold);
+
+// Coarsest level whose error projects to at most the tolerated pixels at the
+// given distance between the camera and the bounding sphere (0 inside).
+// errorScale is the object to world scale.
+uint32_t
+SelectLod(const std::vector<MeshLod>& lods,
+          float distance,
+          float errorScale,
+          float lodScale);
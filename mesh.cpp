@@ -0,0 +1,466 @@
+#include "mesh.h"
+
+#include <algorithm> // stable_sort, min
+#include <chrono>
+#include <cmath>   // pow
+#include <cstring> // memcpy
+#include <iostream>
+
+#include <glm\glm.hpp>
+
+#include "vk_utils.h"
+
+namespace {
+
+const uint32_t FORSYTH_CACHE_SIZE = 32;
+
+glm::vec3
+GetPosition(const Mesh& mesh, uint32_t vertex)
+{
+  const float* p = &mesh.vertices[vertex * mesh.vertexStride];
+  return glm::vec3(p[0], p[1], p[2]);
+}
+
+float
+GetVertexScore(int32_t cachePosition, uint32_t remainingTriangles)
+{
+  if (remainingTriangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    // the last triangle's vertices get a fixed score so its neighbours do
+    // not win just by sharing one of them
+    if (cachePosition < 3) {
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+      score = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+    }
+  }
+
+  // prefer vertices with few triangles left, they leave the cache for good
+  score += 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+  return score;
+}
+
+// -0.0f and 0.0f have to weld
+uint32_t
+HashFloat(float f)
+{
+  f += 0.0f;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+bool
+IsWeldedFloat(uint32_t i, int32_t normalOffset)
+{
+  return normalOffset < 0 || i < static_cast<uint32_t>(normalOffset) ||
+         i >= static_cast<uint32_t>(normalOffset) + 3;
+}
+
+} // namespace
+
+MeshStats
+AnalyzeMesh(const Mesh& mesh, uint32_t cacheSize)
+{
+  MeshStats stats = {};
+
+  uint32_t vertexCount = mesh.GetVertexCount();
+  uint32_t vertexBytes = mesh.vertexStride * sizeof(float);
+
+  if (mesh.indices.size() == 0) {
+    // every corner is its own vertex
+    uint32_t triangleCount = vertexCount / 3;
+    if (triangleCount > 0) {
+      stats.acmr = 3.0f;
+      stats.atvr = 1.0f;
+      stats.bytesPerTriangle = 3.0f * vertexBytes;
+    }
+    return stats;
+  }
+
+  // FIFO cache, a vertex is cached while less than cacheSize misses happened
+  // since it was transformed
+  std::vector<uint32_t> timestamps(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  uint32_t misses = 0;
+  for (auto index : mesh.indices) {
+    if (time - timestamps[index] > cacheSize) {
+      timestamps[index] = time++;
+      misses += 1;
+    }
+  }
+
+  uint32_t indexBytes = vertexCount <= 65536 ? 2 : 4;
+  uint32_t triangleCount = mesh.GetTriangleCount();
+
+  stats.acmr = static_cast<float>(misses) / triangleCount;
+  stats.atvr = static_cast<float>(misses) / vertexCount;
+  stats.bytesPerTriangle =
+    static_cast<float>(vertexCount * vertexBytes +
+                       mesh.indices.size() * indexBytes) /
+    triangleCount;
+  return stats;
+}
+
+Mesh
+WeldVertices(const float* vertices,
+             uint32_t vertexCount,
+             uint32_t vertexStride,
+             int32_t normalOffset)
+{
+  Mesh mesh = {};
+  mesh.vertexStride = vertexStride;
+  mesh.indices.reserve(vertexCount);
+
+  auto hash = [&](const float* v) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < vertexStride; ++i) {
+      if (IsWeldedFloat(i, normalOffset)) {
+        h = (h ^ HashFloat(v[i])) * 16777619u;
+      }
+    }
+    return h;
+  };
+  auto equal = [&](const float* a, const float* b) {
+    for (uint32_t i = 0; i < vertexStride; ++i) {
+      if (IsWeldedFloat(i, normalOffset) && a[i] != b[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // open addressing into the welded vertices, at most half full
+  uint32_t tableSize = 1;
+  while (tableSize < vertexCount * 2) {
+    tableSize *= 2;
+  }
+  std::vector<uint32_t> table(tableSize, UINT32_MAX);
+
+  for (uint32_t i = 0; i < vertexCount; ++i) {
+    const float* vertex = vertices + i * vertexStride;
+
+    uint32_t slot = hash(vertex) & (tableSize - 1);
+    while (table[slot] != UINT32_MAX &&
+           !equal(&mesh.vertices[table[slot] * vertexStride], vertex)) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+
+    if (table[slot] == UINT32_MAX) {
+      table[slot] = mesh.GetVertexCount();
+      mesh.vertices.insert(
+        mesh.vertices.end(), vertex, vertex + vertexStride);
+    }
+    mesh.indices.push_back(table[slot]);
+  }
+
+  return mesh;
+}
+
+void
+ComputeSmoothNormals(Mesh& mesh, uint32_t normalOffset)
+{
+  ASSERT_TRUE(normalOffset + 3 <= mesh.vertexStride);
+
+  uint32_t vertexCount = mesh.GetVertexCount();
+  std::vector<glm::vec3> normals(vertexCount, glm::vec3(0.0f));
+
+  for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+    uint32_t a = mesh.indices[i + 0];
+    uint32_t b = mesh.indices[i + 1];
+    uint32_t c = mesh.indices[i + 2];
+
+    // the length of the cross product is twice the area
+    glm::vec3 pa = GetPosition(mesh, a);
+    glm::vec3 n =
+      glm::cross(GetPosition(mesh, b) - pa, GetPosition(mesh, c) - pa);
+    normals[a] += n;
+    normals[b] += n;
+    normals[c] += n;
+  }
+
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    float length = glm::length(normals[v]);
+    glm::vec3 n = length > 0.0f ? normals[v] / length : glm::vec3(0.0f);
+
+    float* dst = &mesh.vertices[v * mesh.vertexStride + normalOffset];
+    dst[0] = n.x;
+    dst[1] = n.y;
+    dst[2] = n.z;
+  }
+}
+
+void
+OptimizeVertexCache(Mesh& mesh)
+{
+  OptimizeVertexCache(mesh.indices, mesh.GetVertexCount());
+}
+
+void
+OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount)
+{
+  uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+  // triangles of every vertex, the first remainingTriangles[v] entries are
+  // not emitted yet
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (auto index : indices) {
+    adjacencyOffsets[index + 1] += 1;
+  }
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+  }
+
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+  for (uint32_t t = 0; t < triangleCount; ++t) {
+    for (uint32_t k = 0; k < 3; ++k) {
+      uint32_t v = indices[t * 3 + k];
+      adjacency[adjacencyOffsets[v] + remainingTriangles[v]++] = t;
+    }
+  }
+
+  std::vector<int32_t> cachePositions(vertexCount, -1);
+  std::vector<float> vertexScores(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    vertexScores[v] = GetVertexScore(-1, remainingTriangles[v]);
+  }
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+
+  uint32_t cache[FORSYTH_CACHE_SIZE + 3] = {};
+  uint32_t cacheCount = 0;
+  uint32_t scanCursor = 0;
+  int64_t best = -1;
+
+  while (result.size() < indices.size()) {
+    if (best < 0) {
+      // nothing in the cache has triangles left, continue with the next
+      // triangle in the original order
+      while (emitted[scanCursor]) {
+        ++scanCursor;
+      }
+      best = scanCursor;
+    }
+
+    uint32_t triangle = static_cast<uint32_t>(best);
+    const uint32_t* corners = &indices[triangle * 3];
+    emitted[triangle] = true;
+    result.insert(result.end(), corners, corners + 3);
+
+    for (uint32_t k = 0; k < 3; ++k) {
+      uint32_t v = corners[k];
+      uint32_t* begin = adjacency.data() + adjacencyOffsets[v];
+      uint32_t* end = begin + remainingTriangles[v];
+      uint32_t* it = std::find(begin, end, triangle);
+      if (it != end) {
+        *it = *(end - 1);
+        remainingTriangles[v] -= 1;
+      }
+    }
+
+    // the triangle's vertices move to the front, the rest shifts back
+    uint32_t newCache[FORSYTH_CACHE_SIZE + 3] = {};
+    uint32_t newCacheCount = 0;
+    for (uint32_t k = 0; k < 3; ++k) {
+      uint32_t* newCacheEnd = newCache + newCacheCount;
+      if (std::find(newCache, newCacheEnd, corners[k]) == newCacheEnd) {
+        newCache[newCacheCount++] = corners[k];
+      }
+    }
+    for (uint32_t i = 0; i < cacheCount; ++i) {
+      uint32_t v = cache[i];
+      if (v != corners[0] && v != corners[1] && v != corners[2]) {
+        newCache[newCacheCount++] = v;
+      }
+    }
+
+    for (uint32_t i = 0; i < newCacheCount; ++i) {
+      uint32_t v = newCache[i];
+      cachePositions[v] =
+        i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+      vertexScores[v] =
+        GetVertexScore(cachePositions[v], remainingTriangles[v]);
+    }
+
+    // only triangles touching the cache changed their score
+    best = -1;
+    float bestScore = -1.0f;
+    for (uint32_t i = 0; i < newCacheCount; ++i) {
+      uint32_t v = newCache[i];
+      for (uint32_t j = 0; j < remainingTriangles[v]; ++j) {
+        uint32_t t = adjacency[adjacencyOffsets[v] + j];
+        float score = vertexScores[indices[t * 3 + 0]] +
+                      vertexScores[indices[t * 3 + 1]] +
+                      vertexScores[indices[t * 3 + 2]];
+        if (score > bestScore) {
+          bestScore = score;
+          best = t;
+        }
+      }
+    }
+
+    cacheCount = std::min(newCacheCount, FORSYTH_CACHE_SIZE);
+    std::copy(newCache, newCache + cacheCount, cache);
+  }
+
+  indices = std::move(result);
+}
+
+void
+OptimizeOverdraw(Mesh& mesh, uint32_t cacheSize)
+{
+  uint32_t vertexCount = mesh.GetVertexCount();
+  uint32_t triangleCount = mesh.GetTriangleCount();
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // a cluster starts with every triangle that misses the cache with all of
+  // its vertices, reordering clusters then keeps the ACMR
+  std::vector<uint32_t> clusterStarts;
+  std::vector<uint32_t> timestamps(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  for (uint32_t t = 0; t < triangleCount; ++t) {
+    uint32_t misses = 0;
+    for (uint32_t k = 0; k < 3; ++k) {
+      uint32_t v = mesh.indices[t * 3 + k];
+      if (time - timestamps[v] > cacheSize) {
+        timestamps[v] = time++;
+        misses += 1;
+      }
+    }
+    if (t == 0 || misses == 3) {
+      clusterStarts.push_back(t);
+    }
+  }
+  clusterStarts.push_back(triangleCount);
+
+  glm::vec3 meshCentroid(0.0f);
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    meshCentroid += GetPosition(mesh, v);
+  }
+  meshCentroid /= static_cast<float>(vertexCount);
+
+  struct Cluster
+  {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    float sortKey = 0.0f;
+  };
+
+  std::vector<Cluster> clusters(clusterStarts.size() - 1);
+  for (size_t c = 0; c < clusters.size(); ++c) {
+    Cluster& cluster = clusters[c];
+    cluster.first = clusterStarts[c];
+    cluster.count = clusterStarts[c + 1] - clusterStarts[c];
+
+    glm::vec3 centroid(0.0f);
+    glm::vec3 normal(0.0f);
+    float area = 0.0f;
+    for (uint32_t t = cluster.first; t < cluster.first + cluster.count; ++t) {
+      glm::vec3 a = GetPosition(mesh, mesh.indices[t * 3 + 0]);
+      glm::vec3 b = GetPosition(mesh, mesh.indices[t * 3 + 1]);
+      glm::vec3 c = GetPosition(mesh, mesh.indices[t * 3 + 2]);
+
+      glm::vec3 n = glm::cross(b - a, c - a);
+      float triangleArea = glm::length(n);
+      centroid += (a + b + c) * (triangleArea / 3.0f);
+      normal += n;
+      area += triangleArea;
+    }
+    if (area > 0.0f) {
+      centroid /= area;
+    }
+
+    // clusters facing away from the center occlude the ones facing inward
+    float length = glm::length(normal);
+    if (length > 0.0f) {
+      cluster.sortKey = glm::dot(centroid - meshCentroid, normal / length);
+    }
+  }
+
+  std::stable_sort(
+    clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+      return a.sortKey > b.sortKey;
+    });
+
+  std::vector<uint32_t> result;
+  result.reserve(mesh.indices.size());
+  for (auto const& cluster : clusters) {
+    auto first = mesh.indices.begin() + cluster.first * 3;
+    result.insert(result.end(), first, first + cluster.count * 3);
+  }
+  mesh.indices = std::move(result);
+}
+
+void
+OptimizeVertexFetch(Mesh& mesh)
+{
+  uint32_t vertexCount = mesh.GetVertexCount();
+  std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+  std::vector<float> vertices;
+  vertices.reserve(mesh.vertices.size());
+
+  uint32_t nextVertex = 0;
+  for (auto& index : mesh.indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = nextVertex++;
+      auto first = mesh.vertices.begin() + index * mesh.vertexStride;
+      vertices.insert(vertices.end(), first, first + mesh.vertexStride);
+    }
+    index = remap[index];
+  }
+
+  // unreferenced vertices are dropped
+  mesh.vertices = std::move(vertices);
+}
+
+void
+MeshOptimizationReport::Print(const char* name) const
+{
+  std::cout << "INFO: mesh " << name << ": ACMR " << before.acmr << " -> "
+            << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+            << ", bytes per triangle " << before.bytesPerTriangle << " -> "
+            << after.bytesPerTriangle << ", " << seconds * 1000.0 << " ms"
+            << std::endl;
+}
+
+Mesh
+OptimizeMesh(const float* vertices,
+             uint32_t vertexCount,
+             uint32_t vertexStride,
+             int32_t normalOffset,
+             MeshOptimizationReport* report)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  Mesh mesh = WeldVertices(vertices, vertexCount, vertexStride, normalOffset);
+  if (normalOffset >= 0) {
+    ComputeSmoothNormals(mesh, normalOffset);
+  }
+  OptimizeVertexCache(mesh);
+  OptimizeOverdraw(mesh);
+  OptimizeVertexFetch(mesh);
+
+  if (report != nullptr) {
+    report->seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+    Mesh soup = {};
+    soup.vertices.assign(vertices, vertices + vertexCount * vertexStride);
+    soup.vertexStride = vertexStride;
+    report->before = AnalyzeMesh(soup);
+    report->after = AnalyzeMesh(mesh);
+  }
+
+  return mesh;
+}
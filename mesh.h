@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Index range of one level of detail, all levels share the vertices.
+struct MeshLod
+{
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  // deviation from the full mesh in object space units, grows with the level
+  float error = 0.0f;
+};
+
+// Indexed triangle list with interleaved float vertices, every vertex starts
+// with its position.
+struct Mesh
+{
+  uint32_t GetVertexCount() const
+  {
+    return static_cast<uint32_t>(vertices.size() / vertexStride);
+  }
+  uint32_t GetTriangleCount() const
+  {
+    return static_cast<uint32_t>(indices.size() / 3);
+  }
+
+  std::vector<float> vertices = {};
+  std::vector<uint32_t> indices = {};
+  uint32_t vertexStride = 0; // in floats
+
+  // Empty until GenerateLods (lod.h) appends the coarser levels to indices,
+  // the functions here then see all levels as one triangle list, i.e. run
+  // them before.
+  std::vector<MeshLod> lods = {};
+};
+
+// Vertex shader invocations and memory of a mesh, an empty index buffer is a
+// non-indexed triangle list.
+struct MeshStats
+{
+  float acmr = 0.0f; // average cache miss ratio, transformed vertices per tri
+  float atvr = 0.0f; // average transformed vertex ratio, per unique vertex
+  float bytesPerTriangle = 0.0f; // vertices plus 16 or 32 bit indices
+};
+
+MeshStats
+AnalyzeMesh(const Mesh& mesh, uint32_t cacheSize = 16);
+
+// Merges bit-identical vertices. The floats at normalOffset are ignored when
+// it is not negative, so faces meet at their shared positions for
+// ComputeSmoothNormals.
+Mesh
+WeldVertices(const float* vertices,
+             uint32_t vertexCount,
+             uint32_t vertexStride,
+             int32_t normalOffset = -1);
+
+// area weighted average of the face normals around each vertex
+void
+ComputeSmoothNormals(Mesh& mesh, uint32_t normalOffset);
+
+// Reorders triangles for the post-transform vertex cache (Forsyth, "Linear-
+// Speed Vertex Cache Optimisation").
+void
+OptimizeVertexCache(Mesh& mesh);
+void
+OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount);
+
+// Splits the vertex cache ordered triangles into clusters where the cache
+// restarts and draws outward facing clusters first (Sander et al., "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw"). Keeps the
+// cache efficiency within the clusters.
+void
+OptimizeOverdraw(Mesh& mesh, uint32_t cacheSize = 16);
+
+// Reorders vertices by their first use in the index buffer.
+void
+OptimizeVertexFetch(Mesh& mesh);
+
+struct MeshOptimizationReport
+{
+  MeshStats before = {};
+  MeshStats after = {};
+  double seconds = 0.0;
+
+  void Print(const char* name) const;
+};
+
+// Runs the whole pipeline on a non-indexed triangle list: weld, optional
+// smooth normals (normalOffset not negative), vertex cache, overdraw and
+// vertex fetch. Offline tools call it once and store the result, at runtime
+// it is cheap enough for procedural meshes.
+Mesh
+OptimizeMesh(const float* vertices,
+             uint32_t vertexCount,
+             uint32_t vertexStride,
+             int32_t normalOffset = -1,
+             MeshOptimizationReport* report = nullptr);
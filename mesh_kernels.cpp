@@ -0,0 +1,582 @@
+#include "mesh_kernels.h"
+
+#include <algorithm> // min, max
+#include <cmath>     // acos, sqrt
+#include <thread>
+#include <vector>
+
+#include <glm\glm.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||           \
+  defined(__i386__)
+#define MESH_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts AVX2 intrinsics in any function and the path is picked at
+// runtime, other compilers only get it when the whole file targets AVX2
+#if defined(MESH_KERNELS_X86) && (defined(_MSC_VER) || defined(__AVX2__))
+#define MESH_KERNELS_AVX2
+#endif
+
+namespace {
+
+// Runs fn(begin, end) over chunks of [0, count) on all cores. The threads
+// are started for every call, there is no pool to keep them around, so this
+// is meant for offline and load time work, see mesh_kernels.h.
+template<typename F>
+void
+ParallelFor(uint32_t count, uint32_t chunkSize, F fn)
+{
+  uint32_t chunkCount = (count + chunkSize - 1) / chunkSize;
+  uint32_t threadCount = std::min(
+    chunkCount, std::max(std::thread::hardware_concurrency(), 1u));
+
+  if (threadCount <= 1) {
+    fn(0u, count);
+    return;
+  }
+
+  // chunks are interleaved over the threads, the calling thread takes the
+  // first share
+  auto work = [&](uint32_t thread) {
+    for (uint32_t chunk = thread; chunk < chunkCount; chunk += threadCount) {
+      uint32_t begin = chunk * chunkSize;
+      fn(begin, std::min(begin + chunkSize, count));
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for (uint32_t thread = 1; thread < threadCount; ++thread) {
+    threads.emplace_back(work, thread);
+  }
+  work(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// The kernels are written once against these lane types.
+struct ScalarOps
+{
+  typedef float V;
+  static const uint32_t WIDTH = 1;
+
+  static V Set(float f) { return f; }
+  static V Load(const float* p) { return *p; }
+  static void Store(float* p, V v) { *p = v; }
+  static V Gather(const float* base, const uint32_t* indices)
+  {
+    return base[indices[0]];
+  }
+
+  static V Add(V a, V b) { return a + b; }
+  static V Sub(V a, V b) { return a - b; }
+  static V Mul(V a, V b) { return a * b; }
+  static V Div(V a, V b) { return a / b; }
+  static V Max(V a, V b) { return a > b ? a : b; }
+  static V Sqrt(V a) { return sqrtf(a); }
+  // -1 if a < 0, 1 otherwise (including -0 and NaN)
+  static V Sign(V a) { return a < 0.0f ? -1.0f : 1.0f; }
+};
+
+#ifdef MESH_KERNELS_X86
+struct SseOps
+{
+  typedef __m128 V;
+  static const uint32_t WIDTH = 4;
+
+  static V Set(float f) { return _mm_set1_ps(f); }
+  static V Load(const float* p) { return _mm_loadu_ps(p); }
+  static void Store(float* p, V v) { _mm_storeu_ps(p, v); }
+  static V Gather(const float* base, const uint32_t* indices)
+  {
+    return _mm_setr_ps(base[indices[0]],
+                       base[indices[1]],
+                       base[indices[2]],
+                       base[indices[3]]);
+  }
+
+  static V Add(V a, V b) { return _mm_add_ps(a, b); }
+  static V Sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V Mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V Div(V a, V b) { return _mm_div_ps(a, b); }
+  static V Max(V a, V b) { return _mm_max_ps(a, b); }
+  static V Sqrt(V a) { return _mm_sqrt_ps(a); }
+  // as ScalarOps::Sign, the comparison keeps -0 positive
+  static V Sign(V a)
+  {
+    V negative = _mm_cmplt_ps(a, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(negative, _mm_set1_ps(-0.0f)),
+                     _mm_set1_ps(1.0f));
+  }
+};
+
+#endif
+
+#ifdef MESH_KERNELS_AVX2
+struct Avx2Ops
+{
+  typedef __m256 V;
+  static const uint32_t WIDTH = 8;
+
+  static V Set(float f) { return _mm256_set1_ps(f); }
+  static V Load(const float* p) { return _mm256_loadu_ps(p); }
+  static void Store(float* p, V v) { _mm256_storeu_ps(p, v); }
+  static V Gather(const float* base, const uint32_t* indices)
+  {
+    __m256i offsets =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices));
+    return _mm256_i32gather_ps(base, offsets, sizeof(float));
+  }
+
+  static V Add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V Div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V Max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V Sqrt(V a) { return _mm256_sqrt_ps(a); }
+  // as ScalarOps::Sign, the comparison keeps -0 positive
+  static V Sign(V a)
+  {
+    V negative = _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ);
+    return _mm256_or_ps(_mm256_and_ps(negative, _mm256_set1_ps(-0.0f)),
+                        _mm256_set1_ps(1.0f));
+  }
+};
+#endif
+
+// Vertex indices of corner k of WIDTH triangles starting at first.
+template<typename Ops>
+void
+GetCornerIndices(const uint32_t* indices,
+                 uint32_t first,
+                 uint32_t k,
+                 uint32_t* corners)
+{
+  for (uint32_t lane = 0; lane < Ops::WIDTH; ++lane) {
+    uint32_t corner = (first + lane) * 3 + k;
+    corners[lane] = indices != nullptr ? indices[corner] : corner;
+  }
+}
+
+template<typename Ops>
+struct Vec3
+{
+  typedef typename Ops::V V;
+
+  static Vec3 Gather(const SoaVec3& v, const uint32_t* indices)
+  {
+    return { Ops::Gather(v.x, indices),
+             Ops::Gather(v.y, indices),
+             Ops::Gather(v.z, indices) };
+  }
+
+  Vec3 operator-(const Vec3& o) const
+  {
+    return { Ops::Sub(x, o.x), Ops::Sub(y, o.y), Ops::Sub(z, o.z) };
+  }
+
+  Vec3 operator*(V s) const
+  {
+    return { Ops::Mul(x, s), Ops::Mul(y, s), Ops::Mul(z, s) };
+  }
+
+  Vec3 Cross(const Vec3& o) const
+  {
+    return { Ops::Sub(Ops::Mul(y, o.z), Ops::Mul(z, o.y)),
+             Ops::Sub(Ops::Mul(z, o.x), Ops::Mul(x, o.z)),
+             Ops::Sub(Ops::Mul(x, o.y), Ops::Mul(y, o.x)) };
+  }
+
+  // zero vectors stay zero
+  Vec3 Normalize() const
+  {
+    V lengthSq =
+      Ops::Add(Ops::Add(Ops::Mul(x, x), Ops::Mul(y, y)), Ops::Mul(z, z));
+    V length = Ops::Max(Ops::Sqrt(lengthSq), Ops::Set(1e-30f));
+    return *this * Ops::Div(Ops::Set(1.0f), length);
+  }
+
+  void Store(const SoaVec3& v, uint32_t i) const
+  {
+    Ops::Store(v.x + i, x);
+    Ops::Store(v.y + i, y);
+    Ops::Store(v.z + i, z);
+  }
+
+  V x, y, z;
+};
+
+template<typename Ops>
+void
+FaceNormalsKernel(const SoaVec3& positions,
+                  const uint32_t* indices,
+                  uint32_t begin,
+                  uint32_t end,
+                  const SoaVec3& faceNormals,
+                  bool normalize)
+{
+  uint32_t t = begin;
+  for (; t + Ops::WIDTH <= end; t += Ops::WIDTH) {
+    uint32_t corners[3][Ops::WIDTH];
+    for (uint32_t k = 0; k < 3; ++k) {
+      GetCornerIndices<Ops>(indices, t, k, corners[k]);
+    }
+
+    auto a = Vec3<Ops>::Gather(positions, corners[0]);
+    auto b = Vec3<Ops>::Gather(positions, corners[1]);
+    auto c = Vec3<Ops>::Gather(positions, corners[2]);
+
+    auto n = (b - a).Cross(c - a);
+    if (normalize) {
+      n = n.Normalize();
+    }
+    n.Store(faceNormals, t);
+  }
+
+  if (t < end) {
+    FaceNormalsKernel<ScalarOps>(
+      positions, indices, t, end, faceNormals, normalize);
+  }
+}
+
+template<typename Ops>
+void
+NormalizeKernel(const SoaVec3& v, uint32_t begin, uint32_t end)
+{
+  uint32_t i = begin;
+  for (; i + Ops::WIDTH <= end; i += Ops::WIDTH) {
+    Vec3<Ops> n = { Ops::Load(v.x + i),
+                    Ops::Load(v.y + i),
+                    Ops::Load(v.z + i) };
+    n.Normalize().Store(v, i);
+  }
+
+  if (i < end) {
+    NormalizeKernel<ScalarOps>(v, i, end);
+  }
+}
+
+// Unnormalized texture space directions of each triangle, MikkTSpace's
+// vOs and vOt: the UV derivative directions scaled by the sign of the UV
+// area instead of divided by it, so degenerate UVs do not blow up.
+template<typename Ops>
+void
+FaceTangentsKernel(const SoaVec3& positions,
+                   const SoaVec2& uvs,
+                   const uint32_t* indices,
+                   uint32_t begin,
+                   uint32_t end,
+                   const SoaVec3& faceTangents,
+                   const SoaVec3& faceBitangents)
+{
+  typedef typename Ops::V V;
+
+  uint32_t t = begin;
+  for (; t + Ops::WIDTH <= end; t += Ops::WIDTH) {
+    uint32_t corners[3][Ops::WIDTH];
+    for (uint32_t k = 0; k < 3; ++k) {
+      GetCornerIndices<Ops>(indices, t, k, corners[k]);
+    }
+
+    auto p0 = Vec3<Ops>::Gather(positions, corners[0]);
+    auto d1 = Vec3<Ops>::Gather(positions, corners[1]) - p0;
+    auto d2 = Vec3<Ops>::Gather(positions, corners[2]) - p0;
+
+    V u0 = Ops::Gather(uvs.x, corners[0]);
+    V v0 = Ops::Gather(uvs.y, corners[0]);
+    V du1 = Ops::Sub(Ops::Gather(uvs.x, corners[1]), u0);
+    V dv1 = Ops::Sub(Ops::Gather(uvs.y, corners[1]), v0);
+    V du2 = Ops::Sub(Ops::Gather(uvs.x, corners[2]), u0);
+    V dv2 = Ops::Sub(Ops::Gather(uvs.y, corners[2]), v0);
+
+    V sign = Ops::Sign(Ops::Sub(Ops::Mul(du1, dv2), Ops::Mul(du2, dv1)));
+
+    auto s = (d1 * dv2 - d2 * dv1) * sign;
+    auto b = (d2 * du1 - d1 * du2) * sign;
+    s.Store(faceTangents, t);
+    b.Store(faceBitangents, t);
+  }
+
+  if (t < end) {
+    FaceTangentsKernel<ScalarOps>(
+      positions, uvs, indices, t, end, faceTangents, faceBitangents);
+  }
+}
+
+SimdLevel
+DetectSimdLevel()
+{
+#ifdef MESH_KERNELS_X86
+#ifdef _MSC_VER
+  int info[4] = {};
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+
+  bool avx2 = false;
+  if (maxLeaf >= 7 && osxsave && avx) {
+    // the OS has to save the ymm registers
+    bool ymmState = (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    avx2 = ymmState && (info[1] & (1 << 5)) != 0;
+  }
+#elif defined(MESH_KERNELS_AVX2)
+  bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#else
+  bool avx2 = false;
+#endif
+  // SSE2 is part of every x64 CPU and the default of the x86 compilers
+  return avx2 ? SIMD_AVX2 : SIMD_SSE;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+SimdLevel
+GetSimdLevel(const MeshKernelOptions& options)
+{
+  return std::min(options.simdLevel, GetSupportedSimdLevel());
+}
+
+// Corners around every vertex into scratch.offsets and scratch.corners,
+// corner / 3 is the triangle.
+void
+GetVertexCorners(const uint32_t* indices,
+                 uint32_t vertexCount,
+                 uint32_t triangleCount,
+                 MeshKernelScratch& scratch)
+{
+  auto& offsets = scratch.offsets;
+  auto& corners = scratch.corners;
+  offsets.assign(vertexCount + 1, 0);
+  corners.resize(triangleCount * 3);
+
+  uint32_t cornerCount = triangleCount * 3;
+  for (uint32_t c = 0; c < cornerCount; ++c) {
+    offsets[(indices != nullptr ? indices[c] : c) + 1] += 1;
+  }
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    offsets[v + 1] += offsets[v];
+  }
+
+  scratch.fill.assign(offsets.begin(), offsets.end() - 1);
+  for (uint32_t c = 0; c < cornerCount; ++c) {
+    corners[scratch.fill[indices != nullptr ? indices[c] : c]++] = c;
+  }
+}
+
+glm::vec3
+Load(const SoaVec3& v, uint32_t i)
+{
+  return glm::vec3(v.x[i], v.y[i], v.z[i]);
+}
+
+} // namespace
+
+SimdLevel
+GetSupportedSimdLevel()
+{
+  static const SimdLevel level = DetectSimdLevel();
+  return level;
+}
+
+void
+ComputeFaceNormals(const SoaVec3& positions,
+                   const uint32_t* indices,
+                   uint32_t triangleCount,
+                   const SoaVec3& faceNormals,
+                   bool normalize,
+                   const MeshKernelOptions& options)
+{
+  SimdLevel level = GetSimdLevel(options);
+
+  ParallelFor(triangleCount, options.chunkSize, [&](uint32_t b, uint32_t e) {
+    switch (level) {
+#ifdef MESH_KERNELS_AVX2
+      case SIMD_AVX2:
+        FaceNormalsKernel<Avx2Ops>(
+          positions, indices, b, e, faceNormals, normalize);
+        break;
+#endif
+#ifdef MESH_KERNELS_X86
+      case SIMD_SSE:
+        FaceNormalsKernel<SseOps>(
+          positions, indices, b, e, faceNormals, normalize);
+        break;
+#endif
+      default:
+        FaceNormalsKernel<ScalarOps>(
+          positions, indices, b, e, faceNormals, normalize);
+        break;
+    }
+  });
+}
+
+void
+ComputeVertexNormals(const SoaVec3& positions,
+                     uint32_t vertexCount,
+                     const uint32_t* indices,
+                     uint32_t triangleCount,
+                     const SoaVec3& normals,
+                     MeshKernelScratch& scratch,
+                     const MeshKernelOptions& options)
+{
+  std::vector<float>& faceData = scratch.faceData;
+  faceData.resize(triangleCount * 3);
+  SoaVec3 faceNormals = { faceData.data(),
+                          faceData.data() + triangleCount,
+                          faceData.data() + triangleCount * 2 };
+  ComputeFaceNormals(
+    positions, indices, triangleCount, faceNormals, false, options);
+
+  // gathering per vertex instead of scattering per triangle keeps the
+  // chunks free of write conflicts
+  GetVertexCorners(indices, vertexCount, triangleCount, scratch);
+  const auto& offsets = scratch.offsets;
+  const auto& corners = scratch.corners;
+  SimdLevel level = GetSimdLevel(options);
+
+  ParallelFor(vertexCount, options.chunkSize, [&](uint32_t b, uint32_t e) {
+    for (uint32_t v = b; v < e; ++v) {
+      glm::vec3 sum(0.0f);
+      for (uint32_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+        sum += Load(faceNormals, corners[i] / 3);
+      }
+      normals.x[v] = sum.x;
+      normals.y[v] = sum.y;
+      normals.z[v] = sum.z;
+    }
+
+    switch (level) {
+#ifdef MESH_KERNELS_AVX2
+      case SIMD_AVX2:
+        NormalizeKernel<Avx2Ops>(normals, b, e);
+        break;
+#endif
+#ifdef MESH_KERNELS_X86
+      case SIMD_SSE:
+        NormalizeKernel<SseOps>(normals, b, e);
+        break;
+#endif
+      default:
+        NormalizeKernel<ScalarOps>(normals, b, e);
+        break;
+    }
+  });
+}
+
+void
+ComputeTangents(const SoaVec3& positions,
+                const SoaVec3& normals,
+                const SoaVec2& uvs,
+                uint32_t vertexCount,
+                const uint32_t* indices,
+                uint32_t triangleCount,
+                const SoaVec4& tangents,
+                MeshKernelScratch& scratch,
+                const MeshKernelOptions& options)
+{
+  std::vector<float>& faceData = scratch.faceData;
+  faceData.resize(triangleCount * 6);
+  SoaVec3 faceTangents = { faceData.data(),
+                           faceData.data() + triangleCount,
+                           faceData.data() + triangleCount * 2 };
+  SoaVec3 faceBitangents = { faceData.data() + triangleCount * 3,
+                             faceData.data() + triangleCount * 4,
+                             faceData.data() + triangleCount * 5 };
+  SimdLevel level = GetSimdLevel(options);
+
+  ParallelFor(triangleCount, options.chunkSize, [&](uint32_t b, uint32_t e) {
+    switch (level) {
+#ifdef MESH_KERNELS_AVX2
+      case SIMD_AVX2:
+        FaceTangentsKernel<Avx2Ops>(
+          positions, uvs, indices, b, e, faceTangents, faceBitangents);
+        break;
+#endif
+#ifdef MESH_KERNELS_X86
+      case SIMD_SSE:
+        FaceTangentsKernel<SseOps>(
+          positions, uvs, indices, b, e, faceTangents, faceBitangents);
+        break;
+#endif
+      default:
+        FaceTangentsKernel<ScalarOps>(
+          positions, uvs, indices, b, e, faceTangents, faceBitangents);
+        break;
+    }
+  });
+
+  GetVertexCorners(indices, vertexCount, triangleCount, scratch);
+  const auto& offsets = scratch.offsets;
+  const auto& corners = scratch.corners;
+
+  auto vertexOf = [indices](uint32_t corner) {
+    return indices != nullptr ? indices[corner] : corner;
+  };
+
+  ParallelFor(vertexCount, options.chunkSize, [&](uint32_t b, uint32_t e) {
+    for (uint32_t v = b; v < e; ++v) {
+      glm::vec3 n = Load(normals, v);
+      glm::vec3 p = Load(positions, v);
+
+      glm::vec3 tangent(0.0f);
+      glm::vec3 bitangent(0.0f);
+      for (uint32_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+        uint32_t corner = corners[i];
+        uint32_t triangle = corner / 3;
+        uint32_t first = triangle * 3;
+
+        // angle between the edges at the corner, in the normal's plane
+        glm::vec3 e0 =
+          Load(positions, vertexOf(first + (corner - first + 1) % 3)) - p;
+        glm::vec3 e1 =
+          Load(positions, vertexOf(first + (corner - first + 2) % 3)) - p;
+        e0 -= n * glm::dot(n, e0);
+        e1 -= n * glm::dot(n, e1);
+        float lengths = glm::length(e0) * glm::length(e1);
+        if (lengths <= 0.0f) {
+          continue;
+        }
+        float angle =
+          acosf(glm::clamp(glm::dot(e0, e1) / lengths, -1.0f, 1.0f));
+
+        glm::vec3 s = Load(faceTangents, triangle);
+        glm::vec3 t = Load(faceBitangents, triangle);
+        s -= n * glm::dot(n, s);
+        t -= n * glm::dot(n, t);
+        if (glm::dot(s, s) > 0.0f) {
+          tangent += glm::normalize(s) * angle;
+        }
+        if (glm::dot(t, t) > 0.0f) {
+          bitangent += glm::normalize(t) * angle;
+        }
+      }
+
+      tangent -= n * glm::dot(n, tangent);
+      if (glm::dot(tangent, tangent) > 0.0f) {
+        tangent = glm::normalize(tangent);
+      } else {
+        // no UV gradient, any direction in the plane will do
+        glm::vec3 axis = fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                           : glm::vec3(0.0f, 1.0f, 0.0f);
+        tangent = glm::normalize(axis - n * glm::dot(n, axis));
+      }
+
+      tangents.x[v] = tangent.x;
+      tangents.y[v] = tangent.y;
+      tangents.z[v] = tangent.z;
+      tangents.w[v] =
+        glm::dot(glm::cross(n, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+    }
+  });
+}
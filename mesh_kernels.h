@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Structure of arrays views for the normal and tangent kernels, every
+// component points to count floats owned by the caller. The kernels never
+// allocate their outputs, size them before the call.
+//
+// The kernels start and join their worker threads in every call, which is
+// fine for tools and loading but too slow for per-frame use.
+struct SoaVec2
+{
+  float* x = nullptr;
+  float* y = nullptr;
+};
+
+struct SoaVec3
+{
+  float* x = nullptr;
+  float* y = nullptr;
+  float* z = nullptr;
+};
+
+struct SoaVec4
+{
+  float* x = nullptr;
+  float* y = nullptr;
+  float* z = nullptr;
+  float* w = nullptr;
+};
+
+enum SimdLevel
+{
+  SIMD_SCALAR = 0,
+  SIMD_SSE,  // 4 lanes, SSE2
+  SIMD_AVX2, // 8 lanes, gathers
+};
+
+// best level of the CPU, detected once
+SimdLevel
+GetSupportedSimdLevel();
+
+struct MeshKernelOptions
+{
+  // clamped to GetSupportedSimdLevel, lower it to compare the paths
+  SimdLevel simdLevel = SIMD_AVX2;
+  // triangles or vertices per job, chunks run in parallel on all cores
+  uint32_t chunkSize = 16 * 1024;
+};
+
+// Temporaries of ComputeVertexNormals and ComputeTangents. Keep one around
+// for a batch of meshes, it stops allocating once it fits the largest.
+struct MeshKernelScratch
+{
+  std::vector<float> faceData = {};
+  // corners around every vertex (offsets per vertex into corners)
+  std::vector<uint32_t> offsets = {};
+  std::vector<uint32_t> corners = {};
+  std::vector<uint32_t> fill = {};
+};
+
+// One normal per triangle, unit length if normalize is set and twice the
+// triangle area long otherwise. indices holds 3 vertices per triangle,
+// nullptr for non-indexed triangle lists.
+void
+ComputeFaceNormals(const SoaVec3& positions,
+                   const uint32_t* indices,
+                   uint32_t triangleCount,
+                   const SoaVec3& faceNormals,
+                   bool normalize = true,
+                   const MeshKernelOptions& options = {});
+
+// Area weighted average of the face normals around each vertex.
+void
+ComputeVertexNormals(const SoaVec3& positions,
+                     uint32_t vertexCount,
+                     const uint32_t* indices,
+                     uint32_t triangleCount,
+                     const SoaVec3& normals,
+                     MeshKernelScratch& scratch,
+                     const MeshKernelOptions& options = {});
+
+// Per vertex tangents in the MikkTSpace convention: the face tangents are
+// projected into the plane of the vertex normal, weighted by the corner
+// angle and w holds the bitangent sign, bitangent = w * cross(n, t.xyz).
+// Matches MikkTSpace for meshes whose vertices are already split at UV
+// seams and hard edges.
+void
+ComputeTangents(const SoaVec3& positions,
+                const SoaVec3& normals,
+                const SoaVec2& uvs,
+                uint32_t vertexCount,
+                const uint32_t* indices,
+                uint32_t triangleCount,
+                const SoaVec4& tangents,
+                MeshKernelScratch& scratch,
+                const MeshKernelOptions& options = {});
@@ -0,0 +1,205 @@
+#include "meshlet.h"
+
+#include <algorithm> // min, max
+#include <cfloat>    // FLT_MAX
+#include <cmath>     // sqrt
+
+#include "vk_utils.h"
+
+namespace {
+
+glm::vec3
+GetPosition(const Mesh& mesh, uint32_t vertex)
+{
+  const float* p = &mesh.vertices[vertex * mesh.vertexStride];
+  return glm::vec3(p[0], p[1], p[2]);
+}
+
+void
+ComputeBounds(const Mesh& mesh, const MeshletMesh& result, Meshlet& meshlet)
+{
+  const uint32_t* vertices = &result.vertices[meshlet.vertexOffset];
+  const uint32_t* indices = &result.indices[meshlet.triangleOffset * 3];
+
+  glm::vec3 lo(FLT_MAX);
+  glm::vec3 hi(-FLT_MAX);
+  for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+    glm::vec3 p = GetPosition(mesh, vertices[i]);
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+
+  glm::vec3 center = (lo + hi) * 0.5f;
+  float radius = 0.0f;
+  for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+    radius =
+      std::max(radius, glm::length(GetPosition(mesh, vertices[i]) - center));
+  }
+  meshlet.sphere = glm::vec4(center, radius);
+
+  // the cone axis averages the unit triangle normals, its spread is the
+  // largest angle between the axis and one of them
+  glm::vec3 normals[Meshlet::MAX_TRIANGLES];
+  uint32_t normalCount = 0;
+  glm::vec3 axis(0.0f);
+  for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+    glm::vec3 a = GetPosition(mesh, indices[t * 3 + 0]);
+    glm::vec3 b = GetPosition(mesh, indices[t * 3 + 1]);
+    glm::vec3 c = GetPosition(mesh, indices[t * 3 + 2]);
+
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float length = glm::length(n);
+    if (length > 0.0f && normalCount < Meshlet::MAX_TRIANGLES) {
+      normals[normalCount++] = n / length;
+      axis += n / length;
+    }
+  }
+
+  float axisLength = glm::length(axis);
+  if (axisLength <= 0.0f) {
+    return;
+  }
+  axis /= axisLength;
+
+  float minDot = 1.0f;
+  for (uint32_t i = 0; i < normalCount; ++i) {
+    minDot = std::min(minDot, glm::dot(normals[i], axis));
+  }
+
+  // a spread of 90 degrees or more always has a triangle facing the camera
+  if (minDot > 0.0f) {
+    meshlet.cone = glm::vec4(axis, sqrtf(1.0f - minDot * minDot));
+  }
+}
+
+} // namespace
+
+MeshletMesh
+BuildMeshlets(const Mesh& mesh, uint32_t maxVertices, uint32_t maxTriangles)
+{
+  ASSERT_TRUE((maxVertices >= 3 && maxVertices <= 256));
+  ASSERT_TRUE(
+    (maxTriangles >= 1 && maxTriangles <= Meshlet::MAX_TRIANGLES));
+
+  uint32_t vertexCount = mesh.GetVertexCount();
+  uint32_t triangleCount = mesh.GetTriangleCount();
+
+  // triangles around every vertex
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (auto index : mesh.indices) {
+    adjacencyOffsets[index + 1] += 1;
+  }
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+  }
+  std::vector<uint32_t> adjacency(mesh.indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                               adjacencyOffsets.end() - 1);
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+      for (uint32_t k = 0; k < 3; ++k) {
+        adjacency[fill[mesh.indices[t * 3 + k]]++] = t;
+      }
+    }
+  }
+
+  MeshletMesh result = {};
+  result.triangles.reserve(mesh.indices.size());
+  result.indices.reserve(mesh.indices.size());
+
+  std::vector<bool> assigned(triangleCount, false);
+  // vertex within the current meshlet
+  std::vector<uint32_t> localVertices(vertexCount, UINT32_MAX);
+
+  Meshlet meshlet = {};
+
+  auto getNewVertexCount = [&](uint32_t triangle) {
+    uint32_t count = 0;
+    for (uint32_t k = 0; k < 3; ++k) {
+      count += localVertices[mesh.indices[triangle * 3 + k]] == UINT32_MAX;
+    }
+    return count;
+  };
+
+  // the unassigned neighbour of the given vertices that fits into the
+  // meshlet and adds the fewest vertices
+  auto findNeighbour = [&](const uint32_t* vertices, uint32_t count) {
+    uint32_t best = UINT32_MAX;
+    uint32_t bestNewVertexCount = UINT32_MAX;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t v = vertices[i];
+      for (uint32_t j = adjacencyOffsets[v]; j < adjacencyOffsets[v + 1];
+           ++j) {
+        uint32_t t = adjacency[j];
+        if (assigned[t]) {
+          continue;
+        }
+        uint32_t newVertexCount = getNewVertexCount(t);
+        if (meshlet.vertexCount + newVertexCount > maxVertices) {
+          continue;
+        }
+        if (newVertexCount < bestNewVertexCount ||
+            (newVertexCount == bestNewVertexCount && t < best)) {
+          best = t;
+          bestNewVertexCount = newVertexCount;
+        }
+      }
+    }
+    return best;
+  };
+
+  auto finish = [&]() {
+    ComputeBounds(mesh, result, meshlet);
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+      localVertices[result.vertices[meshlet.vertexOffset + i]] = UINT32_MAX;
+    }
+    result.meshlets.push_back(meshlet);
+
+    meshlet = {};
+    meshlet.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+    meshlet.triangleOffset = static_cast<uint32_t>(result.indices.size() / 3);
+  };
+
+  uint32_t cursor = 0;
+  uint32_t last = 0;
+  for (uint32_t added = 0; added < triangleCount; ++added) {
+    uint32_t next = UINT32_MAX;
+    if (meshlet.triangleCount > 0 && meshlet.triangleCount < maxTriangles) {
+      next = findNeighbour(&mesh.indices[last * 3], 3);
+      if (next == UINT32_MAX) {
+        next = findNeighbour(&result.vertices[meshlet.vertexOffset],
+                             meshlet.vertexCount);
+      }
+    }
+
+    if (next == UINT32_MAX) {
+      // full or no neighbour left, continue in the mesh's order
+      if (meshlet.triangleCount > 0) {
+        finish();
+      }
+      while (assigned[cursor]) {
+        ++cursor;
+      }
+      next = cursor;
+    }
+
+    for (uint32_t k = 0; k < 3; ++k) {
+      uint32_t v = mesh.indices[next * 3 + k];
+      if (localVertices[v] == UINT32_MAX) {
+        localVertices[v] = meshlet.vertexCount++;
+        result.vertices.push_back(v);
+      }
+      result.triangles.push_back(static_cast<uint8_t>(localVertices[v]));
+      result.indices.push_back(v);
+    }
+    meshlet.triangleCount += 1;
+    assigned[next] = true;
+    last = next;
+  }
+
+  if (meshlet.triangleCount > 0) {
+    finish();
+  }
+
+  return result;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm\glm.hpp>
+
+#include "mesh.h"
+
+// A small cluster of triangles with the bounds the culling pass tests
+// before any of its vertices are transformed.
+struct Meshlet
+{
+  static const uint32_t MAX_VERTICES = 64;
+  static const uint32_t MAX_TRIANGLES = 124;
+
+  // into MeshletMesh::vertices
+  uint32_t vertexOffset = 0;
+  uint32_t vertexCount = 0;
+  // in triangles, into MeshletMesh::triangles (3 bytes each) and
+  // MeshletMesh::indices (3 indices each)
+  uint32_t triangleOffset = 0;
+  uint32_t triangleCount = 0;
+
+  glm::vec4 sphere = {}; // xyz center, w radius (object space)
+  // xyz axis of the normal cone, w sine of its spread; the cluster faces
+  // away from a camera at c if
+  //   dot(center - c, axis) >= w * length(center - c) + radius
+  // w is 1 if the normals spread too far for the test. Normals follow
+  // cross(b - a, c - a), i.e. counter-clockwise front faces
+  glm::vec4 cone = { 0.0f, 0.0f, 0.0f, 1.0f };
+};
+
+struct MeshletMesh
+{
+  std::vector<Meshlet> meshlets = {};
+  // mesh vertex of every meshlet vertex
+  std::vector<uint32_t> vertices = {};
+  // meshlet local vertices, 3 per triangle
+  std::vector<uint8_t> triangles = {};
+  // the same triangles with mesh vertices, i.e. an index buffer in which
+  // every meshlet is one range for the indexed draw path
+  std::vector<uint32_t> indices = {};
+};
+
+// Grows meshlets from the triangle order of the mesh, run
+// OptimizeVertexCache before so they come out compact. Each meshlet prefers
+// the neighbour triangle that adds the fewest vertices.
+MeshletMesh
+BuildMeshlets(const Mesh& mesh,
+              uint32_t maxVertices = Meshlet::MAX_VERTICES,
+              uint32_t maxTriangles = Meshlet::MAX_TRIANGLES);
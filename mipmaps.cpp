@@ -0,0 +1,202 @@
+#include "mipmaps.h"
+
+#include <algorithm> // max
+#include <iostream>
+
+#include "vk_utils.h"
+
+namespace {
+
+const VkFormatFeatureFlags MIP_FORMAT_FEATURES =
+  VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+int32_t
+GetMipSize(uint32_t size, uint32_t level)
+{
+  return static_cast<int32_t>(std::max(size >> level, 1u));
+}
+
+} // namespace
+
+void
+MipGenerator::Create(VkPhysicalDevice physicalDevice)
+{
+  this->physicalDevice = physicalDevice;
+  jobs.clear();
+}
+
+bool
+MipGenerator::IsSupported(VkFormat format) const
+{
+  VkFormatProperties formatProps = {};
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProps);
+  return (formatProps.optimalTilingFeatures & MIP_FORMAT_FEATURES) ==
+         MIP_FORMAT_FEATURES;
+}
+
+bool
+MipGenerator::Add(PhysicalImage& image,
+                  VkFormat format,
+                  VkExtent3D extent,
+                  ImageState finalState)
+{
+  if (!IsSupported(format)) {
+    std::cout << "WARNING: cannot generate mips of format " << format
+              << std::endl;
+    return false;
+  }
+
+  Job job = {};
+  job.image = &image;
+  job.format = format;
+  job.extent = extent;
+  job.finalState = finalState;
+  jobs.push_back(job);
+  return true;
+}
+
+void
+MipGenerator::Record(VkCommandBuffer cmdBuffer)
+{
+  if (jobs.empty()) {
+    return;
+  }
+
+  uint32_t levelCount = 0;
+  for (auto const& job : jobs) {
+    levelCount = std::max(levelCount, job.image->levels);
+  }
+
+  std::vector<VkImageMemoryBarrier> barriers;
+  for (uint32_t level = 1; level < levelCount; ++level) {
+    // the level above becomes the blit source, this level its destination
+    VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    barriers.clear();
+    for (auto const& job : jobs) {
+      PhysicalImage& image = *job.image;
+      if (level >= image.levels) {
+        continue;
+      }
+
+      VkImageAspectFlags aspect = vkuGetImageAspectFlags(job.format);
+      ImageState src = image.GetState(level - 1);
+      srcStages |= src.stageFlags;
+      barriers.push_back(vkiImageMemoryBarrier(
+        src.accessFlags,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        src.layout,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        image.image,
+        vkiImageSubresourceRange(aspect, level - 1, 1, 0, image.layers)));
+      // previous contents are overwritten
+      barriers.push_back(vkiImageMemoryBarrier(
+        0,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        image.image,
+        vkiImageSubresourceRange(aspect, level, 1, 0, image.layers)));
+
+      ImageState state = {};
+      state.stageFlags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      state.accessFlags = VK_ACCESS_TRANSFER_READ_BIT;
+      state.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      image.SetState(
+        vkiImageSubresourceRange(aspect, level - 1, 1, 0, image.layers),
+        state);
+      state.accessFlags = VK_ACCESS_TRANSFER_WRITE_BIT;
+      state.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      image.SetState(
+        vkiImageSubresourceRange(aspect, level, 1, 0, image.layers), state);
+    }
+
+    vkCmdPipelineBarrier(cmdBuffer,
+                         srcStages,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data());
+
+    for (auto const& job : jobs) {
+      const PhysicalImage& image = *job.image;
+      if (level >= image.levels) {
+        continue;
+      }
+
+      // all layers in one blit
+      VkImageAspectFlags aspect = vkuGetImageAspectFlags(job.format);
+      VkImageBlit blit = {};
+      blit.srcSubresource =
+        vkiImageSubresourceLayers(aspect, level - 1, 0, image.layers);
+      blit.srcOffsets[1] = { GetMipSize(job.extent.width, level - 1),
+                             GetMipSize(job.extent.height, level - 1),
+                             GetMipSize(job.extent.depth, level - 1) };
+      blit.dstSubresource =
+        vkiImageSubresourceLayers(aspect, level, 0, image.layers);
+      blit.dstOffsets[1] = { GetMipSize(job.extent.width, level),
+                             GetMipSize(job.extent.height, level),
+                             GetMipSize(job.extent.depth, level) };
+      vkCmdBlitImage(cmdBuffer,
+                     image.image,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     image.image,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     1,
+                     &blit,
+                     VK_FILTER_LINEAR);
+    }
+  }
+
+  // every level was a source except the last, which is still a destination
+  VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  VkPipelineStageFlags dstStages = 0;
+  barriers.clear();
+  for (auto const& job : jobs) {
+    PhysicalImage& image = *job.image;
+    VkImageAspectFlags aspect = vkuGetImageAspectFlags(job.format);
+    // one barrier per run of levels in the same state
+    for (uint32_t level = 0; level < image.levels;) {
+      ImageState state = image.GetState(level);
+      uint32_t end = level + 1;
+      while (end < image.levels && image.GetState(end) == state) {
+        ++end;
+      }
+      srcStages |= state.stageFlags;
+      barriers.push_back(vkiImageMemoryBarrier(
+        state.accessFlags,
+        job.finalState.accessFlags,
+        state.layout,
+        job.finalState.layout,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        image.image,
+        vkiImageSubresourceRange(aspect, level, end - level, 0, image.layers)));
+      level = end;
+    }
+    dstStages |= job.finalState.stageFlags;
+    image.SetState(
+      vkiImageSubresourceRange(aspect, 0, image.levels, 0, image.layers),
+      job.finalState);
+  }
+
+  vkCmdPipelineBarrier(cmdBuffer,
+                       srcStages,
+                       dstStages,
+                       0,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr,
+                       static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+  jobs.clear();
+}
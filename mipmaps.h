@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+// Generates mip chains on the GPU, every level is a linear blit of the level
+// above. Blits decode sRGB formats before filtering and encode the result,
+// so sRGB textures are averaged in linear space.
+//
+// Images are batched: Record walks the levels of all added images in
+// lockstep, so the whole batch costs one pipeline barrier per level plus one
+// at the end, however many images it holds.
+struct MipGenerator
+{
+  void Create(VkPhysicalDevice physicalDevice);
+
+  // Whether optimal tiling images of format can be blitted from and to with
+  // a linear filter. Thread safe, block-compressed formats never are.
+  bool IsSupported(VkFormat format) const;
+
+  // Queues the levels after level 0 of all layers of image for the next
+  // Record, image.states gives the state level 0 was written in. image needs
+  // TRANSFER_SRC and TRANSFER_DST usage and has to stay valid until Record,
+  // which leaves all levels in finalState. Returns false if the format is
+  // not supported.
+  bool Add(PhysicalImage& image,
+           VkFormat format,
+           VkExtent3D extent,
+           ImageState finalState);
+
+  // records the blits and barriers of all queued images, then forgets them
+  void Record(VkCommandBuffer cmdBuffer);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+
+private:
+  struct Job
+  {
+    PhysicalImage* image = nullptr;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent3D extent = {};
+    ImageState finalState = {};
+  };
+
+  std::vector<Job> jobs = {};
+};
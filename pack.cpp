@@ -0,0 +1,855 @@
+#include "pack.h"
+
+#include <algorithm> // sort, min
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "texture.h"
+#include "vertex_format.h"
+#include "vk_utils.h"
+
+namespace {
+
+const uint32_t LZ_MIN_MATCH = 4;
+// the last bytes are always literals and no match starts close to the end,
+// the same limits as LZ4 so the decoder can stay simple
+const size_t LZ_LAST_LITERALS = 5;
+const size_t LZ_MATCH_START_LIMIT = 12;
+const uint32_t LZ_MAX_OFFSET = 65535;
+const uint32_t LZ_HASH_BITS = 14;
+
+uint64_t
+AlignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t
+DivideUp(uint32_t value, uint32_t divisor)
+{
+  return (value + divisor - 1) / divisor;
+}
+
+uint32_t
+Read32(const uint8_t* p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// 15 in the token nibble, the rest in bytes of 255 and a final smaller one
+bool
+WriteLength(size_t length, uint8_t*& out, const uint8_t* end)
+{
+  for (; length >= 255; length -= 255) {
+    if (out == end) {
+      return false;
+    }
+    *out++ = 255;
+  }
+  if (out == end) {
+    return false;
+  }
+  *out++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+bool
+ReadLength(size_t& length, const uint8_t*& in, const uint8_t* end)
+{
+  uint8_t b = 0;
+  do {
+    if (in == end) {
+      return false;
+    }
+    b = *in++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+// literals, then a match unless matchLength is 0
+bool
+WriteSequence(const uint8_t* literals,
+              size_t literalCount,
+              uint32_t offset,
+              size_t matchLength,
+              uint8_t*& out,
+              const uint8_t* end)
+{
+  if (out == end) {
+    return false;
+  }
+  uint8_t* token = out++;
+  size_t matchCode = matchLength > 0 ? matchLength - LZ_MIN_MATCH : 0;
+  *token = static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) |
+                                std::min<size_t>(matchCode, 15));
+
+  if (literalCount >= 15 && !WriteLength(literalCount - 15, out, end)) {
+    return false;
+  }
+  if (static_cast<size_t>(end - out) < literalCount) {
+    return false;
+  }
+  memcpy(out, literals, literalCount);
+  out += literalCount;
+
+  if (matchLength == 0) {
+    return true;
+  }
+  if (end - out < 2) {
+    return false;
+  }
+  *out++ = static_cast<uint8_t>(offset);
+  *out++ = static_cast<uint8_t>(offset >> 8);
+  return matchCode < 15 || WriteLength(matchCode - 15, out, end);
+}
+
+// Splits a payload into independently compressed chunks. Returns false if
+// compression saves less than an eighth, the blob is then stored as is.
+bool
+CompressBlob(const uint8_t* payload, size_t size, PackWriter::Blob& blob)
+{
+  uint32_t chunkCount =
+    static_cast<uint32_t>((size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE);
+  if (chunkCount == 0) {
+    return false;
+  }
+
+  std::vector<uint8_t> data(chunkCount * sizeof(uint32_t));
+  std::vector<uint8_t> chunk(GetPackCompressBound(PACK_CHUNK_SIZE));
+  for (uint32_t i = 0; i < chunkCount; ++i) {
+    size_t offset = size_t(i) * PACK_CHUNK_SIZE;
+    size_t chunkSize = std::min<size_t>(PACK_CHUNK_SIZE, size - offset);
+
+    // a chunk that does not shrink is stored, its size gives it away
+    size_t compressedSize = PackCompress(
+      payload + offset, chunkSize, chunk.data(), chunk.size());
+    const uint8_t* stored = chunk.data();
+    if (compressedSize == 0) {
+      compressedSize = chunkSize;
+      stored = payload + offset;
+    }
+
+    uint32_t storedSize = static_cast<uint32_t>(compressedSize);
+    memcpy(&data[i * sizeof(uint32_t)], &storedSize, sizeof(storedSize));
+    data.insert(data.end(), stored, stored + compressedSize);
+  }
+
+  if (data.size() > size - size / 8) {
+    return false;
+  }
+
+  blob.compression = PACK_COMPRESSION_LZ;
+  blob.chunkCount = chunkCount;
+  blob.data = std::move(data);
+  return true;
+}
+
+template<typename T>
+void
+Append(std::vector<uint8_t>& data, const T* values, size_t count)
+{
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+  data.insert(data.end(), bytes, bytes + count * sizeof(T));
+}
+
+void
+AppendPadding(std::vector<uint8_t>& data, uint64_t alignment)
+{
+  data.resize(static_cast<size_t>(AlignUp(data.size(), alignment)), 0);
+}
+
+} // namespace
+
+uint64_t
+GetPackNameHash(const char* name)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (; *name != '\0'; ++name) {
+    hash ^= static_cast<uint8_t>(*name);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+size_t
+GetPackCompressBound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+size_t
+PackCompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+  uint8_t* out = dst;
+  const uint8_t* end = dst + std::min(dstSize, srcSize);
+
+  // position + 1 of the last occurrence of a 4 byte sequence, 0 if none
+  std::vector<uint32_t> table(size_t(1) << LZ_HASH_BITS, 0);
+
+  size_t anchor = 0;
+  size_t position = 0;
+  if (srcSize > LZ_MATCH_START_LIMIT) {
+    size_t matchStartLimit = srcSize - LZ_MATCH_START_LIMIT;
+    size_t matchEndLimit = srcSize - LZ_LAST_LITERALS;
+
+    while (position < matchStartLimit) {
+      uint32_t sequence = Read32(src + position);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+      size_t candidate = table[hash];
+      table[hash] = static_cast<uint32_t>(position + 1);
+
+      if (candidate == 0 || position - (candidate - 1) > LZ_MAX_OFFSET ||
+          Read32(src + candidate - 1) != sequence) {
+        ++position;
+        continue;
+      }
+
+      size_t match = candidate - 1;
+      size_t length = LZ_MIN_MATCH;
+      while (position + length < matchEndLimit &&
+             src[match + length] == src[position + length]) {
+        ++length;
+      }
+
+      if (!WriteSequence(src + anchor,
+                         position - anchor,
+                         static_cast<uint32_t>(position - match),
+                         length,
+                         out,
+                         end)) {
+        return 0;
+      }
+      position += length;
+      anchor = position;
+    }
+  }
+
+  if (!WriteSequence(src + anchor, srcSize - anchor, 0, 0, out, end) ||
+      out == end) {
+    return 0;
+  }
+  return out - dst;
+}
+
+bool
+PackDecompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+  const uint8_t* in = src;
+  const uint8_t* inEnd = src + srcSize;
+  uint8_t* out = dst;
+  uint8_t* outEnd = dst + dstSize;
+
+  while (in < inEnd) {
+    uint8_t token = *in++;
+
+    size_t literalCount = token >> 4;
+    if (literalCount == 15 && !ReadLength(literalCount, in, inEnd)) {
+      return false;
+    }
+    if (literalCount > static_cast<size_t>(inEnd - in) ||
+        literalCount > static_cast<size_t>(outEnd - out)) {
+      return false;
+    }
+    memcpy(out, in, literalCount);
+    in += literalCount;
+    out += literalCount;
+
+    // the last sequence has no match
+    if (in == inEnd) {
+      break;
+    }
+
+    if (inEnd - in < 2) {
+      return false;
+    }
+    size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > static_cast<size_t>(out - dst)) {
+      return false;
+    }
+
+    size_t length = token & 15;
+    if (length == 15 && !ReadLength(length, in, inEnd)) {
+      return false;
+    }
+    length += LZ_MIN_MATCH;
+    if (length > static_cast<size_t>(outEnd - out)) {
+      return false;
+    }
+
+    // byte by byte, the match may overlap what it writes
+    const uint8_t* match = out - offset;
+    for (size_t i = 0; i < length; ++i) {
+      out[i] = match[i];
+    }
+    out += length;
+  }
+
+  return out == outEnd;
+}
+
+bool
+ReadPackBlobRange(const PackEntry& entry,
+                  const uint8_t* blob,
+                  uint64_t offset,
+                  uint64_t size,
+                  void* dst)
+{
+  if (offset > entry.payloadSize || size > entry.payloadSize - offset) {
+    return false;
+  }
+
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  if (entry.compression == PACK_COMPRESSION_NONE) {
+    memcpy(out, blob + offset, static_cast<size_t>(size));
+    return true;
+  }
+  if (size == 0) {
+    return true;
+  }
+
+  // chunk table, then the chunks back to back
+  uint64_t chunkOffset = entry.chunkCount * sizeof(uint32_t);
+  uint32_t firstChunk = static_cast<uint32_t>(offset / PACK_CHUNK_SIZE);
+  uint32_t lastChunk = static_cast<uint32_t>((offset + size - 1) /
+                                             PACK_CHUNK_SIZE);
+  for (uint32_t i = 0; i < firstChunk; ++i) {
+    chunkOffset += Read32(blob + i * sizeof(uint32_t));
+  }
+
+  std::vector<uint8_t> chunk;
+  for (uint32_t i = firstChunk; i <= lastChunk; ++i) {
+    uint32_t storedSize = Read32(blob + i * sizeof(uint32_t));
+    if (chunkOffset + storedSize > entry.size) {
+      return false;
+    }
+
+    uint64_t chunkStart = uint64_t(i) * PACK_CHUNK_SIZE;
+    size_t chunkSize = static_cast<size_t>(
+      std::min<uint64_t>(PACK_CHUNK_SIZE, entry.payloadSize - chunkStart));
+    uint64_t begin = std::max(offset, chunkStart);
+    uint64_t end = std::min(offset + size, chunkStart + chunkSize);
+    uint8_t* target = out + (begin - offset);
+
+    const uint8_t* stored = blob + chunkOffset;
+    if (storedSize == chunkSize) {
+      memcpy(target, stored + (begin - chunkStart), size_t(end - begin));
+    } else if (begin == chunkStart && end == chunkStart + chunkSize) {
+      // whole chunks go straight to dst
+      if (!PackDecompress(stored, storedSize, target, chunkSize)) {
+        return false;
+      }
+    } else {
+      chunk.resize(chunkSize);
+      if (!PackDecompress(stored, storedSize, chunk.data(), chunkSize)) {
+        return false;
+      }
+      memcpy(target, &chunk[size_t(begin - chunkStart)], size_t(end - begin));
+    }
+
+    chunkOffset += storedSize;
+  }
+  return true;
+}
+
+void
+PackWriter::AddBlob(const char* name,
+                    PackEntryType type,
+                    const void* data,
+                    size_t size,
+                    bool compress)
+{
+  const uint8_t* payload = static_cast<const uint8_t*>(data);
+
+  Blob blob = {};
+  blob.name = name;
+  blob.type = type;
+  blob.payloadSize = size;
+  if (!compress || !CompressBlob(payload, size, blob)) {
+    blob.data.assign(payload, payload + size);
+  }
+  blobs.push_back(std::move(blob));
+}
+
+void
+PackWriter::AddMesh(const char* name,
+                    const Mesh& mesh,
+                    VertexAttributeFlags attributeFlags,
+                    VertexEncodingFlags encodingFlags,
+                    bool compress)
+{
+  // floats of each attribute in VERTEX_ATTRIBUTE_ORDER
+  static const uint32_t ATTRIBUTE_COUNT = 5;
+  static const uint32_t floatCounts[ATTRIBUTE_COUNT] = { 3, 3, 2, 4, 4 };
+
+  uint32_t vertexCount = mesh.GetVertexCount();
+
+  // the float vertices of the mesh, one array per attribute
+  std::vector<float> attributes[ATTRIBUTE_COUNT];
+  VertexSource source = {};
+  source.vertexCount = vertexCount;
+  const float** sourceAttributes[ATTRIBUTE_COUNT] = {
+    &source.positions, &source.normals, &source.uvs,
+    &source.colors,    &source.tangents,
+  };
+
+  uint32_t floatOffset = 0;
+  for (uint32_t i = 0; i < ATTRIBUTE_COUNT; ++i) {
+    if ((attributeFlags & VERTEX_ATTRIBUTE_ORDER[i]) == 0) {
+      continue;
+    }
+    uint32_t count = floatCounts[i];
+    attributes[i].resize(vertexCount * count);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      memcpy(&attributes[i][v * count],
+             &mesh.vertices[v * mesh.vertexStride + floatOffset],
+             count * sizeof(float));
+    }
+    *sourceAttributes[i] = attributes[i].data();
+    floatOffset += count;
+  }
+  ASSERT_TRUE(floatOffset == mesh.vertexStride);
+
+  PositionQuantization quantization = {};
+  if ((encodingFlags & QUANTIZED_POSITION) != 0) {
+    quantization =
+      PositionQuantization::FromPositions(source.positions, vertexCount);
+  }
+
+  std::vector<uint8_t> vertices;
+  PackVertexStream(
+    source, attributeFlags, encodingFlags, &quantization, vertices);
+
+  // a mesh without levels of detail is its own single level
+  std::vector<MeshLod> lods = mesh.lods;
+  if (lods.empty()) {
+    lods.push_back({ 0, static_cast<uint32_t>(mesh.indices.size()), 0.0f });
+  }
+
+  PackMesh header = {};
+  header.vertexCount = vertexCount;
+  header.vertexStride =
+    SimplifiedVertexInputState::GetStride(attributeFlags, encodingFlags);
+  header.attributeFlags = attributeFlags;
+  header.encodingFlags = encodingFlags;
+  header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+  header.indexType =
+    vertexCount <= UINT16_MAX ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  header.lodCount = static_cast<uint32_t>(lods.size());
+  memcpy(header.positionMin, &quantization.min, sizeof(glm::vec3));
+  memcpy(header.positionExtent, &quantization.extent, sizeof(glm::vec3));
+
+  std::vector<uint8_t> payload(sizeof(PackMesh));
+  AppendPadding(payload, 16);
+  header.vertexOffset = payload.size();
+  Append(payload, vertices.data(), vertices.size());
+
+  AppendPadding(payload, 16);
+  header.indexOffset = payload.size();
+  if (header.indexType == VK_INDEX_TYPE_UINT16) {
+    std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+    Append(payload, indices.data(), indices.size());
+  } else {
+    Append(payload, mesh.indices.data(), mesh.indices.size());
+  }
+
+  AppendPadding(payload, 16);
+  header.lodOffset = payload.size();
+  Append(payload, lods.data(), lods.size());
+
+  memcpy(payload.data(), &header, sizeof(header));
+  AddBlob(name, PACK_ENTRY_MESH, payload.data(), payload.size(), compress);
+}
+
+void
+PackWriter::AddTexture(const char* name,
+                       const PackTexture& texture,
+                       const void* const* levels,
+                       const size_t* levelSizes,
+                       bool compress)
+{
+  uint32_t levelCount = texture.mipCount * texture.layerCount;
+
+  std::vector<uint8_t> payload;
+  Append(payload, &texture, 1);
+  size_t levelTableOffset = payload.size();
+  payload.resize(payload.size() + levelCount * sizeof(PackTextureLevel));
+
+  for (uint32_t i = 0; i < levelCount; ++i) {
+    uint32_t mip = i % texture.mipCount;
+
+    AppendPadding(payload, PACK_ALIGNMENT);
+
+    PackTextureLevel level = {};
+    level.offset = payload.size();
+    level.size = levelSizes[i];
+    level.width = std::max(texture.width >> mip, 1u);
+    level.height = std::max(texture.height >> mip, 1u);
+    level.depth = std::max(texture.depth >> mip, 1u);
+    memcpy(&payload[levelTableOffset + i * sizeof(PackTextureLevel)],
+           &level,
+           sizeof(level));
+
+    Append(payload, static_cast<const uint8_t*>(levels[i]), levelSizes[i]);
+  }
+
+  AddBlob(name, PACK_ENTRY_TEXTURE, payload.data(), payload.size(), compress);
+}
+
+bool
+PackWriter::AddVirtualTexture(const char* name,
+                              const TextureData& texture,
+                              uint32_t pageSize,
+                              bool compress)
+{
+  const PackTexture& src = texture.desc;
+  FormatBlockInfo block = GetFormatBlockInfo(static_cast<VkFormat>(src.format));
+  bool powerOfTwo = pageSize != 0 && (pageSize & (pageSize - 1)) == 0;
+  if (block.blockSize == 0 || !powerOfTwo ||
+      pageSize % block.blockWidth != 0 || pageSize % block.blockHeight != 0 ||
+      src.depth != 1 || src.layerCount != 1 ||
+      (src.flags & (PACK_TEXTURE_CUBE | PACK_TEXTURE_GENERATE_MIPS)) != 0 ||
+      DivideUp(src.width, pageSize) > UINT16_MAX ||
+      DivideUp(src.height, pageSize) > UINT16_MAX) {
+    std::cout << "ERROR: " << name << " cannot be a virtual texture"
+              << std::endl;
+    return false;
+  }
+
+  PackVirtualTexture desc = {};
+  desc.format = src.format;
+  desc.width = src.width;
+  desc.height = src.height;
+  desc.mipCount = src.mipCount;
+  desc.pageSize = pageSize;
+  for (uint32_t mip = 0; mip < src.mipCount; ++mip) {
+    desc.pageCount += DivideUp(std::max(src.width >> mip, 1u), pageSize) *
+                      DivideUp(std::max(src.height >> mip, 1u), pageSize);
+  }
+
+  uint32_t pageBlocksX = pageSize / block.blockWidth;
+  uint32_t pageBlocksY = pageSize / block.blockHeight;
+  size_t pageBytes = size_t(pageBlocksX) * pageBlocksY * block.blockSize;
+  size_t pageStride = static_cast<size_t>(AlignUp(pageBytes, PACK_ALIGNMENT));
+  size_t firstOffset = static_cast<size_t>(
+    AlignUp(sizeof(PackVirtualTexture) +
+              desc.pageCount * sizeof(PackVirtualPage),
+            PACK_ALIGNMENT));
+
+  // zero initialized, which pads the pages at the edges
+  std::vector<uint8_t> payload(firstOffset + desc.pageCount * pageStride);
+  memcpy(payload.data(), &desc, sizeof(desc));
+  PackVirtualPage* pageTable =
+    reinterpret_cast<PackVirtualPage*>(&payload[sizeof(desc)]);
+
+  uint32_t page = 0;
+  for (uint32_t mip = 0; mip < src.mipCount; ++mip) {
+    const PackTextureLevel& level = texture.levels[mip];
+    const uint8_t* levelData = texture.data.data() + level.offset;
+    uint32_t levelBlocksX = DivideUp(level.width, block.blockWidth);
+    uint32_t levelBlocksY = DivideUp(level.height, block.blockHeight);
+    size_t rowBytes = size_t(levelBlocksX) * block.blockSize;
+    uint32_t pagesX = DivideUp(level.width, pageSize);
+    uint32_t pagesY = DivideUp(level.height, pageSize);
+
+    for (uint32_t y = 0; y < pagesY; ++y) {
+      for (uint32_t x = 0; x < pagesX; ++x, ++page) {
+        PackVirtualPage entry = {};
+        entry.offset = firstOffset + page * pageStride;
+        entry.size = pageBytes;
+        memcpy(&pageTable[page], &entry, sizeof(entry));
+
+        // block rows of the page that are inside the level
+        uint32_t blockX = x * pageBlocksX;
+        uint32_t blockCount = std::min(pageBlocksX, levelBlocksX - blockX);
+        for (uint32_t row = 0; row < pageBlocksY; ++row) {
+          uint32_t blockY = y * pageBlocksY + row;
+          if (blockY >= levelBlocksY) {
+            break;
+          }
+          memcpy(&payload[static_cast<size_t>(entry.offset) +
+                          row * pageBlocksX * block.blockSize],
+                 levelData + blockY * rowBytes + blockX * block.blockSize,
+                 blockCount * block.blockSize);
+        }
+      }
+    }
+  }
+
+  AddBlob(name,
+          PACK_ENTRY_VIRTUAL_TEXTURE,
+          payload.data(),
+          payload.size(),
+          compress);
+  return true;
+}
+
+void
+PackWriter::AddSpirv(const char* name, const void* code, size_t size)
+{
+  // small and loaded once, not worth decompressing
+  AddBlob(name, PACK_ENTRY_SPIRV, code, size, false);
+}
+
+bool
+PackWriter::Write(const char* fileName) const
+{
+  std::vector<uint32_t> order(blobs.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::vector<uint64_t> hashes(blobs.size());
+  for (uint32_t i = 0; i < blobs.size(); ++i) {
+    hashes[i] = GetPackNameHash(blobs[i].name.c_str());
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return hashes[a] < hashes[b];
+  });
+
+  PackHeader header = {};
+  header.entryCount = static_cast<uint32_t>(blobs.size());
+  header.namesOffset = sizeof(PackHeader) + blobs.size() * sizeof(PackEntry);
+
+  std::vector<PackEntry> entries(blobs.size());
+  std::vector<char> names;
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const Blob& blob = blobs[order[i]];
+    if (i > 0 && hashes[order[i]] == hashes[order[i - 1]]) {
+      std::cout << "WARNING: pack " << fileName << ": " << blob.name
+                << " collides with " << blobs[order[i - 1]].name << std::endl;
+      return false;
+    }
+
+    PackEntry& entry = entries[i];
+    entry.nameHash = hashes[order[i]];
+    entry.nameOffset = static_cast<uint32_t>(names.size());
+    entry.type = blob.type;
+    entry.compression = blob.compression;
+    entry.chunkCount = blob.chunkCount;
+    entry.size = blob.data.size();
+    entry.payloadSize = blob.payloadSize;
+    names.insert(names.end(), blob.name.begin(), blob.name.end());
+    names.push_back('\0');
+  }
+  header.namesSize = static_cast<uint32_t>(names.size());
+
+  uint64_t offset = header.namesOffset + names.size();
+  for (auto& entry : entries) {
+    offset = AlignUp(offset, PACK_ALIGNMENT);
+    entry.offset = offset;
+    offset += entry.size;
+  }
+  header.fileSize = offset;
+
+  FILE* file = 0;
+  fopen_s(&file, fileName, "wb");
+  if (!file) {
+    std::cout << "WARNING: pack " << fileName << " cannot be written"
+              << std::endl;
+    return false;
+  }
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(entries.data(), sizeof(PackEntry), entries.size(), file);
+  fwrite(names.data(), 1, names.size(), file);
+
+  static const uint8_t padding[PACK_ALIGNMENT] = {};
+  uint64_t position = header.namesOffset + names.size();
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const Blob& blob = blobs[order[i]];
+    fwrite(padding, 1, static_cast<size_t>(entries[i].offset - position), file);
+    fwrite(blob.data.data(), 1, blob.data.size(), file);
+    position = entries[i].offset + entries[i].size;
+  }
+
+  bool written = ferror(file) == 0;
+  fclose(file);
+  return written;
+}
+
+bool
+AssetPack::Open(const char* fileName)
+{
+  ASSERT_TRUE(!IsOpen());
+
+#ifdef _WIN32
+  HANDLE fileHandle = CreateFileA(fileName,
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ,
+                                  nullptr,
+                                  OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL,
+                                  nullptr);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  file = fileHandle;
+
+  LARGE_INTEGER fileSize = {};
+  GetFileSizeEx(fileHandle, &fileSize);
+  size = static_cast<uint64_t>(fileSize.QuadPart);
+  if (size >= sizeof(PackHeader)) {
+    mapping =
+      CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      data = static_cast<const uint8_t*>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+  }
+#else
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  file = reinterpret_cast<void*>(static_cast<intptr_t>(fd) + 1);
+
+  struct stat status = {};
+  fstat(fd, &status);
+  size = static_cast<uint64_t>(status.st_size);
+  if (size >= sizeof(PackHeader)) {
+    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+      data = static_cast<const uint8_t*>(view);
+    }
+  }
+#endif
+
+  if (data == nullptr) {
+    Close();
+    return false;
+  }
+
+  // only the header and the table of contents are checked, blobs are
+  // validated when they are read
+  header = reinterpret_cast<const PackHeader*>(data);
+  uint64_t tocEnd =
+    sizeof(PackHeader) + uint64_t(header->entryCount) * sizeof(PackEntry);
+  bool valid = header->magic == PACK_MAGIC &&
+               header->version == PACK_VERSION && header->fileSize == size &&
+               tocEnd <= header->namesOffset &&
+               header->namesOffset + header->namesSize <= size &&
+               (header->namesSize == 0 ||
+                data[header->namesOffset + header->namesSize - 1] == '\0');
+  if (valid) {
+    entries = reinterpret_cast<const PackEntry*>(data + sizeof(PackHeader));
+    names = reinterpret_cast<const char*>(data + header->namesOffset);
+  }
+  for (uint32_t i = 0; valid && i < header->entryCount; ++i) {
+    const PackEntry& entry = entries[i];
+    valid = entry.offset % PACK_ALIGNMENT == 0 && entry.offset <= size &&
+            entry.size <= size - entry.offset &&
+            entry.nameOffset < header->namesSize &&
+            (i == 0 || entries[i - 1].nameHash < entry.nameHash);
+    if (entry.compression == PACK_COMPRESSION_NONE) {
+      valid = valid && entry.size == entry.payloadSize;
+    } else {
+      valid = valid && entry.compression == PACK_COMPRESSION_LZ &&
+              entry.chunkCount ==
+                (entry.payloadSize + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE &&
+              entry.chunkCount * sizeof(uint32_t) <= entry.size;
+    }
+  }
+
+  if (!valid) {
+    std::cout << "WARNING: pack " << fileName << " is invalid" << std::endl;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void
+AssetPack::Close()
+{
+#ifdef _WIN32
+  if (data != nullptr) {
+    UnmapViewOfFile(data);
+  }
+  if (mapping != nullptr) {
+    CloseHandle(mapping);
+  }
+  if (file != nullptr) {
+    CloseHandle(file);
+  }
+#else
+  if (data != nullptr) {
+    munmap(const_cast<uint8_t*>(data), size);
+  }
+  if (file != nullptr) {
+    close(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1));
+  }
+#endif
+
+  *this = AssetPack();
+}
+
+const char*
+AssetPack::GetName(const PackEntry& entry) const
+{
+  return names + entry.nameOffset;
+}
+
+const PackEntry*
+AssetPack::Find(const char* name) const
+{
+  uint64_t hash = GetPackNameHash(name);
+  const PackEntry* end = entries + header->entryCount;
+  const PackEntry* entry = std::lower_bound(
+    entries, end, hash, [](const PackEntry& entry, uint64_t hash) {
+      return entry.nameHash < hash;
+    });
+  if (entry == end || entry->nameHash != hash ||
+      strcmp(GetName(*entry), name) != 0) {
+    return nullptr;
+  }
+  return entry;
+}
+
+const uint8_t*
+AssetPack::GetMappedBlob(const PackEntry& entry) const
+{
+  return data + entry.offset;
+}
+
+const uint8_t*
+AssetPack::GetMappedPayload(const PackEntry& entry) const
+{
+  if (entry.compression != PACK_COMPRESSION_NONE) {
+    return nullptr;
+  }
+  return data + entry.offset;
+}
+
+bool
+AssetPack::ReadRange(const PackEntry& entry,
+                     uint64_t offset,
+                     uint64_t size,
+                     void* dst) const
+{
+  return ReadPackBlobRange(entry, GetMappedBlob(entry), offset, size, dst);
+}
+
+std::string
+AssetPack::Read(const PackEntry& entry) const
+{
+  std::string payload(static_cast<size_t>(entry.payloadSize), '\0');
+  if (!Read(entry, &payload[0])) {
+    payload.clear();
+  }
+  return payload;
+}
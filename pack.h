@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "mesh.h"
+#include "pipeline_state.h"
+
+struct TextureData;
+
+// Asset pack (.pak) layout, little endian:
+//   PackHeader
+//   PackEntry[entryCount]  table of contents, sorted by nameHash
+//   names                  zero terminated, at PackEntry::nameOffset
+//   blobs                  each at a multiple of PACK_ALIGNMENT
+//
+// Payloads are the bytes the GPU consumes, so an uncompressed blob is copied
+// from the mapped file into staging memory as is. A compressed blob starts
+// with the compressed size of each of its chunks (uint32_t[chunkCount]),
+// followed by the chunks. Every chunk holds PACK_CHUNK_SIZE bytes of the
+// payload, the last one the rest, and decompresses on its own, so a range
+// only costs the chunks it touches.
+
+static const uint32_t PACK_MAGIC = 0x4B415041; // "APAK"
+static const uint32_t PACK_VERSION = 1;
+// offsets of mapped blobs satisfy optimalBufferCopyOffsetAlignment and the
+// texel block size of every format
+static const uint64_t PACK_ALIGNMENT = 256;
+static const uint32_t PACK_CHUNK_SIZE = 64 * 1024;
+
+enum PackEntryType
+{
+  PACK_ENTRY_RAW = 0,
+  PACK_ENTRY_MESH,            // PackMesh
+  PACK_ENTRY_TEXTURE,         // PackTexture
+  PACK_ENTRY_SPIRV,           // shader code
+  PACK_ENTRY_VIRTUAL_TEXTURE, // PackVirtualTexture, see VirtualTexture
+};
+
+enum PackCompression
+{
+  PACK_COMPRESSION_NONE = 0,
+  // LZ77 byte codec with the sequence layout of the LZ4 block format
+  PACK_COMPRESSION_LZ,
+};
+
+struct PackHeader
+{
+  uint32_t magic = PACK_MAGIC;
+  uint32_t version = PACK_VERSION;
+  uint32_t entryCount = 0;
+  uint32_t namesSize = 0;
+  uint64_t namesOffset = 0;
+  uint64_t fileSize = 0;
+};
+
+struct PackEntry
+{
+  uint64_t nameHash = 0; // GetPackNameHash
+  uint32_t nameOffset = 0;
+  uint32_t type = PACK_ENTRY_RAW;
+  uint32_t compression = PACK_COMPRESSION_NONE;
+  uint32_t chunkCount = 0; // 0 if uncompressed
+  uint64_t offset = 0;     // of the blob in the file
+  uint64_t size = 0;       // of the blob in the file
+  uint64_t payloadSize = 0;
+};
+
+// Header of a PACK_ENTRY_MESH payload, one interleaved vertex stream as
+// SimplifiedVertexInputState binding 0 describes it, then the indices of all
+// levels of detail. Offsets are relative to the payload and aligned to 16.
+struct PackMesh
+{
+  uint32_t vertexCount = 0;
+  uint32_t vertexStride = 0; // bytes
+  uint32_t attributeFlags = 0; // VertexAttributeFlags
+  uint32_t encodingFlags = 0;  // VertexEncodingFlags
+  uint32_t indexCount = 0;
+  uint32_t indexType = VK_INDEX_TYPE_UINT32;
+  uint32_t lodCount = 0;
+  uint32_t pad = 0;
+  // dequantization of QUANTIZED_POSITION, see PositionQuantization
+  float positionMin[4] = {};
+  float positionExtent[4] = {};
+  uint64_t vertexOffset = 0;
+  uint64_t indexOffset = 0;
+  uint64_t lodOffset = 0; // MeshLod[lodCount]
+  uint64_t pad2 = 0;
+};
+
+enum PackTextureFlagBits
+{
+  // layerCount is a multiple of 6, faces +X, -X, +Y, -Y, +Z, -Z
+  PACK_TEXTURE_CUBE = 0x1,
+  // only level 0 of each layer is stored, the other levels have size 0 and
+  // are generated on the GPU after the upload (mipmaps.h); not for
+  // block-compressed formats
+  PACK_TEXTURE_GENERATE_MIPS = 0x2,
+};
+
+// Header of a PACK_ENTRY_TEXTURE payload, followed by PackTextureLevel for
+// every mip of every layer (layer major). Level data is tightly packed with
+// bufferRowLength 0 and aligned to PACK_ALIGNMENT within the payload.
+struct PackTexture
+{
+  uint32_t format = VK_FORMAT_UNDEFINED; // VkFormat
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t depth = 1;
+  uint32_t mipCount = 1;
+  uint32_t layerCount = 1;
+  uint32_t flags = 0; // PackTextureFlagBits
+  uint32_t pad = 0;
+};
+
+struct PackTextureLevel
+{
+  uint64_t offset = 0; // into the payload
+  uint64_t size = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t depth = 0;
+  uint32_t pad = 0;
+};
+
+// Header of a PACK_ENTRY_VIRTUAL_TEXTURE payload, a 2D texture cut into
+// square pages that load on their own (virtual_texture.h). It is followed by
+// PackVirtualPage for every page, by mip, then row by row. A page holds
+// pageSize x pageSize texels tightly packed, those outside the mip are zero,
+// and is aligned to PACK_ALIGNMENT within the payload.
+struct PackVirtualTexture
+{
+  uint32_t format = VK_FORMAT_UNDEFINED; // VkFormat
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t mipCount = 1;
+  uint32_t pageSize = 0; // texels, a power of two
+  uint32_t pageCount = 0;
+  uint32_t pad[2] = {};
+};
+
+struct PackVirtualPage
+{
+  uint64_t offset = 0; // into the payload
+  uint64_t size = 0;
+};
+
+// FNV-1a of the name, the key of the table of contents
+uint64_t
+GetPackNameHash(const char* name);
+
+// LZ codec of PACK_COMPRESSION_LZ. Compress returns 0 if the data does not
+// shrink. Decompress returns false unless exactly dstSize bytes come out.
+size_t
+GetPackCompressBound(size_t size);
+size_t
+PackCompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+bool
+PackDecompress(const uint8_t* src,
+               size_t srcSize,
+               uint8_t* dst,
+               size_t dstSize);
+
+// Copies the bytes [offset, offset + size) of the payload of entry to dst,
+// blob holds the entry as stored in the pack, e.g. read into memory by a
+// loading thread.
+bool
+ReadPackBlobRange(const PackEntry& entry,
+                  const uint8_t* blob,
+                  uint64_t offset,
+                  uint64_t size,
+                  void* dst);
+
+// Collects payloads and writes them as one pack, used by tools/packer.cpp.
+// Payloads are compressed when that saves at least an eighth.
+struct PackWriter
+{
+  void AddBlob(const char* name,
+               PackEntryType type,
+               const void* data,
+               size_t size,
+               bool compress = true);
+
+  // Encodes the vertices as binding 0 of a SimplifiedVertexInputState with
+  // attributeFlags and encodingFlags reads them. The float vertices of the
+  // mesh hold exactly these attributes in VERTEX_ATTRIBUTE_ORDER (3 position,
+  // 3 normal, 2 uv, 4 color, 4 tangent floats).
+  void AddMesh(const char* name,
+               const Mesh& mesh,
+               VertexAttributeFlags attributeFlags,
+               VertexEncodingFlags encodingFlags,
+               bool compress = true);
+
+  // levels: data of mipCount * layerCount levels, layer major, each tightly
+  // packed
+  void AddTexture(const char* name,
+                  const PackTexture& texture,
+                  const void* const* levels,
+                  const size_t* levelSizes,
+                  bool compress = true);
+
+  // Adds a PACK_ENTRY_VIRTUAL_TEXTURE of a 2D texture with one layer and
+  // all its levels stored (texture.h). pageSize is a power of two and a
+  // multiple of the block size of the format. Sparse residency needs a
+  // multiple of the sparse block size as well, 128 for 32 bit formats and
+  // 256 for BC formats on most devices. Returns false if the texture cannot
+  // be paged.
+  bool AddVirtualTexture(const char* name,
+                         const TextureData& texture,
+                         uint32_t pageSize,
+                         bool compress = true);
+
+  void AddSpirv(const char* name, const void* code, size_t size);
+
+  bool Write(const char* fileName) const;
+
+  struct Blob
+  {
+    std::string name = {};
+    PackEntryType type = PACK_ENTRY_RAW;
+    PackCompression compression = PACK_COMPRESSION_NONE;
+    uint32_t chunkCount = 0;
+    uint64_t payloadSize = 0;
+    std::vector<uint8_t> data = {}; // as stored in the file
+  };
+
+  std::vector<Blob> blobs = {};
+};
+
+// Read-only view of a pack file mapped into the address space. Nothing is
+// parsed beyond the header, the table of contents is searched in place and
+// pages of blobs are only read when they are touched.
+//
+// All const methods are thread safe.
+struct AssetPack
+{
+  bool Open(const char* fileName);
+  void Close();
+
+  bool IsOpen() const { return data != nullptr; }
+
+  uint32_t GetEntryCount() const { return header->entryCount; }
+  const PackEntry& GetEntry(uint32_t index) const { return entries[index]; }
+  const char* GetName(const PackEntry& entry) const;
+
+  // nullptr if the pack has no entry of that name
+  const PackEntry* Find(const char* name) const;
+
+  // The blob as stored in the file, i.e. the payload itself if it is
+  // uncompressed. Stays valid until Close.
+  const uint8_t* GetMappedBlob(const PackEntry& entry) const;
+  // nullptr for compressed entries
+  const uint8_t* GetMappedPayload(const PackEntry& entry) const;
+
+  // Copies the bytes [offset, offset + size) of the payload to dst, e.g. a
+  // mapped staging buffer, and decompresses only the chunks in the range.
+  bool ReadRange(const PackEntry& entry,
+                 uint64_t offset,
+                 uint64_t size,
+                 void* dst) const;
+  bool Read(const PackEntry& entry, void* dst) const
+  {
+    return ReadRange(entry, 0, entry.payloadSize, dst);
+  }
+  std::string Read(const PackEntry& entry) const;
+
+  const uint8_t* data = nullptr;
+  uint64_t size = 0;
+  const PackHeader* header = nullptr;
+  const PackEntry* entries = nullptr;
+  const char* names = nullptr;
+
+  // platform handles of the mapping
+  void* file = nullptr;
+  void* mapping = nullptr;
+};
@@ -0,0 +1,176 @@
+#include "permutations.h"
+
+#include <algorithm> // find_if
+#include <cstring>   // memcpy
+
+#include "vk_utils.h"
+
+PipelinePermutations::~PipelinePermutations()
+{
+  if (precompileThread.joinable()) {
+    precompileThread.join();
+  }
+}
+
+void
+PipelinePermutations::AddAxis(VkShaderStageFlagBits stage,
+                              uint32_t constantID,
+                              std::initializer_list<uint32_t> values)
+{
+  ASSERT_TRUE(variants.size() == 0);
+  ASSERT_TRUE(values.size() > 0);
+
+  Axis axis = {};
+  axis.stage = stage;
+  axis.constantID = constantID;
+  axis.values = values;
+  axes.push_back(axis);
+}
+
+uint32_t
+PipelinePermutations::GetVariantCount() const
+{
+  uint32_t count = 1;
+  for (auto const& axis : axes) {
+    count *= static_cast<uint32_t>(axis.values.size());
+  }
+  return count;
+}
+
+uint32_t
+PipelinePermutations::GetVariant(
+  std::initializer_list<uint32_t> valueIndices) const
+{
+  ASSERT_TRUE(valueIndices.size() == axes.size());
+
+  // mixed radix, the first axis varies fastest
+  uint32_t variant = 0;
+  uint32_t stride = 1;
+  auto index = valueIndices.begin();
+  for (auto const& axis : axes) {
+    ASSERT_TRUE(*index < axis.values.size());
+    variant += *index * stride;
+    stride *= static_cast<uint32_t>(axis.values.size());
+    ++index;
+  }
+  return variant;
+}
+
+PipelineHandle
+PipelinePermutations::GetPipeline(uint32_t variant)
+{
+  CompileVariant(variant);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Variant& v = variants[variant];
+  if (v.handle.IsNull()) {
+    v.handle = resources->pipelines.Add(v.pipeline);
+    v.pipeline = Pipeline();
+  }
+  return v.handle;
+}
+
+void
+PipelinePermutations::CompileVariant(uint32_t variant)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  if (variants.size() == 0) {
+    variants.resize(GetVariantCount());
+  }
+  ASSERT_TRUE(variant < variants.size());
+
+  if (!variants[variant].compiled && !variants[variant].compiling) {
+    variants[variant].compiling = true;
+
+    lock.unlock();
+    Pipeline pipeline = Compile(variant);
+    lock.lock();
+
+    variants[variant].pipeline = std::move(pipeline);
+    variants[variant].compiling = false;
+    variants[variant].compiled = true;
+    compiled.notify_all();
+  }
+
+  compiled.wait(lock, [&]() { return variants[variant].compiled; });
+}
+
+void
+PipelinePermutations::Precompile(std::initializer_list<uint32_t> hotVariants)
+{
+  if (precompileThread.joinable()) {
+    precompileThread.join();
+  }
+
+  std::vector<uint32_t> pending = hotVariants;
+  precompileThread = std::thread([this, pending]() {
+    for (auto variant : pending) {
+      CompileVariant(variant);
+    }
+  });
+}
+
+void
+PipelinePermutations::Retire(DeletionQueue& queue, uint64_t value)
+{
+  if (precompileThread.joinable()) {
+    precompileThread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto& variant : variants) {
+    if (!variant.handle.IsNull()) {
+      resources->pipelines.Get(variant.handle)->Retire(queue, value);
+      resources->pipelines.Remove(variant.handle);
+    } else if (variant.compiled) {
+      variant.pipeline.Retire(queue, value);
+    }
+    variant = Variant();
+  }
+}
+
+Pipeline
+PipelinePermutations::Compile(uint32_t variant)
+{
+  PipelineState variantState = state;
+
+  for (auto const& axis : axes) {
+    uint32_t count = static_cast<uint32_t>(axis.values.size());
+    uint32_t value = axis.values[variant % count];
+    variant /= count;
+
+    // append the constant to the stage's own specialization
+    auto& shader = variantState.shader;
+    auto stage = std::find_if(
+      shader.stages,
+      shader.stages + shader.stageCount,
+      [&axis](const PipelineState::ShaderState::ShaderStage& stage) {
+        return stage.stage == axis.stage;
+      });
+    ASSERT_TRUE(stage != shader.stages + shader.stageCount);
+
+    auto& specialization = stage->specialization;
+    ASSERT_TRUE(specialization.mapEntryCount <
+                PipelineState::ShaderState::ShaderStage::Specialization::
+                  MAX_NUM_MAP_ENTRIES);
+    ASSERT_TRUE(specialization.dataSize + sizeof(value) <=
+                PipelineState::ShaderState::ShaderStage::Specialization::
+                  MAX_DATA_SIZE);
+
+    auto& mapEntry = specialization.mapEntries[specialization.mapEntryCount];
+    mapEntry.constantID = axis.constantID;
+    mapEntry.offset = static_cast<uint32_t>(specialization.dataSize);
+    mapEntry.size = sizeof(value);
+    memcpy(
+      specialization.data + specialization.dataSize, &value, sizeof(value));
+
+    specialization.mapEntryCount += 1;
+    specialization.dataSize += sizeof(value);
+  }
+
+  Pipeline pipeline(device, variantState, renderPass, subpass, cache);
+  pipeline.Compile();
+  return pipeline;
+}
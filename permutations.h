@@ -0,0 +1,105 @@
+#pragma once
+
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan\vulkan.h>
+
+#include "pipeline.h"
+#include "vk_base.h"
+
+// Variants of a pipeline that only differ in specialization constants.
+//
+// Every axis is one 32 bit constant of a shader stage with a list of values,
+// a variant picks one value per axis. Variants are compiled on first use or
+// ahead of time on a background thread by Precompile, e.g. for the variants
+// that are known to be needed right after startup. Module creation and
+// reflection are shared through the PipelineCache, so a variant only costs
+// the pipeline compile itself. Compiled variants go into
+// ResourcePools::pipelines once they are requested.
+class PipelinePermutations
+{
+
+public:
+  PipelinePermutations(VkDevice device,
+                       PipelineState state,
+                       VkRenderPass renderPass,
+                       uint32_t subpass,
+                       PipelineCache* cache,
+                       ResourcePools* resources)
+    : device(device)
+    , state(state)
+    , renderPass(renderPass)
+    , subpass(subpass)
+    , cache(cache)
+    , resources(resources)
+  {}
+
+  // waits for the background compile
+  ~PipelinePermutations();
+
+  PipelinePermutations(const PipelinePermutations&) = delete;
+  PipelinePermutations& operator=(const PipelinePermutations&) = delete;
+
+  // must be called before any variant is requested
+  void AddAxis(VkShaderStageFlagBits stage,
+               uint32_t constantID,
+               std::initializer_list<uint32_t> values);
+
+  uint32_t GetVariantCount() const;
+
+  // one index into the values of each axis, in the order they were added
+  uint32_t GetVariant(std::initializer_list<uint32_t> valueIndices) const;
+
+  // Returns the compiled pipeline of the variant. Compiles it on the calling
+  // thread if nobody did yet, waits if the background thread is on it. Only
+  // on the render thread, it adds the pipeline to resources.
+  PipelineHandle GetPipeline(uint32_t variant);
+
+  // compiles the variants on a background thread
+  void Precompile(std::initializer_list<uint32_t> hotVariants);
+
+  // hands all compiled variants to the queue and removes them from
+  // resources, see Pipeline::Retire
+  void Retire(DeletionQueue& queue, uint64_t value = 0);
+
+private:
+  struct Axis
+  {
+    VkShaderStageFlagBits stage = {};
+    uint32_t constantID = 0;
+    std::vector<uint32_t> values = {};
+  };
+
+  struct Variant
+  {
+    // compiled but not in resources yet, the background thread cannot add
+    Pipeline pipeline = {};
+    bool compiling = false;
+    bool compiled = false;
+    PipelineHandle handle = {};
+  };
+
+  // compiles the variant unless somebody did, waits if another thread is on
+  // it, thread safe
+  void CompileVariant(uint32_t variant);
+  Pipeline Compile(uint32_t variant);
+
+  // passed into constructor
+  VkDevice device;
+  PipelineState state;
+  VkRenderPass renderPass;
+  uint32_t subpass;
+  PipelineCache* cache;
+  ResourcePools* resources;
+
+  std::vector<Axis> axes = {};
+
+  std::vector<Variant> variants = {};
+  std::mutex mutex;
+  std::condition_variable compiled;
+
+  std::thread precompileThread;
+};
@@ -1,4 +1,6 @@
 #include "pipeline.h"
+#include "deletion.h"
+#include "pack.h"
 #include "vk_utils.h"
 #include <algorithm>
 #include <map>
@@ -31,6 +33,26 @@ ReadFile(const char* fileName)
   return buff;
 }
 
+static const AssetPack* shaderPack = nullptr;
+
+void
+SetShaderPack(const AssetPack* pack)
+{
+  shaderPack = pack;
+}
+
+std::string
+ReadShader(const char* shaderName)
+{
+  if (shaderPack != nullptr) {
+    const PackEntry* entry = shaderPack->Find(shaderName);
+    if (entry != nullptr && entry->type == PACK_ENTRY_SPIRV) {
+      return shaderPack->Read(*entry);
+    }
+  }
+  return ReadFile(shaderName);
+}
+
 uint32_t
 ReadDescriptorCount(const spirv_cross::SPIRType& type)
 {
@@ -163,46 +185,44 @@ ReflectLayout(const std::string& code,
 }
 
 void
-Pipeline::Compile()
+CreatePipelineLayout(
+  VkDevice device,
+  const Pipeline::ShaderLayout* layouts,
+  uint32_t layoutCount,
+  std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>>& sets,
+  std::vector<VkDescriptorSetLayout>& descriptorSetLayouts,
+  VkPushConstantRange* pushConstantRanges,
+  uint32_t& pushConstantRangeCount,
+  VkPipelineLayout& pipelineLayout)
 {
-  const char*
-    shaderNames[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
-
-  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
-    const char* name = state.shader.stages[i].shaderName;
-
-    shaderNames[i] = name;
-  }
-
-  // TODO: check if pipeline layout exists
-
-  ShaderLayout layouts[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
-  VkShaderModule
-    shaderModules[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
-
-  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
-    auto code = ReadFile(shaderNames[i]);
-    ReflectLayout(code, state.shader.stages[i].stage, layouts[i]);
-
-    // TODO: check if module exists
-
-    shaderModules[i] = vkuCreateShaderModule(
-      device, code.size(), (uint32_t*)code.data(), nullptr);
-  }
-
   uint32_t last = std::numeric_limits<uint32_t>::min();
 
-  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
+  for (uint32_t i = 0; i < layoutCount; ++i) {
     for (uint32_t j = 0; j < layouts[i].bindingCount; ++j) {
       auto set = layouts[i].bindings[j].set;
       auto binding = layouts[i].bindings[j].binding;
       last = std::max(last, set);
-      sets[set].push_back(binding);
+
+      // the same binding may be used by several stages
+      auto& bindings = sets[set];
+      auto iter =
+        std::find_if(bindings.begin(),
+                     bindings.end(),
+                     [&binding](const VkDescriptorSetLayoutBinding& b) {
+                       return b.binding == binding.binding;
+                     });
+      if (iter != bindings.end()) {
+        ASSERT_TRUE(iter->descriptorType == binding.descriptorType);
+        iter->stageFlags |= binding.stageFlags;
+      } else {
+        bindings.push_back(binding);
+      }
     }
 
     if (layouts[i].pushConstantRangeCount > 0) {
       pushConstantRanges[0].offset = layouts[i].pushConstantRanges[0].offset;
-      pushConstantRanges[0].size = layouts[i].pushConstantRanges[0].size;
+      pushConstantRanges[0].size = std::max(
+        pushConstantRanges[0].size, layouts[i].pushConstantRanges[0].size);
       pushConstantRanges[0].stageFlags |=
         layouts[i].pushConstantRanges[0].stageFlags;
       pushConstantRangeCount = 1;
@@ -233,35 +253,111 @@ Pipeline::Compile()
     }
   }
 
-  {
-    auto createInfo = vkiPipelineLayoutCreateInfo(
-      static_cast<uint32_t>(descriptorSetLayouts.size()),
-      descriptorSetLayouts.data(),
-      pushConstantRangeCount,
-      pushConstantRanges);
+  auto createInfo = vkiPipelineLayoutCreateInfo(
+    static_cast<uint32_t>(descriptorSetLayouts.size()),
+    descriptorSetLayouts.data(),
+    pushConstantRangeCount,
+    pushConstantRanges);
+
+  ASSERT_VK_SUCCESS(
+    vkCreatePipelineLayout(device, &createInfo, nullptr, &pipelineLayout));
+}
+
+VkSpecializationInfo
+GetSpecializationInfo(
+  const PipelineState::ShaderState::ShaderStage::Specialization& specialization)
+{
+  VkSpecializationInfo specializationInfo = {};
+  specializationInfo.dataSize = specialization.dataSize;
+  specializationInfo.pData = specialization.data;
+  specializationInfo.mapEntryCount = specialization.mapEntryCount;
+  specializationInfo.pMapEntries = specialization.mapEntries;
+  return specializationInfo;
+}
 
-    ASSERT_VK_SUCCESS(
-      vkCreatePipelineLayout(device, &createInfo, nullptr, &pipelineLayout));
+// Reflects the shader and returns its module, both are shared through the
+// cache if there is one.
+VkShaderModule
+CreateShaderModule(VkDevice device,
+                   PipelineCache* cache,
+                   const char* shaderName,
+                   VkShaderStageFlagBits stage,
+                   Pipeline::ShaderLayout& layout)
+{
+  if (cache != nullptr) {
+    auto const& shaderModule = cache->GetShaderModule(shaderName, stage);
+    layout = shaderModule.layout;
+    return shaderModule.module;
   }
+
+  auto code = ReadShader(shaderName);
+  ReflectLayout(code, stage, layout);
+
+  return vkuCreateShaderModule(
+    device, code.size(), (uint32_t*)code.data(), nullptr);
+}
+
+void
+DestroyShaderModule(VkDevice device,
+                    PipelineCache* cache,
+                    VkShaderModule shaderModule)
+{
+  // shared modules are destroyed by PipelineCache::Destroy
+  if (cache == nullptr) {
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+  }
+}
+
+void
+Pipeline::Compile()
+{
+  const char*
+    shaderNames[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
+
+  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
+    const char* name = state.shader.stages[i].shaderName;
+
+    shaderNames[i] = name;
+  }
+
+  // TODO: check if pipeline layout exists
+
+  ShaderLayout layouts[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
+  VkShaderModule
+    shaderModules[PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
+
+  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
+    shaderModules[i] = CreateShaderModule(device,
+                                          cache,
+                                          shaderNames[i],
+                                          state.shader.stages[i].stage,
+                                          layouts[i]);
+  }
+
+  CreatePipelineLayout(device,
+                       layouts,
+                       state.shader.stageCount,
+                       sets,
+                       descriptorSetLayouts,
+                       pushConstantRanges,
+                       pushConstantRangeCount,
+                       pipelineLayout);
+
   {
+    VkSpecializationInfo specializationInfos
+      [PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
     VkPipelineShaderStageCreateInfo shaderStageCreateInfos
       [PipelineState::ShaderState::MAX_NUM_SHADER_STAGES] = {};
 
     for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
-      VkSpecializationInfo specializationInfo = {};
-      specializationInfo.dataSize =
-        state.shader.stages[i].specialization.dataSize;
-      specializationInfo.pData = state.shader.stages[i].specialization.data;
-      specializationInfo.mapEntryCount =
-        state.shader.stages[i].specialization.mapEntryCount;
-      specializationInfo.pMapEntries =
-        state.shader.stages[i].specialization.mapEntries;
+      specializationInfos[i] =
+        GetSpecializationInfo(state.shader.stages[i].specialization);
 
       shaderStageCreateInfos[i] =
         vkiPipelineShaderStageCreateInfo(state.shader.stages[i].stage,
                                          shaderModules[i],
                                          "main",
-                                         &specializationInfo);
+                                         &specializationInfos[i]);
     }
 
     VkPipelineColorBlendStateCreateInfo blendStateCreateInfo = {};
@@ -332,6 +428,405 @@ Pipeline::Compile()
       renderPass,
       subpass,
       VK_NULL_HANDLE,
-      -1);
+      -1,
+      cache != nullptr ? cache->cache : VK_NULL_HANDLE);
+  }
+
+  for (uint32_t i = 0; i < state.shader.stageCount; ++i) {
+    DestroyShaderModule(device, cache, shaderModules[i]);
+  }
+
+  dynamicMask = 0;
+  for (uint32_t i = 0; i < state.dynamic.dynamicStateCount; ++i) {
+    // only the core states fit, extensions use large enum values
+    if (state.dynamic.dynamicStates[i] < 32) {
+      dynamicMask |= 1u << state.dynamic.dynamicStates[i];
+    }
+  }
+}
+
+void
+Pipeline::Bind(VkCommandBuffer cmdBuffer, DynamicStateCache* cache)
+{
+  DynamicStateCache uncached = {};
+  if (cache == nullptr) {
+    cache = &uncached;
+  }
+
+  cache->BindPipeline(cmdBuffer, pipeline, dynamicMask);
+
+  auto isDynamic = [this](VkDynamicState state) {
+    return (dynamicMask & (1u << state)) != 0;
+  };
+
+  if (isDynamic(VK_DYNAMIC_STATE_LINE_WIDTH)) {
+    cache->SetLineWidth(cmdBuffer, state.rasterization.lineWidth);
+  }
+
+  if (isDynamic(VK_DYNAMIC_STATE_DEPTH_BIAS)) {
+    cache->SetDepthBias(cmdBuffer,
+                        state.rasterization.depthBiasConstantFactor,
+                        state.rasterization.depthBiasClamp,
+                        state.rasterization.depthBiasSlopeFactor);
+  }
+
+  if (isDynamic(VK_DYNAMIC_STATE_BLEND_CONSTANTS)) {
+    cache->SetBlendConstants(cmdBuffer, state.blend.blendConstants);
+  }
+
+  if (isDynamic(VK_DYNAMIC_STATE_DEPTH_BOUNDS)) {
+    cache->SetDepthBounds(cmdBuffer,
+                          state.depthStencil.minDepthBounds,
+                          state.depthStencil.maxDepthBounds);
+  }
+
+  auto const& front = state.depthStencil.front;
+  auto const& back = state.depthStencil.back;
+
+  if (isDynamic(VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK)) {
+    cache->SetStencilCompareMask(
+      cmdBuffer, VK_STENCIL_FACE_FRONT_BIT, front.compareMask);
+    cache->SetStencilCompareMask(
+      cmdBuffer, VK_STENCIL_FACE_BACK_BIT, back.compareMask);
+  }
+
+  if (isDynamic(VK_DYNAMIC_STATE_STENCIL_WRITE_MASK)) {
+    cache->SetStencilWriteMask(
+      cmdBuffer, VK_STENCIL_FACE_FRONT_BIT, front.writeMask);
+    cache->SetStencilWriteMask(
+      cmdBuffer, VK_STENCIL_FACE_BACK_BIT, back.writeMask);
+  }
+
+  if (isDynamic(VK_DYNAMIC_STATE_STENCIL_REFERENCE)) {
+    cache->SetStencilReference(
+      cmdBuffer, VK_STENCIL_FACE_FRONT_BIT, front.reference);
+    cache->SetStencilReference(
+      cmdBuffer, VK_STENCIL_FACE_BACK_BIT, back.reference);
+  }
+}
+
+void
+RetirePipeline(DeletionQueue& queue,
+               uint64_t value,
+               VkPipeline& pipeline,
+               VkPipelineLayout& pipelineLayout,
+               std::vector<VkDescriptorSetLayout>& descriptorSetLayouts)
+{
+  queue.Push(VK_OBJECT_TYPE_PIPELINE, ToHandle64(pipeline), value);
+  queue.Push(VK_OBJECT_TYPE_PIPELINE_LAYOUT, ToHandle64(pipelineLayout), value);
+  for (auto setLayout : descriptorSetLayouts) {
+    queue.Push(
+      VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, ToHandle64(setLayout), value);
+  }
+
+  pipeline = VK_NULL_HANDLE;
+  pipelineLayout = VK_NULL_HANDLE;
+  descriptorSetLayouts.clear();
+}
+
+void
+Pipeline::Retire(DeletionQueue& queue, uint64_t value)
+{
+  RetirePipeline(queue, value, pipeline, pipelineLayout, descriptorSetLayouts);
+  sets.clear();
+}
+
+void
+ComputePipeline::Compile()
+{
+  Pipeline::ShaderLayout layout = {};
+  VkShaderModule shaderModule =
+    CreateShaderModule(device, cache, stage.shaderName, stage.stage, layout);
+
+  CreatePipelineLayout(device,
+                       &layout,
+                       1,
+                       sets,
+                       descriptorSetLayouts,
+                       pushConstantRanges,
+                       pushConstantRangeCount,
+                       pipelineLayout);
+
+  VkSpecializationInfo specializationInfo =
+    GetSpecializationInfo(stage.specialization);
+
+  pipeline = vkuCreateComputePipeline(
+    device,
+    vkiPipelineShaderStageCreateInfo(
+      stage.stage, shaderModule, "main", &specializationInfo),
+    pipelineLayout,
+    cache != nullptr ? cache->cache : VK_NULL_HANDLE);
+
+  DestroyShaderModule(device, cache, shaderModule);
+}
+
+void
+ComputePipeline::Retire(DeletionQueue& queue, uint64_t value)
+{
+  RetirePipeline(queue, value, pipeline, pipelineLayout, descriptorSetLayouts);
+  sets.clear();
+}
+
+void
+DynamicStateCache::BindPipeline(VkCommandBuffer cmdBuffer,
+                                VkPipeline pipeline,
+                                uint32_t dynamicMask)
+{
+  // static state of the pipeline leaves the dynamic values undefined
+  validMask &= dynamicMask;
+
+  const VkDynamicState stencilStates[3] = {
+    VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK,
+    VK_DYNAMIC_STATE_STENCIL_WRITE_MASK,
+    VK_DYNAMIC_STATE_STENCIL_REFERENCE,
+  };
+  for (uint32_t i = 0; i < 3; ++i) {
+    if ((dynamicMask & (1u << stencilStates[i])) == 0) {
+      stencilValidFaces[i] = 0;
+    }
+  }
+
+  if (this->pipeline == pipeline) {
+    return;
+  }
+
+  vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  this->pipeline = pipeline;
+}
+
+void
+DynamicStateCache::SetViewport(VkCommandBuffer cmdBuffer,
+                               const VkViewport& viewport)
+{
+  if (IsValid(VK_DYNAMIC_STATE_VIEWPORT) &&
+      memcmp(&this->viewport, &viewport, sizeof(VkViewport)) == 0) {
+    return;
   }
+
+  vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+  this->viewport = viewport;
+  SetValid(VK_DYNAMIC_STATE_VIEWPORT);
+}
+
+void
+DynamicStateCache::SetScissor(VkCommandBuffer cmdBuffer,
+                              const VkRect2D& scissor)
+{
+  if (IsValid(VK_DYNAMIC_STATE_SCISSOR) &&
+      memcmp(&this->scissor, &scissor, sizeof(VkRect2D)) == 0) {
+    return;
+  }
+
+  vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+  this->scissor = scissor;
+  SetValid(VK_DYNAMIC_STATE_SCISSOR);
+}
+
+void
+DynamicStateCache::SetLineWidth(VkCommandBuffer cmdBuffer, float lineWidth)
+{
+  if (IsValid(VK_DYNAMIC_STATE_LINE_WIDTH) && this->lineWidth == lineWidth) {
+    return;
+  }
+
+  vkCmdSetLineWidth(cmdBuffer, lineWidth);
+  this->lineWidth = lineWidth;
+  SetValid(VK_DYNAMIC_STATE_LINE_WIDTH);
+}
+
+void
+DynamicStateCache::SetDepthBias(VkCommandBuffer cmdBuffer,
+                                float constantFactor,
+                                float clamp,
+                                float slopeFactor)
+{
+  float depthBias[3] = { constantFactor, clamp, slopeFactor };
+  if (IsValid(VK_DYNAMIC_STATE_DEPTH_BIAS) &&
+      memcmp(this->depthBias, depthBias, sizeof(depthBias)) == 0) {
+    return;
+  }
+
+  vkCmdSetDepthBias(cmdBuffer, constantFactor, clamp, slopeFactor);
+  memcpy(this->depthBias, depthBias, sizeof(depthBias));
+  SetValid(VK_DYNAMIC_STATE_DEPTH_BIAS);
+}
+
+void
+DynamicStateCache::SetBlendConstants(VkCommandBuffer cmdBuffer,
+                                     const float blendConstants[4])
+{
+  if (IsValid(VK_DYNAMIC_STATE_BLEND_CONSTANTS) &&
+      memcmp(this->blendConstants, blendConstants, sizeof(float) * 4) == 0) {
+    return;
+  }
+
+  vkCmdSetBlendConstants(cmdBuffer, blendConstants);
+  memcpy(this->blendConstants, blendConstants, sizeof(float) * 4);
+  SetValid(VK_DYNAMIC_STATE_BLEND_CONSTANTS);
+}
+
+void
+DynamicStateCache::SetDepthBounds(VkCommandBuffer cmdBuffer,
+                                  float min,
+                                  float max)
+{
+  if (IsValid(VK_DYNAMIC_STATE_DEPTH_BOUNDS) && depthBounds[0] == min &&
+      depthBounds[1] == max) {
+    return;
+  }
+
+  vkCmdSetDepthBounds(cmdBuffer, min, max);
+  depthBounds[0] = min;
+  depthBounds[1] = max;
+  SetValid(VK_DYNAMIC_STATE_DEPTH_BOUNDS);
+}
+
+namespace {
+
+// Updates the values of the given faces and returns the faces that changed.
+VkStencilFaceFlags
+UpdateStencilValues(VkStencilFaceFlags& validFaces,
+                    uint32_t values[2],
+                    VkStencilFaceFlags faces,
+                    uint32_t value)
+{
+  VkStencilFaceFlags changed = 0;
+
+  const VkStencilFaceFlagBits bits[2] = { VK_STENCIL_FACE_FRONT_BIT,
+                                          VK_STENCIL_FACE_BACK_BIT };
+  for (uint32_t i = 0; i < 2; ++i) {
+    if ((faces & bits[i]) && (!(validFaces & bits[i]) || values[i] != value)) {
+      values[i] = value;
+      changed |= bits[i];
+    }
+  }
+
+  validFaces |= faces;
+  return changed;
+}
+
+} // namespace
+
+void
+DynamicStateCache::SetStencilCompareMask(VkCommandBuffer cmdBuffer,
+                                         VkStencilFaceFlags faces,
+                                         uint32_t compareMask)
+{
+  VkStencilFaceFlags changed = UpdateStencilValues(
+    stencilValidFaces[0], stencilCompareMask, faces, compareMask);
+  if (changed != 0) {
+    vkCmdSetStencilCompareMask(cmdBuffer, changed, compareMask);
+  }
+}
+
+void
+DynamicStateCache::SetStencilWriteMask(VkCommandBuffer cmdBuffer,
+                                       VkStencilFaceFlags faces,
+                                       uint32_t writeMask)
+{
+  VkStencilFaceFlags changed = UpdateStencilValues(
+    stencilValidFaces[1], stencilWriteMask, faces, writeMask);
+  if (changed != 0) {
+    vkCmdSetStencilWriteMask(cmdBuffer, changed, writeMask);
+  }
+}
+
+void
+DynamicStateCache::SetStencilReference(VkCommandBuffer cmdBuffer,
+                                       VkStencilFaceFlags faces,
+                                       uint32_t reference)
+{
+  VkStencilFaceFlags changed = UpdateStencilValues(
+    stencilValidFaces[2], stencilReference, faces, reference);
+  if (changed != 0) {
+    vkCmdSetStencilReference(cmdBuffer, changed, reference);
+  }
+}
+
+void
+PipelineCache::Create(VkDevice device,
+                      const VkPhysicalDeviceProperties& props,
+                      const char* fileName)
+{
+  this->device = device;
+  this->props = props;
+  this->fileName = fileName;
+
+  auto data = ReadFile(fileName);
+
+  // Some drivers do not validate the data themselves. Header version one is
+  // headerSize, headerVersion, vendorID, deviceID and pipelineCacheUUID.
+  uint32_t header[4] = {};
+  bool valid = data.size() >= sizeof(header) + VK_UUID_SIZE;
+  if (valid) {
+    memcpy(header, data.data(), sizeof(header));
+    valid = header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header[2] == props.vendorID && header[3] == props.deviceID &&
+            memcmp(data.data() + sizeof(header),
+                   props.pipelineCacheUUID,
+                   VK_UUID_SIZE) == 0;
+  }
+  if (!valid) {
+    data.clear();
+  }
+
+  auto createInfo = vkiPipelineCacheCreateInfo(data.size(), data.data());
+  ASSERT_VK_SUCCESS(
+    vkCreatePipelineCache(device, &createInfo, nullptr, &cache));
+}
+
+void
+PipelineCache::Save()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  size_t size = 0;
+  ASSERT_VK_SUCCESS(vkGetPipelineCacheData(device, cache, &size, nullptr));
+  std::string data(size, '\0');
+  ASSERT_VK_SUCCESS(
+    vkGetPipelineCacheData(device, cache, &size, &(*data.begin())));
+
+  FILE* file = 0;
+  fopen_s(&file, fileName.c_str(), "wb");
+  if (file) {
+    fwrite(data.data(), 1, size, file);
+    fclose(file);
+  }
+}
+
+void
+PipelineCache::Destroy()
+{
+  for (auto& kv : shaderModules) {
+    vkDestroyShaderModule(device, kv.second.module, nullptr);
+  }
+  shaderModules.clear();
+
+  vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
+
+const PipelineCache::ShaderModule&
+PipelineCache::GetShaderModule(const char* shaderName,
+                               VkShaderStageFlagBits stage)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto iter = shaderModules.find(shaderName);
+  if (iter != shaderModules.end()) {
+    ASSERT_TRUE(iter->second.stage == stage);
+    return iter->second;
+  }
+
+  ShaderModule shaderModule = {};
+  shaderModule.code = ReadShader(shaderName);
+  shaderModule.stage = stage;
+  ReflectLayout(shaderModule.code, stage, shaderModule.layout);
+  shaderModule.module = vkuCreateShaderModule(
+    device,
+    shaderModule.code.size(),
+    (uint32_t*)shaderModule.code.data(),
+    nullptr);
+
+  return shaderModules[shaderName] = shaderModule;
 }
@@ -3,29 +3,110 @@
 #include <vulkan/vulkan.h>
 
 #include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "pipeline_state.h"
 
+struct AssetPack;
+struct DeletionQueue;
+
+struct PipelineCache;
+
+// Shaders are looked up by their file name in this pack before the file
+// system, e.g. in one written by tools/packer.cpp with --spirv. The pack has
+// to stay open while pipelines are created, nullptr disables it.
+void
+SetShaderPack(const AssetPack* pack);
+
+// Graphics pipeline and dynamic state of a command buffer. Binds and sets that
+// would not change anything are skipped, Reset it when a command buffer is
+// begun.
+struct DynamicStateCache
+{
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  // bit per VkDynamicState whose current value is known, except the stencil
+  // states, which are tracked per face
+  uint32_t validMask = 0;
+
+  VkViewport viewport = {};
+  VkRect2D scissor = {};
+  float lineWidth = 0.f;
+  float depthBias[3] = {}; // constant factor, clamp, slope factor
+  float blendConstants[4] = {};
+  float depthBounds[2] = {};
+  // indexed by front and back face
+  uint32_t stencilCompareMask[2] = {};
+  uint32_t stencilWriteMask[2] = {};
+  uint32_t stencilReference[2] = {};
+  // faces with known values for compare mask, write mask and reference
+  VkStencilFaceFlags stencilValidFaces[3] = {};
+
+  void Reset() { *this = DynamicStateCache(); }
+
+  // dynamicMask: bit per VkDynamicState that is dynamic in the pipeline, the
+  // other states are overwritten by the pipeline
+  void BindPipeline(VkCommandBuffer cmdBuffer,
+                    VkPipeline pipeline,
+                    uint32_t dynamicMask);
+
+  void SetViewport(VkCommandBuffer cmdBuffer, const VkViewport& viewport);
+  void SetScissor(VkCommandBuffer cmdBuffer, const VkRect2D& scissor);
+  void SetLineWidth(VkCommandBuffer cmdBuffer, float lineWidth);
+  void SetDepthBias(VkCommandBuffer cmdBuffer,
+                    float constantFactor,
+                    float clamp,
+                    float slopeFactor);
+  void SetBlendConstants(VkCommandBuffer cmdBuffer,
+                         const float blendConstants[4]);
+  void SetDepthBounds(VkCommandBuffer cmdBuffer, float min, float max);
+  void SetStencilCompareMask(VkCommandBuffer cmdBuffer,
+                             VkStencilFaceFlags faces,
+                             uint32_t compareMask);
+  void SetStencilWriteMask(VkCommandBuffer cmdBuffer,
+                           VkStencilFaceFlags faces,
+                           uint32_t writeMask);
+  void SetStencilReference(VkCommandBuffer cmdBuffer,
+                           VkStencilFaceFlags faces,
+                           uint32_t reference);
+
+private:
+  bool IsValid(VkDynamicState state) const
+  {
+    return (validMask & (1u << state)) != 0;
+  }
+  void SetValid(VkDynamicState state) { validMask |= 1u << state; }
+};
+
+// Stored by value in ResourcePools::pipelines, see PipelineHandle.
 class Pipeline
 {
 
 public:
+  Pipeline() = default;
   Pipeline(VkDevice device,
            PipelineState state,
            VkRenderPass renderPass,
-           uint32_t subpass)
+           uint32_t subpass,
+           PipelineCache* cache = nullptr)
     : device(device)
     , state(state)
     , renderPass(renderPass)
     , subpass(subpass)
+    , cache(cache)
   {}
 
   void Compile();
-  void Bind(VkCommandBuffer cmdBuffer)
-  {
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-  }
+
+  // hands the Vulkan objects to the queue, Compile creates new ones
+  void Retire(DeletionQueue& queue, uint64_t value = 0);
+
+  // Binds the pipeline and sets its dynamic states, except viewport and
+  // scissor, to the values of its PipelineState. Without a cache every state
+  // is set.
+  void Bind(VkCommandBuffer cmdBuffer, DynamicStateCache* cache = nullptr);
 
   void BindDescriptorSets(VkCommandBuffer cmdBuffer,
                           uint32_t firstSet,
@@ -44,6 +125,16 @@ public:
                             dynamicOffsets);
   }
 
+  void PushConstants(VkCommandBuffer cmdBuffer,
+                     VkShaderStageFlags stageFlags,
+                     uint32_t offset,
+                     uint32_t size,
+                     const void* values)
+  {
+    vkCmdPushConstants(
+      cmdBuffer, pipelineLayout, stageFlags, offset, size, values);
+  }
+
   struct ShaderLayout
   {
     static const uint32_t MAX_NUM_DESCRIPTOR_SET_LAYOUT_BINDINGS = 16;
@@ -74,10 +165,11 @@ public:
 
 private:
   // passed into constructor
-  VkDevice device;
-  PipelineState state;
-  VkRenderPass renderPass;
-  uint32_t subpass;
+  VkDevice device = VK_NULL_HANDLE;
+  PipelineState state = {};
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+  PipelineCache* cache = nullptr;
 
   // reflection info
   std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>> sets = {};
@@ -90,4 +182,111 @@ private:
   VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
 
   VkPipeline pipeline = VK_NULL_HANDLE;
+
+  // bit per VkDynamicState in state.dynamic
+  uint32_t dynamicMask = 0;
+};
+
+// Shares what pipelines have in common across compiles. Shader modules are
+// created and reflected once per SPIR-V file and kept until Destroy, and all
+// pipelines go through one VkPipelineCache that is persisted between runs, so
+// the driver can skip stages it has compiled before.
+//
+// Stands in for VK_EXT_graphics_pipeline_library, which the bundled Vulkan
+// headers do not have. All methods are thread safe.
+struct PipelineCache
+{
+  struct ShaderModule
+  {
+    std::string code = {}; // SPIR-V
+    VkShaderModule module = VK_NULL_HANDLE;
+    VkShaderStageFlagBits stage = {};
+    Pipeline::ShaderLayout layout = {};
+  };
+
+  // fileName: initial data of the VkPipelineCache, ignored if it was written
+  // by a different device or driver
+  void Create(VkDevice device,
+              const VkPhysicalDeviceProperties& props,
+              const char* fileName);
+  // writes the VkPipelineCache to the file given to Create
+  void Save();
+  void Destroy();
+
+  // valid until Destroy, a shader file is used for a single stage
+  const ShaderModule& GetShaderModule(const char* shaderName,
+                                      VkShaderStageFlagBits stage);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties props = {};
+  std::string fileName = {};
+
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  std::map<std::string, ShaderModule> shaderModules = {};
+  std::mutex mutex;
+};
+
+// Stored by value in ResourcePools::computePipelines.
+class ComputePipeline
+{
+
+public:
+  ComputePipeline() = default;
+  ComputePipeline(VkDevice device,
+                  PipelineState::ShaderState::ShaderStage stage,
+                  PipelineCache* cache = nullptr)
+    : device(device)
+    , stage(stage)
+    , cache(cache)
+  {}
+
+  void Compile();
+
+  // see Pipeline::Retire
+  void Retire(DeletionQueue& queue, uint64_t value = 0);
+
+  void Bind(VkCommandBuffer cmdBuffer)
+  {
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  }
+
+  void BindDescriptorSets(VkCommandBuffer cmdBuffer,
+                          uint32_t firstSet,
+                          uint32_t descriptorSetCount,
+                          VkDescriptorSet* descriptorSets,
+                          uint32_t dynamicOffsetCount,
+                          uint32_t* dynamicOffsets)
+  {
+    vkCmdBindDescriptorSets(cmdBuffer,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout,
+                            firstSet,
+                            descriptorSetCount,
+                            descriptorSets,
+                            dynamicOffsetCount,
+                            dynamicOffsets);
+  }
+
+  VkDescriptorSetLayout GetDescriptorSetLayout(uint32_t set)
+  {
+    return descriptorSetLayouts[set];
+  }
+
+private:
+  // passed into constructor
+  VkDevice device = VK_NULL_HANDLE;
+  PipelineState::ShaderState::ShaderStage stage = {};
+  PipelineCache* cache = nullptr;
+
+  // reflection info
+  std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>> sets = {};
+  VkPushConstantRange
+    pushConstantRanges[Pipeline::ShaderLayout::MAX_NUM_PUSH_CONSTANT_RANGES] =
+      {};
+  uint32_t pushConstantRangeCount = 0;
+
+  std::vector<VkDescriptorSetLayout> descriptorSetLayouts = {};
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
 };
@@ -40,7 +40,7 @@ struct PipelineState
 
   struct DynamicState
   {
-    static const uint32_t MAX_NUM_DYNAMIC_STATES = 8;
+    static const uint32_t MAX_NUM_DYNAMIC_STATES = 16;
 
     VkDynamicState dynamicStates[MAX_NUM_DYNAMIC_STATES] = {};
     uint32_t dynamicStateCount = 0;
@@ -144,15 +144,100 @@ enum VertexAttributeFlagBits
   NORMAL = 0x00000002,
   TEXTURE_COORD = 0x00000004,
   COLOR = 0x00000008,
+  TANGENT = 0x00000010, // xyz direction, w bitangent sign
 };
 using VertexAttributeFlags = Flags;
 
+// Compressed attribute encodings, attributes without their bit use 32 bit
+// floats. The encoders are in vertex_format.h, the decoders for the shaders
+// in res/shaders/vertex_format.glsl.
+enum VertexEncodingFlagBits
+{
+  // R16G16B16A16_UNORM in the bounds of the mesh, transform with
+  // PositionQuantization::GetDequantizationMatrix
+  QUANTIZED_POSITION = 0x00000001,
+  // R16G16_SNORM octahedral normals and R8G8B8A8_SNORM tangents (octahedral
+  // xy, sign in w)
+  OCTAHEDRAL_NORMAL = 0x00000002,
+  HALF_TEXTURE_COORD = 0x00000004, // R16G16_SFLOAT
+  UNORM8_COLOR = 0x00000008,       // R8G8B8A8_UNORM
+  PACKED_VERTEX = 0x0000000F,
+};
+using VertexEncodingFlags = Flags;
+
+struct VertexAttributeFormat
+{
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t size = 0;
+};
+
+inline VertexAttributeFormat
+GetVertexAttributeFormat(VertexAttributeFlagBits attribute,
+                         VertexEncodingFlags encodingFlags)
+{
+  switch (attribute) {
+    case POSITION:
+      if (encodingFlags & QUANTIZED_POSITION) {
+        return { VK_FORMAT_R16G16B16A16_UNORM, sizeof(uint16_t) * 4 };
+      }
+      return { VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3 };
+    case NORMAL:
+      if (encodingFlags & OCTAHEDRAL_NORMAL) {
+        return { VK_FORMAT_R16G16_SNORM, sizeof(int16_t) * 2 };
+      }
+      return { VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3 };
+    case TEXTURE_COORD:
+      if (encodingFlags & HALF_TEXTURE_COORD) {
+        return { VK_FORMAT_R16G16_SFLOAT, sizeof(uint16_t) * 2 };
+      }
+      return { VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 2 };
+    case COLOR:
+      if (encodingFlags & UNORM8_COLOR) {
+        return { VK_FORMAT_R8G8B8A8_UNORM, sizeof(uint8_t) * 4 };
+      }
+      return { VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(float) * 4 };
+    case TANGENT:
+      if (encodingFlags & OCTAHEDRAL_NORMAL) {
+        return { VK_FORMAT_R8G8B8A8_SNORM, sizeof(int8_t) * 4 };
+      }
+      return { VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(float) * 4 };
+  }
+  return {};
+}
+
+// Attributes in the order of their locations and offsets within a binding.
+static const VertexAttributeFlagBits VERTEX_ATTRIBUTE_ORDER[] = {
+  POSITION, NORMAL, TEXTURE_COORD, COLOR, TANGENT
+};
+
+// Every binding is one tightly packed interleaved stream. Split positions
+// from the other attributes for depth and shadow passes, e.g.
+//   attributeFlags[0] = POSITION;
+//   attributeFlags[1] = NORMAL | TEXTURE_COORD;
+// and use GetPositionOnly for their pipelines, which then only fetch
+// binding 0.
 struct SimplifiedVertexInputState
 {
   static const uint32_t MAX_NUM_VERTEX_BINDINGS = 4;
   VertexAttributeFlags attributeFlags[MAX_NUM_VERTEX_BINDINGS] = {};
+  VertexEncodingFlags encodingFlags[MAX_NUM_VERTEX_BINDINGS] = {};
   uint32_t attributeFlagsCount = 0;
 
+  static uint32_t GetStride(VertexAttributeFlags flags,
+                            VertexEncodingFlags encodings)
+  {
+    uint32_t stride = 0;
+    for (auto attribute : VERTEX_ATTRIBUTE_ORDER) {
+      if (flags & attribute) {
+        stride += GetVertexAttributeFormat(attribute, encodings).size;
+      }
+    }
+    return stride;
+  }
+
+  // binding 0 has to hold the positions and nothing else
+  SimplifiedVertexInputState GetPositionOnly() const;
+
   void Apply(PipelineState* pipelineState)
   {
     VkVertexInputAttributeDescription* attributeDescriptions =
@@ -169,52 +254,22 @@ struct SimplifiedVertexInputState
       auto flags = attributeFlags[i];
       uint32_t offset = 0;
 
-      if (flags & VertexAttributeFlagBits::POSITION) {
-        attributeDescriptions[attributeDescriptionCount].binding = i;
-        attributeDescriptions[attributeDescriptionCount].location =
-          attributeDescriptionCount;
-        attributeDescriptions[attributeDescriptionCount].format =
-          VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[attributeDescriptionCount].offset = offset;
+      for (auto attribute : VERTEX_ATTRIBUTE_ORDER) {
+        if (!(flags & attribute)) {
+          continue;
+        }
 
-        attributeDescriptionCount += 1;
-        offset += sizeof(float) * 3;
-      }
+        auto format = GetVertexAttributeFormat(attribute, encodingFlags[i]);
 
-      if (flags & VertexAttributeFlagBits::NORMAL) {
         attributeDescriptions[attributeDescriptionCount].binding = i;
         attributeDescriptions[attributeDescriptionCount].location =
           attributeDescriptionCount;
         attributeDescriptions[attributeDescriptionCount].format =
-          VK_FORMAT_R32G32B32_SFLOAT;
+          format.format;
         attributeDescriptions[attributeDescriptionCount].offset = offset;
 
         attributeDescriptionCount += 1;
-        offset += sizeof(float) * 3;
-      }
-
-      if (flags & VertexAttributeFlagBits::TEXTURE_COORD) {
-        attributeDescriptions[attributeDescriptionCount].binding = i;
-        attributeDescriptions[attributeDescriptionCount].location =
-          attributeDescriptionCount;
-        attributeDescriptions[attributeDescriptionCount].format =
-          VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[attributeDescriptionCount].offset = offset;
-
-        attributeDescriptionCount += 1;
-        offset += sizeof(float) * 2;
-      }
-
-      if (flags & VertexAttributeFlagBits::COLOR) {
-        attributeDescriptions[attributeDescriptionCount].binding = i;
-        attributeDescriptions[attributeDescriptionCount].location =
-          attributeDescriptionCount;
-        attributeDescriptions[attributeDescriptionCount].format =
-          VK_FORMAT_R32G32B32A32_SFLOAT;
-        attributeDescriptions[attributeDescriptionCount].offset = offset;
-
-        attributeDescriptionCount += 1;
-        offset += sizeof(float) * 4;
+        offset += format.size;
       }
 
       bindingDescriptions[bindingDescriptionCount].binding = i;
@@ -226,3 +281,64 @@ struct SimplifiedVertexInputState
     }
   }
 };
+
+enum DynamicStateFlagBits
+{
+  DYNAMIC_VIEWPORT = 0x00000001, // viewport and scissor
+  DYNAMIC_LINE_WIDTH = 0x00000002,
+  DYNAMIC_DEPTH_BIAS = 0x00000004,
+  DYNAMIC_BLEND_CONSTANTS = 0x00000008,
+  DYNAMIC_DEPTH_BOUNDS = 0x00000010,
+  DYNAMIC_STENCIL = 0x00000020, // compare mask, write mask and reference
+};
+using DynamicStateFlags = Flags;
+
+// Classifies state as dynamic instead of baked into the VkPipeline.
+// RenderGraph::RecordCmds sets viewport and scissor to the render area of each
+// render pass, so the pipeline survives a resize. The other values are taken
+// from the PipelineState when the pipeline is bound and can be changed through
+// the DynamicStateCache afterwards, so one pipeline serves all of them.
+//
+// Cull mode, depth test and write, and topology stay baked, the bundled Vulkan
+// headers predate VK_EXT_extended_dynamic_state.
+struct SimplifiedDynamicState
+{
+  DynamicStateFlags flags = DYNAMIC_VIEWPORT;
+
+  void Apply(PipelineState* pipelineState)
+  {
+    auto& dynamic = pipelineState->dynamic;
+    auto add = [&dynamic](VkDynamicState state) {
+      dynamic.dynamicStates[dynamic.dynamicStateCount++] = state;
+    };
+
+    if (flags & DYNAMIC_VIEWPORT) {
+      pipelineState->viewport.viewportCount = 1;
+      pipelineState->viewport.scissorCount = 1;
+      add(VK_DYNAMIC_STATE_VIEWPORT);
+      add(VK_DYNAMIC_STATE_SCISSOR);
+    }
+
+    if (flags & DYNAMIC_LINE_WIDTH) {
+      add(VK_DYNAMIC_STATE_LINE_WIDTH);
+    }
+
+    if (flags & DYNAMIC_DEPTH_BIAS) {
+      add(VK_DYNAMIC_STATE_DEPTH_BIAS);
+    }
+
+    if (flags & DYNAMIC_BLEND_CONSTANTS) {
+      add(VK_DYNAMIC_STATE_BLEND_CONSTANTS);
+    }
+
+    if (flags & DYNAMIC_DEPTH_BOUNDS) {
+      add(VK_DYNAMIC_STATE_DEPTH_BOUNDS);
+    }
+
+    if (flags & DYNAMIC_STENCIL) {
+      add(VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK);
+      add(VK_DYNAMIC_STATE_STENCIL_WRITE_MASK);
+      add(VK_DYNAMIC_STATE_STENCIL_REFERENCE);
+    }
+  }
+};
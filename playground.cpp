@@ -38,17 +38,10 @@ RenderGraph::RenderFrame()
 
   ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmdBuffer.cmdBuffer));
 
-  VkPipelineStageFlags waitStage =
-    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-  VkSubmitInfo submitInfo = vkiSubmitInfo(1,
-                                          &imageAvailableSemaphore,
-                                          &waitStage,
-                                          1,
-                                          &cmdBuffer.cmdBuffer,
-                                          1,
-                                          &renderFinishedSemaphore);
-  ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, cmdBuffer.fence));
+  base->Submit(cmdBuffer,
+               imageAvailableSemaphore,
+               VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+               renderFinishedSemaphore);
 
   OnFrame();
 }
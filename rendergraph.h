@@ -2,10 +2,17 @@
 
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <set>
+#include <tuple>
 #include <vector>
 #include <vulkan\vulkan.h>
 
+#include "arena.h"
+#include "deletion.h"
+#include "pipeline.h"
+#include "vk_base.h"
 #include "vk_init.h"
 #include "vk_utils.h"
 
@@ -17,9 +24,60 @@ struct Operation
   VkAccessFlags accessFlags = 0;
   VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
 
+  // subresources the operation is restricted to
+  uint32_t baseMipLevel = 0;
+  uint32_t levelCount = VK_REMAINING_MIP_LEVELS;
+  uint32_t baseArrayLayer = 0;
+  uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS;
+
   Operation() { id = nextId++; }
 
-  bool HasWriteFlags() const
+  Operation ForMipLevels(uint32_t base, uint32_t count) const
+  {
+    Operation op = *this;
+    op.baseMipLevel = base;
+    op.levelCount = count;
+    return op;
+  }
+
+  Operation ForArrayLayers(uint32_t base, uint32_t count) const
+  {
+    Operation op = *this;
+    op.baseArrayLayer = base;
+    op.layerCount = count;
+    return op;
+  }
+
+  // exclusive
+  uint32_t GetMipLevelEnd(uint32_t levels) const
+  {
+    return levelCount == VK_REMAINING_MIP_LEVELS ? levels
+                                                 : baseMipLevel + levelCount;
+  }
+
+  // exclusive
+  uint32_t GetArrayLayerEnd(uint32_t layers) const
+  {
+    return layerCount == VK_REMAINING_ARRAY_LAYERS
+             ? layers
+             : baseArrayLayer + layerCount;
+  }
+
+  // resolves VK_REMAINING_* against the given image range
+  VkImageSubresourceRange GetSubresourceRange(
+    const VkImageSubresourceRange& imageRange) const
+  {
+    VkImageSubresourceRange range = imageRange;
+    range.baseMipLevel = baseMipLevel;
+    range.levelCount = GetMipLevelEnd(imageRange.levelCount) - baseMipLevel;
+    range.baseArrayLayer = baseArrayLayer;
+    range.layerCount = GetArrayLayerEnd(imageRange.layerCount) - baseArrayLayer;
+    return range;
+  }
+
+  bool HasWriteFlags() const { return IsWriteAccess(accessFlags); }
+
+  static bool IsWriteAccess(VkAccessFlags accessFlags)
   {
     const VkAccessFlags mask =
       VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
@@ -68,16 +126,28 @@ struct Operation
     return op;
   }
 
-  static Operation Sampled()
+  static Operation Sampled(
+    VkPipelineStageFlags stageFlags = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
   {
     Operation op;
     op.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-    op.stageFlags = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    op.stageFlags = stageFlags;
     op.accessFlags = VK_ACCESS_SHADER_READ_BIT;
     op.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     return op;
   }
 
+  static Operation Storage(
+    VkPipelineStageFlags stageFlags = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+  {
+    Operation op;
+    op.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+    op.stageFlags = stageFlags;
+    op.accessFlags = VK_ACCESS_SHADER_WRITE_BIT;
+    op.layout = VK_IMAGE_LAYOUT_GENERAL;
+    return op;
+  }
+
   static Operation PresentSrc()
   {
     Operation op;
@@ -116,6 +186,21 @@ struct ImageBarrier
   SplitBarrier second;
 };
 
+// Range of mip levels and array layers of an image that is synchronized on its
+// own. Images are split into slices at the mip level and array layer
+// boundaries of their operations; neighbouring layer ranges used by the same
+// operations share a slice.
+struct ImageSlice
+{
+  VkImageSubresourceRange range = {};
+  std::vector<OperationRange> ranges = {};
+  VkEvent event = VK_NULL_HANDLE;
+
+  // last writing range of the frame, later ranges may only read; the next
+  // frame synchronizes with it, not just with the last access
+  SplitBarrier lastWrite = {};
+};
+
 struct VirtualImage
 {
   VkFormat format;
@@ -127,6 +212,12 @@ struct VirtualImage
 
   VkImageUsageFlags usage = 0;
 
+  // the extent follows the swapchain, see RenderGraph::Resize
+  bool swapchainSized = false;
+
+  // value of render passes that clear the image as an attachment
+  VkClearValue clearValue = {};
+
   bool HasStencilFormat() const
   {
     switch (format) {
@@ -142,7 +233,7 @@ struct VirtualImage
 
   bool HasStencilOnlyFormat() const { return format == VK_FORMAT_S8_UINT; }
 
-  PhysicalImage* CreatePhysicalImage(VkDevice device,
+  PhysicalImage CreatePhysicalImage(VkDevice device,
                                      VkPhysicalDeviceMemoryProperties memProps)
   {
     VkImage image;
@@ -163,11 +254,13 @@ struct VirtualImage
     ASSERT_VK_SUCCESS(vkCreateImage(device, &imageCreateInfo, nullptr, &image));
 
     VkDeviceMemory memory =
-      vkuAllocateImageMemory(device, memProps, image, true);
+      vkuAllocateImageMemory(
+        device, memProps, image, true, MEMORY_CATEGORY_ATTACHMENT);
 
     VkImageViewCreateInfo imageViewCreateInfo =
       vkiImageViewCreateInfo(image,
-                             VK_IMAGE_VIEW_TYPE_2D,
+                             layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                        : VK_IMAGE_VIEW_TYPE_2D,
                              format,
                              { VK_COMPONENT_SWIZZLE_IDENTITY,
                                VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -179,16 +272,11 @@ struct VirtualImage
     ASSERT_VK_SUCCESS(
       vkCreateImageView(device, &imageViewCreateInfo, nullptr, &view));
 
-    PhysicalImage* physicalImage = new PhysicalImage;
-    physicalImage->image = image;
-    physicalImage->view = view;
-    physicalImage->stageFlags =
-      VK_PIPELINE_STAGE_HOST_BIT; // VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    physicalImage->accessFlags = 0;
-    physicalImage->layout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-    auto eventCreateInfo = vkiEventCreateInfo();
-    vkCreateEvent(device, &eventCreateInfo, nullptr, &physicalImage->event);
+    PhysicalImage physicalImage = {};
+    physicalImage.image = image;
+    physicalImage.memory = memory;
+    physicalImage.view = view;
+    physicalImage.Resize(levels, layers);
 
     return physicalImage;
   }
@@ -198,11 +286,18 @@ struct RenderGraph;
 struct RenderPass;
 struct Subpass
 {
-  std::map<std::string, Operation> imageOps = {};
+  // an image may be used by several operations on distinct subresources
+  std::multimap<std::string, Operation> imageOps = {};
 
   void SetOperation(const std::string& name, Operation op)
   {
-    imageOps[name] = op;
+    imageOps.erase(name);
+    imageOps.insert({ name, op });
+  }
+
+  void AddOperation(const std::string& name, Operation op)
+  {
+    imageOps.insert({ name, op });
   }
 
   RenderGraph* graph = nullptr;
@@ -217,16 +312,36 @@ struct RenderPass
 {
   std::map<std::string, std::vector<Operation>> imageOps = {};
 
+  // compute passes are recorded outside of a VkRenderPass, they must not use
+  // attachments and consist of a single subpass
+  VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
   std::vector<Subpass*> subpasses = {};
+
+  // subresources of the attachments, a single mip level each
+  std::map<std::string, VkImageSubresourceRange> attachmentRanges = {};
+  uint32_t framebufferLayers = 1;
+
   std::map<std::pair<uint32_t, uint32_t>, VkSubpassDependency>
     subpassDependencies = {};
 
   VkRenderPass renderPass = VK_NULL_HANDLE;
 
+  // only with RenderGraph::imagelessFramebuffers, the attachment views are
+  // given when the render pass begins
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+
   std::vector<VkClearValue> clearValues = {};
   VkRect2D renderArea = {};
 
   void AddSubpass(Subpass* subpass) { subpasses.push_back(subpass); }
+
+  bool IsCompute() const { return bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE; }
+};
+
+struct ComputePass : RenderPass
+{
+  ComputePass() { bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE; }
 };
 
 struct RenderGraph
@@ -237,18 +352,80 @@ struct RenderGraph
   //                 different
 
   std::map<std::string, std::vector<Operation>> imageOps = {};
-  std::map<std::string, std::vector<OperationRange>> imageRanges = {};
-  std::map<uint32_t, SplitBarrier> setEvents = {};
-  std::map<uint32_t, ImageBarrier> waitEvents = {};
+  std::map<std::string, std::vector<ImageSlice>> imageSlices = {};
+
+  // keyed by operation id and slice index
+  std::map<std::pair<uint32_t, uint32_t>, SplitBarrier> setEvents = {};
+  std::map<std::pair<uint32_t, uint32_t>, ImageBarrier> waitEvents = {};
 
   std::vector<RenderPass*> renderPasses = {};
 
   std::map<std::string, VirtualImage*> vis = {};
-  std::map<std::string, PhysicalImage*> pis = {};
-  std::map<std::vector<PhysicalImage*>, VkFramebuffer> framebuffers = {};
+  std::map<std::string, ImageHandle> pis = {};
+
+  // image, mip level, base layer and layer count of an attachment
+  typedef std::tuple<ImageHandle, uint32_t, uint32_t, uint32_t> AttachmentKey;
+
+  // Creates one framebuffer per render pass in Bake that fits any images with
+  // the attachments' formats, extents and usage, instead of caching one per
+  // combination of attachment images. Requires VK_KHR_imageless_framebuffer,
+  // set before Bake.
+  bool imagelessFramebuffers = false;
+
+  // keyed by render pass index and attachments; stale handles never match
+  std::map<std::pair<uint32_t, std::vector<AttachmentKey>>, VkFramebuffer>
+    framebuffers = {};
+
+  // views of attachment subranges
+  std::map<AttachmentKey, VkImageView> attachmentViews = {};
+
+  // state of the command buffer recorded by RecordCmds, subpasses pass it to
+  // Pipeline::Bind
+  DynamicStateCache dynamicState = {};
+
+  // reused by RecordCmds to look up framebuffers without allocating
+  std::pair<uint32_t, std::vector<AttachmentKey>> framebufferKey = {};
 
   std::map<std::string, VkImageLayout> outputs = {};
 
+  std::vector<VkEvent> frameEvents = {};
+
+  // receives objects that are replaced while frames might still use them
+  DeletionQueue* deletionQueue = nullptr;
+
+  // resolves the handles in pis
+  ResourcePools* resources = nullptr;
+
+  // shared by the pipelines of the subpasses, optional
+  PipelineCache* pipelineCache = nullptr;
+
+  // physical images created by CreatePhysicalImage, Resize recreates them
+  std::set<std::string> ownedImages = {};
+
+  PhysicalImage* GetPhysicalImage(const std::string& name)
+  {
+    return resources->images.Get(pis[name]);
+  }
+
+  // valid until the next pipeline is added to resources
+  Pipeline* GetPipeline(PipelineHandle handle)
+  {
+    return resources->pipelines.Get(handle);
+  }
+  ComputePipeline* GetComputePipeline(ComputePipelineHandle handle)
+  {
+    return resources->computePipelines.Get(handle);
+  }
+
+  // Descriptor sets bound by submitted frames must not be rewritten, subpasses
+  // call this before updating theirs after the physical images changed. Waits
+  // for all frames in flight, which only happens on a resize.
+  void WaitForFramesInFlight()
+  {
+    Timeline* timeline = deletionQueue->timeline;
+    timeline->Wait(timeline->lastSubmitted);
+  }
+
   void AddVirtualImage(const std::string& name, VirtualImage* vi)
   {
     vis[name] = vi;
@@ -259,36 +436,127 @@ struct RenderGraph
     renderPasses.push_back(renderPass);
   }
 
+  // creates the physical image of a virtual image and adds it to resources
+  ImageHandle CreatePhysicalImage(VkDevice device,
+                                  VkPhysicalDeviceMemoryProperties memProps,
+                                  const std::string& name)
+  {
+    pis[name] = resources->images.Add(
+      vis[name]->CreatePhysicalImage(device, memProps));
+    ownedImages.insert(name);
+    return pis[name];
+  }
+
+  // Applies a new swapchain extent to the images marked swapchainSized,
+  // recreates those created by CreatePhysicalImage, and the framebuffers
+  // using them. Render passes and pipelines are kept, so pipelines have to
+  // use dynamic viewport and scissor (see SimplifiedDynamicState).
+  //
+  // External images, e.g. the swapchain images, are replaced by the caller,
+  // who has to call ReleaseViews for the old ones.
+  void Resize(VkDevice device,
+              VkPhysicalDeviceMemoryProperties memProps,
+              VkExtent2D extent)
+  {
+    for (auto const& kv : vis) {
+      auto const& name = kv.first;
+      auto vi = kv.second;
+
+      if (!vi->swapchainSized) {
+        continue;
+      }
+
+      // the slicing depends on the mip count, which is kept
+      vi->extent.width = extent.width;
+      vi->extent.height = extent.height;
+      ASSERT_TRUE(
+        ((std::max(extent.width, extent.height) >> (vi->levels - 1)) > 0));
+
+      if (ownedImages.count(name) > 0) {
+        ImageHandle old = pis[name];
+        ReleaseViews(old);
+        deletionQueue->Push(*resources->images.Get(old));
+        resources->images.Remove(old);
+
+        CreatePhysicalImage(device, memProps, name);
+      }
+    }
+
+    for (auto renderPass : renderPasses) {
+      if (renderPass->IsCompute()) {
+        continue;
+      }
+
+      UpdateRenderArea(renderPass);
+
+      if (renderPass->framebuffer != VK_NULL_HANDLE) {
+        deletionQueue->Push(VK_OBJECT_TYPE_FRAMEBUFFER,
+                            ToHandle64(renderPass->framebuffer));
+        CreateImagelessFramebuffer(device, renderPass);
+      }
+    }
+  }
+
+  // Retires the attachment views and framebuffers created for the physical
+  // image, e.g. before the image itself is retired.
+  void ReleaseViews(ImageHandle image)
+  {
+    for (auto iter = attachmentViews.begin(); iter != attachmentViews.end();) {
+      if (std::get<0>(iter->first) == image) {
+        deletionQueue->Push(VK_OBJECT_TYPE_IMAGE_VIEW,
+                            ToHandle64(iter->second));
+        iter = attachmentViews.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+
+    for (auto iter = framebuffers.begin(); iter != framebuffers.end();) {
+      auto const& keys = iter->first.second;
+      auto usesImage = [image](const AttachmentKey& key) {
+        return std::get<0>(key) == image;
+      };
+      if (std::any_of(keys.begin(), keys.end(), usesImage)) {
+        deletionQueue->Push(VK_OBJECT_TYPE_FRAMEBUFFER,
+                            ToHandle64(iter->second));
+        iter = framebuffers.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+
+  // Temporary data lives in arena, which has to stay valid until recording is
+  // done. Once all framebuffers and views exist, this does not allocate from
+  // the heap.
   void RecordCmds(
-    VkDevice device,
-    VkCommandBuffer cmdBuffer) // device needed until we have a better solution
-                               // for handling framebuffers
+    VkDevice device, // device needed until we have a better solution for
+                     // handling framebuffers
+    VkCommandBuffer cmdBuffer,
+    FrameArena* arena)
   {
+    dynamicState.Reset();
+
     {
       // TODO: move these barrier closer to the actual first usage of the image
       VkPipelineStageFlags srcStage = 0;
       VkPipelineStageFlags dstStage = 0;
 
-      std::vector<VkImageMemoryBarrier> imageMemoryBarriers = {};
-      for (auto const& kv : imageRanges) {
+      ScratchVector<VkImageMemoryBarrier> imageMemoryBarriers(arena);
+      for (auto const& kv : imageSlices) {
         auto const& name = kv.first;
-        auto const& ranges = kv.second;
 
-        auto pi = pis[name];
-        auto vi = vis[name];
+        auto pi = GetPhysicalImage(name);
 
-        auto barrier = vkiImageMemoryBarrier(pi->accessFlags,
-                                             ranges.front().op.accessFlags,
-                                             pi->layout,
-                                             ranges.front().op.layout,
-                                             VK_QUEUE_FAMILY_IGNORED,
-                                             VK_QUEUE_FAMILY_IGNORED,
-                                             pi->image,
-                                             vi->subresourceRange);
-        imageMemoryBarriers.push_back(barrier);
-
-        srcStage |= pi->stageFlags;
-        dstStage |= ranges.front().op.stageFlags;
+        for (auto const& slice : kv.second) {
+          AppendFrameBarriers(pi,
+                              slice,
+                              slice.ranges.front().op,
+                              arena,
+                              imageMemoryBarriers,
+                              srcStage,
+                              dstStage);
+        }
       }
 
       if (imageMemoryBarriers.size() > 0) {
@@ -306,97 +574,127 @@ struct RenderGraph
     }
 
     for (uint32_t i = 0; i < renderPasses.size(); ++i) {
-      std::vector<VkEvent> events = {};
-      std::vector<VkPipelineStageFlags> stages = {};
+      ScratchVector<VkEvent> events(arena);
+      ScratchVector<VkPipelineStageFlags> stages(arena);
 
-      // TODO: find better solution for handling framebuffers
+      bool compute = renderPasses[i]->IsCompute();
 
-      std::vector<PhysicalImage*> physicalAttachments = {};
-      for (auto const& kv : renderPasses[i]->imageOps) {
-        if (std::any_of(
-              kv.second.begin(), kv.second.end(), [](const Operation& op) {
-                return op.HasAttachmentUsageFlags();
-              })) {
-          physicalAttachments.push_back(pis[kv.first]);
+      VkFramebuffer framebuffer = renderPasses[i]->framebuffer;
+      ScratchVector<VkImageView> views(arena);
+
+      if (!compute && imagelessFramebuffers) {
+        for (auto const& kv : renderPasses[i]->attachmentRanges) {
+          views.push_back(GetAttachmentView(device, kv.first, kv.second));
+        }
+      } else if (!compute) {
+        // TODO: find better solution for handling framebuffers
+        framebufferKey.first = i;
+        framebufferKey.second.clear();
+        for (auto const& kv : renderPasses[i]->attachmentRanges) {
+          framebufferKey.second.push_back(
+            GetAttachmentKey(kv.first, kv.second));
         }
+
+        auto iter = framebuffers.find(framebufferKey);
+        if (iter == framebuffers.end()) {
+          for (auto const& kv : renderPasses[i]->attachmentRanges) {
+            views.push_back(GetAttachmentView(device, kv.first, kv.second));
+          }
+
+          VkFramebufferCreateInfo framebufferCreateInfo =
+            vkiFramebufferCreateInfo(renderPasses[i]->renderPass,
+                                     static_cast<uint32_t>(views.size()),
+                                     views.data(),
+                                     renderPasses[i]->renderArea.extent.width,
+                                     renderPasses[i]->renderArea.extent.height,
+                                     renderPasses[i]->framebufferLayers);
+
+          ASSERT_VK_SUCCESS(vkCreateFramebuffer(
+            device, &framebufferCreateInfo, nullptr, &framebuffer));
+          iter = framebuffers.insert({ framebufferKey, framebuffer }).first;
+        }
+        framebuffer = iter->second;
       }
 
-      auto iter = framebuffers.find(physicalAttachments);
-      if (iter == framebuffers.end()) {
-        std::vector<VkImageView> views = {};
-        for (auto const& pi : physicalAttachments) {
-          views.push_back(pi->view);
+      if (!compute) {
+        VkRenderPassBeginInfo renderPassBeginInfo = vkiRenderPassBeginInfo(
+          renderPasses[i]->renderPass,
+          framebuffer,
+          renderPasses[i]->renderArea,
+          static_cast<uint32_t>(renderPasses[i]->clearValues.size()),
+          renderPasses[i]->clearValues.data());
+
+        auto attachmentBeginInfo = vkiRenderPassAttachmentBeginInfoKHR(
+          static_cast<uint32_t>(views.size()), views.data());
+        if (imagelessFramebuffers) {
+          renderPassBeginInfo.pNext = &attachmentBeginInfo;
         }
 
-        VkFramebufferCreateInfo framebufferCreateInfo =
-          vkiFramebufferCreateInfo(renderPasses[i]->renderPass,
-                                   static_cast<uint32_t>(views.size()),
-                                   views.data(),
-                                   renderPasses[i]->renderArea.extent.width,
-                                   renderPasses[i]->renderArea.extent.height,
-                                   1);
-
-        VkFramebuffer framebuffer = VK_NULL_HANDLE;
-        ASSERT_VK_SUCCESS(vkCreateFramebuffer(
-          device, &framebufferCreateInfo, nullptr, &framebuffer));
-        framebuffers.insert({ physicalAttachments, framebuffer });
+        vkCmdBeginRenderPass(
+          cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // for pipelines with dynamic viewport and scissor
+        auto const& area = renderPasses[i]->renderArea;
+        VkViewport viewport = { (float)area.offset.x,
+                                (float)area.offset.y,
+                                (float)area.extent.width,
+                                (float)area.extent.height,
+                                0.0f,
+                                1.0f };
+        dynamicState.SetViewport(cmdBuffer, viewport);
+        dynamicState.SetScissor(cmdBuffer, area);
       }
 
-      VkRenderPassBeginInfo renderPassBeginInfo = vkiRenderPassBeginInfo(
-        renderPasses[i]->renderPass,
-        framebuffers[physicalAttachments],
-        renderPasses[i]->renderArea,
-        static_cast<uint32_t>(renderPasses[i]->clearValues.size()),
-        renderPasses[i]->clearValues.data());
-      vkCmdBeginRenderPass(
-        cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
       for (uint32_t j = 0; j < renderPasses[i]->subpasses.size(); ++j) {
         for (auto const& kv : renderPasses[i]->subpasses[j]->imageOps) {
           auto const& name = kv.first;
           auto const& op = kv.second;
 
-          auto vi = vis[name];
-          auto pi = pis[name];
-
-          {
-            auto iter = waitEvents.find(op.id);
-            if (iter != waitEvents.end()) {
-              auto const& barrierPair = (*iter).second;
-              VkImageMemoryBarrier imageMemoryBarrier =
-                vkiImageMemoryBarrier(barrierPair.first.accessFlags,
-                                      barrierPair.second.accessFlags,
-                                      barrierPair.first.layout,
-                                      barrierPair.second.layout,
-                                      VK_QUEUE_FAMILY_IGNORED,
-                                      -1,
-                                      pi->image,
-                                      vi->subresourceRange);
-
-              vkCmdWaitEvents(cmdBuffer,
-                              1,
-                              &pi->event,
-                              barrierPair.first.stageFlags,
-                              barrierPair.second.stageFlags,
-                              0,
-                              nullptr,
-                              0,
-                              nullptr,
-                              1,
-                              &imageMemoryBarrier);
+          auto pi = GetPhysicalImage(name);
+          auto const& slices = imageSlices[name];
+
+          for (uint32_t k = 0; k < slices.size(); ++k) {
+            auto const& slice = slices[k];
+
+            {
+              auto iter = waitEvents.find({ op.id, k });
+              if (iter != waitEvents.end()) {
+                auto const& barrierPair = (*iter).second;
+                VkImageMemoryBarrier imageMemoryBarrier =
+                  vkiImageMemoryBarrier(barrierPair.first.accessFlags,
+                                        barrierPair.second.accessFlags,
+                                        barrierPair.first.layout,
+                                        barrierPair.second.layout,
+                                        VK_QUEUE_FAMILY_IGNORED,
+                                        -1,
+                                        pi->image,
+                                        slice.range);
+
+                vkCmdWaitEvents(cmdBuffer,
+                                1,
+                                &slice.event,
+                                barrierPair.first.stageFlags,
+                                barrierPair.second.stageFlags,
+                                0,
+                                nullptr,
+                                0,
+                                nullptr,
+                                1,
+                                &imageMemoryBarrier);
+              }
             }
-          }
 
-          {
-            auto iter = setEvents.find(op.id);
-            if (iter != setEvents.end()) {
-              // vkCmdSetEvent cannot be called inside a render pass,
-              // but we can move it to the end of the render pass, because
-              // it will not be waited on in the same render pass anyways.
-              // Reason: Synchronization between subpasses is done via subpass
-              // dependencies.
-              events.push_back(pi->event);
-              stages.push_back((*iter).second.stageFlags);
+            {
+              auto iter = setEvents.find({ op.id, k });
+              if (iter != setEvents.end()) {
+                // vkCmdSetEvent cannot be called inside a render pass,
+                // but we can move it to the end of the render pass, because
+                // it will not be waited on in the same render pass anyways.
+                // Reason: Synchronization between subpasses is done via
+                // subpass dependencies.
+                events.push_back(slice.event);
+                stages.push_back((*iter).second.stageFlags);
+              }
             }
           }
         }
@@ -408,22 +706,34 @@ struct RenderGraph
         }
       }
 
-      vkCmdEndRenderPass(cmdBuffer);
+      if (!compute) {
+        vkCmdEndRenderPass(cmdBuffer);
+      }
 
       // set events
       for (uint32_t j = 0; j < events.size(); ++j) {
         vkCmdSetEvent(cmdBuffer, events[j], stages[j]);
       }
 
-      for (auto const& kv : imageRanges) {
-        auto const& name = kv.first;
-        auto const& ranges = kv.second;
+      frameEvents.insert(frameEvents.end(), events.begin(), events.end());
+    }
+
+    // reset the events after their waits, so that a wait in the next frame
+    // does not see the signal of this frame
+    for (auto event : frameEvents) {
+      vkCmdResetEvent(cmdBuffer, event, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+    frameEvents.clear();
+
+    for (auto const& kv : imageSlices) {
+      auto const& name = kv.first;
 
-        auto pi = pis[name];
+      auto pi = GetPhysicalImage(name);
 
-        pi->stageFlags = ranges.back().op.stageFlags;
-        pi->accessFlags = ranges.back().op.accessFlags;
-        pi->layout = ranges.back().op.layout;
+      for (auto const& slice : kv.second) {
+        auto const& op = slice.ranges.back().op;
+        pi->SetState(slice.range,
+                     { op.stageFlags, op.accessFlags, op.layout });
       }
     }
   }
@@ -464,188 +774,82 @@ struct RenderGraph
 
     for (auto const& kv : imageOps) {
       auto const& name = kv.first;
-      auto const& ops = kv.second;
-
-      if (ops.size() == 0) {
-        return;
-      }
 
-      // synchronization only necessary between ranges
-      std::vector<OperationRange> ranges = {
-        { ops[0], 0u, static_cast<uint32_t>(ops.size()) }
-      };
+      auto vi = vis[name];
 
-      for (uint32_t j = 1; j < ops.size(); ++j) {
-        auto& currRange = ranges.back();
-        if (ops[j].HasWriteFlags() || currRange.op.HasWriteFlags() ||
-            ops[j].layout != currRange.op.layout) {
-          // end current range here
-          currRange.end = j;
-
-          // begin new range
-          ranges.push_back({ ops[j], j, static_cast<uint32_t>(ops.size()) });
-        } else {
-          // add to current range
-          currRange.op.stageFlags |= ops[j].stageFlags;
-          currRange.op.accessFlags |= ops[j].accessFlags;
-        }
+      // split the image into slices at the mip level and array layer
+      // boundaries of its operations, each slice is synchronized on its own
+      std::set<uint32_t> levelBoundaries = { 0, vi->levels };
+      std::set<uint32_t> layerBoundaries = { 0, vi->layers };
+      for (auto const& op : kv.second) {
+        // attachment views cover a single mip level
+        ASSERT_TRUE((!op.HasAttachmentUsageFlags() ||
+                     op.GetMipLevelEnd(vi->levels) == op.baseMipLevel + 1));
+
+        levelBoundaries.insert(op.baseMipLevel);
+        levelBoundaries.insert(op.GetMipLevelEnd(vi->levels));
+        layerBoundaries.insert(op.baseArrayLayer);
+        layerBoundaries.insert(op.GetArrayLayerEnd(vi->layers));
       }
 
-      imageRanges[name] = ranges;
-
-      // if a renderpass crosses a range boundary, the ranges have to be
-      // synchronized with subpass dependencies; we are using the Overlap
-      // struct to track where the renderpass crosses a range boundary
-
-      struct Overlap
-      {
-        uint32_t start = 0;
-        uint32_t end = 0;
-      };
-
-      for (uint32_t j = 1; j < ranges.size(); ++j) {
-        // TODO: synchronization with previous frame
-
-        Overlap overlap = {};
-        overlap.start = ranges[j - 1].end;
-        overlap.end = ranges[j].start;
-
-        if (ops[ranges[j - 1].end - 1].renderPass ==
-            ops[ranges[j].start].renderPass) {
-          overlap.start = ranges[j - 1].end - 1;
-          overlap.end = ranges[j].start + 1;
-
-          while (overlap.start - 1 >= ranges[j - 1].start &&
-                 ops[overlap.start - 1].renderPass ==
-                   ops[overlap.start].renderPass) {
-            --overlap.start;
-          }
-
-          while (overlap.end < ranges[j].end &&
-                 ops[overlap.end].renderPass == ops[overlap.start].renderPass) {
-            ++overlap.end;
-          }
-        }
-
-        if (overlap.start < overlap.end) {
-          // NOTE: The spec says that images that are used as attachments in
-          // one subpass are not allowed to be used as e.g.
-          // VK_IMAGE_USAGE_SAMPLED_BIT in another subpass. We can only
-          // transition the image layout from one attachment layout to
-          // another attachment layout between subpasses (The target layout
-          // of an image for a subpass can only be specified in the
-          // ATTACHMENT REFERENCE, so there is no way to specify a target
-          // layout for non attachment images.)
-
-          // Valid cases for synchronization between subpasses:
-          // - synchronization with and with layout transition for
-          // attachments
-          // - synchronization without layout transition for non attachments
-
-          bool attachmentUsageConsistent =
-            std::all_of(ops.begin() + overlap.start,
-                        ops.begin() + overlap.end,
-                        [&ops, &overlap](const Operation& op) {
-                          return op.HasAttachmentUsageFlags() ==
-                                 ops[overlap.start].HasAttachmentUsageFlags();
-                        });
-
-          ASSERT_TRUE(attachmentUsageConsistent);
-
-          bool layoutConsistent =
-            std::all_of(ops.begin() + overlap.start,
-                        ops.begin() + overlap.end,
-                        [&ops, &overlap](const Operation& op) {
-                          return op.layout == ops[overlap.start].layout;
-                        });
-
-          ASSERT_TRUE(ops[overlap.start].HasAttachmentUsageFlags() ||
-                      layoutConsistent);
-
-          for (uint32_t k = overlap.start; k < ranges[j - 1].end; ++k) {
-            for (uint32_t l = ranges[j].start; l < overlap.end; ++l) {
-
-              uint32_t renderPass = ops[overlap.start].renderPass;
-
-              std::cout << "INFO: subpass dependency for image " << name.c_str()
-                        << " in render pass " << renderPass
-                        << " between subpass " << k << " and subpass " << l
-                        << std::endl;
-
-              auto& dependency =
-                renderPasses[renderPass]
-                  ->subpassDependencies[{ ops[k].subpass, ops[l].subpass }];
-
-              dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-              dependency.srcAccessMask |= ops[k].stageFlags;
-              dependency.srcStageMask |= ops[k].accessFlags;
-              dependency.srcSubpass = ops[k].subpass;
-
-              dependency.dstStageMask |= ops[l].stageFlags;
-              dependency.dstAccessMask |= ops[l].accessFlags;
-              dependency.dstSubpass = ops[l].subpass;
-            }
-          }
-        }
-
-        // 1. no overlap: sets the one necessary set/wait
-        // 2.    overlap: sets first of two necessary set/wait
-        if (ranges[j - 1].start < overlap.start) {
-          SplitBarrier first = {};
-          SplitBarrier second = {};
-
-          for (uint32_t k = ranges[j - 1].start; k < overlap.start; ++k) {
-            first.stageFlags |= ops[k].stageFlags;
-            first.accessFlags |= ops[k].accessFlags;
-            first.layout = ops[k].layout;
-          }
-
-          for (uint32_t k = ranges[j].start; k < ranges[j].end; ++k) {
-            second.stageFlags |= ops[k].stageFlags;
-            second.accessFlags |= ops[k].accessFlags;
-            second.layout = ops[k].layout;
+      for (auto level = levelBoundaries.begin();
+           std::next(level) != levelBoundaries.end();
+           ++level) {
+        uint32_t levelBase = *level;
+        uint32_t levelEnd = *std::next(level);
+
+        std::vector<Operation> ops = {};
+        uint32_t layerBase = 0;
+
+        for (auto layer = layerBoundaries.begin();
+             std::next(layer) != layerBoundaries.end();
+             ++layer) {
+          uint32_t base = *layer;
+          uint32_t end = *std::next(layer);
+
+          std::vector<Operation> layerOps = {};
+          std::copy_if(kv.second.begin(),
+                       kv.second.end(),
+                       std::back_inserter(layerOps),
+                       [levelBase, levelEnd, base, end, vi](
+                         const Operation& op) {
+                         return op.baseMipLevel < levelEnd &&
+                                op.GetMipLevelEnd(vi->levels) > levelBase &&
+                                op.baseArrayLayer < end &&
+                                op.GetArrayLayerEnd(vi->layers) > base;
+                       });
+
+          // layers used by the same operations share a slice
+          if (SameOperations(ops, layerOps)) {
+            continue;
           }
 
-          std::cout << "INFO: set event for image " << name.c_str()
-                    << std::endl;
-          std::cout << "INFO: wait event for image " << name.c_str()
-                    << std::endl;
+          AddSlice(device, name, levelBase, levelEnd, layerBase, base, ops);
 
-          setEvents[ops[overlap.start - 1].id] = first;
-          waitEvents[ops[ranges[j].start].id] = { first, second };
+          ops = layerOps;
+          layerBase = base;
         }
 
-        // 1. no overlap: nop
-        // 2.    overlap: sets the second of the two necessary set/wait
-        if (overlap.start < overlap.end && overlap.end < ranges[j].end) {
-          SplitBarrier first = {};
-          SplitBarrier second = {};
-
-          for (uint32_t k = overlap.start; k < ranges[j - 1].end; ++k) {
-            first.stageFlags |= ops[k].stageFlags;
-            first.accessFlags |= ops[k].accessFlags;
-            first.layout = ops[k].layout;
-          }
-
-          for (uint32_t k = overlap.end; k < ranges[j].end; ++k) {
-            second.stageFlags |= ops[k].stageFlags;
-            second.accessFlags |= ops[k].accessFlags;
-            second.layout = ops[k].layout;
-          }
-
-          std::cout << "INFO: set event for image " << name.c_str()
-                    << std::endl;
-          std::cout << "INFO: wait event for image " << name.c_str()
-                    << std::endl;
-
-          setEvents[ops[overlap.end - 1].id] = first;
-          waitEvents[ops[overlap.end].id] = { first, second };
-        }
+        AddSlice(
+          device, name, levelBase, levelEnd, layerBase, vi->layers, ops);
       }
     }
 
     for (uint32_t i = 0; i < renderPasses.size(); ++i) {
+      if (renderPasses[i]->IsCompute()) {
+        ASSERT_TRUE(renderPasses[i]->subpasses.size() == 1);
+        ASSERT_TRUE(std::none_of(
+          renderPasses[i]->imageOps.begin(),
+          renderPasses[i]->imageOps.end(),
+          [](const std::pair<const std::string, std::vector<Operation>>& kv) {
+            return std::any_of(
+              kv.second.begin(), kv.second.end(), [](const Operation& op) {
+                return op.HasAttachmentUsageFlags();
+              });
+          }));
+        continue;
+      }
+
       std::vector<VkAttachmentDescription> attachmentDescriptions;
       std::map<std::string, uint32_t> attachmentIndices = {};
       std::vector<VkSubpassDescription> subpassDescriptions = {};
@@ -682,17 +886,31 @@ struct RenderGraph
 
         attachmentIndices[name] = attachmentDescriptions.size() - 1;
 
-        VkClearValue clearValue = vi->HasStencilFormat()
-                                    ? VkClearValue{ 0.f, 0 }
-                                    : VkClearValue{ 0.f, 0.f, 0.f };
-        renderPasses[i]->clearValues.push_back(clearValue);
-
-        renderPasses[i]->renderArea.extent.width =
-          std::max(vi->extent.width, renderPasses[i]->renderArea.extent.width);
-        renderPasses[i]->renderArea.extent.height = std::max(
-          vi->extent.height, renderPasses[i]->renderArea.extent.height);
+        auto attachmentOp =
+          *std::find_if(ops.begin(), ops.end(), [](const Operation& op) {
+            return op.HasAttachmentUsageFlags();
+          });
+        auto range = attachmentOp.GetSubresourceRange(vi->subresourceRange);
+
+        // all subpasses of a render pass use the same attachment views
+        ASSERT_TRUE(
+          std::all_of(ops.begin(), ops.end(), [&](const Operation& op) {
+            auto other = op.GetSubresourceRange(vi->subresourceRange);
+            return !op.HasAttachmentUsageFlags() ||
+                   (other.baseMipLevel == range.baseMipLevel &&
+                    other.baseArrayLayer == range.baseArrayLayer &&
+                    other.layerCount == range.layerCount);
+          }));
+
+        renderPasses[i]->attachmentRanges[name] = range;
+        renderPasses[i]->framebufferLayers =
+          std::max(range.layerCount, renderPasses[i]->framebufferLayers);
+
+        renderPasses[i]->clearValues.push_back(vi->clearValue);
       }
 
+      UpdateRenderArea(renderPasses[i]);
+
       std::vector<std::vector<VkAttachmentReference>> colorAttachmentRefs = {};
       std::vector<std::vector<VkAttachmentReference>>
         depthStencilAttachmentRefs = {};
@@ -768,6 +986,10 @@ struct RenderGraph
 
       ASSERT_VK_SUCCESS(vkCreateRenderPass(
         device, &renderPassCreateInfo, nullptr, &renderPasses[i]->renderPass));
+
+      if (imagelessFramebuffers) {
+        CreateImagelessFramebuffer(device, renderPasses[i]);
+      }
     }
 
     for (uint32_t i = 0; i < renderPasses.size(); ++i) {
@@ -777,5 +999,421 @@ struct RenderGraph
     }
   }
 
+  // the largest attachment extent
+  void UpdateRenderArea(RenderPass* renderPass)
+  {
+    renderPass->renderArea = {};
+    for (auto const& kv : renderPass->attachmentRanges) {
+      auto vi = vis[kv.first];
+      auto const& range = kv.second;
+
+      renderPass->renderArea.extent.width =
+        std::max(std::max(1u, vi->extent.width >> range.baseMipLevel),
+                 renderPass->renderArea.extent.width);
+      renderPass->renderArea.extent.height =
+        std::max(std::max(1u, vi->extent.height >> range.baseMipLevel),
+                 renderPass->renderArea.extent.height);
+    }
+  }
+
+  void CreateImagelessFramebuffer(VkDevice device, RenderPass* renderPass)
+  {
+    std::vector<VkFramebufferAttachmentImageInfoKHR> imageInfos = {};
+    for (auto const& kv : renderPass->attachmentRanges) {
+      auto vi = vis[kv.first];
+      auto const& range = kv.second;
+
+      imageInfos.push_back(vkiFramebufferAttachmentImageInfoKHR(
+        vi->usage,
+        std::max(1u, vi->extent.width >> range.baseMipLevel),
+        std::max(1u, vi->extent.height >> range.baseMipLevel),
+        range.layerCount,
+        1,
+        &vi->format));
+    }
+
+    auto attachmentsCreateInfo = vkiFramebufferAttachmentsCreateInfoKHR(
+      static_cast<uint32_t>(imageInfos.size()), imageInfos.data());
+
+    VkFramebufferCreateInfo framebufferCreateInfo =
+      vkiFramebufferCreateInfo(renderPass->renderPass,
+                               static_cast<uint32_t>(imageInfos.size()),
+                               nullptr,
+                               renderPass->renderArea.extent.width,
+                               renderPass->renderArea.extent.height,
+                               renderPass->framebufferLayers);
+    framebufferCreateInfo.pNext = &attachmentsCreateInfo;
+    framebufferCreateInfo.flags = VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR;
+
+    ASSERT_VK_SUCCESS(vkCreateFramebuffer(
+      device, &framebufferCreateInfo, nullptr, &renderPass->framebuffer));
+  }
+
+  static bool SameOperations(const std::vector<Operation>& a,
+                             const std::vector<Operation>& b)
+  {
+    return std::equal(a.begin(),
+                      a.end(),
+                      b.begin(),
+                      b.end(),
+                      [](const Operation& opA, const Operation& opB) {
+                        return opA.id == opB.id;
+                      });
+  }
+
+  void AddSlice(VkDevice device,
+                const std::string& name,
+                uint32_t levelBase,
+                uint32_t levelEnd,
+                uint32_t layerBase,
+                uint32_t layerEnd,
+                const std::vector<Operation>& ops)
+  {
+    if (ops.size() == 0) {
+      return;
+    }
+
+    ImageSlice slice = {};
+    slice.range = vis[name]->subresourceRange;
+    slice.range.baseMipLevel = levelBase;
+    slice.range.levelCount = levelEnd - levelBase;
+    slice.range.baseArrayLayer = layerBase;
+    slice.range.layerCount = layerEnd - layerBase;
+
+    auto eventCreateInfo = vkiEventCreateInfo();
+    ASSERT_VK_SUCCESS(
+      vkCreateEvent(device, &eventCreateInfo, nullptr, &slice.event));
+
+    auto& slices = imageSlices[name];
+    slices.push_back(slice);
+
+    BakeSlice(name, static_cast<uint32_t>(slices.size() - 1), ops);
+  }
+
+  // Transitions the subresources of a slice from their state at the end of
+  // the last frame to the first operation of this frame. Subresources might
+  // have been left in different states, e.g. in the first frame or if the
+  // slicing changed, so barriers are emitted per run of equal states and
+  // merged across mip levels. Read-only accesses in an unchanged layout need
+  // no barrier, unless the last frame wrote the slice.
+  void AppendFrameBarriers(PhysicalImage* pi,
+                           const ImageSlice& slice,
+                           const Operation& op,
+                           FrameArena* arena,
+                           ScratchVector<VkImageMemoryBarrier>& barriers,
+                           VkPipelineStageFlags& srcStage,
+                           VkPipelineStageFlags& dstStage)
+  {
+    const auto& r = slice.range;
+
+    // barriers of the previous mip level that can still be extended
+    ScratchVector<std::pair<size_t, ImageState>> open(arena);
+    ScratchVector<std::pair<size_t, ImageState>> next(arena);
+
+    for (uint32_t level = r.baseMipLevel; level < r.baseMipLevel + r.levelCount;
+         ++level) {
+      next.clear();
+
+      uint32_t layer = r.baseArrayLayer;
+      while (layer < r.baseArrayLayer + r.layerCount) {
+        ImageState state = pi->GetState(level, layer);
+
+        uint32_t count = 1;
+        while (layer + count < r.baseArrayLayer + r.layerCount &&
+               pi->GetState(level, layer + count) == state) {
+          ++count;
+        }
+
+        // the slice is left in the state of its last access, but a write
+        // before it has to be waited for as well
+        ImageState src = state;
+        src.stageFlags |= slice.lastWrite.stageFlags;
+        src.accessFlags |= slice.lastWrite.accessFlags;
+
+        bool needed = state.layout != op.layout ||
+                      Operation::IsWriteAccess(src.accessFlags) ||
+                      op.HasWriteFlags();
+
+        if (needed) {
+          auto iter = std::find_if(
+            open.begin(),
+            open.end(),
+            [&](const std::pair<size_t, ImageState>& candidate) {
+              auto const& range = barriers[candidate.first].subresourceRange;
+              return candidate.second == state &&
+                     range.baseArrayLayer == layer &&
+                     range.layerCount == count;
+            });
+
+          if (iter != open.end()) {
+            barriers[iter->first].subresourceRange.levelCount += 1;
+            next.push_back(*iter);
+          } else {
+            VkImageSubresourceRange range = r;
+            range.baseMipLevel = level;
+            range.levelCount = 1;
+            range.baseArrayLayer = layer;
+            range.layerCount = count;
+
+            barriers.push_back(vkiImageMemoryBarrier(src.accessFlags,
+                                                     op.accessFlags,
+                                                     state.layout,
+                                                     op.layout,
+                                                     VK_QUEUE_FAMILY_IGNORED,
+                                                     VK_QUEUE_FAMILY_IGNORED,
+                                                     pi->image,
+                                                     range));
+            next.push_back({ barriers.size() - 1, state });
+
+            srcStage |= src.stageFlags;
+            dstStage |= op.stageFlags;
+          }
+        }
+
+        layer += count;
+      }
+
+      open.swap(next);
+    }
+  }
+
+  AttachmentKey GetAttachmentKey(const std::string& name,
+                                 const VkImageSubresourceRange& range)
+  {
+    return std::make_tuple(
+      pis[name], range.baseMipLevel, range.baseArrayLayer, range.layerCount);
+  }
+
+  // Returns the whole image view or a cached view of the subrange.
+  VkImageView GetAttachmentView(VkDevice device,
+                                const std::string& name,
+                                const VkImageSubresourceRange& range)
+  {
+    auto vi = vis[name];
+    auto pi = GetPhysicalImage(name);
+
+    if (range.baseMipLevel == 0 && range.levelCount == vi->levels &&
+        range.baseArrayLayer == 0 && range.layerCount == vi->layers) {
+      return pi->view;
+    }
+
+    auto key = GetAttachmentKey(name, range);
+
+    auto iter = attachmentViews.find(key);
+    if (iter != attachmentViews.end()) {
+      return iter->second;
+    }
+
+    auto imageViewCreateInfo =
+      vkiImageViewCreateInfo(pi->image,
+                             range.layerCount > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                                  : VK_IMAGE_VIEW_TYPE_2D,
+                             vi->format,
+                             { VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY },
+                             range);
+
+    VkImageView view = VK_NULL_HANDLE;
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &imageViewCreateInfo, nullptr, &view));
+    attachmentViews[key] = view;
+
+    return view;
+  }
+
+  void BakeSlice(const std::string& name,
+                 uint32_t slice,
+                 const std::vector<Operation>& ops)
+  {
+    // synchronization only necessary between ranges
+    std::vector<OperationRange> ranges = {
+      { ops[0], 0u, static_cast<uint32_t>(ops.size()) }
+    };
+
+    for (uint32_t j = 1; j < ops.size(); ++j) {
+      auto& currRange = ranges.back();
+      if (ops[j].HasWriteFlags() || currRange.op.HasWriteFlags() ||
+          ops[j].layout != currRange.op.layout) {
+        // end current range here
+        currRange.end = j;
+
+        // begin new range
+        ranges.push_back({ ops[j], j, static_cast<uint32_t>(ops.size()) });
+      } else {
+        // add to current range
+        currRange.op.stageFlags |= ops[j].stageFlags;
+        currRange.op.accessFlags |= ops[j].accessFlags;
+      }
+    }
+
+    imageSlices[name][slice].ranges = ranges;
+
+    auto lastWrite = std::find_if(
+      ranges.rbegin(), ranges.rend(), [](const OperationRange& range) {
+        return range.op.HasWriteFlags();
+      });
+    if (lastWrite != ranges.rend()) {
+      imageSlices[name][slice].lastWrite = { lastWrite->op.stageFlags,
+                                             lastWrite->op.accessFlags,
+                                             lastWrite->op.layout };
+    }
+
+    // if a renderpass crosses a range boundary, the ranges have to be
+    // synchronized with subpass dependencies; we are using the Overlap
+    // struct to track where the renderpass crosses a range boundary
+
+    struct Overlap
+    {
+      uint32_t start = 0;
+      uint32_t end = 0;
+    };
+
+    for (uint32_t j = 1; j < ranges.size(); ++j) {
+      // TODO: synchronization with previous frame
+
+      Overlap overlap = {};
+      overlap.start = ranges[j - 1].end;
+      overlap.end = ranges[j].start;
+
+      if (ops[ranges[j - 1].end - 1].renderPass ==
+          ops[ranges[j].start].renderPass) {
+        overlap.start = ranges[j - 1].end - 1;
+        overlap.end = ranges[j].start + 1;
+
+        while (overlap.start - 1 >= ranges[j - 1].start &&
+               ops[overlap.start - 1].renderPass ==
+                 ops[overlap.start].renderPass) {
+          --overlap.start;
+        }
+
+        while (overlap.end < ranges[j].end &&
+               ops[overlap.end].renderPass == ops[overlap.start].renderPass) {
+          ++overlap.end;
+        }
+      }
+
+      if (overlap.start < overlap.end) {
+        // NOTE: The spec says that images that are used as attachments in
+        // one subpass are not allowed to be used as e.g.
+        // VK_IMAGE_USAGE_SAMPLED_BIT in another subpass. We can only
+        // transition the image layout from one attachment layout to
+        // another attachment layout between subpasses (The target layout
+        // of an image for a subpass can only be specified in the
+        // ATTACHMENT REFERENCE, so there is no way to specify a target
+        // layout for non attachment images.)
+
+        // Valid cases for synchronization between subpasses:
+        // - synchronization with and with layout transition for
+        // attachments
+        // - synchronization without layout transition for non attachments
+
+        bool attachmentUsageConsistent =
+          std::all_of(ops.begin() + overlap.start,
+                      ops.begin() + overlap.end,
+                      [&ops, &overlap](const Operation& op) {
+                        return op.HasAttachmentUsageFlags() ==
+                               ops[overlap.start].HasAttachmentUsageFlags();
+                      });
+
+        ASSERT_TRUE(attachmentUsageConsistent);
+
+        bool layoutConsistent =
+          std::all_of(ops.begin() + overlap.start,
+                      ops.begin() + overlap.end,
+                      [&ops, &overlap](const Operation& op) {
+                        return op.layout == ops[overlap.start].layout;
+                      });
+
+        ASSERT_TRUE(ops[overlap.start].HasAttachmentUsageFlags() ||
+                    layoutConsistent);
+
+        for (uint32_t k = overlap.start; k < ranges[j - 1].end; ++k) {
+          for (uint32_t l = ranges[j].start; l < overlap.end; ++l) {
+
+            uint32_t renderPass = ops[overlap.start].renderPass;
+
+            // compute passes have no subpass dependencies
+            ASSERT_TRUE(!renderPasses[renderPass]->IsCompute());
+
+            std::cout << "INFO: subpass dependency for image " << name.c_str()
+                      << " in render pass " << renderPass
+                      << " between subpass " << k << " and subpass " << l
+                      << std::endl;
+
+            auto& dependency =
+              renderPasses[renderPass]
+                ->subpassDependencies[{ ops[k].subpass, ops[l].subpass }];
+
+            dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+            dependency.srcAccessMask |= ops[k].stageFlags;
+            dependency.srcStageMask |= ops[k].accessFlags;
+            dependency.srcSubpass = ops[k].subpass;
+
+            dependency.dstStageMask |= ops[l].stageFlags;
+            dependency.dstAccessMask |= ops[l].accessFlags;
+            dependency.dstSubpass = ops[l].subpass;
+          }
+        }
+      }
+
+      // 1. no overlap: sets the one necessary set/wait
+      // 2.    overlap: sets first of two necessary set/wait
+      if (ranges[j - 1].start < overlap.start) {
+        SplitBarrier first = {};
+        SplitBarrier second = {};
+
+        for (uint32_t k = ranges[j - 1].start; k < overlap.start; ++k) {
+          first.stageFlags |= ops[k].stageFlags;
+          first.accessFlags |= ops[k].accessFlags;
+          first.layout = ops[k].layout;
+        }
+
+        for (uint32_t k = ranges[j].start; k < ranges[j].end; ++k) {
+          second.stageFlags |= ops[k].stageFlags;
+          second.accessFlags |= ops[k].accessFlags;
+          second.layout = ops[k].layout;
+        }
+
+        std::cout << "INFO: set event for image " << name.c_str()
+                  << std::endl;
+        std::cout << "INFO: wait event for image " << name.c_str()
+                  << std::endl;
+
+        setEvents[{ ops[overlap.start - 1].id, slice }] = first;
+        waitEvents[{ ops[ranges[j].start].id, slice }] = { first, second };
+      }
+
+      // 1. no overlap: nop
+      // 2.    overlap: sets the second of the two necessary set/wait
+      if (overlap.start < overlap.end && overlap.end < ranges[j].end) {
+        SplitBarrier first = {};
+        SplitBarrier second = {};
+
+        for (uint32_t k = overlap.start; k < ranges[j - 1].end; ++k) {
+          first.stageFlags |= ops[k].stageFlags;
+          first.accessFlags |= ops[k].accessFlags;
+          first.layout = ops[k].layout;
+        }
+
+        for (uint32_t k = overlap.end; k < ranges[j].end; ++k) {
+          second.stageFlags |= ops[k].stageFlags;
+          second.accessFlags |= ops[k].accessFlags;
+          second.layout = ops[k].layout;
+        }
+
+        std::cout << "INFO: set event for image " << name.c_str()
+                  << std::endl;
+        std::cout << "INFO: wait event for image " << name.c_str()
+                  << std::endl;
+
+        setEvents[{ ops[overlap.end - 1].id, slice }] = first;
+        waitEvents[{ ops[overlap.end].id, slice }] = { first, second };
+      }
+    }
+  }
+
   virtual void OnCreatePhysicalImages() {}
 };
@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 inNormal;
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	vec3 light = normalize(vec3(1, 2, 1));
+	float diffuse = max(dot(normalize(inNormal), light), 0);
+	outColor = vec4(vec3(0.1 + 0.9 * diffuse), 1);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_format.glsl"
+
+// QUANTIZED_POSITION | OCTAHEDRAL_NORMAL vertices of the asset pack
+layout(constant_id = 0) const bool packed = false;
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec3 inNormal;
+
+layout(location = 0) out vec3 outNormal;
+
+layout(push_constant) uniform Push {
+	mat4 viewProj;
+	// dequantization of packed positions, 0 and 1 for float ones
+	vec4 positionMin;
+	vec4 positionExtent;
+};
+
+// firstInstance of the culled draws is the index of the instance
+layout(set = 0, binding = 0) readonly buffer Models {
+	mat4 models[];
+};
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+	mat4 model = models[gl_InstanceIndex];
+	vec3 position = positionMin.xyz + inPos * positionExtent.xyz;
+	vec3 normal = packed ? DecodeOctahedral(inNormal.xy) : inNormal;
+	gl_Position = viewProj * model * vec4(position, 1);
+	outNormal = mat3(model) * normal;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+// Decoders for the packed vertex formats of SimplifiedVertexInputState, use
+//   #extension GL_GOOGLE_include_directive : require
+//   #include "vertex_format.glsl"
+// Quantized positions need no decoding, their dequantization matrix is part
+// of the model matrix.
+
+// NORMAL with OCTAHEDRAL_NORMAL (R16G16_SNORM)
+vec3 DecodeOctahedral(vec2 e)
+{
+  vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-v.z, 0.0);
+  v.x += v.x >= 0.0 ? -t : t;
+  v.y += v.y >= 0.0 ? -t : t;
+  return normalize(v);
+}
+
+// TANGENT with OCTAHEDRAL_NORMAL (R8G8B8A8_SNORM)
+vec4 DecodeTangent(vec4 e)
+{
+  return vec4(DecodeOctahedral(e.xy), e.w < 0.0 ? -1.0 : 1.0);
+}
@@ -0,0 +1,23 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// VirtualTexture::image, built with -DVIRTUAL_TEXTURE_SPARSE for sparse mode
+layout(set = 0, binding = 0) uniform sampler2D image;
+
+#define VIRTUAL_TEXTURE_SET 0
+#define VIRTUAL_TEXTURE_BINDING 1
+#include "virtual_texture.glsl"
+
+layout(push_constant) uniform Push {
+	VirtualTextureInfo info;
+};
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	float lod = VirtualTextureLod(info, inUV);
+	VirtualTextureFeedback(info, inUV, lod, uvec2(gl_FragCoord.xy));
+	outColor = SampleVirtualTexture(info, image, inUV, lod);
+}
\ No newline at end of file
@@ -0,0 +1,159 @@
+// Sampling and feedback of a VirtualTexture, use
+//   #define VIRTUAL_TEXTURE_SET 0
+//   #define VIRTUAL_TEXTURE_BINDING 1
+//   #extension GL_GOOGLE_include_directive : require
+//   #include "virtual_texture.glsl"
+// VirtualTexture::pageTable is bound at VIRTUAL_TEXTURE_BINDING and
+// VirtualTexture::feedback at the binding after it. Define
+// VIRTUAL_TEXTURE_SPARSE for VIRTUAL_TEXTURE_MODE_SPARSE, the sampler is
+// VirtualTexture::image in both modes. Texture coordinates are clamped to
+// [0, 1], there is no wrapping.
+
+// VirtualTextureInfo of virtual_texture.h
+struct VirtualTextureInfo
+{
+  uint width;
+  uint height;
+  uint pageSize;
+  uint mipCount;
+  uint atlasWidth;
+  uint atlasHeight;
+  uint frameIndex;
+  uint pad;
+};
+
+// slot in the low 24 bits, mip in the high 8, 0xffffffff for none
+layout(std430, set = VIRTUAL_TEXTURE_SET, binding = VIRTUAL_TEXTURE_BINDING)
+  readonly buffer VirtualTexturePageTable
+{
+  uint virtualTexturePageTable[];
+};
+
+// a bit per page
+layout(std430,
+       set = VIRTUAL_TEXTURE_SET,
+       binding = VIRTUAL_TEXTURE_BINDING + 1) buffer VirtualTextureRequests
+{
+  uint virtualTextureRequests[];
+};
+
+uvec2 VirtualTextureMipSize(VirtualTextureInfo info, uint mip)
+{
+  return max(uvec2(info.width, info.height) >> mip, uvec2(1u));
+}
+
+uvec2 VirtualTexturePageCount(VirtualTextureInfo info, uint mip)
+{
+  return (VirtualTextureMipSize(info, mip) + info.pageSize - 1u) /
+         info.pageSize;
+}
+
+// pages are stored mip by mip, row by row
+uint VirtualTexturePageIndex(VirtualTextureInfo info,
+                             vec2 uv,
+                             uint mip,
+                             out uvec2 page)
+{
+  uint first = 0u;
+  for (uint i = 0u; i < mip; ++i) {
+    uvec2 count = VirtualTexturePageCount(info, i);
+    first += count.x * count.y;
+  }
+
+  uvec2 count = VirtualTexturePageCount(info, mip);
+  vec2 texel = clamp(uv, 0.0, 1.0) * vec2(VirtualTextureMipSize(info, mip));
+  page = min(uvec2(texel) / info.pageSize, count - 1u);
+  return first + page.y * count.x + page.x;
+}
+
+// LOD of the whole texture, fragment shaders only
+float VirtualTextureLod(VirtualTextureInfo info, vec2 uv)
+{
+  vec2 texels = uv * vec2(info.width, info.height);
+  vec2 dx = dFdx(texels);
+  vec2 dy = dFdy(texels);
+  float rho = max(dot(dx, dx), dot(dy, dy));
+  return clamp(0.5 * log2(max(rho, 1e-8)), 0.0, float(info.mipCount - 1u));
+}
+
+// Asks for the page sampled at uv and lod. One pixel of each 4x4 tile
+// writes per frame, a different one every frame, e.g. pixel is
+// uvec2(gl_FragCoord.xy).
+void VirtualTextureFeedback(VirtualTextureInfo info,
+                            vec2 uv,
+                            float lod,
+                            uvec2 pixel)
+{
+  uvec2 tile = pixel & 3u;
+  if (tile.y * 4u + tile.x != ((info.frameIndex * 7u) & 15u)) {
+    return;
+  }
+
+  uvec2 page;
+  uint index = VirtualTexturePageIndex(info, uv, uint(lod), page);
+  uint bit = 1u << (index & 31u);
+  // most pages are asked for by many pixels, skip the atomic then
+  if ((virtualTextureRequests[index >> 5] & bit) == 0u) {
+    atomicOr(virtualTextureRequests[index >> 5], bit);
+  }
+}
+
+#ifdef VIRTUAL_TEXTURE_SPARSE
+
+// The LOD is clamped to the finest resident mip. Filtering can reach the
+// next coarser mip and pages next to the sampled one, which are resident
+// as long as the pixels there asked for them.
+vec4 SampleVirtualTexture(VirtualTextureInfo info,
+                          sampler2D image,
+                          vec2 uv,
+                          float lod)
+{
+  uvec2 page;
+  uint entry =
+    virtualTexturePageTable[VirtualTexturePageIndex(info, uv, uint(lod), page)];
+  if (entry == 0xffffffffu) {
+    return vec4(0.0);
+  }
+  return textureLod(image, uv, max(lod, float(entry >> 24)));
+}
+
+#else
+
+// Bilinear from the finest resident page, the atlas has no mips. Pages have
+// no borders, samples are clamped half a texel inside the page.
+vec4 SampleVirtualTexture(VirtualTextureInfo info,
+                          sampler2D atlas,
+                          vec2 uv,
+                          float lod)
+{
+  uint mip = uint(lod);
+  uvec2 page;
+  uint entry =
+    virtualTexturePageTable[VirtualTexturePageIndex(info, uv, mip, page)];
+  if (entry == 0xffffffffu) {
+    return vec4(0.0);
+  }
+
+  // the resident page is the ancestor of page, see VirtualTexture::GetParent;
+  // with odd mip sizes uv can lie up to half a texel outside of it
+  uint residentMip = entry >> 24;
+  for (uint i = mip; i < residentMip; ++i) {
+    page = min(page / 2u, VirtualTexturePageCount(info, i + 1u) - 1u);
+  }
+  uvec2 mipSize = VirtualTextureMipSize(info, residentMip);
+  uvec2 pageOrigin = page * info.pageSize;
+  vec2 pageEnd = vec2(min(uvec2(info.pageSize), mipSize - pageOrigin));
+  vec2 texel = clamp(uv, 0.0, 1.0) * vec2(mipSize) - vec2(pageOrigin);
+  texel = clamp(texel, vec2(0.5), pageEnd - 0.5);
+
+  uint slot = entry & 0xffffffu;
+  uint slotsPerRow = info.atlasWidth / info.pageSize;
+  uvec2 slotOrigin = uvec2(slot % slotsPerRow, slot / slotsPerRow) *
+                     info.pageSize;
+  return textureLod(atlas,
+                    (vec2(slotOrigin) + texel) /
+                      vec2(info.atlasWidth, info.atlasHeight),
+                    0.0);
+}
+
+#endif
@@ -0,0 +1,776 @@
+#include "streaming.h"
+
+#include <algorithm> // sort, max
+#include <iostream>
+
+#include "texture.h"
+#include "vk_utils.h"
+
+namespace {
+
+VkDeviceSize
+AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// stages and accesses of everything that reads streamed assets
+const VkPipelineStageFlags ASSET_READ_STAGES =
+  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+const VkAccessFlags ASSET_READ_ACCESS = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                        VK_ACCESS_INDEX_READ_BIT |
+                                        VK_ACCESS_SHADER_READ_BIT;
+
+VkImageMemoryBarrier
+GetImageBarrier(const PhysicalImage& image,
+                VkFormat format,
+                VkAccessFlags srcAccess,
+                VkAccessFlags dstAccess,
+                VkImageLayout oldLayout,
+                VkImageLayout newLayout)
+{
+  return vkiImageMemoryBarrier(
+    srcAccess,
+    dstAccess,
+    oldLayout,
+    newLayout,
+    VK_QUEUE_FAMILY_IGNORED,
+    VK_QUEUE_FAMILY_IGNORED,
+    image.image,
+    vkiImageSubresourceRange(
+      vkuGetImageAspectFlags(format), 0, image.levels, 0, image.layers));
+}
+
+} // namespace
+
+void
+StagingRing::Create(VkDevice device,
+                    const VkPhysicalDeviceMemoryProperties& memProps,
+                    VkDeviceSize size)
+{
+  this->device = device;
+  this->size = size;
+
+  buffer = vkuCreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  memory = vkuAllocateBufferMemory(device,
+                                   memProps,
+                                   buffer,
+                                   VKU_MEMORY_USAGE_STAGING,
+                                   true,
+                                   MEMORY_CATEGORY_STAGING);
+
+  // staging memory is coherent, writes need no flush
+  void* data = nullptr;
+  ASSERT_VK_SUCCESS(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+  mapped = static_cast<uint8_t*>(data);
+}
+
+void
+StagingRing::Destroy()
+{
+  if (memory != VK_NULL_HANDLE) {
+    vkUnmapMemory(device, memory);
+    vkuFreeMemory(device, memory);
+  }
+  vkDestroyBuffer(device, buffer, nullptr);
+
+  buffer = VK_NULL_HANDLE;
+  memory = VK_NULL_HANDLE;
+  mapped = nullptr;
+  spans.clear();
+}
+
+bool
+StagingRing::Allocate(VkDeviceSize size,
+                      VkDeviceSize alignment,
+                      Allocation& allocation)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // empty allocations take a byte, the head has to move
+  size = std::max<VkDeviceSize>(size, 1);
+  if (spans.empty()) {
+    head = 0;
+    tail = 0;
+  }
+
+  // used is [tail, head) or, once wrapped, [tail, size) and [0, head); a
+  // wrapped head stays below tail so a full ring is not mistaken for empty
+  VkDeviceSize offset = AlignUp(head, alignment);
+  if (spans.empty() || head > tail) {
+    if (offset + size > this->size) {
+      if (spans.empty() || size >= tail) {
+        return false;
+      }
+      offset = 0;
+    }
+  } else if (offset + size >= tail) {
+    return false;
+  }
+
+  head = offset + size;
+
+  Span span = {};
+  span.end = head;
+  spans.push_back(span);
+
+  allocation.id = firstId + spans.size() - 1;
+  allocation.offset = offset;
+  allocation.size = size;
+  allocation.data = mapped + offset;
+  return true;
+}
+
+void
+StagingRing::Retire(const Allocation& allocation, uint64_t value)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  spans[static_cast<size_t>(allocation.id - firstId)].value = value;
+}
+
+bool
+StagingRing::Collect(uint64_t completedValue)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  bool freed = false;
+  while (!spans.empty() && spans.front().value <= completedValue) {
+    tail = spans.front().end;
+    spans.pop_front();
+    firstId += 1;
+    freed = true;
+  }
+  return freed;
+}
+
+void
+AssetStreamer::Create(VkPhysicalDevice physicalDevice,
+                      VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties& memProps,
+                      Timeline* timeline,
+                      DeletionQueue* deletionQueue,
+                      const AssetPack* pack,
+                      uint32_t ioThreadCount,
+                      uint32_t decodeThreadCount,
+                      VkDeviceSize stagingSize)
+{
+  this->device = device;
+  this->memProps = memProps;
+  this->timeline = timeline;
+  this->deletionQueue = deletionQueue;
+  this->pack = pack;
+
+  stagingRing.Create(device, memProps, stagingSize);
+  mipGenerator.Create(physicalDevice);
+
+  // cleared by the first Update
+  defaultTexture.texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+  defaultTexture.texture.width = 1;
+  defaultTexture.texture.height = 1;
+  CreateTextureImage(device,
+                     memProps,
+                     defaultTexture.texture,
+                     VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                     defaultTexture.image);
+
+  stopping = false;
+  for (uint32_t i = 0; i < ioThreadCount; ++i) {
+    threads.emplace_back(&AssetStreamer::IoThread, this);
+  }
+  for (uint32_t i = 0; i < decodeThreadCount; ++i) {
+    threads.emplace_back(&AssetStreamer::DecodeThread, this);
+  }
+}
+
+void
+AssetStreamer::Destroy()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  requestCondition.notify_all();
+  decodeCondition.notify_all();
+  stagingCondition.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+
+  for (auto const& name : names) {
+    Release(*assets.Get(name.second));
+  }
+  deletionQueue->Push(defaultTexture.image);
+
+  // the ring is reused until the last upload completed
+  timeline->Wait(timeline->lastSubmitted);
+  stagingRing.Destroy();
+
+  assets = {};
+  names.clear();
+  requests.clear();
+  decodeJobs.clear();
+  readyJobs.clear();
+  uploads.clear();
+  residentSize = 0;
+}
+
+AssetHandle
+AssetStreamer::Request(const char* name, float distance, float importance)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  AssetHandle handle = {};
+  auto iter = names.find(name);
+  if (iter != names.end()) {
+    handle = iter->second;
+  } else {
+    // virtual textures stream page by page, see VirtualTexture
+    const PackEntry* entry = pack->Find(name);
+    if (entry == nullptr || entry->type == PACK_ENTRY_VIRTUAL_TEXTURE) {
+      return {};
+    }
+
+    StreamedAsset asset = {};
+    asset.entry = entry;
+    asset.state = ASSET_STATE_EVICTED;
+    handle = assets.Add(asset);
+    names[name] = handle;
+  }
+
+  StreamedAsset* asset = assets.Get(handle);
+  asset->priority = importance / (1.0f + std::max(distance, 0.0f));
+  if (asset->state == ASSET_STATE_EVICTED) {
+    asset->state = ASSET_STATE_PENDING;
+    asset->serial += 1;
+    requests.push_back(handle);
+    lock.unlock();
+    requestCondition.notify_one();
+  }
+  return handle;
+}
+
+void
+AssetStreamer::SetPriority(AssetHandle handle, float distance, float importance)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StreamedAsset* asset = assets.Get(handle);
+  if (asset != nullptr) {
+    asset->priority = importance / (1.0f + std::max(distance, 0.0f));
+  }
+}
+
+void
+AssetStreamer::SetPlaceholder(AssetHandle handle, AssetHandle placeholder)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StreamedAsset* asset = assets.Get(handle);
+  if (asset != nullptr) {
+    asset->placeholder = placeholder;
+  }
+}
+
+void
+AssetStreamer::Evict(AssetHandle handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StreamedAsset* asset = assets.Get(handle);
+  if (asset == nullptr || asset->state == ASSET_STATE_EVICTED) {
+    return;
+  }
+
+  // a pending load is dropped when it shows up in Update
+  requests.erase(std::remove(requests.begin(), requests.end(), handle),
+                 requests.end());
+  Release(*asset);
+  asset->state = ASSET_STATE_EVICTED;
+  asset->serial += 1;
+}
+
+AssetState
+AssetStreamer::GetState(AssetHandle handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StreamedAsset* asset = assets.Get(handle);
+  return asset != nullptr ? asset->state : ASSET_STATE_FAILED;
+}
+
+const StreamedAsset*
+AssetStreamer::GetResident(AssetHandle handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StreamedAsset* asset = assets.Get(handle);
+  if (asset == nullptr) {
+    return nullptr;
+  }
+  asset->lastUsedFrame = frame;
+  if (asset->state == ASSET_STATE_RESIDENT) {
+    return asset;
+  }
+
+  StreamedAsset* placeholder = assets.Get(asset->placeholder);
+  if (placeholder != nullptr && placeholder->state == ASSET_STATE_RESIDENT) {
+    placeholder->lastUsedFrame = frame;
+    return placeholder;
+  }
+
+  if (asset->entry->type == PACK_ENTRY_TEXTURE &&
+      defaultTexture.state == ASSET_STATE_RESIDENT) {
+    return &defaultTexture;
+  }
+  return nullptr;
+}
+
+void
+AssetStreamer::Update(VkCommandBuffer cmdBuffer, VkDeviceSize maxUploadSize)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  frame += 1;
+  uint64_t completedValue = timeline->GetCompletedValue();
+  uint64_t uploadValue = timeline->GetNextValue();
+
+  // under the lock, so a thread waiting for room cannot miss it
+  if (stagingRing.Collect(completedValue)) {
+    stagingCondition.notify_all();
+  }
+
+  for (auto& upload : uploads) {
+    StreamedAsset* asset = assets.Get(upload.handle);
+    if (upload.serial != asset->serial ||
+        asset->state != ASSET_STATE_PENDING) {
+      upload.handle = {}; // evicted, or requested again, meanwhile
+    } else if (asset->uploadValue <= completedValue) {
+      asset->state = ASSET_STATE_RESIDENT;
+      upload.handle = {};
+    }
+  }
+  uploads.erase(std::remove_if(uploads.begin(),
+                               uploads.end(),
+                               [](const Upload& upload) {
+                                 return upload.handle == AssetHandle();
+                               }),
+                uploads.end());
+
+  if (defaultTexture.uploadValue != 0 &&
+      defaultTexture.uploadValue <= completedValue) {
+    defaultTexture.state = ASSET_STATE_RESIDENT;
+  }
+
+  // highest priority first, the rest waits for the next frame
+  std::sort(readyJobs.begin(),
+            readyJobs.end(),
+            [this](const Job& a, const Job& b) {
+              return assets.Get(a.handle)->priority >
+                     assets.Get(b.handle)->priority;
+            });
+
+  std::vector<Job> jobs;
+  std::vector<Job> deferredJobs;
+  VkDeviceSize uploadSize = 0;
+  for (auto& job : readyJobs) {
+    StreamedAsset* asset = assets.Get(job.handle);
+    bool stale =
+      job.serial != asset->serial || asset->state != ASSET_STATE_PENDING;
+
+    if (!stale && !job.failed && uploadSize > 0 &&
+        uploadSize + job.entry->payloadSize > maxUploadSize) {
+      deferredJobs.push_back(std::move(job));
+      continue;
+    }
+
+    if (!stale && job.failed) {
+      std::cout << "WARNING: asset " << pack->GetName(*job.entry)
+                << " failed to load" << std::endl;
+      asset->state = ASSET_STATE_FAILED;
+    }
+    if (stale || job.failed) {
+      if (job.staging.data != nullptr) {
+        stagingRing.Retire(job.staging, completedValue);
+      }
+      continue;
+    }
+
+    uploadSize += job.entry->payloadSize;
+    jobs.push_back(std::move(job));
+  }
+  readyJobs = std::move(deferredJobs);
+
+  // one barrier before and one after all copies
+  std::vector<VkImageMemoryBarrier> preBarriers;
+  std::vector<VkImageMemoryBarrier> postBarriers;
+  bool bufferCopies = false;
+
+  if (defaultTexture.uploadValue == 0) {
+    preBarriers.push_back(
+      GetImageBarrier(defaultTexture.image,
+                      VK_FORMAT_R8G8B8A8_UNORM,
+                      0,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_UNDEFINED,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+    postBarriers.push_back(
+      GetImageBarrier(defaultTexture.image,
+                      VK_FORMAT_R8G8B8A8_UNORM,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_ACCESS_SHADER_READ_BIT,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+  }
+
+  for (auto& job : jobs) {
+    StreamedAsset& asset = *assets.Get(job.handle);
+    asset.mesh = job.mesh;
+    asset.texture = job.texture;
+    asset.uploadValue = uploadValue;
+
+    switch (job.entry->type) {
+      case PACK_ENTRY_MESH: {
+        asset.buffer = vkuCreateBuffer(device,
+                                       job.entry->payloadSize,
+                                       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        asset.memory = vkuAllocateBufferMemory(
+          device, memProps, asset.buffer, VKU_MEMORY_USAGE_GPU_ONLY, true);
+
+        VkMemoryRequirements requirements = {};
+        vkGetBufferMemoryRequirements(device, asset.buffer, &requirements);
+        asset.residentSize = requirements.size;
+        bufferCopies = true;
+        break;
+      }
+      case PACK_ENTRY_TEXTURE: {
+        bool generateMips =
+          (asset.texture.flags & PACK_TEXTURE_GENERATE_MIPS) != 0;
+        VkImageUsageFlags usage =
+          VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        if (generateMips) {
+          usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+        CreateTextureImage(device, memProps, asset.texture, usage, asset.image);
+
+        VkMemoryRequirements requirements = {};
+        vkGetImageMemoryRequirements(device, asset.image.image, &requirements);
+        asset.residentSize = requirements.size;
+
+        VkFormat format = static_cast<VkFormat>(asset.texture.format);
+        preBarriers.push_back(
+          GetImageBarrier(asset.image,
+                          format,
+                          0,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+
+        ImageState state = {};
+        state.stageFlags = ASSET_READ_STAGES;
+        state.accessFlags = VK_ACCESS_SHADER_READ_BIT;
+        state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        if (generateMips) {
+          // the generator picks up after the copies of level 0
+          ImageState copied = {};
+          copied.stageFlags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+          copied.accessFlags = VK_ACCESS_TRANSFER_WRITE_BIT;
+          copied.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+          asset.image.states.assign(asset.image.states.size(), copied);
+          mipGenerator.Add(asset.image,
+                           format,
+                           { asset.texture.width,
+                             asset.texture.height,
+                             asset.texture.depth },
+                           state);
+        } else {
+          postBarriers.push_back(
+            GetImageBarrier(asset.image,
+                            format,
+                            VK_ACCESS_TRANSFER_WRITE_BIT,
+                            VK_ACCESS_SHADER_READ_BIT,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+          asset.image.states.assign(asset.image.states.size(), state);
+        }
+        break;
+      }
+      default:
+        // stays on the host, nothing to wait for
+        asset.data = std::move(job.data);
+        asset.state = ASSET_STATE_RESIDENT;
+        break;
+    }
+    residentSize += asset.residentSize;
+  }
+
+  if (preBarriers.size() > 0) {
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(preBarriers.size()),
+                         preBarriers.data());
+  }
+
+  if (defaultTexture.uploadValue == 0) {
+    VkClearColorValue grey = { { 0.5f, 0.5f, 0.5f, 1.0f } };
+    auto range =
+      vkiImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1);
+    vkCmdClearColorImage(cmdBuffer,
+                         defaultTexture.image.image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         &grey,
+                         1,
+                         &range);
+    defaultTexture.uploadValue = uploadValue;
+  }
+
+  std::vector<VkBufferImageCopy> regions;
+  for (auto& job : jobs) {
+    StreamedAsset& asset = *assets.Get(job.handle);
+
+    if (job.entry->type == PACK_ENTRY_MESH) {
+      VkBufferCopy region = { job.staging.offset, 0, job.entry->payloadSize };
+      vkCmdCopyBuffer(cmdBuffer, stagingRing.buffer, asset.buffer, 1, &region);
+    } else if (job.entry->type == PACK_ENTRY_TEXTURE) {
+      GetTextureCopyRegions(
+        asset.texture, job.levels.data(), job.staging.offset, regions);
+      vkCmdCopyBufferToImage(cmdBuffer,
+                             stagingRing.buffer,
+                             asset.image.image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             static_cast<uint32_t>(regions.size()),
+                             regions.data());
+    }
+
+    if (job.staging.data != nullptr) {
+      stagingRing.Retire(job.staging, uploadValue);
+    }
+    if (asset.state == ASSET_STATE_PENDING) {
+      uploads.push_back({ job.handle, job.serial });
+    }
+  }
+
+  if (bufferCopies || postBarriers.size() > 0) {
+    auto memoryBarrier =
+      vkiMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, ASSET_READ_ACCESS);
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         ASSET_READ_STAGES,
+                         0,
+                         bufferCopies ? 1 : 0,
+                         &memoryBarrier,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(postBarriers.size()),
+                         postBarriers.data());
+  }
+
+  // all generated chains in one batch, after the copies of their level 0
+  mipGenerator.Record(cmdBuffer);
+
+  if (budget == 0 || residentSize <= budget) {
+    return;
+  }
+
+  // lowest priority and longest unused first, assets used since the
+  // previous Update are still referenced by the frame being recorded
+  std::vector<StreamedAsset*> candidates;
+  for (auto const& name : names) {
+    StreamedAsset* asset = assets.Get(name.second);
+    if (asset->state == ASSET_STATE_RESIDENT && asset->residentSize > 0 &&
+        asset->lastUsedFrame + 1 < frame) {
+      candidates.push_back(asset);
+    }
+  }
+  std::sort(candidates.begin(),
+            candidates.end(),
+            [](const StreamedAsset* a, const StreamedAsset* b) {
+              return a->priority < b->priority ||
+                     (a->priority == b->priority &&
+                      a->lastUsedFrame < b->lastUsedFrame);
+            });
+
+  for (auto asset : candidates) {
+    if (residentSize <= budget) {
+      break;
+    }
+    Release(*asset);
+    asset->state = ASSET_STATE_EVICTED;
+    asset->serial += 1;
+  }
+}
+
+void
+AssetStreamer::IoThread()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    requestCondition.wait(lock,
+                          [this] { return stopping || !requests.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    auto next = requests.begin();
+    for (auto iter = requests.begin(); iter != requests.end(); ++iter) {
+      if (assets.Get(*iter)->priority > assets.Get(*next)->priority) {
+        next = iter;
+      }
+    }
+
+    Job job = {};
+    job.handle = *next;
+    job.entry = assets.Get(job.handle)->entry;
+    job.serial = assets.Get(job.handle)->serial;
+    requests.erase(next);
+
+    const PackEntry& entry = *job.entry;
+    if (entry.type == PACK_ENTRY_RAW || entry.type == PACK_ENTRY_SPIRV) {
+      lock.unlock();
+      job.data = pack->Read(entry);
+      job.failed = job.data.size() != entry.payloadSize;
+      lock.lock();
+    } else if (entry.compression != PACK_COMPRESSION_NONE) {
+      // reading the mapped blob faults its pages in, off the decode threads
+      lock.unlock();
+      const uint8_t* blob = pack->GetMappedBlob(entry);
+      job.blob.assign(blob, blob + entry.size);
+      lock.lock();
+
+      decodeJobs.push_back(std::move(job));
+      decodeCondition.notify_one();
+      continue;
+    } else {
+      if (!AllocateStaging(job, lock)) {
+        return;
+      }
+      if (!job.failed) {
+        lock.unlock();
+        pack->ReadRange(entry, 0, entry.payloadSize, job.staging.data);
+        ReadHeaders(job, pack->GetMappedPayload(entry));
+        lock.lock();
+      }
+    }
+
+    readyJobs.push_back(std::move(job));
+  }
+}
+
+void
+AssetStreamer::DecodeThread()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    decodeCondition.wait(lock,
+                         [this] { return stopping || !decodeJobs.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    Job job = std::move(decodeJobs.front());
+    decodeJobs.pop_front();
+
+    if (!AllocateStaging(job, lock)) {
+      return;
+    }
+    if (!job.failed) {
+      lock.unlock();
+      const PackEntry& entry = *job.entry;
+      job.failed = !ReadPackBlobRange(
+        entry, job.blob.data(), 0, entry.payloadSize, job.staging.data);
+      job.blob = {};
+      if (!job.failed) {
+        ReadHeaders(job, job.staging.data);
+      }
+      lock.lock();
+    }
+
+    readyJobs.push_back(std::move(job));
+  }
+}
+
+bool
+AssetStreamer::AllocateStaging(Job& job, std::unique_lock<std::mutex>& lock)
+{
+  VkDeviceSize size = job.entry->payloadSize;
+  if (size > stagingRing.size) {
+    job.failed = true;
+    return true;
+  }
+
+  stagingCondition.wait(lock, [&] {
+    return stopping || stagingRing.Allocate(size, PACK_ALIGNMENT, job.staging);
+  });
+  return !stopping;
+}
+
+void
+AssetStreamer::ReadHeaders(Job& job, const uint8_t* payload)
+{
+  const PackEntry& entry = *job.entry;
+
+  if (entry.type == PACK_ENTRY_MESH) {
+    job.failed = entry.payloadSize < sizeof(PackMesh);
+    if (!job.failed) {
+      memcpy(&job.mesh, payload, sizeof(PackMesh));
+    }
+  } else if (entry.type == PACK_ENTRY_TEXTURE) {
+    job.failed = entry.payloadSize < sizeof(PackTexture);
+    if (job.failed) {
+      return;
+    }
+    memcpy(&job.texture, payload, sizeof(PackTexture));
+
+    uint64_t levelCount =
+      uint64_t(job.texture.mipCount) * job.texture.layerCount;
+    job.failed = levelCount == 0 ||
+                 sizeof(PackTexture) + levelCount * sizeof(PackTextureLevel) >
+                   entry.payloadSize;
+    if (job.failed) {
+      return;
+    }
+    job.levels.resize(static_cast<size_t>(levelCount));
+    memcpy(job.levels.data(),
+           payload + sizeof(PackTexture),
+           job.levels.size() * sizeof(PackTextureLevel));
+
+    for (auto const& level : job.levels) {
+      job.failed = job.failed || level.offset > entry.payloadSize ||
+                   level.size > entry.payloadSize - level.offset;
+    }
+    // thread safe, formats the device cannot blit fail the load
+    job.failed = job.failed ||
+                 ((job.texture.flags & PACK_TEXTURE_GENERATE_MIPS) != 0 &&
+                  !mipGenerator.IsSupported(
+                    static_cast<VkFormat>(job.texture.format)));
+  }
+}
+
+void
+AssetStreamer::Release(StreamedAsset& asset)
+{
+  deletionQueue->Push(VK_OBJECT_TYPE_BUFFER, ToHandle64(asset.buffer));
+  deletionQueue->Push(VK_OBJECT_TYPE_DEVICE_MEMORY, ToHandle64(asset.memory));
+  deletionQueue->Push(asset.image);
+
+  residentSize -= asset.residentSize;
+  asset.buffer = VK_NULL_HANDLE;
+  asset.memory = VK_NULL_HANDLE;
+  asset.image = {};
+  asset.data = {};
+  asset.residentSize = 0;
+}
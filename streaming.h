@@ -0,0 +1,226 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+#include "mipmaps.h"
+#include "pack.h"
+
+// Persistently mapped staging buffer that is allocated from like a ring.
+// Allocations are freed in the order they were made, each once the timeline
+// value it was retired with completed, so the ring never waits on the GPU
+// and never fragments.
+struct StagingRing
+{
+  struct Allocation
+  {
+    uint64_t id = 0;
+    VkDeviceSize offset = 0; // into buffer
+    VkDeviceSize size = 0;
+    uint8_t* data = nullptr; // mapped
+  };
+
+  void Create(VkDevice device,
+              const VkPhysicalDeviceMemoryProperties& memProps,
+              VkDeviceSize size);
+  // the GPU must be done with the buffer
+  void Destroy();
+
+  // Thread safe. Returns false if there is no room until older allocations
+  // are freed.
+  bool Allocate(VkDeviceSize size,
+                VkDeviceSize alignment,
+                Allocation& allocation);
+  // thread safe, the allocation is freed once value completed
+  void Retire(const Allocation& allocation, uint64_t value);
+  // Thread safe. Frees the allocations retired with at most completedValue,
+  // returns whether anything was freed.
+  bool Collect(uint64_t completedValue);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  uint8_t* mapped = nullptr;
+  VkDeviceSize size = 0;
+
+private:
+  struct Span
+  {
+    VkDeviceSize end = 0;
+    uint64_t value = UINT64_MAX; // until retired
+  };
+
+  std::mutex mutex;
+  // in allocation order, the front is the oldest
+  std::deque<Span> spans = {};
+  uint64_t firstId = 0; // of spans.front()
+  VkDeviceSize head = 0; // next allocation
+  VkDeviceSize tail = 0; // end of the freed range
+};
+
+enum AssetState
+{
+  // requested, being read, decoded or uploaded
+  ASSET_STATE_PENDING = 0,
+  // uploaded and the upload completed on the GPU
+  ASSET_STATE_RESIDENT,
+  // released to stay within the budget or by Evict, Request loads it again
+  ASSET_STATE_EVICTED,
+  // missing from the pack or larger than the staging ring
+  ASSET_STATE_FAILED,
+};
+
+// An entry of the pack and what is resident of it. Meshes are uploaded into
+// one buffer that holds the whole payload, i.e. mesh.vertexOffset and
+// mesh.indexOffset are offsets into buffer. Textures get an image with all
+// levels in SHADER_READ_ONLY_OPTIMAL, generated ones included. Raw and
+// SPIR-V payloads stay on the host in data.
+struct StreamedAsset
+{
+  const PackEntry* entry = nullptr;
+  AssetState state = ASSET_STATE_PENDING;
+
+  // importance / (1 + distance), higher loads first and is evicted last
+  float priority = 0.0f;
+  uint64_t lastUsedFrame = 0;
+  // bumped by every request, jobs of an earlier request are dropped
+  uint32_t serial = 0;
+  Handle<StreamedAsset> placeholder = {};
+
+  PackMesh mesh = {};
+  PackTexture texture = {};
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  PhysicalImage image = {};
+  std::string data = {};
+
+  VkDeviceSize residentSize = 0; // device memory
+  uint64_t uploadValue = 0;      // timeline value of the upload
+};
+
+typedef Handle<StreamedAsset> AssetHandle;
+
+// Loads assets of a pack in the background. I/O threads take the requests
+// with the highest priority and copy their payloads from the mapped pack into
+// the staging ring, compressed payloads go through the decode threads
+// instead. The render thread records the uploads of what is ready in Update
+// and sees an asset resident once the frame that copied it completed; until
+// then GetResident returns its placeholder, so nothing ever waits for a load.
+//
+// Everything but the worker threads runs on the render thread.
+struct AssetStreamer
+{
+  static const VkDeviceSize DEFAULT_STAGING_SIZE = 64 * 1024 * 1024;
+  static const VkDeviceSize DEFAULT_UPLOAD_SIZE = 16 * 1024 * 1024;
+
+  // pack, timeline and deletionQueue have to outlive the streamer
+  void Create(VkPhysicalDevice physicalDevice,
+              VkDevice device,
+              const VkPhysicalDeviceMemoryProperties& memProps,
+              Timeline* timeline,
+              DeletionQueue* deletionQueue,
+              const AssetPack* pack,
+              uint32_t ioThreadCount = 1,
+              uint32_t decodeThreadCount = 2,
+              VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+  // joins the threads, waits for the uploads in flight and releases all
+  // assets
+  void Destroy();
+
+  // Returns the asset of the pack entry name and queues it unless it is
+  // pending or resident; a null handle if the pack has no such entry or it
+  // is a virtual texture. The priority of an asset that is already known is
+  // updated.
+  AssetHandle Request(const char* name,
+                      float distance = 0.0f,
+                      float importance = 1.0f);
+  void SetPriority(AssetHandle handle, float distance, float importance = 1.0f);
+  // returned by GetResident while the asset is not resident
+  void SetPlaceholder(AssetHandle handle, AssetHandle placeholder);
+  void Evict(AssetHandle handle);
+  // Device memory of the resident assets, Update evicts the lowest priority
+  // assets beyond it, except those used since the previous Update. 0 is
+  // unlimited.
+  void SetBudget(VkDeviceSize budget) { this->budget = budget; }
+
+  AssetState GetState(AssetHandle handle);
+  // The asset if it is resident, else its resident placeholder, else for
+  // textures a 1x1 grey texture, otherwise nullptr. Valid until the next
+  // Request or Update, counts as a use for the budget.
+  const StreamedAsset* GetResident(AssetHandle handle);
+
+  // Records the copies of ready assets, at most maxUploadSize bytes, and
+  // evicts over budget. cmdBuffer must be part of the next submission of
+  // the timeline.
+  void Update(VkCommandBuffer cmdBuffer,
+              VkDeviceSize maxUploadSize = DEFAULT_UPLOAD_SIZE);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memProps = {};
+  Timeline* timeline = nullptr;
+  DeletionQueue* deletionQueue = nullptr;
+  const AssetPack* pack = nullptr;
+
+  StagingRing stagingRing = {};
+  // textures with PACK_TEXTURE_GENERATE_MIPS, batched per Update
+  MipGenerator mipGenerator = {};
+  VkDeviceSize budget = 0;
+  VkDeviceSize residentSize = 0;
+  uint64_t frame = 0;
+
+  StreamedAsset defaultTexture = {};
+
+private:
+  struct Job
+  {
+    AssetHandle handle = {};
+    const PackEntry* entry = nullptr;
+    uint32_t serial = 0;
+    bool failed = false;
+    std::vector<uint8_t> blob = {}; // compressed, read by an I/O thread
+    StagingRing::Allocation staging = {};
+    std::string data = {};
+    // copied from the payload, the image layout needs the level table
+    PackMesh mesh = {};
+    PackTexture texture = {};
+    std::vector<PackTextureLevel> levels = {};
+  };
+
+  void IoThread();
+  void DecodeThread();
+  // waits for room in the ring, false if the streamer stops
+  bool AllocateStaging(Job& job, std::unique_lock<std::mutex>& lock);
+  void ReadHeaders(Job& job, const uint8_t* payload);
+  void Release(StreamedAsset& asset);
+
+  // guards everything below, the worker threads only touch assets under it
+  std::mutex mutex;
+  std::condition_variable requestCondition;
+  std::condition_variable decodeCondition;
+  std::condition_variable stagingCondition;
+  bool stopping = false;
+
+  HandlePool<StreamedAsset> assets = {};
+  std::map<std::string, AssetHandle> names = {};
+  std::vector<AssetHandle> requests = {};
+  std::deque<Job> decodeJobs = {};
+  std::vector<Job> readyJobs = {};
+  // uploaded, resident once their value completes unless the serial moved
+  struct Upload
+  {
+    AssetHandle handle = {};
+    uint32_t serial = 0;
+  };
+  std::vector<Upload> uploads = {};
+
+  std::vector<std::thread> threads = {};
+};
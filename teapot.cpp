@@ -1,6 +1,8 @@
 #include "teapot.h"
 #include <glm\glm.hpp>
 
+#include "mesh_kernels.h"
+
 std::vector<float> teapot = {
   1.368074f,  2.435437f, -0.227403f, 1.381968f,  2.4f,      -0.229712f,
   1.4f,       2.4f,      0.0f,       1.4f,       2.4f,      0.0f,
@@ -9484,33 +9486,50 @@ std::vector<float> teapot = {
   1.48068f,   0.15f,     -0.24612f,  1.5f,       0.15f,     0.0f
 };
 
-static void
-pushVec3(std::vector<float>& floats, glm::vec3 v)
-{
-  floats.push_back(v.x);
-  floats.push_back(v.y);
-  floats.push_back(v.z);
-}
-
 std::vector<float>
 GenerateTeapotWithNormals()
 {
-  std::vector<float> result;
+  uint32_t vertexCount = static_cast<uint32_t>(teapot.size() / 3);
+  uint32_t triangleCount = vertexCount / 3;
 
-  for (int i = 0; i < teapot.size(); i += 9) {
-    const glm::vec3& a = *(glm::vec3*)&teapot[i + 0];
-    const glm::vec3& b = *(glm::vec3*)&teapot[i + 3];
-    const glm::vec3& c = *(glm::vec3*)&teapot[i + 6];
+  std::vector<float> positions(vertexCount * 3);
+  SoaVec3 soaPositions = { positions.data(),
+                           positions.data() + vertexCount,
+                           positions.data() + vertexCount * 2 };
+  for (uint32_t i = 0; i < vertexCount; ++i) {
+    soaPositions.x[i] = teapot[i * 3 + 0];
+    soaPositions.y[i] = teapot[i * 3 + 1];
+    soaPositions.z[i] = teapot[i * 3 + 2];
+  }
 
-    glm::vec3 n = glm::normalize(glm::cross(b - a, c - a));
+  std::vector<float> normals(triangleCount * 3);
+  SoaVec3 faceNormals = { normals.data(),
+                          normals.data() + triangleCount,
+                          normals.data() + triangleCount * 2 };
+  ComputeFaceNormals(soaPositions, nullptr, triangleCount, faceNormals);
 
-    pushVec3(result, a);
-    pushVec3(result, n);
-    pushVec3(result, b);
-    pushVec3(result, n);
-    pushVec3(result, c);
-    pushVec3(result, n);
+  std::vector<float> result(vertexCount * 6);
+  for (uint32_t i = 0; i < vertexCount; ++i) {
+    uint32_t triangle = i / 3;
+    float* vertex = &result[i * 6];
+    vertex[0] = soaPositions.x[i];
+    vertex[1] = soaPositions.y[i];
+    vertex[2] = soaPositions.z[i];
+    vertex[3] = faceNormals.x[triangle];
+    vertex[4] = faceNormals.y[triangle];
+    vertex[5] = faceNormals.z[triangle];
   }
 
   return result;
 }
+
+Mesh
+GenerateTeapotMesh(bool smoothNormals, MeshOptimizationReport* report)
+{
+  std::vector<float> vertices = GenerateTeapotWithNormals();
+  return OptimizeMesh(vertices.data(),
+                      static_cast<uint32_t>(vertices.size() / 6),
+                      6,
+                      smoothNormals ? 3 : -1,
+                      report);
+}
@@ -1,6 +1,14 @@
 #include <vector>
 
+#include "mesh.h"
+
 extern std::vector<float> teapot;
 
 std::vector<float>
 GenerateTeapotWithNormals();
+
+// Welded and optimized teapot, 6 floats per vertex (position, normal). Flat
+// normals keep the faceted look of GenerateTeapotWithNormals.
+Mesh
+GenerateTeapotMesh(bool smoothNormals,
+                   MeshOptimizationReport* report = nullptr);
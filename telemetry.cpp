@@ -0,0 +1,235 @@
+#include "telemetry.h"
+
+#include <algorithm> // copy
+#include <iostream>
+#include <iterator> // begin, end
+
+#include "vk_init.h"
+
+namespace {
+
+double
+ToMiB(double bytes)
+{
+  return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+const char*
+GetMemoryCategoryName(MemoryCategory category)
+{
+  switch (category) {
+    case MEMORY_CATEGORY_ATTACHMENT:
+      return "attachments";
+    case MEMORY_CATEGORY_IMAGE:
+      return "images";
+    case MEMORY_CATEGORY_BUFFER:
+      return "buffers";
+    case MEMORY_CATEGORY_STAGING:
+      return "staging";
+    default:
+      return "unknown";
+  }
+}
+
+MemoryTelemetry&
+MemoryTelemetry::Get()
+{
+  static MemoryTelemetry telemetry;
+  return telemetry;
+}
+
+void
+MemoryTelemetry::Init(VkInstance instance,
+                      VkPhysicalDevice physicalDevice,
+                      const VkPhysicalDeviceMemoryProperties& memProps,
+                      bool hasBudget)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  this->physicalDevice = physicalDevice;
+  this->memProps = memProps;
+
+  if (hasBudget) {
+    vkGetPhysicalDeviceMemoryProperties2KHR =
+      (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+        instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+  }
+
+  heaps.assign(memProps.memoryHeapCount, {});
+  types.assign(memProps.memoryTypeCount, {});
+  delta.heapBytes.assign(memProps.memoryHeapCount, 0);
+}
+
+void
+MemoryTelemetry::OnAllocate(VkDeviceMemory memory,
+                            VkDeviceSize size,
+                            uint32_t memoryTypeIdx,
+                            MemoryCategory category)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // not initialized, e.g. allocations of tools without a VulkanBase
+  if (memoryTypeIdx >= types.size()) {
+    return;
+  }
+
+  Allocation allocation = { size, memoryTypeIdx, category };
+  allocations[memory] = allocation;
+  Record(allocation, 1);
+  delta.allocations += 1;
+}
+
+void
+MemoryTelemetry::OnFree(VkDeviceMemory memory)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto iter = allocations.find(memory);
+  if (iter == allocations.end()) {
+    return;
+  }
+
+  Record(iter->second, -1);
+  delta.frees += 1;
+  allocations.erase(iter);
+}
+
+void
+MemoryTelemetry::Record(const Allocation& allocation, int64_t sign)
+{
+  uint32_t heapIdx = memProps.memoryTypes[allocation.memoryTypeIdx].heapIndex;
+  int64_t bytes = sign * static_cast<int64_t>(allocation.size);
+
+  for (Counter* counter : { &heaps[heapIdx],
+                            &types[allocation.memoryTypeIdx],
+                            &categories[allocation.category] }) {
+    counter->bytes += bytes;
+    counter->count += static_cast<int32_t>(sign);
+  }
+
+  delta.heapBytes[heapIdx] += bytes;
+  delta.categoryBytes[allocation.category] += bytes;
+}
+
+MemoryTelemetry::Snapshot
+MemoryTelemetry::GetSnapshot()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Snapshot snapshot = {};
+  snapshot.frame = frame;
+  snapshot.types = types;
+  std::copy(std::begin(categories),
+            std::end(categories),
+            std::begin(snapshot.categories));
+
+  snapshot.heaps.resize(memProps.memoryHeapCount);
+  for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i) {
+    snapshot.heaps[i].size = memProps.memoryHeaps[i].size;
+    snapshot.heaps[i].flags = memProps.memoryHeaps[i].flags;
+    snapshot.heaps[i].live = heaps[i];
+  }
+
+  if (vkGetPhysicalDeviceMemoryProperties2KHR != nullptr) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+    budget.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    auto props = vkiPhysicalDeviceMemoryProperties2({});
+    props.pNext = &budget;
+    vkGetPhysicalDeviceMemoryProperties2KHR(physicalDevice, &props);
+
+    for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i) {
+      snapshot.heaps[i].budget = budget.heapBudget[i];
+      snapshot.heaps[i].usage = budget.heapUsage[i];
+    }
+    snapshot.hasBudget = true;
+  }
+
+  return snapshot;
+}
+
+void
+MemoryTelemetry::EndFrame()
+{
+  Snapshot snapshot = GetSnapshot();
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  delta.frame = frame;
+
+  if (printFrameDeltas && (delta.allocations > 0 || delta.frees > 0)) {
+    std::cout << "INFO: memory frame " << frame << ": " << delta.allocations
+              << " allocations, " << delta.frees << " frees";
+    for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+      if (delta.categoryBytes[i] != 0) {
+        std::cout << ", " << GetMemoryCategoryName((MemoryCategory)i) << " "
+                  << (delta.categoryBytes[i] > 0 ? "+" : "")
+                  << ToMiB((double)delta.categoryBytes[i]) << " MiB";
+      }
+    }
+    std::cout << std::endl;
+  }
+
+  for (uint32_t i = 0; i < snapshot.heaps.size(); ++i) {
+    auto const& heap = snapshot.heaps[i];
+    if (snapshot.hasBudget && heap.usage > heap.budget) {
+      std::cout << "WARNING: memory heap " << i << " over budget: "
+                << ToMiB((double)heap.usage) << " / "
+                << ToMiB((double)heap.budget) << " MiB" << std::endl;
+    }
+  }
+
+  frameLog.push_back(delta);
+  while (frameLog.size() > maxFrameLogSize) {
+    frameLog.pop_front();
+  }
+
+  frame += 1;
+  delta = {};
+  delta.heapBytes.assign(memProps.memoryHeapCount, 0);
+}
+
+std::deque<MemoryTelemetry::FrameDelta>
+MemoryTelemetry::GetFrameLog()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return frameLog;
+}
+
+void
+MemoryTelemetry::Print(const Snapshot& snapshot)
+{
+  std::cout << "INFO: memory snapshot frame " << snapshot.frame << std::endl;
+
+  for (uint32_t i = 0; i < snapshot.heaps.size(); ++i) {
+    auto const& heap = snapshot.heaps[i];
+    std::cout << "  heap " << i
+              << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device)"
+                                                                : " (host)")
+              << ": " << ToMiB((double)heap.live.bytes) << " MiB in "
+              << heap.live.count << " allocations, size "
+              << ToMiB((double)heap.size) << " MiB";
+    if (snapshot.hasBudget) {
+      std::cout << ", usage " << ToMiB((double)heap.usage) << " / budget "
+                << ToMiB((double)heap.budget) << " MiB";
+    }
+    std::cout << std::endl;
+  }
+
+  for (uint32_t i = 0; i < snapshot.types.size(); ++i) {
+    if (snapshot.types[i].count > 0) {
+      std::cout << "  type " << i << ": "
+                << ToMiB((double)snapshot.types[i].bytes) << " MiB in "
+                << snapshot.types[i].count << " allocations" << std::endl;
+    }
+  }
+
+  for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+    std::cout << "  " << GetMemoryCategoryName((MemoryCategory)i) << ": "
+              << ToMiB((double)snapshot.categories[i].bytes) << " MiB in "
+              << snapshot.categories[i].count << " allocations" << std::endl;
+  }
+}
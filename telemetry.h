@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <vulkan\vulkan.h>
+
+enum MemoryCategory
+{
+  MEMORY_CATEGORY_ATTACHMENT = 0,
+  MEMORY_CATEGORY_IMAGE,
+  MEMORY_CATEGORY_BUFFER,
+  MEMORY_CATEGORY_STAGING,
+  MEMORY_CATEGORY_COUNT,
+};
+
+const char*
+GetMemoryCategoryName(MemoryCategory category);
+
+// Tracks the device memory allocated through vkuAllocateMemory and released
+// through vkuFreeMemory, per heap, memory type and category. Heap budget and
+// usage of the whole process are queried from VK_EXT_memory_budget when the
+// device supports it.
+//
+// All methods are thread safe.
+struct MemoryTelemetry
+{
+  struct Counter
+  {
+    VkDeviceSize bytes = 0;
+    uint32_t count = 0;
+  };
+
+  struct Heap
+  {
+    VkDeviceSize size = 0;
+    VkMemoryHeapFlags flags = 0;
+
+    // 0 without VK_EXT_memory_budget
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+
+    Counter live = {};
+  };
+
+  struct Snapshot
+  {
+    uint64_t frame = 0;
+    bool hasBudget = false;
+
+    std::vector<Heap> heaps = {};
+    std::vector<Counter> types = {};
+    Counter categories[MEMORY_CATEGORY_COUNT] = {};
+  };
+
+  // changes of the live bytes recorded during one frame
+  struct FrameDelta
+  {
+    uint64_t frame = 0;
+
+    uint32_t allocations = 0;
+    uint32_t frees = 0;
+
+    std::vector<int64_t> heapBytes = {};
+    int64_t categoryBytes[MEMORY_CATEGORY_COUNT] = {};
+  };
+
+  static MemoryTelemetry& Get();
+
+  void Init(VkInstance instance,
+            VkPhysicalDevice physicalDevice,
+            const VkPhysicalDeviceMemoryProperties& memProps,
+            bool hasBudget);
+
+  void OnAllocate(VkDeviceMemory memory,
+                  VkDeviceSize size,
+                  uint32_t memoryTypeIdx,
+                  MemoryCategory category);
+  void OnFree(VkDeviceMemory memory);
+
+  Snapshot GetSnapshot();
+
+  // Closes the delta of the current frame, appends it to the frame log and
+  // prints it if anything changed. Warns about heaps over budget.
+  void EndFrame();
+
+  std::deque<FrameDelta> GetFrameLog();
+
+  static void Print(const Snapshot& snapshot);
+
+  bool printFrameDeltas = true;
+  size_t maxFrameLogSize = 256;
+
+private:
+  struct Allocation
+  {
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIdx = 0;
+    MemoryCategory category = MEMORY_CATEGORY_BUFFER;
+  };
+
+  void Record(const Allocation& allocation, int64_t sign);
+
+  std::mutex mutex = {};
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memProps = {};
+  PFN_vkGetPhysicalDeviceMemoryProperties2KHR
+    vkGetPhysicalDeviceMemoryProperties2KHR = nullptr;
+
+  std::map<VkDeviceMemory, Allocation> allocations = {};
+
+  std::vector<Counter> heaps = {};
+  std::vector<Counter> types = {};
+  Counter categories[MEMORY_CATEGORY_COUNT] = {};
+
+  uint64_t frame = 0;
+  FrameDelta delta = {};
+  std::deque<FrameDelta> frameLog = {};
+};
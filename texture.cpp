@@ -0,0 +1,869 @@
+#include "texture.h"
+
+#include <algorithm> // max
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "mipmaps.h"
+#include "vk_utils.h"
+
+namespace {
+
+const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K',  'T',  'X', ' ',  '2',
+                                      '0',  0xBB, '\r', '\n', 0x1A, '\n' };
+
+// follows the identifier, sgdByteOffset and sgdByteLength are 64 bit
+struct Ktx2Header
+{
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint32_t sgdByteOffset[2];
+  uint32_t sgdByteLength[2];
+};
+
+struct Ktx2Level
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+
+struct DdsPixelFormat
+{
+  uint32_t size;
+  uint32_t flags;
+  uint32_t fourCC;
+  uint32_t rgbBitCount;
+  uint32_t rBitMask;
+  uint32_t gBitMask;
+  uint32_t bBitMask;
+  uint32_t aBitMask;
+};
+
+struct DdsHeader
+{
+  uint32_t size;
+  uint32_t flags;
+  uint32_t height;
+  uint32_t width;
+  uint32_t pitchOrLinearSize;
+  uint32_t depth;
+  uint32_t mipMapCount;
+  uint32_t reserved1[11];
+  DdsPixelFormat pixelFormat;
+  uint32_t caps;
+  uint32_t caps2;
+  uint32_t caps3;
+  uint32_t caps4;
+  uint32_t reserved2;
+};
+
+struct DdsHeaderDx10
+{
+  uint32_t dxgiFormat;
+  uint32_t resourceDimension;
+  uint32_t miscFlag;
+  uint32_t arraySize;
+  uint32_t miscFlags2;
+};
+
+const uint32_t DDPF_FOURCC = 0x4;
+const uint32_t DDPF_RGB = 0x40;
+const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+const uint32_t DDSCAPS2_VOLUME = 0x200000;
+const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+const uint32_t DDS_DIMENSION_TEXTURE3D = 4;
+
+uint32_t
+MakeFourCC(char a, char b, char c, char d)
+{
+  return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) |
+         (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+VkFormat
+GetDxgiFormat(uint32_t dxgiFormat)
+{
+  switch (dxgiFormat) {
+    case 28:
+      return VK_FORMAT_R8G8B8A8_UNORM;
+    case 29:
+      return VK_FORMAT_R8G8B8A8_SRGB;
+    case 71:
+      return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    case 72:
+      return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    case 74:
+      return VK_FORMAT_BC2_UNORM_BLOCK;
+    case 75:
+      return VK_FORMAT_BC2_SRGB_BLOCK;
+    case 77:
+      return VK_FORMAT_BC3_UNORM_BLOCK;
+    case 78:
+      return VK_FORMAT_BC3_SRGB_BLOCK;
+    case 80:
+      return VK_FORMAT_BC4_UNORM_BLOCK;
+    case 81:
+      return VK_FORMAT_BC4_SNORM_BLOCK;
+    case 83:
+      return VK_FORMAT_BC5_UNORM_BLOCK;
+    case 84:
+      return VK_FORMAT_BC5_SNORM_BLOCK;
+    case 87:
+      return VK_FORMAT_B8G8R8A8_UNORM;
+    case 91:
+      return VK_FORMAT_B8G8R8A8_SRGB;
+    case 95:
+      return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+    case 96:
+      return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+    case 98:
+      return VK_FORMAT_BC7_UNORM_BLOCK;
+    case 99:
+      return VK_FORMAT_BC7_SRGB_BLOCK;
+    default:
+      return VK_FORMAT_UNDEFINED;
+  }
+}
+
+VkFormat
+GetDdsFormat(const DdsPixelFormat& pixelFormat)
+{
+  if ((pixelFormat.flags & DDPF_FOURCC) != 0) {
+    uint32_t fourCC = pixelFormat.fourCC;
+    if (fourCC == MakeFourCC('D', 'X', 'T', '1')) {
+      return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('D', 'X', 'T', '2') ||
+        fourCC == MakeFourCC('D', 'X', 'T', '3')) {
+      return VK_FORMAT_BC2_UNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('D', 'X', 'T', '4') ||
+        fourCC == MakeFourCC('D', 'X', 'T', '5')) {
+      return VK_FORMAT_BC3_UNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('A', 'T', 'I', '1') ||
+        fourCC == MakeFourCC('B', 'C', '4', 'U')) {
+      return VK_FORMAT_BC4_UNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('B', 'C', '4', 'S')) {
+      return VK_FORMAT_BC4_SNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('A', 'T', 'I', '2') ||
+        fourCC == MakeFourCC('B', 'C', '5', 'U')) {
+      return VK_FORMAT_BC5_UNORM_BLOCK;
+    }
+    if (fourCC == MakeFourCC('B', 'C', '5', 'S')) {
+      return VK_FORMAT_BC5_SNORM_BLOCK;
+    }
+    return VK_FORMAT_UNDEFINED;
+  }
+
+  if ((pixelFormat.flags & DDPF_RGB) != 0 && pixelFormat.rgbBitCount == 32) {
+    if (pixelFormat.rBitMask == 0x000000ff &&
+        pixelFormat.bBitMask == 0x00ff0000) {
+      return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+    if (pixelFormat.rBitMask == 0x00ff0000 &&
+        pixelFormat.bBitMask == 0x000000ff) {
+      return VK_FORMAT_B8G8R8A8_UNORM;
+    }
+  }
+  return VK_FORMAT_UNDEFINED;
+}
+
+// checks the description of a texture before anything is allocated for it
+bool
+IsValidDesc(const PackTexture& desc)
+{
+  VkFormat format = static_cast<VkFormat>(desc.format);
+  if (GetFormatBlockInfo(format).blockSize == 0) {
+    std::cout << "WARNING: texture format " << desc.format
+              << " is not supported" << std::endl;
+    return false;
+  }
+
+  return desc.width > 0 && desc.height > 0 && desc.depth > 0 &&
+         desc.layerCount > 0 && desc.mipCount > 0 &&
+         desc.mipCount <= GetMipCount(desc.width, desc.height, desc.depth) &&
+         ((desc.flags & PACK_TEXTURE_CUBE) == 0 ||
+          (desc.layerCount % 6 == 0 && desc.width == desc.height)) &&
+         ((desc.flags & PACK_TEXTURE_GENERATE_MIPS) == 0 ||
+          !IsBlockCompressed(format));
+}
+
+// basic data format descriptor (Khronos Data Format specification)
+bool
+WriteDataFormatDescriptor(VkFormat format, std::vector<uint32_t>& dfd)
+{
+  enum
+  {
+    MODEL_RGBSDA = 1,
+    MODEL_BC1A = 128,
+    MODEL_BC2 = 129,
+    MODEL_BC3 = 130,
+    MODEL_BC4 = 131,
+    MODEL_BC5 = 132,
+    MODEL_BC7 = 134,
+  };
+  const uint32_t PRIMARIES_BT709 = 1;
+  const uint32_t TRANSFER_LINEAR = 1;
+  const uint32_t TRANSFER_SRGB = 2;
+  const uint32_t CHANNEL_ALPHA = 15;
+  const uint32_t SAMPLE_LINEAR = 0x10;
+
+  struct Sample
+  {
+    uint32_t bitOffset;
+    uint32_t bitLength;
+    uint32_t channel;
+    uint32_t upper;
+  };
+
+  uint32_t model = 0;
+  bool srgb = false;
+  Sample samples[4] = {};
+  uint32_t sampleCount = 1;
+  samples[0] = { 0, 64, 0, UINT32_MAX };
+
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: // fallthrough
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+      srgb = true; // fallthrough
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: // fallthrough
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+      model = MODEL_BC1A;
+      // the alpha present channel marks the punch-through alpha variant
+      if (format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK ||
+          format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK) {
+        samples[0].channel = 1;
+      }
+      break;
+    case VK_FORMAT_BC2_SRGB_BLOCK: // fallthrough
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+      srgb = true; // fallthrough
+    case VK_FORMAT_BC2_UNORM_BLOCK: // fallthrough
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+      model = format == VK_FORMAT_BC2_UNORM_BLOCK ||
+                  format == VK_FORMAT_BC2_SRGB_BLOCK
+                ? MODEL_BC2
+                : MODEL_BC3;
+      samples[0] = { 0, 64, CHANNEL_ALPHA | SAMPLE_LINEAR, UINT32_MAX };
+      samples[1] = { 64, 64, 0, UINT32_MAX };
+      sampleCount = 2;
+      break;
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+      model = MODEL_BC4;
+      break;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      model = MODEL_BC5;
+      samples[1] = { 64, 64, 1, UINT32_MAX };
+      sampleCount = 2;
+      break;
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      srgb = true; // fallthrough
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+      model = MODEL_BC7;
+      samples[0] = { 0, 128, 0, UINT32_MAX };
+      break;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+      srgb = true; // fallthrough
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      model = MODEL_RGBSDA;
+      for (uint32_t i = 0; i < 4; ++i) {
+        samples[i] = { i * 8, 8, i, 255 };
+      }
+      samples[3].channel = CHANNEL_ALPHA | SAMPLE_LINEAR;
+      sampleCount = 4;
+      break;
+    default:
+      return false;
+  }
+  // only sRGB encoded samples carry the flag
+  if (!srgb) {
+    for (uint32_t i = 0; i < sampleCount; ++i) {
+      samples[i].channel &= ~SAMPLE_LINEAR;
+    }
+  }
+
+  FormatBlockInfo block = GetFormatBlockInfo(format);
+  uint32_t blockSize = 24 + 16 * sampleCount;
+
+  dfd.clear();
+  dfd.push_back(4 + blockSize); // total size
+  dfd.push_back(0);             // vendor Khronos, basic descriptor
+  dfd.push_back(2 | (blockSize << 16));
+  dfd.push_back(model | (PRIMARIES_BT709 << 8) |
+                ((srgb ? TRANSFER_SRGB : TRANSFER_LINEAR) << 16));
+  dfd.push_back((block.blockWidth - 1) | ((block.blockHeight - 1) << 8));
+  dfd.push_back(block.blockSize);
+  dfd.push_back(0);
+  for (uint32_t i = 0; i < sampleCount; ++i) {
+    dfd.push_back(samples[i].bitOffset | ((samples[i].bitLength - 1) << 16) |
+                  (samples[i].channel << 24));
+    dfd.push_back(0);
+    dfd.push_back(0);
+    dfd.push_back(samples[i].upper);
+  }
+  return true;
+}
+
+VkDeviceSize
+AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+FormatBlockInfo
+GetFormatBlockInfo(VkFormat format)
+{
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:  // fallthrough
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:   // fallthrough
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: // fallthrough
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:  // fallthrough
+    case VK_FORMAT_BC4_UNORM_BLOCK:      // fallthrough
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+      return { 4, 4, 8 };
+    case VK_FORMAT_BC2_UNORM_BLOCK:    // fallthrough
+    case VK_FORMAT_BC2_SRGB_BLOCK:     // fallthrough
+    case VK_FORMAT_BC3_UNORM_BLOCK:    // fallthrough
+    case VK_FORMAT_BC3_SRGB_BLOCK:     // fallthrough
+    case VK_FORMAT_BC5_UNORM_BLOCK:    // fallthrough
+    case VK_FORMAT_BC5_SNORM_BLOCK:    // fallthrough
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:  // fallthrough
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:  // fallthrough
+    case VK_FORMAT_BC7_UNORM_BLOCK:    // fallthrough
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      return { 4, 4, 16 };
+    case VK_FORMAT_R8_UNORM:
+      return { 1, 1, 1 };
+    case VK_FORMAT_R8G8_UNORM: // fallthrough
+    case VK_FORMAT_R16_SFLOAT:
+      return { 1, 1, 2 };
+    case VK_FORMAT_R8G8B8A8_UNORM:           // fallthrough
+    case VK_FORMAT_R8G8B8A8_SRGB:            // fallthrough
+    case VK_FORMAT_B8G8R8A8_UNORM:           // fallthrough
+    case VK_FORMAT_B8G8R8A8_SRGB:            // fallthrough
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32: // fallthrough
+    case VK_FORMAT_B10G11R11_UFLOAT_PACK32:  // fallthrough
+    case VK_FORMAT_R16G16_SFLOAT:            // fallthrough
+    case VK_FORMAT_R32_SFLOAT:
+      return { 1, 1, 4 };
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+      return { 1, 1, 8 };
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+      return { 1, 1, 16 };
+    default:
+      return { 1, 1, 0 };
+  }
+}
+
+uint32_t
+GetMipCount(uint32_t width, uint32_t height, uint32_t depth)
+{
+  uint32_t size = std::max(std::max(width, height), depth);
+  uint32_t mipCount = 1;
+  while ((size >> mipCount) != 0) {
+    ++mipCount;
+  }
+  return mipCount;
+}
+
+bool
+IsBlockCompressed(VkFormat format)
+{
+  return GetFormatBlockInfo(format).blockWidth > 1;
+}
+
+VkDeviceSize
+GetLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t depth)
+{
+  FormatBlockInfo block = GetFormatBlockInfo(format);
+  VkDeviceSize blocksX = (width + block.blockWidth - 1) / block.blockWidth;
+  VkDeviceSize blocksY = (height + block.blockHeight - 1) / block.blockHeight;
+  return blocksX * blocksY * depth * block.blockSize;
+}
+
+void
+TextureData::Allocate()
+{
+  VkFormat format = static_cast<VkFormat>(desc.format);
+
+  levels.resize(desc.mipCount * desc.layerCount);
+  VkDeviceSize size = 0;
+  for (uint32_t layer = 0; layer < desc.layerCount; ++layer) {
+    for (uint32_t mip = 0; mip < desc.mipCount; ++mip) {
+      PackTextureLevel& level = GetLevel(mip, layer);
+      level.width = std::max(desc.width >> mip, 1u);
+      level.height = std::max(desc.height >> mip, 1u);
+      level.depth = std::max(desc.depth >> mip, 1u);
+      if (mip > 0 && (desc.flags & PACK_TEXTURE_GENERATE_MIPS) != 0) {
+        level.offset = size;
+        level.size = 0;
+        continue;
+      }
+      // a multiple of 4 and of every texel block size
+      level.offset = AlignUp(size, 16);
+      level.size = GetLevelSize(format, level.width, level.height, level.depth);
+      size = level.offset + level.size;
+    }
+  }
+  data.assign(static_cast<size_t>(size), 0);
+}
+
+bool
+LoadKtx2(const uint8_t* file, size_t size, TextureData& texture)
+{
+  size_t levelIndexOffset = sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header);
+  if (size < levelIndexOffset ||
+      memcmp(file, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+    return false;
+  }
+
+  Ktx2Header header = {};
+  memcpy(&header, file + sizeof(KTX2_IDENTIFIER), sizeof(header));
+  if (header.supercompressionScheme != 0) {
+    std::cout << "WARNING: KTX2 supercompression is not supported"
+              << std::endl;
+    return false;
+  }
+
+  // 0 marks the dimensions and counts that are not used
+  uint32_t faceCount = std::max(header.faceCount, 1u);
+  uint32_t layerCount = std::max(header.layerCount, 1u);
+
+  texture = {};
+  PackTexture& desc = texture.desc;
+  desc.format = header.vkFormat;
+  desc.width = header.pixelWidth;
+  desc.height = std::max(header.pixelHeight, 1u);
+  desc.depth = std::max(header.pixelDepth, 1u);
+  desc.layerCount = layerCount * faceCount;
+  desc.flags = faceCount == 6 ? PACK_TEXTURE_CUBE : 0;
+  // no levels asks for a full chain generated from level 0 at load time
+  uint32_t levelCount = std::max(header.levelCount, 1u);
+  if (header.levelCount == 0) {
+    desc.mipCount = GetMipCount(desc.width, desc.height, desc.depth);
+    desc.flags |= PACK_TEXTURE_GENERATE_MIPS;
+  } else {
+    desc.mipCount = header.levelCount;
+  }
+  if ((faceCount != 1 && faceCount != 6) || !IsValidDesc(desc) ||
+      levelIndexOffset + levelCount * sizeof(Ktx2Level) > size) {
+    return false;
+  }
+
+  texture.Allocate();
+
+  // a level holds all layers, faces and slices of one mip
+  for (uint32_t mip = 0; mip < levelCount; ++mip) {
+    Ktx2Level level = {};
+    memcpy(&level,
+           file + levelIndexOffset + mip * sizeof(Ktx2Level),
+           sizeof(level));
+
+    VkDeviceSize imageSize = texture.GetLevel(mip).size;
+    if (level.byteOffset > size || level.byteLength > size - level.byteOffset ||
+        level.byteLength != imageSize * desc.layerCount) {
+      return false;
+    }
+
+    for (uint32_t layer = 0; layer < desc.layerCount; ++layer) {
+      memcpy(texture.GetLevelData(mip, layer),
+             file + level.byteOffset + layer * imageSize,
+             static_cast<size_t>(imageSize));
+    }
+  }
+  return true;
+}
+
+bool
+LoadDds(const uint8_t* file, size_t size, TextureData& texture)
+{
+  size_t offset = sizeof(uint32_t) + sizeof(DdsHeader);
+  uint32_t magic = 0;
+  if (size < offset) {
+    return false;
+  }
+  memcpy(&magic, file, sizeof(magic));
+  if (magic != DDS_MAGIC) {
+    return false;
+  }
+
+  DdsHeader header = {};
+  memcpy(&header, file + sizeof(uint32_t), sizeof(header));
+
+  texture = {};
+  PackTexture& desc = texture.desc;
+  desc.width = header.width;
+  desc.height = std::max(header.height, 1u);
+  desc.depth = 1;
+  desc.mipCount = std::max(header.mipMapCount, 1u);
+
+  if ((header.pixelFormat.flags & DDPF_FOURCC) != 0 &&
+      header.pixelFormat.fourCC == MakeFourCC('D', 'X', '1', '0')) {
+    if (size < offset + sizeof(DdsHeaderDx10)) {
+      return false;
+    }
+    DdsHeaderDx10 dx10 = {};
+    memcpy(&dx10, file + offset, sizeof(dx10));
+    offset += sizeof(DdsHeaderDx10);
+
+    desc.format = GetDxgiFormat(dx10.dxgiFormat);
+    desc.layerCount = std::max(dx10.arraySize, 1u);
+    if ((dx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE) != 0) {
+      desc.layerCount *= 6;
+      desc.flags = PACK_TEXTURE_CUBE;
+    }
+    if (dx10.resourceDimension == DDS_DIMENSION_TEXTURE3D) {
+      desc.depth = std::max(header.depth, 1u);
+    }
+  } else {
+    desc.format = GetDdsFormat(header.pixelFormat);
+    desc.layerCount = 1;
+    // cube maps without all faces are not supported
+    if ((header.caps2 & DDSCAPS2_CUBEMAP) != 0) {
+      desc.layerCount = 6;
+      desc.flags = PACK_TEXTURE_CUBE;
+    }
+    if ((header.caps2 & DDSCAPS2_VOLUME) != 0) {
+      desc.depth = std::max(header.depth, 1u);
+    }
+  }
+
+  if (!IsValidDesc(desc)) {
+    return false;
+  }
+
+  texture.Allocate();
+
+  // all mips of a layer, then the next layer
+  for (auto const& level : texture.levels) {
+    if (level.size > size - offset) {
+      return false;
+    }
+    memcpy(&texture.data[static_cast<size_t>(level.offset)],
+           file + offset,
+           static_cast<size_t>(level.size));
+    offset += static_cast<size_t>(level.size);
+  }
+  return true;
+}
+
+bool
+LoadTexture(const char* fileName, TextureData& texture)
+{
+  std::string file;
+
+  FILE* handle = 0;
+  fopen_s(&handle, fileName, "rb");
+  if (handle) {
+    fseek(handle, 0, SEEK_END);
+    file.resize(ftell(handle));
+    fseek(handle, 0, SEEK_SET);
+    fread(&file[0], 1, file.size(), handle);
+    fclose(handle);
+  }
+
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(file.data());
+  bool loaded = LoadKtx2(data, file.size(), texture) ||
+                LoadDds(data, file.size(), texture);
+  if (!loaded) {
+    std::cout << "WARNING: texture " << fileName << " cannot be loaded"
+              << std::endl;
+  }
+  return loaded;
+}
+
+bool
+SaveKtx2(const char* fileName, const TextureData& texture)
+{
+  const PackTexture& desc = texture.desc;
+  VkFormat format = static_cast<VkFormat>(desc.format);
+
+  std::vector<uint32_t> dfd;
+  if (!WriteDataFormatDescriptor(format, dfd)) {
+    std::cout << "WARNING: KTX2 format " << desc.format
+              << " is not supported" << std::endl;
+    return false;
+  }
+
+  uint32_t faceCount = (desc.flags & PACK_TEXTURE_CUBE) != 0 ? 6 : 1;
+  uint32_t layerCount = desc.layerCount / faceCount;
+
+  Ktx2Header header = {};
+  header.vkFormat = desc.format;
+  header.typeSize = 1;
+  header.pixelWidth = desc.width;
+  header.pixelHeight = desc.height;
+  header.pixelDepth = desc.depth > 1 ? desc.depth : 0;
+  header.layerCount = layerCount > 1 ? layerCount : 0;
+  header.faceCount = faceCount;
+  // 0 levels marks a chain generated at load time
+  bool generateMips = (desc.flags & PACK_TEXTURE_GENERATE_MIPS) != 0;
+  uint32_t levelCount = generateMips ? 1 : desc.mipCount;
+  header.levelCount = generateMips ? 0 : desc.mipCount;
+
+  size_t levelIndexOffset = sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header);
+  header.dfdByteOffset =
+    static_cast<uint32_t>(levelIndexOffset + levelCount * sizeof(Ktx2Level));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+  // the smallest mip comes first, so a reader can stream the rest later
+  std::vector<Ktx2Level> levels(levelCount);
+  VkDeviceSize offset = header.dfdByteOffset + header.dfdByteLength;
+  // a multiple of 4 and of the block size
+  VkDeviceSize alignment = GetFormatBlockInfo(format).blockSize;
+  while (alignment % 4 != 0) {
+    alignment *= 2;
+  }
+  for (uint32_t mip = levelCount; mip-- > 0;) {
+    offset = AlignUp(offset, alignment);
+    levels[mip].byteOffset = offset;
+    levels[mip].byteLength = texture.levels[mip].size * desc.layerCount;
+    levels[mip].uncompressedByteLength = levels[mip].byteLength;
+    offset += levels[mip].byteLength;
+  }
+
+  std::vector<uint8_t> file(static_cast<size_t>(offset), 0);
+  memcpy(&file[0], KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  memcpy(&file[sizeof(KTX2_IDENTIFIER)], &header, sizeof(header));
+  memcpy(&file[levelIndexOffset],
+         levels.data(),
+         levels.size() * sizeof(Ktx2Level));
+  memcpy(&file[header.dfdByteOffset], dfd.data(), header.dfdByteLength);
+
+  for (uint32_t mip = 0; mip < levelCount; ++mip) {
+    for (uint32_t layer = 0; layer < desc.layerCount; ++layer) {
+      const PackTextureLevel& level =
+        texture.levels[layer * desc.mipCount + mip];
+      memcpy(&file[static_cast<size_t>(levels[mip].byteOffset +
+                                       layer * level.size)],
+             &texture.data[static_cast<size_t>(level.offset)],
+             static_cast<size_t>(level.size));
+    }
+  }
+
+  FILE* handle = 0;
+  fopen_s(&handle, fileName, "wb");
+  if (!handle) {
+    std::cout << "WARNING: texture " << fileName << " cannot be written"
+              << std::endl;
+    return false;
+  }
+  size_t written = fwrite(file.data(), 1, file.size(), handle);
+  fclose(handle);
+  return written == file.size();
+}
+
+void
+CreateTextureImage(VkDevice device,
+                   const VkPhysicalDeviceMemoryProperties& memProps,
+                   const PackTexture& desc,
+                   VkImageUsageFlags usage,
+                   PhysicalImage& image)
+{
+  VkFormat format = static_cast<VkFormat>(desc.format);
+  bool is3D = desc.depth > 1;
+  bool isCube = (desc.flags & PACK_TEXTURE_CUBE) != 0;
+
+  auto imageCreateInfo =
+    vkiImageCreateInfo(is3D ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D,
+                       format,
+                       { desc.width, desc.height, desc.depth },
+                       desc.mipCount,
+                       desc.layerCount,
+                       VK_SAMPLE_COUNT_1_BIT,
+                       VK_IMAGE_TILING_OPTIMAL,
+                       usage,
+                       VK_SHARING_MODE_EXCLUSIVE,
+                       0,
+                       nullptr,
+                       VK_IMAGE_LAYOUT_UNDEFINED);
+  if (isCube) {
+    imageCreateInfo.flags |= VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+  }
+  ASSERT_VK_SUCCESS(
+    vkCreateImage(device, &imageCreateInfo, nullptr, &image.image));
+  image.memory = vkuAllocateImageMemory(device, memProps, image.image, true);
+  image.Resize(desc.mipCount, desc.layerCount);
+
+  VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D;
+  if (is3D) {
+    viewType = VK_IMAGE_VIEW_TYPE_3D;
+  } else if (isCube) {
+    viewType = desc.layerCount > 6 ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY
+                                   : VK_IMAGE_VIEW_TYPE_CUBE;
+  } else if (desc.layerCount > 1) {
+    viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  }
+
+  auto viewCreateInfo = vkiImageViewCreateInfo(
+    image.image,
+    viewType,
+    format,
+    { VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY },
+    vkiImageSubresourceRange(
+      vkuGetImageAspectFlags(format), 0, desc.mipCount, 0, desc.layerCount));
+  ASSERT_VK_SUCCESS(
+    vkCreateImageView(device, &viewCreateInfo, nullptr, &image.view));
+}
+
+void
+GetTextureCopyRegions(const PackTexture& desc,
+                      const PackTextureLevel* levels,
+                      VkDeviceSize bufferOffset,
+                      std::vector<VkBufferImageCopy>& regions)
+{
+  VkImageAspectFlags aspect =
+    vkuGetImageAspectFlags(static_cast<VkFormat>(desc.format));
+
+  regions.clear();
+  for (uint32_t i = 0; i < desc.mipCount * desc.layerCount; ++i) {
+    const PackTextureLevel& level = levels[i];
+    if (level.size == 0) {
+      continue;
+    }
+    regions.push_back(vkiBufferImageCopy(
+      bufferOffset + level.offset,
+      0,
+      0,
+      vkiImageSubresourceLayers(
+        aspect, i % desc.mipCount, i / desc.mipCount, 1),
+      {},
+      { level.width, level.height, level.depth }));
+  }
+}
+
+bool
+UploadTexture(VkDevice device,
+              VkPhysicalDevice physicalDevice,
+              const VkPhysicalDeviceMemoryProperties& memProps,
+              VkCommandPool cmdPool,
+              VkQueue queue,
+              const TextureData& texture,
+              PhysicalImage& image)
+{
+  const PackTexture& desc = texture.desc;
+  VkFormat format = static_cast<VkFormat>(desc.format);
+
+  VkFormatProperties formatProps = {};
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProps);
+  if ((formatProps.optimalTilingFeatures &
+       VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0) {
+    std::cout << "WARNING: texture format " << desc.format
+              << " cannot be sampled" << std::endl;
+    return false;
+  }
+
+  bool generateMips = (desc.flags & PACK_TEXTURE_GENERATE_MIPS) != 0;
+  MipGenerator mipGenerator = {};
+  mipGenerator.Create(physicalDevice);
+  if (generateMips && !mipGenerator.IsSupported(format)) {
+    std::cout << "WARNING: cannot generate mips of texture format "
+              << desc.format << std::endl;
+    return false;
+  }
+
+  VkImageUsageFlags usage =
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if (generateMips) {
+    usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  CreateTextureImage(device, memProps, desc, usage, image);
+
+  VkDeviceSize size = texture.data.size();
+  VkBuffer stagingBuffer =
+    vkuCreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  VkDeviceMemory stagingBufferMemory =
+    vkuAllocateBufferMemory(device,
+                            memProps,
+                            stagingBuffer,
+                            VKU_MEMORY_USAGE_STAGING,
+                            true,
+                            MEMORY_CATEGORY_STAGING);
+  vkuTransferData(device,
+                  stagingBufferMemory,
+                  0,
+                  size,
+                  const_cast<uint8_t*>(texture.data.data()));
+
+  VkCommandBuffer cmdBuffer =
+    vkuAllocateCmdBuffer(device, cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+  vkuBeginCmdBuffer(cmdBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+  VkImageSubresourceRange range = vkiImageSubresourceRange(
+    vkuGetImageAspectFlags(format), 0, desc.mipCount, 0, desc.layerCount);
+  vkuTransitionLayout(cmdBuffer,
+                      image.image,
+                      range,
+                      VK_IMAGE_LAYOUT_UNDEFINED,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  // every level in one copy
+  std::vector<VkBufferImageCopy> regions;
+  GetTextureCopyRegions(desc, texture.levels.data(), 0, regions);
+  vkCmdCopyBufferToImage(cmdBuffer,
+                         stagingBuffer,
+                         image.image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+
+  ImageState state = {};
+  state.stageFlags =
+    vkuGetImageStageFlags(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  state.accessFlags = VK_ACCESS_SHADER_READ_BIT;
+  state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  if (generateMips) {
+    ImageState copied = {};
+    copied.stageFlags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    copied.accessFlags = VK_ACCESS_TRANSFER_WRITE_BIT;
+    copied.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image.SetState(range, copied);
+    mipGenerator.Add(
+      image, format, { desc.width, desc.height, desc.depth }, state);
+    mipGenerator.Record(cmdBuffer);
+  } else {
+    vkuTransitionLayout(cmdBuffer,
+                        image.image,
+                        range,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    image.SetState(range, state);
+  }
+  vkEndCommandBuffer(cmdBuffer);
+
+  VkFence fence = vkuCreateFence(device);
+  auto submitInfo =
+    vkiSubmitInfo(0, nullptr, nullptr, 1, &cmdBuffer, 0, nullptr);
+  vkQueueSubmit(queue, 1, &submitInfo, fence);
+  vkWaitForFences(device, 1, &fence, true, (uint64_t)-1);
+  vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+  vkDestroyFence(device, fence, nullptr);
+  vkDestroyBuffer(device, stagingBuffer, nullptr);
+  vkuFreeMemory(device, stagingBufferMemory);
+  return true;
+}
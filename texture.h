@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+#include "pack.h"
+
+// Size of the blocks a format stores texels in, 1x1 for uncompressed
+// formats. blockSize is 0 for formats the texture loaders do not know.
+struct FormatBlockInfo
+{
+  uint32_t blockWidth = 1;
+  uint32_t blockHeight = 1;
+  uint32_t blockSize = 0; // bytes
+};
+
+FormatBlockInfo
+GetFormatBlockInfo(VkFormat format);
+
+bool
+IsBlockCompressed(VkFormat format);
+
+// levels of a full mip chain
+uint32_t
+GetMipCount(uint32_t width, uint32_t height, uint32_t depth = 1);
+
+// bytes of one mip level of one layer
+VkDeviceSize
+GetLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t depth);
+
+// A texture with all its levels on the host. levels holds every mip of
+// every layer, layer major, with offsets into data that keep each level
+// aligned for buffer to image copies, i.e. the layout of a PACK_ENTRY_TEXTURE
+// payload without its headers. With PACK_TEXTURE_GENERATE_MIPS only level 0
+// of each layer has data.
+struct TextureData
+{
+  PackTexture desc = {};
+  std::vector<PackTextureLevel> levels = {};
+  std::vector<uint8_t> data = {};
+
+  // sets up levels and sizes data for desc
+  void Allocate();
+
+  PackTextureLevel& GetLevel(uint32_t mip, uint32_t layer = 0)
+  {
+    return levels[layer * desc.mipCount + mip];
+  }
+  uint8_t* GetLevelData(uint32_t mip, uint32_t layer = 0)
+  {
+    return &data[static_cast<size_t>(GetLevel(mip, layer).offset)];
+  }
+};
+
+// Reads KTX2 containers without supercompression, and DDS containers with
+// legacy FourCC codes or the DX10 header. Both keep BC1-7 payloads as they
+// are, cube maps come out as 6 layers per cube. A KTX2 level count of 0 sets
+// PACK_TEXTURE_GENERATE_MIPS.
+bool
+LoadKtx2(const uint8_t* file, size_t size, TextureData& texture);
+bool
+LoadDds(const uint8_t* file, size_t size, TextureData& texture);
+// picks the loader by the file's magic
+bool
+LoadTexture(const char* fileName, TextureData& texture);
+
+// Writes a KTX2 container with a basic data format descriptor, for the
+// formats the BC encoder (bc_encoder.h) produces and RGBA8.
+bool
+SaveKtx2(const char* fileName, const TextureData& texture);
+
+// Image, memory and view of a texture, sampled and transfer destination. The
+// image is left in VK_IMAGE_LAYOUT_UNDEFINED.
+void
+CreateTextureImage(VkDevice device,
+                   const VkPhysicalDeviceMemoryProperties& memProps,
+                   const PackTexture& desc,
+                   VkImageUsageFlags usage,
+                   PhysicalImage& image);
+
+// Creates the image and uploads all levels with one staging buffer and one
+// copy, or generates them (PACK_TEXTURE_GENERATE_MIPS), then waits for it.
+// The image ends in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Returns false if the device
+// cannot sample the format, e.g. BC formats without textureCompressionBC,
+// or cannot generate its mips.
+bool
+UploadTexture(VkDevice device,
+              VkPhysicalDevice physicalDevice,
+              const VkPhysicalDeviceMemoryProperties& memProps,
+              VkCommandPool cmdPool,
+              VkQueue queue,
+              const TextureData& texture,
+              PhysicalImage& image);
+
+// buffer to image copies of all levels with data, bufferOffset is added to
+// the level offsets
+void
+GetTextureCopyRegions(const PackTexture& desc,
+                      const PackTextureLevel* levels,
+                      VkDeviceSize bufferOffset,
+                      std::vector<VkBufferImageCopy>& regions);
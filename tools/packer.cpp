@@ -0,0 +1,177 @@
+// Writes an asset pack (pack.h) from the teapot and files on disk, e.g.
+//   packer build\assets.pak --teapot --spirv build\main.vert.spv
+//
+// Build it from a Developer Command Prompt in the repository root:
+//   cl /EHsc /O2 /Iinclude /I. tools\packer.cpp pack.cpp mesh.cpp lod.cpp
+//      vertex_format.cpp mesh_kernels.cpp teapot.cpp texture.cpp mipmaps.cpp
+//      telemetry.cpp /link /LIBPATH:lib vulkan-1.lib
+//
+// Options, in any order after the output file:
+//   --teapot        optimized teapot with levels of detail, named "teapot"
+//   --spirv <file>  shader code named after the file, the name ReadShader
+//                   looks up
+//   --texture <file> KTX2 or DDS texture (texture_encoder writes them),
+//                   named after the file
+//   --virtual <file> KTX2 or DDS texture with all its mips, paged for
+//                   VirtualTexture, named after the file
+//   --page-size <n> pages of the following virtual textures are n x n
+//                   texels, 128 by default
+//   --raw <file>    bytes of the file, named after the file
+//   --store         no compression for the following entries
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lod.h"
+#include "pack.h"
+#include "teapot.h"
+#include "texture.h"
+
+namespace {
+
+bool
+ReadWholeFile(const char* fileName, std::string& data)
+{
+  FILE* file = 0;
+  fopen_s(&file, fileName, "rb");
+  if (!file) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  data.resize(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  size_t read = fread(&data[0], 1, data.size(), file);
+  fclose(file);
+  return read == data.size();
+}
+
+// file name without its directory
+const char*
+GetEntryName(const char* fileName)
+{
+  const char* name = fileName;
+  for (const char* c = fileName; *c != '\0'; ++c) {
+    if (*c == '\\' || *c == '/') {
+      name = c + 1;
+    }
+  }
+  return name;
+}
+
+void
+PrintUsage()
+{
+  std::cout << "usage: packer <output> [--store] [--teapot] [--spirv <file>]"
+               " [--texture <file>] [--page-size <n>] [--virtual <file>]"
+               " [--raw <file>] ..."
+            << std::endl;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 3) {
+    PrintUsage();
+    return 1;
+  }
+
+  const char* output = argv[1];
+  PackWriter writer = {};
+  bool compress = true;
+  uint32_t pageSize = 128;
+
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--store") == 0) {
+      compress = false;
+    } else if (strcmp(argv[i], "--teapot") == 0) {
+      MeshOptimizationReport report = {};
+      Mesh mesh = GenerateTeapotMesh(true, &report);
+      report.Print("teapot");
+      GenerateLods(mesh);
+
+      writer.AddMesh("teapot",
+                     mesh,
+                     POSITION | NORMAL,
+                     QUANTIZED_POSITION | OCTAHEDRAL_NORMAL,
+                     compress);
+    } else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+      const char* fileName = argv[++i];
+
+      TextureData texture = {};
+      if (!LoadTexture(fileName, texture)) {
+        return 1;
+      }
+
+      std::vector<const void*> levels;
+      std::vector<size_t> levelSizes;
+      for (auto const& level : texture.levels) {
+        levels.push_back(texture.data.data() + level.offset);
+        levelSizes.push_back(static_cast<size_t>(level.size));
+      }
+      writer.AddTexture(GetEntryName(fileName),
+                        texture.desc,
+                        levels.data(),
+                        levelSizes.data(),
+                        compress);
+    } else if (strcmp(argv[i], "--virtual") == 0 && i + 1 < argc) {
+      const char* fileName = argv[++i];
+
+      TextureData texture = {};
+      if (!LoadTexture(fileName, texture) ||
+          !writer.AddVirtualTexture(
+            GetEntryName(fileName), texture, pageSize, compress)) {
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+      pageSize = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if ((strcmp(argv[i], "--spirv") == 0 ||
+                strcmp(argv[i], "--raw") == 0) &&
+               i + 1 < argc) {
+      bool spirv = strcmp(argv[i], "--spirv") == 0;
+      const char* fileName = argv[++i];
+
+      std::string data;
+      if (!ReadWholeFile(fileName, data)) {
+        std::cout << "ERROR: cannot read " << fileName << std::endl;
+        return 1;
+      }
+
+      if (spirv) {
+        writer.AddSpirv(GetEntryName(fileName), data.data(), data.size());
+      } else {
+        writer.AddBlob(GetEntryName(fileName),
+                       PACK_ENTRY_RAW,
+                       data.data(),
+                       data.size(),
+                       compress);
+      }
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  uint64_t payloadSize = 0;
+  uint64_t storedSize = 0;
+  for (auto const& blob : writer.blobs) {
+    payloadSize += blob.payloadSize;
+    storedSize += blob.data.size();
+    std::cout << "INFO: " << blob.name << ": " << blob.payloadSize << " -> "
+              << blob.data.size() << " bytes" << std::endl;
+  }
+
+  if (!writer.Write(output)) {
+    return 1;
+  }
+  std::cout << "INFO: " << output << ": " << writer.blobs.size()
+            << " entries, " << payloadSize << " -> " << storedSize << " bytes"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,282 @@
+// Encodes an image into a BC compressed KTX2 texture with mips, e.g.
+//   texture_encoder res\albedo.tga build\albedo.ktx2 --format bc7 --srgb
+//
+// Build it from a Developer Command Prompt in the repository root:
+//   cl /EHsc /O2 /Iinclude /I. tools\texture_encoder.cpp bc_encoder.cpp
+//      texture.cpp mipmaps.cpp telemetry.cpp /link /LIBPATH:lib vulkan-1.lib
+//
+// Reads uncompressed or RLE true colour TGA and binary PPM (P6) images.
+// Options, in any order after the output file:
+//   --format <f>    bc1, bc1a, bc3, bc4, bc5, bc7 or rgba8, bc7 by default
+//   --quality <q>   fast, normal or high, normal by default
+//   --srgb          the image is sRGB encoded, mips are filtered in linear
+//                   space; not for bc4 and bc5
+//   --no-mips       only the top level
+//   --gpu-mips      only the top level, the loaders generate the other
+//                   levels on the GPU (KTX2 level count 0); rgba8 only
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bc_encoder.h"
+#include "texture.h"
+
+namespace {
+
+struct Image
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> rgba = {};
+};
+
+bool
+ReadWholeFile(const char* fileName, std::string& data)
+{
+  FILE* file = 0;
+  fopen_s(&file, fileName, "rb");
+  if (!file) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  data.resize(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  size_t read = fread(&data[0], 1, data.size(), file);
+  fclose(file);
+  return read == data.size();
+}
+
+// image types 2 (true colour) and 10 (RLE true colour), 24 or 32 bits
+bool
+ReadTga(const std::string& file, Image& image)
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(file.data());
+  if (file.size() < 18) {
+    return false;
+  }
+  uint32_t type = data[2];
+  uint32_t bits = data[16];
+  if ((type != 2 && type != 10) || data[1] != 0 || (bits != 24 && bits != 32)) {
+    return false;
+  }
+
+  image.width = data[12] | (data[13] << 8);
+  image.height = data[14] | (data[15] << 8);
+  // rows are stored bottom up unless bit 5 of the descriptor is set
+  bool topDown = (data[17] & 0x20) != 0;
+  uint32_t bytes = bits / 8;
+  size_t offset = 18 + data[0];
+  size_t texelCount = size_t(image.width) * image.height;
+  image.rgba.resize(texelCount * 4);
+
+  std::vector<uint8_t> texels(texelCount * bytes);
+  if (type == 2) {
+    if (file.size() < offset + texels.size()) {
+      return false;
+    }
+    memcpy(texels.data(), data + offset, texels.size());
+  } else {
+    for (size_t i = 0; i < texelCount;) {
+      if (offset >= file.size()) {
+        return false;
+      }
+      uint32_t header = data[offset++];
+      uint32_t count = (header & 0x7f) + 1;
+      bool run = (header & 0x80) != 0;
+      size_t size = (run ? 1 : count) * bytes;
+      if (i + count > texelCount || offset + size > file.size()) {
+        return false;
+      }
+      for (uint32_t j = 0; j < count; ++j, ++i) {
+        memcpy(&texels[i * bytes],
+               data + offset + (run ? 0 : j * bytes),
+               bytes);
+      }
+      offset += size;
+    }
+  }
+
+  // BGR(A) to RGBA
+  for (size_t i = 0; i < texelCount; ++i) {
+    size_t y = i / image.width;
+    size_t x = i % image.width;
+    size_t row = topDown ? y : image.height - 1 - y;
+    uint8_t* rgba = &image.rgba[(row * image.width + x) * 4];
+    const uint8_t* texel = &texels[i * bytes];
+    rgba[0] = texel[2];
+    rgba[1] = texel[1];
+    rgba[2] = texel[0];
+    rgba[3] = bytes == 4 ? texel[3] : 255;
+  }
+  return true;
+}
+
+bool
+ReadPpm(const std::string& file, Image& image)
+{
+  if (file.compare(0, 2, "P6") != 0) {
+    return false;
+  }
+
+  // width, height and maximum value, separated by whitespace and comments
+  uint32_t values[3] = {};
+  size_t offset = 2;
+  for (uint32_t i = 0; i < 3; ++i) {
+    while (offset < file.size() &&
+           (isspace(static_cast<uint8_t>(file[offset])) ||
+            file[offset] == '#')) {
+      if (file[offset] == '#') {
+        offset = file.find('\n', offset);
+      } else {
+        ++offset;
+      }
+    }
+    while (offset < file.size() &&
+           isdigit(static_cast<uint8_t>(file[offset]))) {
+      values[i] = values[i] * 10 + (file[offset++] - '0');
+    }
+  }
+  if (offset >= file.size()) {
+    return false;
+  }
+  ++offset; // single whitespace before the texels
+
+  image.width = values[0];
+  image.height = values[1];
+  size_t texelCount = size_t(image.width) * image.height;
+  if (values[2] != 255 || file.size() < offset + texelCount * 3) {
+    return false;
+  }
+
+  image.rgba.resize(texelCount * 4);
+  for (size_t i = 0; i < texelCount; ++i) {
+    memcpy(&image.rgba[i * 4], &file[offset + i * 3], 3);
+    image.rgba[i * 4 + 3] = 255;
+  }
+  return true;
+}
+
+void
+PrintUsage()
+{
+  std::cout << "usage: texture_encoder <input.tga|ppm> <output.ktx2>"
+               " [--format bc1|bc1a|bc3|bc4|bc5|bc7|rgba8]"
+               " [--quality fast|normal|high] [--srgb] [--no-mips]"
+               " [--gpu-mips]"
+            << std::endl;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 3) {
+    PrintUsage();
+    return 1;
+  }
+
+  const char* input = argv[1];
+  const char* output = argv[2];
+  std::string format = "bc7";
+  BcQuality quality = BC_QUALITY_NORMAL;
+  bool srgb = false;
+  bool mips = true;
+  bool gpuMips = false;
+
+  for (int i = 3; i < argc; ++i) {
+    if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      format = argv[++i];
+    } else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "fast") {
+        quality = BC_QUALITY_FAST;
+      } else if (name == "high") {
+        quality = BC_QUALITY_HIGH;
+      } else if (name != "normal") {
+        PrintUsage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--srgb") == 0) {
+      srgb = true;
+    } else if (strcmp(argv[i], "--no-mips") == 0) {
+      mips = false;
+    } else if (strcmp(argv[i], "--gpu-mips") == 0) {
+      gpuMips = true;
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  VkFormat vkFormat = VK_FORMAT_UNDEFINED;
+  if (format == "bc1") {
+    vkFormat =
+      srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+  } else if (format == "bc1a") {
+    vkFormat =
+      srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+  } else if (format == "bc3") {
+    vkFormat = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+  } else if (format == "bc4" && !srgb) {
+    vkFormat = VK_FORMAT_BC4_UNORM_BLOCK;
+  } else if (format == "bc5" && !srgb) {
+    vkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+  } else if (format == "bc7") {
+    vkFormat = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+  } else if (format == "rgba8") {
+    vkFormat = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+  } else {
+    PrintUsage();
+    return 1;
+  }
+  // block-compressed images cannot be blit destinations
+  if (gpuMips && IsBlockCompressed(vkFormat)) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::string file;
+  Image image = {};
+  if (!ReadWholeFile(input, file) ||
+      !(ReadTga(file, image) || ReadPpm(file, image)) || image.width == 0 ||
+      image.height == 0) {
+    std::cout << "ERROR: cannot read " << input << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  TextureData texture = {};
+  EncodeTexture(image.rgba.data(),
+                image.width,
+                image.height,
+                vkFormat,
+                quality,
+                mips && !gpuMips,
+                texture);
+  if (mips && gpuMips) {
+    std::vector<uint8_t> top = std::move(texture.data);
+    texture.desc.mipCount = GetMipCount(image.width, image.height);
+    texture.desc.flags |= PACK_TEXTURE_GENERATE_MIPS;
+    texture.Allocate();
+    memcpy(texture.GetLevelData(0), top.data(), top.size());
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+
+  if (!SaveKtx2(output, texture)) {
+    return 1;
+  }
+  std::cout << "INFO: " << output << ": " << image.width << "x" << image.height
+            << ", " << texture.desc.mipCount << " mips, "
+            << image.rgba.size() << " -> " << texture.data.size()
+            << " bytes in "
+            << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms" << std::endl;
+  return 0;
+}
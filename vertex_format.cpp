@@ -0,0 +1,188 @@
+#include "vertex_format.h"
+
+#include <cstring> // memcpy
+
+#include <glm\gtc\packing.hpp>
+
+#include "vk_utils.h"
+
+PositionQuantization
+PositionQuantization::FromPositions(const float* positions,
+                                    uint32_t count,
+                                    uint32_t stride)
+{
+  ASSERT_TRUE(count > 0);
+
+  glm::vec3 lo(positions[0], positions[1], positions[2]);
+  glm::vec3 hi = lo;
+  for (uint32_t i = 1; i < count; ++i) {
+    const float* p = positions + i * stride;
+    lo = glm::min(lo, glm::vec3(p[0], p[1], p[2]));
+    hi = glm::max(hi, glm::vec3(p[0], p[1], p[2]));
+  }
+
+  PositionQuantization quantization = {};
+  quantization.min = lo;
+  // flat meshes still need an invertible mapping
+  quantization.extent = glm::max(hi - lo, glm::vec3(1e-6f));
+  return quantization;
+}
+
+uint64_t
+PositionQuantization::Encode(glm::vec3 position) const
+{
+  return glm::packUnorm4x16(glm::vec4((position - min) / extent, 1.0f));
+}
+
+glm::mat4
+PositionQuantization::GetDequantizationMatrix() const
+{
+  glm::mat4 m(1.0f);
+  m[0][0] = extent.x;
+  m[1][1] = extent.y;
+  m[2][2] = extent.z;
+  m[3] = glm::vec4(min, 1.0f);
+  return m;
+}
+
+glm::vec2
+EncodeOctahedral(glm::vec3 v)
+{
+  float length = glm::abs(v.x) + glm::abs(v.y) + glm::abs(v.z);
+  if (length == 0.0f) {
+    // e.g. the normal of a degenerate triangle, (0, 0) decodes to +Z
+    return glm::vec2(0.0f);
+  }
+  v /= length;
+
+  glm::vec2 e(v.x, v.y);
+  if (v.z < 0.0f) {
+    // fold the lower hemisphere over the diagonals
+    e = glm::vec2(1.0f - glm::abs(v.y), 1.0f - glm::abs(v.x));
+    e.x *= v.x >= 0.0f ? 1.0f : -1.0f;
+    e.y *= v.y >= 0.0f ? 1.0f : -1.0f;
+  }
+  return e;
+}
+
+glm::vec3
+DecodeOctahedral(glm::vec2 e)
+{
+  glm::vec3 v(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+  float t = glm::max(-v.z, 0.0f);
+  v.x += v.x >= 0.0f ? -t : t;
+  v.y += v.y >= 0.0f ? -t : t;
+  return glm::normalize(v);
+}
+
+uint32_t
+EncodeNormal(glm::vec3 normal)
+{
+  return glm::packSnorm2x16(EncodeOctahedral(normal));
+}
+
+uint32_t
+EncodeTangent(glm::vec4 tangent)
+{
+  glm::vec2 e = EncodeOctahedral(glm::vec3(tangent));
+  return glm::packSnorm4x8(
+    glm::vec4(e, 0.0f, tangent.w < 0.0f ? -1.0f : 1.0f));
+}
+
+uint32_t
+EncodeTextureCoord(glm::vec2 uv)
+{
+  return glm::packHalf2x16(uv);
+}
+
+uint32_t
+EncodeColor(glm::vec4 color)
+{
+  return glm::packUnorm4x8(color);
+}
+
+void
+PackVertexStream(const VertexSource& source,
+                 VertexAttributeFlags attributeFlags,
+                 VertexEncodingFlags encodingFlags,
+                 const PositionQuantization* quantization,
+                 std::vector<uint8_t>& stream)
+{
+  uint32_t stride =
+    SimplifiedVertexInputState::GetStride(attributeFlags, encodingFlags);
+  stream.resize(static_cast<size_t>(stride) * source.vertexCount);
+
+  uint8_t* dst = stream.data();
+  auto write = [&dst](const void* data, size_t size) {
+    memcpy(dst, data, size);
+    dst += size;
+  };
+
+  for (uint32_t i = 0; i < source.vertexCount; ++i) {
+    if (attributeFlags & POSITION) {
+      const float* p = source.positions + i * 3;
+      if (encodingFlags & QUANTIZED_POSITION) {
+        ASSERT_TRUE(quantization != nullptr);
+        uint64_t packed = quantization->Encode(glm::vec3(p[0], p[1], p[2]));
+        write(&packed, sizeof(packed));
+      } else {
+        write(p, sizeof(float) * 3);
+      }
+    }
+
+    if (attributeFlags & NORMAL) {
+      const float* n = source.normals + i * 3;
+      if (encodingFlags & OCTAHEDRAL_NORMAL) {
+        uint32_t packed = EncodeNormal(glm::vec3(n[0], n[1], n[2]));
+        write(&packed, sizeof(packed));
+      } else {
+        write(n, sizeof(float) * 3);
+      }
+    }
+
+    if (attributeFlags & TEXTURE_COORD) {
+      const float* uv = source.uvs + i * 2;
+      if (encodingFlags & HALF_TEXTURE_COORD) {
+        uint32_t packed = EncodeTextureCoord(glm::vec2(uv[0], uv[1]));
+        write(&packed, sizeof(packed));
+      } else {
+        write(uv, sizeof(float) * 2);
+      }
+    }
+
+    if (attributeFlags & COLOR) {
+      const float* c = source.colors + i * 4;
+      if (encodingFlags & UNORM8_COLOR) {
+        uint32_t packed = EncodeColor(glm::vec4(c[0], c[1], c[2], c[3]));
+        write(&packed, sizeof(packed));
+      } else {
+        write(c, sizeof(float) * 4);
+      }
+    }
+
+    if (attributeFlags & TANGENT) {
+      const float* t = source.tangents + i * 4;
+      if (encodingFlags & OCTAHEDRAL_NORMAL) {
+        uint32_t packed = EncodeTangent(glm::vec4(t[0], t[1], t[2], t[3]));
+        write(&packed, sizeof(packed));
+      } else {
+        write(t, sizeof(float) * 4);
+      }
+    }
+  }
+
+  ASSERT_TRUE((dst == stream.data() + stream.size()));
+}
+
+SimplifiedVertexInputState
+SimplifiedVertexInputState::GetPositionOnly() const
+{
+  ASSERT_TRUE(attributeFlagsCount > 0);
+  ASSERT_TRUE((attributeFlags[0] == VertexAttributeFlagBits::POSITION));
+
+  SimplifiedVertexInputState positionOnly = {};
+  positionOnly.attributeFlags[0] = attributeFlags[0];
+  positionOnly.encodingFlags[0] = encodingFlags[0];
+  positionOnly.attributeFlagsCount = 1;
+  return positionOnly;
+}
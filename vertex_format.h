@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm\glm.hpp>
+
+#include "pipeline_state.h"
+
+// Maps positions into the bounds of a mesh so they fit R16G16B16A16_UNORM.
+// The dequantization matrix takes the UNORM position back to object space,
+// multiply it into the model matrix.
+struct PositionQuantization
+{
+  static PositionQuantization FromPositions(const float* positions,
+                                            uint32_t count,
+                                            uint32_t stride = 3);
+
+  uint64_t Encode(glm::vec3 position) const;
+  glm::mat4 GetDequantizationMatrix() const;
+
+  glm::vec3 min = {};
+  glm::vec3 extent = {}; // max - min, never 0
+};
+
+// octahedral unit vector in [-1, 1]^2
+glm::vec2
+EncodeOctahedral(glm::vec3 v);
+glm::vec3
+DecodeOctahedral(glm::vec2 e);
+
+uint32_t
+EncodeNormal(glm::vec3 normal);   // R16G16_SNORM
+uint32_t
+EncodeTangent(glm::vec4 tangent); // R8G8B8A8_SNORM
+uint32_t
+EncodeTextureCoord(glm::vec2 uv); // R16G16_SFLOAT
+uint32_t
+EncodeColor(glm::vec4 color);     // R8G8B8A8_UNORM
+
+// Float attributes of a mesh, unused attributes stay nullptr.
+struct VertexSource
+{
+  const float* positions = nullptr; // 3 per vertex
+  const float* normals = nullptr;   // 3 per vertex
+  const float* uvs = nullptr;       // 2 per vertex
+  const float* colors = nullptr;    // 4 per vertex
+  const float* tangents = nullptr;  // 4 per vertex
+  uint32_t vertexCount = 0;
+};
+
+// Writes the interleaved stream of one binding of SimplifiedVertexInputState,
+// quantization is only used with QUANTIZED_POSITION.
+void
+PackVertexStream(const VertexSource& source,
+                 VertexAttributeFlags attributeFlags,
+                 VertexEncodingFlags encodingFlags,
+                 const PositionQuantization* quantization,
+                 std::vector<uint8_t>& stream);
@@ -0,0 +1,964 @@
+#include "virtual_texture.h"
+
+#include <algorithm> // sort, min, max
+#include <cstring>
+#include <iostream>
+
+#include "vk_utils.h"
+
+namespace {
+
+// stages of everything that samples virtual textures or writes feedback
+const VkPipelineStageFlags SHADER_STAGES =
+  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+// the feedback of a pixel is written once every 16 frames, see
+// virtual_texture.glsl
+const uint64_t FEEDBACK_PERIOD = 16;
+
+VkDeviceSize
+AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t
+DivideUp(uint32_t value, uint32_t divisor)
+{
+  return (value + divisor - 1) / divisor;
+}
+
+// whole image, the contents are kept unless it is still undefined
+void
+TransitionImage(VkCommandBuffer cmdBuffer,
+                PhysicalImage& image,
+                VkFormat format,
+                ImageState state)
+{
+  ImageState old = image.GetState(0);
+  auto range = vkiImageSubresourceRange(
+    vkuGetImageAspectFlags(format), 0, image.levels, 0, image.layers);
+  auto barrier = vkiImageMemoryBarrier(old.accessFlags,
+                                       state.accessFlags,
+                                       old.layout,
+                                       state.layout,
+                                       VK_QUEUE_FAMILY_IGNORED,
+                                       VK_QUEUE_FAMILY_IGNORED,
+                                       image.image,
+                                       range);
+  vkCmdPipelineBarrier(cmdBuffer,
+                       old.stageFlags,
+                       state.stageFlags,
+                       0,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr,
+                       1,
+                       &barrier);
+  image.SetState(range, state);
+}
+
+void
+BufferBarrier(VkCommandBuffer cmdBuffer,
+              VkBuffer buffer,
+              VkPipelineStageFlags srcStages,
+              VkAccessFlags srcAccess,
+              VkPipelineStageFlags dstStages,
+              VkAccessFlags dstAccess)
+{
+  auto barrier = vkiBufferMemoryBarrier(srcAccess,
+                                        dstAccess,
+                                        VK_QUEUE_FAMILY_IGNORED,
+                                        VK_QUEUE_FAMILY_IGNORED,
+                                        buffer,
+                                        0,
+                                        VK_WHOLE_SIZE);
+  vkCmdPipelineBarrier(cmdBuffer,
+                       srcStages,
+                       dstStages,
+                       0,
+                       0,
+                       nullptr,
+                       1,
+                       &barrier,
+                       0,
+                       nullptr);
+}
+
+} // namespace
+
+bool
+VirtualTexture::Create(DeviceProps deviceProps,
+                       VkDevice device,
+                       Timeline* timeline,
+                       DeletionQueue* deletionQueue,
+                       const AssetPack* pack,
+                       const char* name,
+                       uint32_t slotCount,
+                       bool allowSparse,
+                       VkDeviceSize stagingSize)
+{
+  this->deviceProps = deviceProps;
+  this->device = device;
+  this->timeline = timeline;
+  this->deletionQueue = deletionQueue;
+  this->pack = pack;
+
+  entry = pack->Find(name);
+  if (entry == nullptr || entry->type != PACK_ENTRY_VIRTUAL_TEXTURE ||
+      entry->payloadSize < sizeof(PackVirtualTexture)) {
+    std::cout << "ERROR: no virtual texture " << name << std::endl;
+    return false;
+  }
+  pack->ReadRange(*entry, 0, sizeof(desc), &desc);
+
+  uint64_t pageTableSize = uint64_t(desc.pageCount) * sizeof(PackVirtualPage);
+  FormatBlockInfo block =
+    GetFormatBlockInfo(static_cast<VkFormat>(desc.format));
+  bool valid = block.blockSize != 0 && desc.pageSize != 0 &&
+               desc.pageSize % block.blockWidth == 0 &&
+               desc.pageSize % block.blockHeight == 0 &&
+               desc.mipCount != 0 && desc.mipCount < 32 &&
+               sizeof(desc) + pageTableSize <= entry->payloadSize;
+
+  uint32_t pageCount = 0;
+  mips.clear();
+  for (uint32_t i = 0; valid && i < desc.mipCount; ++i) {
+    Mip mip = {};
+    mip.width = std::max(desc.width >> i, 1u);
+    mip.height = std::max(desc.height >> i, 1u);
+    mip.pagesX = DivideUp(mip.width, desc.pageSize);
+    mip.pagesY = DivideUp(mip.height, desc.pageSize);
+    mip.firstPage = pageCount;
+    pageCount += mip.pagesX * mip.pagesY;
+    mips.push_back(mip);
+  }
+
+  pageBytes = VkDeviceSize(desc.pageSize / block.blockWidth) *
+              (desc.pageSize / block.blockHeight) * block.blockSize;
+  // the staging ring holds the page table and at least one page
+  valid = valid && pageCount == desc.pageCount &&
+          pageBytes + pageCount * sizeof(uint32_t) + PACK_ALIGNMENT <=
+            stagingSize;
+  if (valid) {
+    pageEntries.resize(desc.pageCount);
+    pack->ReadRange(
+      *entry, sizeof(desc), pageTableSize, pageEntries.data());
+  }
+  for (auto const& page : pageEntries) {
+    valid = valid && page.size == pageBytes &&
+            page.offset <= entry->payloadSize - page.size;
+  }
+  if (!valid) {
+    std::cout << "ERROR: invalid virtual texture " << name << std::endl;
+    pageEntries.clear();
+    return false;
+  }
+
+  pages.assign(pageCount, Page{});
+  pinnedMip = desc.mipCount - 1;
+  for (uint32_t i = 0; i < desc.mipCount; ++i) {
+    const Mip& mip = mips[i];
+    if (mip.pagesX == 1 && mip.pagesY == 1) {
+      pinnedMip = std::min(pinnedMip, i);
+    }
+    for (uint32_t page = 0; page < mip.pagesX * mip.pagesY; ++page) {
+      Page& p = pages[mip.firstPage + page];
+      p.x = static_cast<uint16_t>(page % mip.pagesX);
+      p.y = static_cast<uint16_t>(page / mip.pagesX);
+      p.mip = static_cast<uint8_t>(i);
+    }
+  }
+
+  // pinned pages never leave their slots, keep room for the others
+  uint32_t pinnedSlots = pageCount - mips[pinnedMip].firstPage;
+  slotCount = std::max(slotCount, pinnedSlots + DEFAULT_MAX_UPLOADS);
+
+  stagingRing.Create(device, deviceProps.memProps, stagingSize);
+
+  tailMip = desc.mipCount;
+  if (allowSparse && CreateSparse(slotCount)) {
+    mode = VIRTUAL_TEXTURE_MODE_SPARSE;
+  } else {
+    mode = VIRTUAL_TEXTURE_MODE_SOFTWARE;
+    CreateSoftware(slotCount);
+  }
+
+  slots.assign(this->slotCount, Slot{});
+  freeSlots.clear();
+  for (uint32_t i = this->slotCount; i > 0; --i) {
+    freeSlots.push_back(i - 1);
+  }
+  drainingSlots.clear();
+
+  const VkPhysicalDeviceMemoryProperties& memProps = deviceProps.memProps;
+  pageTable.size = pageCount * sizeof(uint32_t);
+  pageTable.buffer = vkuCreateBuffer(device,
+                                     pageTable.size,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  pageTable.memory = vkuAllocateBufferMemory(
+    device, memProps, pageTable.buffer, VKU_MEMORY_USAGE_GPU_ONLY, true);
+
+  feedback.size = DivideUp(pageCount, 32) * sizeof(uint32_t);
+  feedback.buffer = vkuCreateBuffer(device,
+                                    feedback.size,
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  feedback.memory = vkuAllocateBufferMemory(
+    device, memProps, feedback.buffer, VKU_MEMORY_USAGE_GPU_ONLY, true);
+
+  for (auto& readback : readbacks) {
+    readback = {};
+    readback.buffer = vkuCreateBuffer(
+      device, feedback.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    VkMemoryPropertyFlags flags = 0;
+    readback.memory = vkuAllocateBufferMemory(device,
+                                              memProps,
+                                              readback.buffer,
+                                              VKU_MEMORY_USAGE_READBACK,
+                                              true,
+                                              MEMORY_CATEGORY_STAGING,
+                                              &flags);
+    readback.coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    void* data = nullptr;
+    ASSERT_VK_SUCCESS(
+      vkMapMemory(device, readback.memory, 0, VK_WHOLE_SIZE, 0, &data));
+    readback.data = static_cast<const uint32_t*>(data);
+  }
+  feedbackIndex = 0;
+
+  fallback.assign(pageCount, NO_PAGE);
+  // the first Update uploads the empty table
+  dirtyMip = static_cast<int32_t>(desc.mipCount) - 1;
+  frame = 0;
+  residentPageCount = 0;
+
+  // the fallback of everything else, loaded first
+  requests.clear();
+  readyPages.clear();
+  for (uint32_t page = mips[pinnedMip].firstPage; page < pageCount; ++page) {
+    pages[page].state = PAGE_STATE_QUEUED;
+    requests.push_back(page);
+  }
+
+  stopping = false;
+  thread = std::thread(&VirtualTexture::IoThread, this);
+
+  std::cout << "INFO: virtual texture " << name << ": " << desc.width << "x"
+            << desc.height << ", " << pageCount << " pages of "
+            << desc.pageSize << "x" << desc.pageSize << ", "
+            << this->slotCount << " slots, "
+            << (mode == VIRTUAL_TEXTURE_MODE_SPARSE ? "sparse" : "software")
+            << std::endl;
+  return true;
+}
+
+bool
+VirtualTexture::CreateSparse(uint32_t slotCount)
+{
+  uint32_t queueFamilyIdx = deviceProps.GetGrahicsQueueFamiliyIdx();
+  if (!deviceProps.features.sparseBinding ||
+      !deviceProps.features.sparseResidencyImage2D ||
+      (deviceProps.queueFamilyProps[queueFamilyIdx].queueFlags &
+       VK_QUEUE_SPARSE_BINDING_BIT) == 0) {
+    return false;
+  }
+
+  VkFormat format = static_cast<VkFormat>(desc.format);
+  VkImageUsageFlags usage =
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  VkImageAspectFlags aspect = vkuGetImageAspectFlags(format);
+
+  uint32_t count = 0;
+  vkGetPhysicalDeviceSparseImageFormatProperties(deviceProps.handle,
+                                                 format,
+                                                 VK_IMAGE_TYPE_2D,
+                                                 VK_SAMPLE_COUNT_1_BIT,
+                                                 usage,
+                                                 VK_IMAGE_TILING_OPTIMAL,
+                                                 &count,
+                                                 nullptr);
+  std::vector<VkSparseImageFormatProperties> formatProps(count);
+  vkGetPhysicalDeviceSparseImageFormatProperties(deviceProps.handle,
+                                                 format,
+                                                 VK_IMAGE_TYPE_2D,
+                                                 VK_SAMPLE_COUNT_1_BIT,
+                                                 usage,
+                                                 VK_IMAGE_TILING_OPTIMAL,
+                                                 &count,
+                                                 formatProps.data());
+
+  // a page has to be a whole number of sparse blocks
+  VkExtent3D granularity = {};
+  for (auto const& props : formatProps) {
+    if ((props.aspectMask & aspect) != 0) {
+      granularity = props.imageGranularity;
+    }
+  }
+  if (granularity.width == 0 || granularity.height == 0 ||
+      desc.pageSize % granularity.width != 0 ||
+      desc.pageSize % granularity.height != 0) {
+    return false;
+  }
+
+  auto imageCreateInfo = vkiImageCreateInfo(VK_IMAGE_TYPE_2D,
+                                            format,
+                                            { desc.width, desc.height, 1 },
+                                            desc.mipCount,
+                                            1,
+                                            VK_SAMPLE_COUNT_1_BIT,
+                                            VK_IMAGE_TILING_OPTIMAL,
+                                            usage,
+                                            VK_SHARING_MODE_EXCLUSIVE,
+                                            0,
+                                            nullptr,
+                                            VK_IMAGE_LAYOUT_UNDEFINED);
+  imageCreateInfo.flags =
+    VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+  ASSERT_VK_SUCCESS(
+    vkCreateImage(device, &imageCreateInfo, nullptr, &image.image));
+
+  // the alignment is the size of a sparse block
+  VkMemoryRequirements memoryRequirements = {};
+  vkGetImageMemoryRequirements(device, image.image, &memoryRequirements);
+  uint32_t memoryTypeIdx =
+    vkuFindMemoryTypeIdx(memoryRequirements,
+                         deviceProps.memProps,
+                         vkuGetMemoryPreferences(VKU_MEMORY_USAGE_GPU_ONLY));
+
+  count = 0;
+  vkGetImageSparseMemoryRequirements(device, image.image, &count, nullptr);
+  std::vector<VkSparseImageMemoryRequirements> sparseRequirements(count);
+  vkGetImageSparseMemoryRequirements(
+    device, image.image, &count, sparseRequirements.data());
+  const VkSparseImageMemoryRequirements* colorRequirements = nullptr;
+  for (auto const& requirements : sparseRequirements) {
+    if ((requirements.formatProperties.aspectMask & aspect) != 0) {
+      colorRequirements = &requirements;
+    }
+  }
+
+  if (memoryTypeIdx == VKU_INVALID_MEMORY_TYPE_IDX ||
+      colorRequirements == nullptr) {
+    vkDestroyImage(device, image.image, nullptr);
+    image = {};
+    return false;
+  }
+
+  this->slotCount = slotCount;
+  slotStride = VkDeviceSize(desc.pageSize / granularity.width) *
+               (desc.pageSize / granularity.height) *
+               memoryRequirements.alignment;
+  slotMemory = vkuAllocateMemory(device,
+                                 slotCount * slotStride,
+                                 memoryTypeIdx,
+                                 MEMORY_CATEGORY_IMAGE);
+  ASSERT_TRUE(slotMemory != VK_NULL_HANDLE);
+
+  // the mip tail is bound as a whole and stays resident
+  tailMip = std::min(colorRequirements->imageMipTailFirstLod, desc.mipCount);
+  if (tailMip < desc.mipCount) {
+    VkDeviceSize tailSize = AlignUp(colorRequirements->imageMipTailSize,
+                                    memoryRequirements.alignment);
+    tailMemory = vkuAllocateMemory(
+      device, tailSize, memoryTypeIdx, MEMORY_CATEGORY_IMAGE);
+    ASSERT_TRUE(tailMemory != VK_NULL_HANDLE);
+
+    auto bind = vkiSparseMemoryBind(colorRequirements->imageMipTailOffset,
+                                    colorRequirements->imageMipTailSize,
+                                    tailMemory,
+                                    0);
+    auto opaqueBindInfo =
+      vkiSparseImageOpaqueMemoryBindInfo(image.image, 1, &bind);
+    auto bindInfo = vkiBindSparseInfo(
+      0, nullptr, 0, nullptr, 1, &opaqueBindInfo, 0, nullptr, 0, nullptr);
+    timeline->BindSparse(bindInfo);
+  }
+
+  image.Resize(desc.mipCount, 1);
+  auto viewCreateInfo = vkiImageViewCreateInfo(
+    image.image,
+    VK_IMAGE_VIEW_TYPE_2D,
+    format,
+    { VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY,
+      VK_COMPONENT_SWIZZLE_IDENTITY },
+    vkiImageSubresourceRange(aspect, 0, desc.mipCount, 0, 1));
+  ASSERT_VK_SUCCESS(
+    vkCreateImageView(device, &viewCreateInfo, nullptr, &image.view));
+  return true;
+}
+
+void
+VirtualTexture::CreateSoftware(uint32_t slotCount)
+{
+  // square-ish atlas within the image size limit
+  uint32_t maxSlots =
+    deviceProps.props.limits.maxImageDimension2D / desc.pageSize;
+  slotsPerRow = 1;
+  while (slotsPerRow * slotsPerRow < slotCount && slotsPerRow < maxSlots) {
+    slotsPerRow *= 2;
+  }
+  slotsPerRow = std::min(slotsPerRow, maxSlots);
+  uint32_t rows = std::min(DivideUp(slotCount, slotsPerRow), maxSlots);
+  this->slotCount = std::min(slotCount, slotsPerRow * rows);
+
+  PackTexture atlas = {};
+  atlas.format = desc.format;
+  atlas.width = slotsPerRow * desc.pageSize;
+  atlas.height = rows * desc.pageSize;
+  CreateTextureImage(device,
+                     deviceProps.memProps,
+                     atlas,
+                     VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                     image);
+}
+
+void
+VirtualTexture::Destroy()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  requestCondition.notify_all();
+  stagingCondition.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+
+  deletionQueue->Push(image);
+  deletionQueue->Push(VK_OBJECT_TYPE_DEVICE_MEMORY, ToHandle64(slotMemory));
+  deletionQueue->Push(VK_OBJECT_TYPE_DEVICE_MEMORY, ToHandle64(tailMemory));
+  deletionQueue->Push(VK_OBJECT_TYPE_BUFFER, ToHandle64(pageTable.buffer));
+  deletionQueue->Push(VK_OBJECT_TYPE_DEVICE_MEMORY,
+                      ToHandle64(pageTable.memory));
+  deletionQueue->Push(VK_OBJECT_TYPE_BUFFER, ToHandle64(feedback.buffer));
+  deletionQueue->Push(VK_OBJECT_TYPE_DEVICE_MEMORY,
+                      ToHandle64(feedback.memory));
+
+  // the ring and the readbacks are used until the last frame completed
+  timeline->Wait(timeline->lastSubmitted);
+  stagingRing.Destroy();
+  for (auto& readback : readbacks) {
+    vkDestroyBuffer(device, readback.buffer, nullptr);
+    vkuFreeMemory(device, readback.memory);
+    readback = {};
+  }
+
+  image = {};
+  pageTable = {};
+  feedback = {};
+  slotMemory = VK_NULL_HANDLE;
+  tailMemory = VK_NULL_HANDLE;
+  pages.clear();
+  requests.clear();
+  readyPages.clear();
+  slots.clear();
+  freeSlots.clear();
+  drainingSlots.clear();
+  binds.clear();
+  residentPageCount = 0;
+}
+
+void
+VirtualTexture::Update(VkCommandBuffer cmdBuffer, uint32_t maxUploads)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  frame += 1;
+  uint64_t completedValue = timeline->GetCompletedValue();
+  VkFormat format = static_cast<VkFormat>(desc.format);
+  bool sparse = mode == VIRTUAL_TEXTURE_MODE_SPARSE;
+
+  // under the lock, so the I/O thread cannot miss it
+  if (stagingRing.Collect(completedValue)) {
+    stagingCondition.notify_all();
+  }
+
+  if (frame == 1) {
+    // copies and sampling share the layout, no transitions per upload
+    ImageState state = {};
+    state.stageFlags = SHADER_STAGES;
+    state.accessFlags = VK_ACCESS_SHADER_READ_BIT;
+    state.layout = VK_IMAGE_LAYOUT_GENERAL;
+    TransitionImage(cmdBuffer, image, format, state);
+
+    vkCmdFillBuffer(cmdBuffer, feedback.buffer, 0, feedback.size, 0);
+    BufferBarrier(cmdBuffer,
+                  feedback.buffer,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT,
+                  SHADER_STAGES,
+                  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    // no page until the first upload finds room in the staging ring
+    vkCmdFillBuffer(cmdBuffer, pageTable.buffer, 0, pageTable.size, NO_PAGE);
+    BufferBarrier(cmdBuffer,
+                  pageTable.buffer,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT,
+                  SHADER_STAGES,
+                  VK_ACCESS_SHADER_READ_BIT);
+  }
+
+  // oldest feedback first
+  std::vector<Readback*> completed;
+  for (auto& readback : readbacks) {
+    if (!readback.read && readback.value <= completedValue) {
+      completed.push_back(&readback);
+    }
+  }
+  std::sort(completed.begin(),
+            completed.end(),
+            [](const Readback* a, const Readback* b) {
+              return a->value < b->value;
+            });
+  size_t requestCount = requests.size();
+  for (auto readback : completed) {
+    if (!readback->coherent) {
+      auto range = vkiMappedMemoryRange(readback->memory, 0, VK_WHOLE_SIZE);
+      vkInvalidateMappedMemoryRanges(device, 1, &range);
+    }
+    ReadFeedback(*readback);
+    readback->read = true;
+  }
+  if (requests.size() > requestCount) {
+    requestCondition.notify_all();
+  }
+
+  // requests that no feedback repeated are dropped, pinned pages stay
+  for (auto& page : requests) {
+    Page& p = pages[page];
+    if (p.mip < pinnedMip && p.lastUsed + FEEDBACK_PERIOD < frame) {
+      p.state = PAGE_STATE_NONE;
+      page = NO_PAGE;
+    }
+  }
+  requests.erase(std::remove(requests.begin(), requests.end(), NO_PAGE),
+                 requests.end());
+
+  // slots of evicted pages are reused once the frames that could sample
+  // them completed
+  std::vector<uint32_t> stillDraining;
+  for (uint32_t slotIdx : drainingSlots) {
+    Slot& slot = slots[slotIdx];
+    if (slot.page == NO_PAGE || pages[slot.page].state != PAGE_STATE_DRAINING) {
+      continue; // used again meanwhile
+    }
+    if (slot.drainValue > completedValue) {
+      stillDraining.push_back(slotIdx);
+      continue;
+    }
+
+    Page& page = pages[slot.page];
+    if (sparse) {
+      binds.push_back(vkiSparseImageMemoryBind(
+        vkiImageSubresource(VK_IMAGE_ASPECT_COLOR_BIT, page.mip, 0),
+        vkiOffset3D(page.x * desc.pageSize, page.y * desc.pageSize, 0),
+        GetPageExtent(page),
+        VK_NULL_HANDLE,
+        0));
+    }
+    page.state = PAGE_STATE_NONE;
+    page.slot = NO_SLOT;
+    slot.page = NO_PAGE;
+    freeSlots.push_back(slotIdx);
+  }
+  drainingSlots = std::move(stillDraining);
+
+  // coarse mips first, they are the fallback of the others
+  std::stable_sort(readyPages.begin(),
+                   readyPages.end(),
+                   [this](const Load& a, const Load& b) {
+                     return pages[a.page].mip > pages[b.page].mip;
+                   });
+
+  std::vector<Load> loads;
+  std::vector<Load> deferredLoads;
+  for (auto& load : readyPages) {
+    Page& page = pages[load.page];
+    bool stale =
+      page.mip < pinnedMip && page.lastUsed + FEEDBACK_PERIOD < frame;
+    bool needsSlot = page.mip < tailMip;
+
+    if (load.failed) {
+      std::cout << "WARNING: page " << load.page << " of virtual texture "
+                << pack->GetName(*entry) << " failed to load" << std::endl;
+      page.state = PAGE_STATE_FAILED;
+    } else if (stale) {
+      page.state = PAGE_STATE_NONE;
+    } else if (loads.size() >= maxUploads ||
+               (needsSlot && freeSlots.empty())) {
+      deferredLoads.push_back(load);
+      continue;
+    } else {
+      if (needsSlot) {
+        page.slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[page.slot].page = load.page;
+      }
+      page.state = PAGE_STATE_RESIDENT;
+      residentPageCount += 1;
+      dirtyMip = std::max(dirtyMip, static_cast<int32_t>(page.mip));
+      loads.push_back(load);
+      continue;
+    }
+    stagingRing.Retire(load.staging, completedValue);
+  }
+  readyPages = std::move(deferredLoads);
+
+  if (sparse) {
+    for (auto const& load : loads) {
+      const Page& page = pages[load.page];
+      if (page.slot != NO_SLOT) {
+        binds.push_back(vkiSparseImageMemoryBind(
+          vkiImageSubresource(VK_IMAGE_ASPECT_COLOR_BIT, page.mip, 0),
+          vkiOffset3D(page.x * desc.pageSize, page.y * desc.pageSize, 0),
+          GetPageExtent(page),
+          slotMemory,
+          page.slot * slotStride));
+      }
+    }
+    // the submission of cmdBuffer waits for the binds, see BindSparse
+    if (!binds.empty()) {
+      auto imageBindInfo = vkiSparseImageMemoryBindInfo(
+        image.image, static_cast<uint32_t>(binds.size()), binds.data());
+      auto bindInfo = vkiBindSparseInfo(
+        0, nullptr, 0, nullptr, 0, nullptr, 1, &imageBindInfo, 0, nullptr);
+      timeline->BindSparse(bindInfo);
+      binds.clear();
+    }
+  }
+
+  if (!loads.empty()) {
+    uint64_t uploadValue = timeline->GetNextValue();
+
+    ImageState state = {};
+    state.stageFlags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    state.accessFlags = VK_ACCESS_TRANSFER_WRITE_BIT;
+    state.layout = VK_IMAGE_LAYOUT_GENERAL;
+    TransitionImage(cmdBuffer, image, format, state);
+
+    // pages in the atlas are copied whole, sparse ones end at the mip edge
+    std::vector<VkBufferImageCopy> regions;
+    for (auto const& load : loads) {
+      const Page& page = pages[load.page];
+      uint32_t mip = 0;
+      VkOffset3D offset = {};
+      VkExtent3D extent = { desc.pageSize, desc.pageSize, 1 };
+      if (sparse) {
+        mip = page.mip;
+        offset = vkiOffset3D(page.x * desc.pageSize, page.y * desc.pageSize, 0);
+        extent = GetPageExtent(page);
+      } else {
+        offset = vkiOffset3D(page.slot % slotsPerRow * desc.pageSize,
+                             page.slot / slotsPerRow * desc.pageSize,
+                             0);
+      }
+      regions.push_back(vkiBufferImageCopy(
+        load.staging.offset,
+        desc.pageSize,
+        desc.pageSize,
+        vkiImageSubresourceLayers(vkuGetImageAspectFlags(format), mip, 0, 1),
+        offset,
+        extent));
+      stagingRing.Retire(load.staging, uploadValue);
+    }
+    vkCmdCopyBufferToImage(cmdBuffer,
+                           stagingRing.buffer,
+                           image.image,
+                           VK_IMAGE_LAYOUT_GENERAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+
+    state.stageFlags = SHADER_STAGES;
+    state.accessFlags = VK_ACCESS_SHADER_READ_BIT;
+    TransitionImage(cmdBuffer, image, format, state);
+  }
+
+  // keep room for the next uploads while pages are still asked for
+  uint32_t room =
+    static_cast<uint32_t>(freeSlots.size() + drainingSlots.size());
+  if (room < maxUploads && (!requests.empty() || !readyPages.empty())) {
+    Evict(maxUploads - room);
+  }
+
+  UploadPageTable(cmdBuffer);
+}
+
+void
+VirtualTexture::RecordFeedback(VkCommandBuffer cmdBuffer)
+{
+  Readback& readback = readbacks[feedbackIndex % FEEDBACK_LATENCY];
+  feedbackIndex += 1;
+
+  BufferBarrier(cmdBuffer,
+                feedback.buffer,
+                SHADER_STAGES,
+                VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  // skipped while the GPU is more than FEEDBACK_LATENCY frames behind
+  if (readback.read && timeline->IsComplete(readback.value)) {
+    auto region = vkiBufferCopy(0, 0, feedback.size);
+    vkCmdCopyBuffer(cmdBuffer, feedback.buffer, readback.buffer, 1, &region);
+    BufferBarrier(cmdBuffer,
+                  readback.buffer,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_HOST_BIT,
+                  VK_ACCESS_HOST_READ_BIT);
+    readback.value = timeline->GetNextValue();
+    readback.read = false;
+  }
+
+  vkCmdFillBuffer(cmdBuffer, feedback.buffer, 0, feedback.size, 0);
+  BufferBarrier(cmdBuffer,
+                feedback.buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                SHADER_STAGES,
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+VirtualTextureInfo
+VirtualTexture::GetInfo() const
+{
+  VirtualTextureInfo info = {};
+  info.width = desc.width;
+  info.height = desc.height;
+  info.pageSize = desc.pageSize;
+  info.mipCount = desc.mipCount;
+  if (mode == VIRTUAL_TEXTURE_MODE_SOFTWARE) {
+    info.atlasWidth = slotsPerRow * desc.pageSize;
+    info.atlasHeight = DivideUp(slotCount, slotsPerRow) * desc.pageSize;
+  }
+  info.frameIndex = static_cast<uint32_t>(frame);
+  return info;
+}
+
+void
+VirtualTexture::ReadFeedback(const Readback& readback)
+{
+  uint32_t pageCount = static_cast<uint32_t>(pages.size());
+  for (uint32_t word = 0; word < DivideUp(pageCount, 32); ++word) {
+    uint32_t bits = readback.data[word];
+    for (uint32_t page = word * 32; bits != 0; ++page, bits >>= 1) {
+      if ((bits & 1) != 0 && page < pageCount) {
+        Use(page);
+      }
+    }
+  }
+}
+
+void
+VirtualTexture::Use(uint32_t index)
+{
+  // the coarser pages covering it are its fallback, they are used as well
+  for (; index != NO_PAGE; index = GetParent(index)) {
+    Page& page = pages[index];
+    if (page.lastUsed == frame) {
+      return; // and so are its parents
+    }
+    page.lastUsed = frame;
+
+    if (page.state == PAGE_STATE_NONE) {
+      page.state = PAGE_STATE_QUEUED;
+      requests.push_back(index);
+    } else if (page.state == PAGE_STATE_DRAINING) {
+      // still in its slot
+      page.state = PAGE_STATE_RESIDENT;
+      residentPageCount += 1;
+      dirtyMip = std::max(dirtyMip, static_cast<int32_t>(page.mip));
+    }
+  }
+}
+
+uint32_t
+VirtualTexture::GetParent(uint32_t index) const
+{
+  const Page& page = pages[index];
+  if (page.mip + 1u >= mips.size()) {
+    return NO_PAGE;
+  }
+  // odd sizes round down, the last row and column can be one page short
+  const Mip& parent = mips[page.mip + 1];
+  uint32_t x = std::min(page.x / 2u, parent.pagesX - 1);
+  uint32_t y = std::min(page.y / 2u, parent.pagesY - 1);
+  return parent.firstPage + y * parent.pagesX + x;
+}
+
+VkExtent3D
+VirtualTexture::GetPageExtent(const Page& page) const
+{
+  const Mip& mip = mips[page.mip];
+  VkExtent3D extent = {};
+  extent.width = std::min(desc.pageSize, mip.width - page.x * desc.pageSize);
+  extent.height = std::min(desc.pageSize, mip.height - page.y * desc.pageSize);
+  extent.depth = 1;
+  return extent;
+}
+
+void
+VirtualTexture::Evict(uint32_t count)
+{
+  std::vector<uint32_t> candidates;
+  for (uint32_t slotIdx = 0; slotIdx < slotCount; ++slotIdx) {
+    uint32_t index = slots[slotIdx].page;
+    if (index == NO_PAGE) {
+      continue;
+    }
+    const Page& page = pages[index];
+    if (page.state == PAGE_STATE_RESIDENT && page.mip < pinnedMip &&
+        page.lastUsed + FEEDBACK_PERIOD < frame) {
+      candidates.push_back(slotIdx);
+    }
+  }
+
+  // least recently used first, finer mips before the parents they fall
+  // back to
+  count = std::min(count, static_cast<uint32_t>(candidates.size()));
+  std::partial_sort(candidates.begin(),
+                    candidates.begin() + count,
+                    candidates.end(),
+                    [this](uint32_t a, uint32_t b) {
+                      const Page& pageA = pages[slots[a].page];
+                      const Page& pageB = pages[slots[b].page];
+                      if (pageA.lastUsed != pageB.lastUsed) {
+                        return pageA.lastUsed < pageB.lastUsed;
+                      }
+                      return pageA.mip < pageB.mip;
+                    });
+
+  for (uint32_t i = 0; i < count; ++i) {
+    Slot& slot = slots[candidates[i]];
+    Page& page = pages[slot.page];
+    page.state = PAGE_STATE_DRAINING;
+    // set once the page table without the page is uploaded
+    slot.drainValue = UINT64_MAX;
+    drainingSlots.push_back(candidates[i]);
+    residentPageCount -= 1;
+    dirtyMip = std::max(dirtyMip, static_cast<int32_t>(page.mip));
+  }
+}
+
+void
+VirtualTexture::UploadPageTable(VkCommandBuffer cmdBuffer)
+{
+  if (dirtyMip < 0) {
+    return;
+  }
+
+  // a page only changes the table of the finer mips it covers, which come
+  // first in page order
+  uint32_t count = static_cast<uint32_t>(pages.size());
+  if (dirtyMip + 1 < static_cast<int32_t>(mips.size())) {
+    count = mips[dirtyMip + 1].firstPage;
+  }
+  StagingRing::Allocation staging = {};
+  if (!stagingRing.Allocate(
+        count * sizeof(uint32_t), PACK_ALIGNMENT, staging)) {
+    return; // the next Update tries again
+  }
+
+  uint32_t* entries = reinterpret_cast<uint32_t*>(staging.data);
+  for (int32_t mip = dirtyMip; mip >= 0; --mip) {
+    const Mip& m = mips[mip];
+    for (uint32_t index = m.firstPage;
+         index < m.firstPage + m.pagesX * m.pagesY;
+         ++index) {
+      uint32_t parent = GetParent(index);
+      if (pages[index].state == PAGE_STATE_RESIDENT) {
+        fallback[index] = index;
+      } else {
+        fallback[index] = parent == NO_PAGE ? NO_PAGE : fallback[parent];
+      }
+
+      if (fallback[index] == NO_PAGE) {
+        entries[index] = UINT32_MAX;
+      } else {
+        const Page& page = pages[fallback[index]];
+        entries[index] = (uint32_t(page.mip) << 24) | (page.slot & 0xffffff);
+      }
+    }
+  }
+
+  BufferBarrier(cmdBuffer,
+                pageTable.buffer,
+                SHADER_STAGES,
+                0,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT);
+  auto region = vkiBufferCopy(staging.offset, 0, count * sizeof(uint32_t));
+  vkCmdCopyBuffer(
+    cmdBuffer, stagingRing.buffer, pageTable.buffer, 1, &region);
+  BufferBarrier(cmdBuffer,
+                pageTable.buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                SHADER_STAGES,
+                VK_ACCESS_SHADER_READ_BIT);
+  stagingRing.Retire(staging, timeline->GetNextValue());
+  dirtyMip = -1;
+
+  // frames submitted so far may still sample the evicted pages
+  for (uint32_t slotIdx : drainingSlots) {
+    if (slots[slotIdx].drainValue == UINT64_MAX) {
+      slots[slotIdx].drainValue = timeline->lastSubmitted;
+    }
+  }
+}
+
+void
+VirtualTexture::IoThread()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    requestCondition.wait(lock,
+                          [this] { return stopping || !requests.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    // coarse mips first, then the most recently used
+    auto next = requests.begin();
+    for (auto iter = requests.begin(); iter != requests.end(); ++iter) {
+      const Page& page = pages[*iter];
+      const Page& best = pages[*next];
+      if (page.mip > best.mip ||
+          (page.mip == best.mip && page.lastUsed > best.lastUsed)) {
+        next = iter;
+      }
+    }
+
+    Load load = {};
+    load.page = *next;
+    requests.erase(next);
+    pages[load.page].state = PAGE_STATE_LOADING;
+
+    stagingCondition.wait(lock, [&] {
+      return stopping ||
+             stagingRing.Allocate(pageBytes, PACK_ALIGNMENT, load.staging);
+    });
+    if (stopping) {
+      return;
+    }
+
+    // only the chunks of the page are decompressed
+    const PackVirtualPage& pageEntry = pageEntries[load.page];
+    lock.unlock();
+    load.failed = !pack->ReadRange(
+      *entry, pageEntry.offset, pageEntry.size, load.staging.data);
+    lock.lock();
+
+    pages[load.page].state = PAGE_STATE_READY;
+    readyPages.push_back(load);
+  }
+}
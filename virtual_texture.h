@@ -0,0 +1,230 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <vulkan\vulkan.h>
+
+#include "vk_base.h"
+
+#include "pack.h"
+#include "streaming.h"
+#include "texture.h"
+
+// The VirtualTextureInfo of virtual_texture.glsl, e.g. in a uniform buffer
+// or push constants.
+struct VirtualTextureInfo
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t pageSize = 0;
+  uint32_t mipCount = 0;
+  // texels of the page atlas, 0 in sparse mode
+  uint32_t atlasWidth = 0;
+  uint32_t atlasHeight = 0;
+  // selects the pixel of each 4x4 tile that writes feedback
+  uint32_t frameIndex = 0;
+  uint32_t pad = 0;
+};
+
+enum VirtualTextureMode
+{
+  // pages are bound to a partially resident image
+  VIRTUAL_TEXTURE_MODE_SPARSE = 0,
+  // pages are copied into an atlas, a page table maps them
+  VIRTUAL_TEXTURE_MODE_SOFTWARE,
+};
+
+// Keeps the pages of a PACK_ENTRY_VIRTUAL_TEXTURE resident that the shaders
+// ask for, in a fixed number of page slots, so textures far beyond the size
+// of device memory can be sampled.
+//
+// Shaders (virtual_texture.glsl) set the bit of each page they sample in the
+// feedback buffer. RecordFeedback copies it to the host and clears it, and
+// Update reads the feedback of completed frames: the pages that are missing
+// are requested, coarse mips first, and an I/O thread reads them from the
+// pack into a staging ring. Update copies ready pages into free slots and
+// evicts the pages that were not asked for longest when the slots run out.
+// Asking for a page also asks for the pages of the coarser mips covering it,
+// so the shaders always have a fallback; the mips that fit into one page are
+// loaded first and never evicted.
+//
+// pageTable holds a uint per page, in pack order: the slot of the finest
+// resident page covering it in the low 24 bits and the mip of that page in
+// the high 8, UINT32_MAX if there is none. In sparse mode image is partially
+// resident, slots are ranges of one memory allocation bound with
+// Timeline::BindSparse, and the shaders clamp the LOD to the resident mip;
+// the mip tail is always resident. In software mode image is an atlas of
+// page slots without mips, which the shaders sample through the page table.
+//
+// Everything but the I/O thread runs on the render thread.
+struct VirtualTexture
+{
+  static const uint32_t DEFAULT_SLOT_COUNT = 1024;
+  static const uint32_t DEFAULT_MAX_UPLOADS = 32;
+  static const VkDeviceSize DEFAULT_STAGING_SIZE = 16 * 1024 * 1024;
+  // frames of feedback in flight
+  static const uint32_t FEEDBACK_LATENCY = 3;
+
+  // Sparse mode is used if allowSparse is set, the device supports sparse
+  // residency for 2D images of the format and its sparse blocks tile the
+  // pages. pack, timeline and deletionQueue have to outlive the texture.
+  // Returns false if the pack has no virtual texture of that name.
+  bool Create(DeviceProps deviceProps,
+              VkDevice device,
+              Timeline* timeline,
+              DeletionQueue* deletionQueue,
+              const AssetPack* pack,
+              const char* name,
+              uint32_t slotCount = DEFAULT_SLOT_COUNT,
+              bool allowSparse = true,
+              VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+  // joins the I/O thread and releases everything once the GPU is done
+  void Destroy();
+
+  // Reads completed feedback, records the copies of at most maxUploads ready
+  // pages and the page table, and evicts. In sparse mode the binds are
+  // queued right away. cmdBuffer must be part of the next submission of the
+  // timeline, before anything samples the texture.
+  void Update(VkCommandBuffer cmdBuffer,
+              uint32_t maxUploads = DEFAULT_MAX_UPLOADS);
+  // after everything that writes feedback, in the same submission
+  void RecordFeedback(VkCommandBuffer cmdBuffer);
+
+  VirtualTextureInfo GetInfo() const;
+
+  VirtualTextureMode mode = VIRTUAL_TEXTURE_MODE_SOFTWARE;
+  PackVirtualTexture desc = {};
+
+  // stays in VK_IMAGE_LAYOUT_GENERAL, pages are copied in while the others
+  // are sampled
+  PhysicalImage image = {};
+  // storage buffers, the feedback has a bit per page
+  PhysicalBuffer pageTable = {};
+  PhysicalBuffer feedback = {};
+
+  DeviceProps deviceProps = {};
+  VkDevice device = VK_NULL_HANDLE;
+  Timeline* timeline = nullptr;
+  DeletionQueue* deletionQueue = nullptr;
+  const AssetPack* pack = nullptr;
+  const PackEntry* entry = nullptr;
+
+  StagingRing stagingRing = {};
+  uint32_t slotCount = 0;
+  uint32_t slotsPerRow = 0; // of the atlas
+  // sparse mode, slot i is bound at i * slotStride
+  VkDeviceMemory slotMemory = VK_NULL_HANDLE;
+  VkDeviceSize slotStride = 0;
+  VkDeviceMemory tailMemory = VK_NULL_HANDLE;
+  uint32_t tailMip = 0; // first mip of the tail, mipCount without one
+  // mips from here on are never evicted
+  uint32_t pinnedMip = 0;
+
+  uint64_t frame = 0;
+  uint32_t residentPageCount = 0;
+
+private:
+  // enumerators, the std algorithms take them by reference
+  enum : uint32_t
+  {
+    NO_PAGE = UINT32_MAX,
+    NO_SLOT = UINT32_MAX,
+  };
+
+  enum PageState
+  {
+    PAGE_STATE_NONE = 0,
+    PAGE_STATE_QUEUED,
+    PAGE_STATE_LOADING, // read by the I/O thread
+    PAGE_STATE_READY,   // in readyPages
+    PAGE_STATE_RESIDENT,
+    // evicted, but the slot still holds it until the GPU is done with it
+    PAGE_STATE_DRAINING,
+    PAGE_STATE_FAILED,
+  };
+
+  struct Page
+  {
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint8_t mip = 0;
+    uint8_t state = PAGE_STATE_NONE;
+    uint32_t slot = NO_SLOT; // none for pages in the mip tail
+    uint64_t lastUsed = 0;   // frame of the last feedback asking for it
+  };
+
+  struct Slot
+  {
+    uint32_t page = NO_PAGE;
+    uint64_t drainValue = 0; // while the page is draining
+  };
+
+  struct Mip
+  {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pagesX = 0;
+    uint32_t pagesY = 0;
+    uint32_t firstPage = 0;
+  };
+
+  struct Load
+  {
+    uint32_t page = NO_PAGE;
+    bool failed = false;
+    StagingRing::Allocation staging = {};
+  };
+
+  struct Readback
+  {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    const uint32_t* data = nullptr; // mapped
+    bool coherent = false;
+    uint64_t value = 0; // of the frame that copied the feedback
+    bool read = true;
+  };
+
+  bool CreateSparse(uint32_t slotCount);
+  void CreateSoftware(uint32_t slotCount);
+  void ReadFeedback(const Readback& readback);
+  void Use(uint32_t page);
+  uint32_t GetParent(uint32_t page) const;
+  VkExtent3D GetPageExtent(const Page& page) const;
+  void Evict(uint32_t count);
+  void UploadPageTable(VkCommandBuffer cmdBuffer);
+  void IoThread();
+
+  std::vector<Mip> mips = {};
+  std::vector<PackVirtualPage> pageEntries = {};
+  VkDeviceSize pageBytes = 0;
+
+  std::vector<Slot> slots = {};
+  std::vector<uint32_t> freeSlots = {};
+  std::vector<uint32_t> drainingSlots = {};
+  // mips up to this one changed since the last page table upload, -1 if
+  // none did
+  int32_t dirtyMip = -1;
+  // per page, the finest resident page covering it
+  std::vector<uint32_t> fallback = {};
+  // sparse mode, binds and unbinds for the next BindSparse
+  std::vector<VkSparseImageMemoryBind> binds = {};
+
+  Readback readbacks[FEEDBACK_LATENCY] = {};
+  uint32_t feedbackIndex = 0;
+
+  // guards everything below
+  std::mutex mutex;
+  std::condition_variable requestCondition;
+  std::condition_variable stagingCondition;
+  bool stopping = false;
+
+  std::vector<Page> pages = {};
+  std::vector<uint32_t> requests = {};
+  std::vector<Load> readyPages = {};
+
+  std::thread thread = {};
+};
@@ -1,6 +1,7 @@
 #include "vk_base.h"
 
-#include <algorithm> // find_if, find_first_of
+#include <algorithm> // any_of, find_if, find_first_of, min, max
+#include <cstring>   // strcmp
 
 #include "vk_init.h"
 #include "vk_utils.h"
@@ -30,6 +31,12 @@ DeviceProps::DeviceProps(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
   presentModes.resize(count);
   vkGetPhysicalDeviceSurfacePresentModesKHR(
     handle, surface, &count, presentModes.data());
+
+  count = 0;
+  vkEnumerateDeviceExtensionProperties(handle, nullptr, &count, nullptr);
+  extensions.resize(count);
+  vkEnumerateDeviceExtensionProperties(
+    handle, nullptr, &count, extensions.data());
 }
 
 uint32_t
@@ -79,10 +86,21 @@ DeviceProps::HasPresentSupport()
   return GetPresentQueueFamiliyIdx() != (uint32_t)-1;
 }
 
+bool
+DeviceProps::HasExtension(const char* name) const
+{
+  return std::any_of(extensions.begin(),
+                     extensions.end(),
+                     [name](const VkExtensionProperties& extension) {
+                       return strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
 Swapchain::Swapchain(VkDevice device,
                      DeviceProps physicalDeviceProps,
                      VkSurfaceKHR surface)
   : device(device)
+  , deviceProps(physicalDeviceProps)
   , surface(surface)
 {
   auto surfaceCapabilities = physicalDeviceProps.GetSurfaceCapabilities();
@@ -122,7 +140,49 @@ Swapchain::Swapchain(VkDevice device,
 }
 
 void
-Swapchain::CreatePhysicalSwapchain(VkImageUsageFlags usage)
+Swapchain::CreatePhysicalSwapchain(VkImageUsageFlags usage,
+                                   ResourcePools* resources)
+{
+  this->usage = usage;
+  this->resources = resources;
+
+  CreateSwapchain(VK_NULL_HANDLE);
+}
+
+void
+Swapchain::Resize(VkExtent2D windowExtent, DeletionQueue& deletionQueue)
+{
+  auto surfaceCapabilities = deviceProps.GetSurfaceCapabilities();
+
+  extent = surfaceCapabilities.currentExtent;
+  if (extent.width == UINT32_MAX) {
+    extent.width = std::max(surfaceCapabilities.minImageExtent.width,
+                            std::min(surfaceCapabilities.maxImageExtent.width,
+                                     windowExtent.width));
+    extent.height =
+      std::max(surfaceCapabilities.minImageExtent.height,
+               std::min(surfaceCapabilities.maxImageExtent.height,
+                        windowExtent.height));
+  }
+  transform = surfaceCapabilities.currentTransform;
+
+  for (auto image : images) {
+    deletionQueue.Push(VK_OBJECT_TYPE_IMAGE_VIEW,
+                       ToHandle64(resources->images.Get(image)->view));
+    resources->images.Remove(image);
+  }
+  images.clear();
+
+  // presentation of the old swapchain's images may still be pending
+  VkSwapchainKHR oldSwapchain = swapchain;
+  CreateSwapchain(oldSwapchain);
+  deletionQueue.Push(VK_OBJECT_TYPE_SWAPCHAIN_KHR, ToHandle64(oldSwapchain));
+
+  outOfDate = false;
+}
+
+void
+Swapchain::CreateSwapchain(VkSwapchainKHR oldSwapchain)
 {
   auto swapchainCreateInfo =
     vkiSwapchainCreateInfoKHR(surface,
@@ -139,7 +199,7 @@ Swapchain::CreatePhysicalSwapchain(VkImageUsageFlags usage)
                               VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
                               presentMode,
                               VK_TRUE,
-                              VK_NULL_HANDLE);
+                              oldSwapchain);
 
   ASSERT_VK_SUCCESS(
     vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &swapchain));
@@ -155,18 +215,13 @@ Swapchain::CreatePhysicalSwapchain(VkImageUsageFlags usage)
 
   images.resize(imageCount);
   for (uint32_t i = 0; i < imageCount; ++i) {
-    images[i].image = vkImages[i];
-    images[i].memory = VK_NULL_HANDLE;
-    images[i].stageFlags =
-      VK_PIPELINE_STAGE_HOST_BIT; // VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    images[i].accessFlags = 0;
-    images[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-    auto eventCreateInfo = vkiEventCreateInfo();
-    vkCreateEvent(device, &eventCreateInfo, nullptr, &images[i].event);
+    PhysicalImage image = {};
+    image.image = vkImages[i];
+    image.memory = VK_NULL_HANDLE;
+    image.Resize(1, 1);
 
     auto imageViewCreateInfo =
-      vkiImageViewCreateInfo(images[i].image,
+      vkiImageViewCreateInfo(image.image,
                              VK_IMAGE_VIEW_TYPE_2D,
                              format.format,
                              { VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -175,15 +230,18 @@ Swapchain::CreatePhysicalSwapchain(VkImageUsageFlags usage)
                                VK_COMPONENT_SWIZZLE_IDENTITY },
                              { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
 
-    ASSERT_VK_SUCCESS(vkCreateImageView(
-      device, &imageViewCreateInfo, nullptr, &images[i].view));
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &imageViewCreateInfo, nullptr, &image.view));
+
+    images[i] = resources->images.Add(image);
   }
 }
 
 Swapchain::~Swapchain()
 {
   for (auto image : images) {
-    vkDestroyImageView(device, image.view, nullptr);
+    vkDestroyImageView(device, resources->images.Get(image)->view, nullptr);
+    resources->images.Remove(image);
   }
 
   if (swapchain != VK_NULL_HANDLE) {
@@ -191,18 +249,30 @@ Swapchain::~Swapchain()
   }
 }
 
-PhysicalImage*
+ImageHandle
 Swapchain::AcquireImage(VkSemaphore imageAvailable)
 {
   ASSERT_VK_VALID_HANDLE(swapchain);
-  ASSERT_VK_SUCCESS(vkAcquireNextImageKHR(device,
+  VkResult result = vkAcquireNextImageKHR(device,
                                           swapchain,
                                           UINT64_MAX,
                                           imageAvailable,
                                           VK_NULL_HANDLE,
-                                          &nextImageIdx));
+                                          &nextImageIdx);
+
+  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+    outOfDate = true;
+    return {};
+  }
+
+  // a suboptimal image can still be presented
+  if (result == VK_SUBOPTIMAL_KHR) {
+    outOfDate = true;
+  } else {
+    ASSERT_VK_SUCCESS(result);
+  }
 
-  return &images[nextImageIdx];
+  return images[nextImageIdx];
 }
 
 void
@@ -211,11 +281,168 @@ Swapchain::Present(VkQueue queue, VkSemaphore renderFinished)
   ASSERT_VK_VALID_HANDLE(swapchain);
   VkPresentInfoKHR presentInfo = vkiPresentInfoKHR(
     1, &renderFinished, 1, &swapchain, &nextImageIdx, nullptr);
-  ASSERT_VK_SUCCESS(vkQueuePresentKHR(queue, &presentInfo));
+  VkResult result = vkQueuePresentKHR(queue, &presentInfo);
+
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    outOfDate = true;
+  } else {
+    ASSERT_VK_SUCCESS(result);
+  }
 }
 
-VulkanBase::VulkanBase(VulkanWindow* window)
+void
+Timeline::Create(VkDevice device, VkQueue queue)
+{
+  this->device = device;
+  this->queue = queue;
+
+  vkGetSemaphoreCounterValueKHR =
+    (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(
+      device, "vkGetSemaphoreCounterValueKHR");
+  vkWaitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(
+    device, "vkWaitSemaphoresKHR");
+  ASSERT_TRUE(vkGetSemaphoreCounterValueKHR != nullptr);
+  ASSERT_TRUE(vkWaitSemaphoresKHR != nullptr);
+
+  auto typeCreateInfo =
+    vkiSemaphoreTypeCreateInfoKHR(VK_SEMAPHORE_TYPE_TIMELINE_KHR, 0);
+  auto createInfo = vkiSemaphoreCreateInfo();
+  createInfo.pNext = &typeCreateInfo;
+
+  ASSERT_VK_SUCCESS(
+    vkCreateSemaphore(device, &createInfo, nullptr, &semaphore));
+
+  auto bindCreateInfo = vkiSemaphoreCreateInfo();
+  for (auto& bindSemaphore : bindSemaphores) {
+    ASSERT_VK_SUCCESS(
+      vkCreateSemaphore(device, &bindCreateInfo, nullptr, &bindSemaphore));
+  }
+}
+
+void
+Timeline::Destroy()
+{
+  vkDestroySemaphore(device, semaphore, nullptr);
+  semaphore = VK_NULL_HANDLE;
+  for (auto& bindSemaphore : bindSemaphores) {
+    vkDestroySemaphore(device, bindSemaphore, nullptr);
+    bindSemaphore = VK_NULL_HANDLE;
+  }
+}
+
+uint64_t
+Timeline::GetCompletedValue()
+{
+  if (lastCompleted < lastSubmitted) {
+    ASSERT_VK_SUCCESS(
+      vkGetSemaphoreCounterValueKHR(device, semaphore, &lastCompleted));
+  }
+  return lastCompleted;
+}
+
+bool
+Timeline::IsComplete(uint64_t value)
+{
+  return value <= lastCompleted || value <= GetCompletedValue();
+}
+
+void
+Timeline::Wait(uint64_t value)
+{
+  if (value <= lastCompleted) {
+    return;
+  }
+
+  ASSERT_TRUE(value <= lastSubmitted);
+
+  auto waitInfo = vkiSemaphoreWaitInfoKHR(1, &semaphore, &value);
+  ASSERT_VK_SUCCESS(vkWaitSemaphoresKHR(device, &waitInfo, UINT64_MAX));
+  lastCompleted = value;
+}
+
+uint64_t
+Timeline::Submit(uint32_t commandBufferCount,
+                 const VkCommandBuffer* pCommandBuffers,
+                 uint32_t waitSemaphoreCount,
+                 const VkSemaphore* pWaitSemaphores,
+                 const uint64_t* pWaitValues,
+                 const VkPipelineStageFlags* pWaitDstStageMask,
+                 uint32_t signalSemaphoreCount,
+                 const VkSemaphore* pSignalSemaphores)
+{
+  uint64_t value = GetNextValue();
+
+  // the timeline semaphore is signalled after the binary ones
+  std::vector<VkSemaphore> signalSemaphores(
+    pSignalSemaphores, pSignalSemaphores + signalSemaphoreCount);
+  signalSemaphores.push_back(semaphore);
+  std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+  signalValues.back() = value;
+
+  std::vector<VkSemaphore> waitSemaphores(
+    pWaitSemaphores, pWaitSemaphores + waitSemaphoreCount);
+  std::vector<VkPipelineStageFlags> waitStages(
+    pWaitDstStageMask, pWaitDstStageMask + waitSemaphoreCount);
+  std::vector<uint64_t> waitValues(waitSemaphoreCount, 0);
+  if (pWaitValues != nullptr) {
+    waitValues.assign(pWaitValues, pWaitValues + waitSemaphoreCount);
+  }
+  // pages bound by BindSparse might be written or read by any command
+  if (bindPending) {
+    waitSemaphores.push_back(bindSemaphores[bindIndex]);
+    waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    waitValues.push_back(0);
+  }
+
+  auto timelineSubmitInfo = vkiTimelineSemaphoreSubmitInfoKHR(
+    static_cast<uint32_t>(waitValues.size()),
+    waitValues.data(),
+    static_cast<uint32_t>(signalValues.size()),
+    signalValues.data());
+
+  auto submitInfo =
+    vkiSubmitInfo(static_cast<uint32_t>(waitSemaphores.size()),
+                  waitSemaphores.data(),
+                  waitStages.data(),
+                  commandBufferCount,
+                  pCommandBuffers,
+                  static_cast<uint32_t>(signalSemaphores.size()),
+                  signalSemaphores.data());
+  submitInfo.pNext = &timelineSubmitInfo;
+
+  ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+  lastSubmitted = value;
+  bindPending = false;
+
+  return value;
+}
+
+void
+Timeline::BindSparse(const VkBindSparseInfo& bindInfo)
+{
+  ASSERT_TRUE((bindInfo.waitSemaphoreCount == 0 &&
+               bindInfo.signalSemaphoreCount == 0));
+
+  // the binds keep their order by waiting for the one before, the
+  // semaphores alternate as a binary one cannot wait for itself
+  uint32_t next = (bindIndex + 1) % 2;
+
+  VkBindSparseInfo info = bindInfo;
+  if (bindPending) {
+    info.waitSemaphoreCount = 1;
+    info.pWaitSemaphores = &bindSemaphores[bindIndex];
+  }
+  info.signalSemaphoreCount = 1;
+  info.pSignalSemaphores = &bindSemaphores[next];
+
+  ASSERT_VK_SUCCESS(vkQueueBindSparse(queue, 1, &info, VK_NULL_HANDLE));
+  bindIndex = next;
+  bindPending = true;
+}
+
+VulkanBase::VulkanBase(VulkanWindow* window, uint32_t recordingThreadCount)
   : window(window)
+  , recordingThreadCount(recordingThreadCount)
 {
   CreateResources();
 }
@@ -242,6 +469,24 @@ VulkanBase::CreateResources()
   ASSERT_VK_SUCCESS(
     vkEnumerateInstanceLayerProperties(&count, layerProperties.data()));
 
+  // optional instance extensions
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensionProperties(count);
+  vkEnumerateInstanceExtensionProperties(
+    nullptr, &count, extensionProperties.data());
+
+  const char* properties2 =
+    VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+  bool hasProperties2 =
+    std::any_of(extensionProperties.begin(),
+                extensionProperties.end(),
+                [properties2](const VkExtensionProperties& props) {
+                  return strcmp(props.extensionName, properties2) == 0;
+                });
+  if (hasProperties2) {
+    instanceExtensions.push_back(properties2);
+  }
+
   VkApplicationInfo appInfo = vkiApplicationInfo(nullptr, 0, nullptr, 0, 1);
 
   VkInstanceCreateInfo instInfo =
@@ -276,6 +521,51 @@ VulkanBase::CreateResources()
   ASSERT_TRUE(deviceProps.GetGrahicsQueueFamiliyIdx() ==
               deviceProps.GetPresentQueueFamiliyIdx());
 
+  // optional device extensions
+  if (deviceProps.HasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+    deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
+
+  // the frame scheduler is built on timeline semaphores
+  ASSERT_TRUE((hasProperties2 &&
+               deviceProps.HasExtension(
+                 VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)));
+  deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+  bool hasMemoryBudget =
+    hasProperties2 &&
+    deviceProps.HasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if (hasMemoryBudget) {
+    deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+
+  // framebuffers that only know the attachment formats and extents, the
+  // images are bound when the render pass begins
+  auto imagelessFeatures =
+    vkiPhysicalDeviceImagelessFramebufferFeaturesKHR(false);
+  if (hasProperties2 &&
+      deviceProps.HasExtension(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME) &&
+      deviceProps.HasExtension(VK_KHR_MAINTENANCE2_EXTENSION_NAME) &&
+      deviceProps.HasExtension(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME)) {
+    auto vkGetPhysicalDeviceFeatures2KHR =
+      (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+        instance, "vkGetPhysicalDeviceFeatures2KHR");
+
+    auto features2 = vkiPhysicalDeviceFeatures2({});
+    features2.pNext = &imagelessFeatures;
+    vkGetPhysicalDeviceFeatures2KHR(deviceProps.handle, &features2);
+
+    imagelessFramebuffer = imagelessFeatures.imagelessFramebuffer == VK_TRUE;
+  }
+  if (imagelessFramebuffer) {
+    deviceExtensions.push_back(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+    deviceExtensions.push_back(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME);
+    deviceExtensions.push_back(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME);
+  }
+
+  MemoryTelemetry::Get().Init(
+    instance, deviceProps.handle, deviceProps.memProps, hasMemoryBudget);
+
   float queuePriority = 1.0f;
   uint32_t queueFamiliyIdx = deviceProps.GetGrahicsQueueFamiliyIdx();
 
@@ -286,6 +576,19 @@ VulkanBase::CreateResources()
   deviceFeatures.textureCompressionBC = true;
   deviceFeatures.fillModeNonSolid = true;
   deviceFeatures.multiDrawIndirect = true;
+  deviceFeatures.drawIndirectFirstInstance =
+    deviceProps.features.drawIndirectFirstInstance;
+  // rg32f storage images for the Hi-Z pyramid
+  deviceFeatures.shaderStorageImageExtendedFormats =
+    deviceProps.features.shaderStorageImageExtendedFormats;
+  // partially resident virtual textures, VirtualTexture falls back to a
+  // page table without them
+  deviceFeatures.sparseBinding = deviceProps.features.sparseBinding;
+  deviceFeatures.sparseResidencyImage2D =
+    deviceProps.features.sparseResidencyImage2D;
+  // virtual texture feedback written by fragment shaders
+  deviceFeatures.fragmentStoresAndAtomics =
+    deviceProps.features.fragmentStoresAndAtomics;
 
   VkDeviceCreateInfo deviceCreateInfo =
     vkiDeviceCreateInfo(1,
@@ -296,17 +599,27 @@ VulkanBase::CreateResources()
                         deviceExtensions.data(),
                         &deviceFeatures);
 
+  auto timelineFeatures = vkiPhysicalDeviceTimelineSemaphoreFeaturesKHR(true);
+  deviceCreateInfo.pNext = &timelineFeatures;
+  if (imagelessFramebuffer) {
+    timelineFeatures.pNext = &imagelessFeatures;
+  }
+
   ASSERT_VK_SUCCESS(
     vkCreateDevice(deviceProps.handle, &deviceCreateInfo, nullptr, &device));
 
   // queue
   vkGetDeviceQueue(device, queueFamiliyIdx, 0, &queue);
 
-  // commandPool
+  timeline.Create(device, queue);
+  deletionQueue.Create(device, &timeline);
+  pipelineCache.Create(device, deviceProps.props, "pipeline_cache.bin");
+
+  // commandPool, for one time submissions outside of frames
   VkCommandPoolCreateInfo commandPoolCreateInfo =
     vkiCommandPoolCreateInfo(deviceProps.GetGrahicsQueueFamiliyIdx());
 
-  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
   ASSERT_VK_SUCCESS(
     vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &cmdPool));
@@ -320,39 +633,35 @@ VulkanBase::CreateResources()
   ASSERT_VK_SUCCESS(vkCreateSemaphore(
     device, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphore));
 
-  // command buffers
-  commandBuffers.resize(MAX_NUMBER_CMD_BUFFERS);
-  VkCommandBufferAllocateInfo allocateInfo = vkiCommandBufferAllocateInfo(
-    cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, MAX_NUMBER_CMD_BUFFERS);
-
-  ASSERT_VK_SUCCESS(
-    vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data()));
-
-  // fences
-  VkFenceCreateInfo fenceInfo = vkiFenceCreateInfo();
-  fences.resize(MAX_NUMBER_CMD_BUFFERS);
-  for (size_t i = 0; i < fences.size(); ++i) {
-    ASSERT_VK_SUCCESS(vkCreateFence(device, &fenceInfo, nullptr, &fences[i]));
-
-    // put fences in a signalled state
-    VkSubmitInfo submitInfo =
-      vkiSubmitInfo(0, nullptr, 0, 0, nullptr, 0, nullptr);
-
-    ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fences[i]));
-    vkQueueWaitIdle(queue);
+  // per frame and thread command pools and arenas, command buffers are
+  // allocated on demand
+  frames.resize(MAX_FRAMES_IN_FLIGHT);
+  for (auto& frame : frames) {
+    frame.threadPools.resize(recordingThreadCount);
+    for (auto& threadPool : frame.threadPools) {
+      ASSERT_VK_SUCCESS(vkCreateCommandPool(
+        device, &commandPoolCreateInfo, nullptr, &threadPool.pool));
+      threadPool.arena.Create();
+    }
   }
 }
 
 void
 VulkanBase::DestroyResources()
 {
-  for (auto fence : fences) {
-    vkDestroyFence(device, fence, nullptr);
+  timeline.Wait(timeline.lastSubmitted);
+  deletionQueue.Flush();
+  pipelineCache.Save();
+  pipelineCache.Destroy();
+  timeline.Destroy();
+
+  // destroying the pools frees their command buffers
+  for (auto& frame : frames) {
+    for (auto& threadPool : frame.threadPools) {
+      vkDestroyCommandPool(device, threadPool.pool, nullptr);
+      threadPool.arena.Destroy();
+    }
   }
-  vkFreeCommandBuffers(device,
-                       cmdPool,
-                       static_cast<uint32_t>(commandBuffers.size()),
-                       commandBuffers.data());
 
   vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
   vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
@@ -362,17 +671,78 @@ VulkanBase::DestroyResources()
   vkDestroyInstance(instance, nullptr);
 }
 
+void
+VulkanBase::BeginFrame()
+{
+  frameIdx = nextFrameIdx;
+  nextFrameIdx = (nextFrameIdx + 1) % MAX_FRAMES_IN_FLIGHT;
+
+  auto& frame = frames[frameIdx];
+
+  // wait until the last submission of this frame is done
+  timeline.Wait(frame.value);
+  deletionQueue.Collect();
+
+  for (auto& threadPool : frame.threadPools) {
+    ASSERT_VK_SUCCESS(vkResetCommandPool(device, threadPool.pool, 0));
+    threadPool.usedCmdBuffers[VK_COMMAND_BUFFER_LEVEL_PRIMARY] = 0;
+    threadPool.usedCmdBuffers[VK_COMMAND_BUFFER_LEVEL_SECONDARY] = 0;
+    threadPool.arena.Reset();
+  }
+}
+
+VkCommandBuffer
+VulkanBase::AllocateCmdBuffer(uint32_t thread, VkCommandBufferLevel level)
+{
+  ASSERT_TRUE(thread < recordingThreadCount);
+
+  auto& threadPool = frames[frameIdx].threadPools[thread];
+  auto& cmdBuffers = threadPool.cmdBuffers[level];
+  auto& used = threadPool.usedCmdBuffers[level];
+
+  if (used == cmdBuffers.size()) {
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo allocateInfo =
+      vkiCommandBufferAllocateInfo(threadPool.pool, level, 1);
+    ASSERT_VK_SUCCESS(
+      vkAllocateCommandBuffers(device, &allocateInfo, &cmdBuffer));
+    cmdBuffers.push_back(cmdBuffer);
+  }
+
+  return cmdBuffers[used++];
+}
+
+FrameArena*
+VulkanBase::GetArena(uint32_t thread)
+{
+  ASSERT_TRUE(thread < recordingThreadCount);
+
+  return &frames[frameIdx].threadPools[thread].arena;
+}
+
 VulkanBase::CommandBuffer
 VulkanBase::NextCmdBuffer()
 {
-  auto cmdBuffer = commandBuffers[nextCmdBufferIdx];
-  ASSERT_VK_SUCCESS(
-    vkWaitForFences(device, 1, &fences[nextCmdBufferIdx], true, (uint64_t)-1));
-  ASSERT_VK_SUCCESS(vkResetFences(device, 1, &fences[nextCmdBufferIdx]));
-  ASSERT_VK_SUCCESS(vkResetCommandBuffer(cmdBuffer, 0));
-
-  auto fence = fences[nextCmdBufferIdx];
-  nextCmdBufferIdx = (nextCmdBufferIdx + 1) % MAX_NUMBER_CMD_BUFFERS;
+  BeginFrame();
+  return { AllocateCmdBuffer(0), frameIdx };
+}
 
-  return { cmdBuffer, fence };
+uint64_t
+VulkanBase::Submit(CommandBuffer cmdBuffer,
+                   VkSemaphore waitSemaphore,
+                   VkPipelineStageFlags waitStage,
+                   VkSemaphore signalSemaphore)
+{
+  uint64_t value = timeline.Submit(1,
+                                   &cmdBuffer.cmdBuffer,
+                                   1,
+                                   &waitSemaphore,
+                                   nullptr,
+                                   &waitStage,
+                                   1,
+                                   &signalSemaphore);
+
+  frames[cmdBuffer.frameIdx].value = value;
+
+  return value;
 }
@@ -7,6 +7,11 @@
 
 #include <vector>
 
+#include "arena.h"
+#include "deletion.h"
+#include "handles.h"
+#include "pipeline.h"
+
 struct DeviceProps
 {
   VkSurfaceKHR surface = VK_NULL_HANDLE;
@@ -17,6 +22,7 @@ struct DeviceProps
   std::vector<VkQueueFamilyProperties> queueFamilyProps = {};
   std::vector<VkSurfaceFormatKHR> surfaceFormats = {};
   std::vector<VkPresentModeKHR> presentModes = {};
+  std::vector<VkExtensionProperties> extensions = {};
 
   DeviceProps() = default;
   DeviceProps(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
@@ -29,6 +35,25 @@ struct DeviceProps
 
   bool HasGraphicsSupport();
   bool HasPresentSupport();
+
+  // VulkanBase enables the optional extensions it knows about whenever they
+  // are supported, so for those this also tells if they are enabled
+  bool HasExtension(const char* name) const;
+};
+
+struct ImageState
+{
+  VkPipelineStageFlags stageFlags =
+    VK_PIPELINE_STAGE_HOST_BIT; // VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  VkAccessFlags accessFlags = 0;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  bool operator==(const ImageState& other) const
+  {
+    return stageFlags == other.stageFlags &&
+           accessFlags == other.accessFlags && layout == other.layout;
+  }
+  bool operator!=(const ImageState& other) const { return !(*this == other); }
 };
 
 struct PhysicalImage
@@ -37,16 +62,70 @@ struct PhysicalImage
   VkDeviceMemory memory = VK_NULL_HANDLE;
   VkImageView view = VK_NULL_HANDLE;
 
-  VkPipelineStageFlags stageFlags;
-  VkAccessFlags accessFlags;
-  VkImageLayout layout;
+  uint32_t levels = 1;
+  uint32_t layers = 1;
+
+  // state of each subresource at the end of the last recorded frame,
+  // indexed by level * layers + layer
+  std::vector<ImageState> states = { ImageState{} };
+
+  void Resize(uint32_t levels, uint32_t layers)
+  {
+    this->levels = levels;
+    this->layers = layers;
+    states.assign(levels * layers, ImageState{});
+  }
+
+  ImageState GetState(uint32_t level, uint32_t layer = 0) const
+  {
+    return states[level * layers + layer];
+  }
+
+  void SetState(const VkImageSubresourceRange& range, ImageState state)
+  {
+    uint32_t levelEnd = range.levelCount == VK_REMAINING_MIP_LEVELS
+                          ? levels
+                          : range.baseMipLevel + range.levelCount;
+    uint32_t layerEnd = range.layerCount == VK_REMAINING_ARRAY_LAYERS
+                          ? layers
+                          : range.baseArrayLayer + range.layerCount;
+
+    for (uint32_t level = range.baseMipLevel; level < levelEnd; ++level) {
+      for (uint32_t layer = range.baseArrayLayer; layer < layerEnd; ++layer) {
+        states[level * layers + layer] = state;
+      }
+    }
+  }
+};
+
+struct PhysicalBuffer
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+};
+
+typedef Handle<PhysicalImage> ImageHandle;
+typedef Handle<Pipeline> PipelineHandle;
+typedef Handle<ComputePipeline> ComputePipelineHandle;
 
-  VkEvent event = VK_NULL_HANDLE;
+// Slot arrays of the resources that are referenced by handle, e.g. in cache
+// keys: the graph keys its views and framebuffers by images, and passes keep
+// their pipelines here instead of allocating each one. Buffers, views and
+// samplers stay with their owners, nothing outside of them refers to one.
+// Removing a handle does not destroy the Vulkan objects, Retire pipelines
+// first. Not thread safe, pools are only touched on the render thread.
+struct ResourcePools
+{
+  HandlePool<PhysicalImage> images = {};
+  HandlePool<Pipeline> pipelines = {};
+  HandlePool<ComputePipeline> computePipelines = {};
 };
 
 struct Swapchain
 {
   VkDevice device = VK_NULL_HANDLE;
+  DeviceProps deviceProps = {};
   VkSurfaceKHR surface = VK_NULL_HANDLE;
   VkSurfaceFormatKHR format = {};
   VkExtent2D extent = {};
@@ -55,11 +134,25 @@ struct Swapchain
   VkSurfaceTransformFlagBitsKHR transform = {};
 
   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
-  std::vector<PhysicalImage> images = {};
+  VkImageUsageFlags usage = 0;
+  ResourcePools* resources = nullptr;
+  std::vector<ImageHandle> images = {};
+
+  // set when acquire or present report that the swapchain no longer matches
+  // the surface, cleared by Resize
+  bool outOfDate = false;
 
   Swapchain(VkDevice device, DeviceProps deviceProps, VkSurfaceKHR surface);
 
-  void CreatePhysicalSwapchain(VkImageUsageFlags usage);
+  // adds the swapchain images to the image pool of resources
+  void CreatePhysicalSwapchain(VkImageUsageFlags usage,
+                               ResourcePools* resources);
+
+  // Recreates the swapchain for the current surface extent, windowExtent is
+  // used if the surface leaves the extent to the swapchain. The old swapchain
+  // is passed as oldSwapchain and retired together with the views of its
+  // images, the handles of the old images become stale.
+  void Resize(VkExtent2D windowExtent, DeletionQueue& deletionQueue);
 
   Swapchain() = delete;
   Swapchain(const Swapchain&) = delete;
@@ -67,10 +160,70 @@ struct Swapchain
 
   ~Swapchain();
 
-  PhysicalImage* AcquireImage(VkSemaphore imageAvailable);
+  // returns a null handle if the swapchain is out of date, imageAvailable is
+  // not signalled then
+  ImageHandle AcquireImage(VkSemaphore imageAvailable);
   void Present(VkQueue queue, VkSemaphore renderFinished);
 
   uint32_t nextImageIdx = -1;
+
+private:
+  void CreateSwapchain(VkSwapchainKHR oldSwapchain);
+};
+
+// Monotonically increasing GPU timeline of a queue, backed by a timeline
+// semaphore (VK_KHR_timeline_semaphore). Every submission signals the next
+// value. Subsystems keep the value of the submission that last used a
+// resource and poll or wait on it instead of owning fences; other queues can
+// wait on the semaphore with that value.
+struct Timeline
+{
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+
+  uint64_t lastSubmitted = 0;
+  uint64_t lastCompleted = 0; // cached, at most the current counter value
+
+  // binary, BindSparse chains the binds since the last submission on them
+  // and the submission waits for the last one
+  VkSemaphore bindSemaphores[2] = {};
+  uint32_t bindIndex = 0; // signalled by the last bind
+  bool bindPending = false;
+
+  PFN_vkGetSemaphoreCounterValueKHR vkGetSemaphoreCounterValueKHR = nullptr;
+  PFN_vkWaitSemaphoresKHR vkWaitSemaphoresKHR = nullptr;
+
+  void Create(VkDevice device, VkQueue queue);
+  void Destroy();
+
+  // Value signalled by the next submission. Only Submit advances it, so
+  // everything recorded for a frame, e.g. retired staging memory or
+  // DeletionQueue::Push(..., 0), gets the value of the frame's command
+  // buffers however it is interleaved with BindSparse.
+  uint64_t GetNextValue() const { return lastSubmitted + 1; }
+
+  uint64_t GetCompletedValue();
+  bool IsComplete(uint64_t value);
+  void Wait(uint64_t value);
+
+  // Submits the command buffers and signals the next value, returns it.
+  // pWaitValues holds the values of timeline semaphores among the wait
+  // semaphores (ignored for binary ones), nullptr if all are binary.
+  uint64_t Submit(uint32_t commandBufferCount,
+                  const VkCommandBuffer* pCommandBuffers,
+                  uint32_t waitSemaphoreCount = 0,
+                  const VkSemaphore* pWaitSemaphores = nullptr,
+                  const uint64_t* pWaitValues = nullptr,
+                  const VkPipelineStageFlags* pWaitDstStageMask = nullptr,
+                  uint32_t signalSemaphoreCount = 0,
+                  const VkSemaphore* pSignalSemaphores = nullptr);
+
+  // Queues the binds of bindInfo, which has no semaphores of its own. Sparse
+  // binds are not ordered with other queue operations, so the next
+  // submission waits for them and its value covers them. The queue needs
+  // VK_QUEUE_SPARSE_BINDING_BIT.
+  void BindSparse(const VkBindSparseInfo& bindInfo);
 };
 
 struct VulkanBase
@@ -95,16 +248,51 @@ struct VulkanBase
   VkQueue queue = VK_NULL_HANDLE;
   VkCommandPool cmdPool = VK_NULL_HANDLE;
 
+  Timeline timeline = {};
+
+  // collected at the beginning of each frame
+  DeletionQueue deletionQueue = {};
+
+  // persisted in pipeline_cache.bin
+  PipelineCache pipelineCache;
+
+  ResourcePools resources = {};
+
+  // VK_KHR_imageless_framebuffer is enabled, see
+  // RenderGraph::imagelessFramebuffers
+  bool imagelessFramebuffer = false;
+
   struct CommandBuffer
   {
     VkCommandBuffer cmdBuffer;
-    VkFence fence;
+    uint32_t frameIdx;
   };
 
-  const uint32_t MAX_NUMBER_CMD_BUFFERS = 5;
-  std::vector<VkCommandBuffer> commandBuffers = {};
-  std::vector<VkFence> fences = {};
-  uint32_t nextCmdBufferIdx = 0;
+  // Transient command pool and scratch memory of one recording thread.
+  // Command buffers are allocated on demand and reused after the pool is
+  // reset.
+  struct ThreadPool
+  {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    // indexed by VkCommandBufferLevel
+    std::vector<VkCommandBuffer> cmdBuffers[2] = {};
+    uint32_t usedCmdBuffers[2] = {};
+    FrameArena arena = {};
+  };
+
+  // Command pools and arenas of a frame in flight, reset as a whole once the
+  // frame's last submission has completed.
+  struct Frame
+  {
+    std::vector<ThreadPool> threadPools = {};
+    uint64_t value = 0; // timeline value of the last submission
+  };
+
+  const uint32_t MAX_FRAMES_IN_FLIGHT = 5;
+  uint32_t recordingThreadCount = 1;
+  std::vector<Frame> frames = {};
+  uint32_t frameIdx = 0;
+  uint32_t nextFrameIdx = 0;
 
   VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
   VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
@@ -112,9 +300,31 @@ struct VulkanBase
   // --------------------------------------------------------------------------
   // --------------------------------------------------------------------------
 
+  // Waits until the next frame in flight retired and resets its pools and
+  // arenas.
+  void BeginFrame();
+
+  // Returns a command buffer of the current frame for the recording thread,
+  // the thread must only use its own index.
+  VkCommandBuffer AllocateCmdBuffer(
+    uint32_t thread = 0,
+    VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+  // Returns the arena of the current frame for the recording thread, valid
+  // until the frame retires.
+  FrameArena* GetArena(uint32_t thread = 0);
+
+  // begins the next frame and returns a primary command buffer of thread 0
   CommandBuffer NextCmdBuffer();
 
-  VulkanBase(VulkanWindow* window);
+  // submits a frame that waits on waitSemaphore and signals signalSemaphore,
+  // returns its timeline value
+  uint64_t Submit(CommandBuffer cmdBuffer,
+                  VkSemaphore waitSemaphore,
+                  VkPipelineStageFlags waitStage,
+                  VkSemaphore signalSemaphore);
+
+  VulkanBase(VulkanWindow* window, uint32_t recordingThreadCount = 1);
   ~VulkanBase();
 
 private:
@@ -5,6 +5,7 @@
 #include <memory> // memcpy
 #include <vulkan\vulkan.h>
 
+#include "telemetry.h"
 #include "vk_init.h"
 
 #define BREAK                                                                  \
@@ -42,7 +43,8 @@ vkuCreateGraphicsPipeline(
   VkRenderPass renderPass,
   uint32_t subpass,
   VkPipeline basePipelineHandle,
-  int32_t basePipelineIndex)
+  int32_t basePipelineIndex,
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE)
 {
   auto graphicsPipelineCreateInfo =
     vkiGraphicsPipelineCreateInfo(stageCount,
@@ -64,7 +66,22 @@ vkuCreateGraphicsPipeline(
 
   VkPipeline pipeline = VK_NULL_HANDLE;
   VkResult result = vkCreateGraphicsPipelines(
-    device, VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline);
+    device, pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline);
+  return pipeline;
+}
+
+inline VkPipeline
+vkuCreateComputePipeline(VkDevice device,
+                         VkPipelineShaderStageCreateInfo stage,
+                         VkPipelineLayout layout,
+                         VkPipelineCache pipelineCache = VK_NULL_HANDLE)
+{
+  auto computePipelineCreateInfo =
+    vkiComputePipelineCreateInfo(stage, layout, VK_NULL_HANDLE, -1);
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkResult result = vkCreateComputePipelines(
+    device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline);
   return pipeline;
 }
 
@@ -252,49 +269,163 @@ vkuGetImageAspectFlags(VkFormat format)
   return flags;
 }
 
-static uint32_t
-findMemoryTypeIdx(const VkMemoryRequirements& memoryRequirements,
-                  const VkPhysicalDeviceMemoryProperties& memoryProperties,
-                  const VkMemoryPropertyFlags& propertyFlags)
+// What the memory is used for, selects the memory type by score instead of
+// taking the first type with the requested flags.
+enum VkuMemoryUsage
 {
-  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-    if (memoryRequirements.memoryTypeBits & (1 << i) &&
-        (memoryProperties.memoryTypes[i].propertyFlags & propertyFlags) ==
-          propertyFlags) {
-      return i;
+  // written and read by the device only: render targets, static meshes
+  VKU_MEMORY_USAGE_GPU_ONLY = 0,
+  // written by the host (e.g. every frame) and read by the device, placed in
+  // device local host visible memory when available to skip staging copies
+  VKU_MEMORY_USAGE_UPLOAD,
+  // written by the device and read back by the host
+  VKU_MEMORY_USAGE_READBACK,
+  // host written source of transfers, kept out of device local heaps
+  VKU_MEMORY_USAGE_STAGING,
+};
+
+struct VkuMemoryPreferences
+{
+  VkMemoryPropertyFlags required = 0;
+  VkMemoryPropertyFlags preferred = 0;
+  VkMemoryPropertyFlags avoided = 0;
+};
+
+inline VkuMemoryPreferences
+vkuGetMemoryPreferences(VkuMemoryUsage usage)
+{
+  const VkMemoryPropertyFlags hostCoherent =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  VkuMemoryPreferences preferences = {};
+  switch (usage) {
+    case VKU_MEMORY_USAGE_GPU_ONLY:
+      // leave host visible device memory to uploads
+      preferences.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      preferences.avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+      break;
+    case VKU_MEMORY_USAGE_UPLOAD:
+      // coherent, so mapped writes do not have to be flushed
+      preferences.required = hostCoherent;
+      preferences.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      preferences.avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
       break;
+    case VKU_MEMORY_USAGE_READBACK:
+      // not necessarily coherent, invalidate before reading
+      preferences.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+      preferences.preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+      break;
+    case VKU_MEMORY_USAGE_STAGING:
+      preferences.required = hostCoherent;
+      preferences.avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                            VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+      break;
+  }
+
+  // never chosen unless explicitly required
+  preferences.avoided |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+                         VK_MEMORY_PROPERTY_PROTECTED_BIT;
+
+  return preferences;
+}
+
+inline uint32_t
+vkuCountBits(uint32_t bits)
+{
+  uint32_t count = 0;
+  for (; bits != 0; bits &= bits - 1) {
+    ++count;
+  }
+  return count;
+}
+
+enum
+{
+  VKU_INVALID_MEMORY_TYPE_IDX = 0xffffffff,
+};
+
+// Returns the allowed memory type with all required flags, the most preferred
+// and the fewest avoided flags; ties go to the type with the larger heap.
+// Returns VKU_INVALID_MEMORY_TYPE_IDX if no type qualifies.
+inline uint32_t
+vkuFindMemoryTypeIdx(const VkMemoryRequirements& memoryRequirements,
+                     const VkPhysicalDeviceMemoryProperties& memoryProperties,
+                     const VkuMemoryPreferences& preferences)
+{
+  uint32_t bestIdx = VKU_INVALID_MEMORY_TYPE_IDX;
+  int32_t bestScore = 0;
+  VkDeviceSize bestHeapSize = 0;
+
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    auto const& type = memoryProperties.memoryTypes[i];
+
+    if ((memoryRequirements.memoryTypeBits & (1 << i)) == 0 ||
+        (type.propertyFlags & preferences.required) != preferences.required) {
+      continue;
+    }
+
+    int32_t score =
+      vkuCountBits(type.propertyFlags & preferences.preferred) -
+      vkuCountBits(type.propertyFlags & preferences.avoided &
+                   ~preferences.required);
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[type.heapIndex].size;
+
+    if (bestIdx == VKU_INVALID_MEMORY_TYPE_IDX || score > bestScore ||
+        (score == bestScore && heapSize > bestHeapSize)) {
+      bestIdx = i;
+      bestScore = score;
+      bestHeapSize = heapSize;
     }
   }
 
-  return -1;
+  return bestIdx;
 }
 
 inline VkDeviceMemory
 vkuAllocateMemory(VkDevice device,
                   VkDeviceSize allocationSize,
                   uint32_t memoryTypeIndex,
+                  MemoryCategory category = MEMORY_CATEGORY_BUFFER,
                   const VkAllocationCallbacks* pAllocator = nullptr)
 {
   auto info = vkiMemoryAllocateInfo(allocationSize, memoryTypeIndex);
   VkDeviceMemory handle = VK_NULL_HANDLE;
   vkAllocateMemory(device, &info, pAllocator, &handle);
+  if (handle != VK_NULL_HANDLE) {
+    MemoryTelemetry::Get().OnAllocate(
+      handle, allocationSize, memoryTypeIndex, category);
+  }
   return handle;
 }
 
+inline void
+vkuFreeMemory(VkDevice device,
+              VkDeviceMemory memory,
+              const VkAllocationCallbacks* pAllocator = nullptr)
+{
+  MemoryTelemetry::Get().OnFree(memory);
+  vkFreeMemory(device, memory, pAllocator);
+}
+
 inline VkDeviceMemory
 vkuAllocateImageMemory(VkDevice device,
                        VkPhysicalDeviceMemoryProperties memProps,
                        VkImage image,
-                       bool bind)
+                       bool bind,
+                       MemoryCategory category = MEMORY_CATEGORY_IMAGE)
 {
   VkMemoryRequirements memoryRequirements;
   vkGetImageMemoryRequirements(device, image, &memoryRequirements);
 
-  VkDeviceMemory deviceMemory = vkuAllocateMemory(
-    device,
-    memoryRequirements.size,
-    findMemoryTypeIdx(
-      memoryRequirements, memProps, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+  uint32_t memoryTypeIdx =
+    vkuFindMemoryTypeIdx(memoryRequirements,
+                         memProps,
+                         vkuGetMemoryPreferences(VKU_MEMORY_USAGE_GPU_ONLY));
+  ASSERT_TRUE(memoryTypeIdx != VKU_INVALID_MEMORY_TYPE_IDX);
+
+  VkDeviceMemory deviceMemory =
+    vkuAllocateMemory(device, memoryRequirements.size, memoryTypeIdx, category);
 
   if (bind) {
     vkBindImageMemory(device, image, deviceMemory, 0);
@@ -308,15 +439,23 @@ vkuAllocateBufferMemory(VkDevice device,
                         VkPhysicalDeviceMemoryProperties memProps,
                         VkBuffer buffer,
                         VkMemoryPropertyFlags propertyFlags,
-                        bool bind)
+                        bool bind,
+                        MemoryCategory category = MEMORY_CATEGORY_BUFFER)
 {
   VkMemoryRequirements memoryRequirements;
   vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
 
-  VkDeviceMemory deviceMemory = vkuAllocateMemory(
-    device,
-    memoryRequirements.size,
-    findMemoryTypeIdx(memoryRequirements, memProps, propertyFlags));
+  // any type with all flags, the one with the larger heap on a tie
+  VkuMemoryPreferences preferences = {};
+  preferences.required = propertyFlags;
+  preferences.avoided = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+                        VK_MEMORY_PROPERTY_PROTECTED_BIT;
+  uint32_t memoryTypeIdx =
+    vkuFindMemoryTypeIdx(memoryRequirements, memProps, preferences);
+  ASSERT_TRUE(memoryTypeIdx != VKU_INVALID_MEMORY_TYPE_IDX);
+
+  VkDeviceMemory deviceMemory =
+    vkuAllocateMemory(device, memoryRequirements.size, memoryTypeIdx, category);
 
   if (bind)
     vkBindBufferMemory(device, buffer, deviceMemory, 0);
@@ -324,6 +463,45 @@ vkuAllocateBufferMemory(VkDevice device,
   return deviceMemory;
 }
 
+// pPropertyFlags returns the flags of the chosen memory type, e.g. to write
+// UPLOAD memory directly if it turned out to be host visible
+inline VkDeviceMemory
+vkuAllocateBufferMemory(VkDevice device,
+                        VkPhysicalDeviceMemoryProperties memProps,
+                        VkBuffer buffer,
+                        VkuMemoryUsage usage,
+                        bool bind,
+                        MemoryCategory category = MEMORY_CATEGORY_BUFFER,
+                        VkMemoryPropertyFlags* pPropertyFlags = nullptr)
+{
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+
+  uint32_t memoryTypeIdx = vkuFindMemoryTypeIdx(
+    memoryRequirements, memProps, vkuGetMemoryPreferences(usage));
+  ASSERT_TRUE(memoryTypeIdx != VKU_INVALID_MEMORY_TYPE_IDX);
+
+  // no flags at all when no type matched, callers never see stale values
+  if (pPropertyFlags != nullptr) {
+    *pPropertyFlags = 0;
+  }
+  if (memoryTypeIdx == VKU_INVALID_MEMORY_TYPE_IDX) {
+    return VK_NULL_HANDLE;
+  }
+
+  VkDeviceMemory deviceMemory =
+    vkuAllocateMemory(device, memoryRequirements.size, memoryTypeIdx, category);
+
+  if (bind)
+    vkBindBufferMemory(device, buffer, deviceMemory, 0);
+
+  if (pPropertyFlags != nullptr && deviceMemory != VK_NULL_HANDLE) {
+    *pPropertyFlags = memProps.memoryTypes[memoryTypeIdx].propertyFlags;
+  }
+
+  return deviceMemory;
+}
+
 inline void
 vkuTransferData(VkDevice device,
                 VkDeviceMemory memory,
@@ -378,12 +556,13 @@ vkuTransferImageData(VkDevice device,
                                            VK_SHARING_MODE_EXCLUSIVE,
                                            {});
 
-  VkDeviceMemory stagingBufferMemory = vkuAllocateBufferMemory(
-    device,
-    memProps,
-    stagingBuffer,
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-    true);
+  VkDeviceMemory stagingBufferMemory =
+    vkuAllocateBufferMemory(device,
+                            memProps,
+                            stagingBuffer,
+                            VKU_MEMORY_USAGE_STAGING,
+                            true,
+                            MEMORY_CATEGORY_STAGING);
 
   vkuTransferData(device, stagingBufferMemory, 0, size, data);
 
@@ -433,7 +612,7 @@ vkuTransferImageData(VkDevice device,
   vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
   vkDestroyFence(device, fence, nullptr);
   vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  vkuFreeMemory(device, stagingBufferMemory);
 }
 
 inline void
@@ -453,12 +632,13 @@ vkuTransferBufferData(VkDevice device,
                                            VK_SHARING_MODE_EXCLUSIVE,
                                            {});
 
-  VkDeviceMemory stagingBufferMemory = vkuAllocateBufferMemory(
-    device,
-    memProps,
-    stagingBuffer,
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-    true);
+  VkDeviceMemory stagingBufferMemory =
+    vkuAllocateBufferMemory(device,
+                            memProps,
+                            stagingBuffer,
+                            VKU_MEMORY_USAGE_STAGING,
+                            true,
+                            MEMORY_CATEGORY_STAGING);
 
   vkuTransferData(device, stagingBufferMemory, 0, size, data);
 
@@ -479,6 +659,6 @@ vkuTransferBufferData(VkDevice device,
   vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
   vkDestroyFence(device, fence, nullptr);
   vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  vkuFreeMemory(device, stagingBufferMemory);
 }
 #endif